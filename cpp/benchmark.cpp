@@ -0,0 +1,821 @@
+#include "core/global.h"
+#include "core/allocationcount.h"
+#include "core/config_parser.h"
+#include "core/timer.h"
+#include "dataio/sgf.h"
+#include "neuralnet/laddercache.h"
+#include "search/search.h"
+#include "program/setup.h"
+#include "main.h"
+
+#include <cstring>
+
+using namespace std;
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+namespace {
+  struct BenchmarkPosition {
+    string name;
+    Board board;
+    Player pla;
+    BoardHistory hist;
+  };
+}
+
+static vector<int> parseIntList(const string& s, const string& argName) {
+  vector<int> ret;
+  vector<string> pieces = Global::split(s,',');
+  for(size_t i = 0; i<pieces.size(); i++) {
+    string piece = Global::trim(pieces[i]);
+    if(piece.length() <= 0)
+      continue;
+    int x;
+    if(!Global::tryStringToInt(piece,x) || x <= 0)
+      throw StringError("Could not parse positive integer list for " + argName + ": " + s);
+    ret.push_back(x);
+  }
+  if(ret.size() <= 0)
+    throw StringError("Empty list for " + argName);
+  return ret;
+}
+
+//Percent of batches that filled up to each quarter of the max batch size
+static string batchFillSummary(const vector<uint64_t>& histogram) {
+  int maxBatchSize = (int)histogram.size() - 1;
+  uint64_t total = 0;
+  uint64_t quarters[4] = {0,0,0,0};
+  for(int rows = 1; rows <= maxBatchSize; rows++) {
+    int q = std::min(3, (rows * 4 - 1) / maxBatchSize);
+    quarters[q] += histogram[rows];
+    total += histogram[rows];
+  }
+  if(total <= 0)
+    total = 1;
+  return Global::strprintf(
+    "fill%% <=25:%3.0f <=50:%3.0f <=75:%3.0f <=100:%3.0f",
+    100.0 * quarters[0] / total, 100.0 * quarters[1] / total, 100.0 * quarters[2] / total, 100.0 * quarters[3] / total
+  );
+}
+
+//Used when no sgfs are given, a few positions of different sizes and phases of the game
+static vector<BenchmarkPosition> getBuiltinPositions() {
+  vector<BenchmarkPosition> positions;
+  auto add = [&positions](const string& name, const Board& board, Player pla, const Rules& rules) {
+    BenchmarkPosition pos;
+    pos.name = name;
+    pos.board = board;
+    pos.pla = pla;
+    pos.hist = BoardHistory(board,pla,rules,0);
+    positions.push_back(pos);
+  };
+
+  add("19x19 empty", Board(19,19), P_BLACK, Rules::getTrompTaylorish());
+
+  Board opening = Board::parseBoard(19,19,R"%%(
+...................
+...................
+...................
+...o.........x.....
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...x...........o...
+..o................
+...................
+...................
+)%%");
+  add("19x19 opening", opening, P_BLACK, Rules::getTrompTaylorish());
+
+  Board middle13 = Board::parseBoard(13,13,R"%%(
+.............
+.............
+...xo....x...
+..xo.o.......
+..xo.........
+...x..o..o...
+.........x...
+..x..........
+.......x..o..
+...o.x..xo...
+..o.ox.xo....
+...o..xo.....
+.............
+)%%");
+  add("13x13 middlegame", middle13, P_WHITE, Rules::getSimpleTerritory());
+
+  Board middle9 = Board::parseBoard(9,9,R"%%(
+.........
+...o.x...
+..xo.x...
+..xoox...
+..xxo.x..
+...xoo...
+..xo.o...
+...o.....
+.........
+)%%");
+  add("9x9 middlegame", middle9, P_BLACK, Rules::getTrompTaylorish());
+
+  return positions;
+}
+
+int MainCmds::benchmarksearch(int argc, const char* const* argv) {
+  Board::initHash();
+  ScoreValue::initTables();
+
+  string configFile;
+  vector<string> sgfFiles;
+  int64_t maxVisits;
+  vector<int> threadCounts;
+  vector<int> maxBatchSizes;
+  vector<string> batchingModes;
+  SyntheticNNParams syntheticParams;
+  try {
+    TCLAP::CmdLine cmd("Benchmark search throughput against a synthetic neural net", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::ValueArg<string> configFileArg("","config","Config file for search params (see configs/gtp_example.cfg), otherwise defaults",false,string(),"FILE");
+    TCLAP::MultiArg<string> sgfFileArg("","sgf","Sgf file, the position halfway through the game is searched. Defaults to a builtin suite",false,"FILE");
+    TCLAP::ValueArg<string> visitsArg("v","visits","Visits per search",false,"1600","VISITS");
+    TCLAP::ValueArg<string> threadsArg("t","threads","Comma-separated search thread counts to test",false,"1,2,4,8,16","THREADS");
+    TCLAP::ValueArg<string> batchSizesArg("","nn-max-batch-sizes","Comma-separated nnMaxBatchSize values to test",false,"8,32","SIZES");
+    TCLAP::ValueArg<string> batchingModesArg("","batching-modes","Comma-separated nnBatchingMode values to test",false,"immediate,throughput","MODES");
+    TCLAP::ValueArg<double> batchLatencyArg("","batch-latency-ms","Synthetic net fixed latency per batch",false,syntheticParams.batchLatencyMs,"MS");
+    TCLAP::ValueArg<double> rowLatencyArg("","row-latency-ms","Synthetic net latency per row, before the batch size exponent",false,syntheticParams.rowLatencyMs,"MS");
+    TCLAP::ValueArg<double> batchSizeExponentArg("","batch-size-exponent","Synthetic net latency grows as numRows^exponent",false,syntheticParams.batchSizeExponent,"EXPONENT");
+    cmd.add(configFileArg);
+    cmd.add(sgfFileArg);
+    cmd.add(visitsArg);
+    cmd.add(threadsArg);
+    cmd.add(batchSizesArg);
+    cmd.add(batchingModesArg);
+    cmd.add(batchLatencyArg);
+    cmd.add(rowLatencyArg);
+    cmd.add(batchSizeExponentArg);
+    cmd.parse(argc,argv);
+    configFile = configFileArg.getValue();
+    sgfFiles = sgfFileArg.getValue();
+    if(!Global::tryStringToInt64(visitsArg.getValue(),maxVisits) || maxVisits <= 0) {
+      cerr << "Error: invalid value for visits" << endl;
+      return 1;
+    }
+    threadCounts = parseIntList(threadsArg.getValue(),"threads");
+    maxBatchSizes = parseIntList(batchSizesArg.getValue(),"nn-max-batch-sizes");
+    vector<string> modePieces = Global::split(batchingModesArg.getValue(),',');
+    for(size_t i = 0; i<modePieces.size(); i++) {
+      string mode = Global::trim(modePieces[i]);
+      if(mode.length() <= 0)
+        continue;
+      NNBatchingParams::getDefaults(mode); //Validate
+      batchingModes.push_back(mode);
+    }
+    if(batchingModes.size() <= 0)
+      throw StringError("Empty list for batching-modes");
+    syntheticParams.batchLatencyMs = batchLatencyArg.getValue();
+    syntheticParams.rowLatencyMs = rowLatencyArg.getValue();
+    syntheticParams.batchSizeExponent = batchSizeExponentArg.getValue();
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+  catch (const StringError& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  SearchParams baseParams;
+  if(configFile != "") {
+    ConfigParser cfg(configFile);
+    baseParams = Setup::loadParams(cfg)[0];
+  }
+  baseParams.maxVisits = maxVisits;
+  baseParams.maxPlayouts = maxVisits;
+  baseParams.maxTime = 1.0e20;
+
+  vector<BenchmarkPosition> positions;
+  if(sgfFiles.size() <= 0)
+    positions = getBuiltinPositions();
+  for(size_t i = 0; i<sgfFiles.size(); i++) {
+    CompactSgf* sgf = CompactSgf::loadFile(sgfFiles[i]);
+    BenchmarkPosition pos;
+    pos.name = sgfFiles[i];
+    Rules rules = sgf->getRulesFromSgf(Rules::getTrompTaylorish());
+    sgf->setupBoardAndHist(rules, pos.board, pos.pla, pos.hist, (int)(sgf->moves.size() / 2));
+    positions.push_back(pos);
+    delete sgf;
+  }
+
+  int nnXLen = 0;
+  int nnYLen = 0;
+  for(size_t i = 0; i<positions.size(); i++) {
+    nnXLen = std::max(nnXLen,positions[i].board.x_size);
+    nnYLen = std::max(nnYLen,positions[i].board.y_size);
+  }
+
+  Logger logger;
+  logger.setLogToStdout(false);
+
+  NeuralNet::globalInitialize();
+
+  cout << "Synthetic net latency per batch: " << syntheticParams.batchLatencyMs << "ms + "
+       << syntheticParams.rowLatencyMs << "ms * numRows^" << syntheticParams.batchSizeExponent << endl;
+  cout << "Searching " << positions.size() << " positions with " << maxVisits << " visits each" << endl;
+  cout << endl;
+
+  for(size_t m = 0; m<batchingModes.size(); m++) {
+    for(size_t b = 0; b<maxBatchSizes.size(); b++) {
+      for(size_t t = 0; t<threadCounts.size(); t++) {
+        const string& batchingMode = batchingModes[m];
+        int maxBatchSize = maxBatchSizes[b];
+        int numThreads = threadCounts[t];
+
+        const string modelFile = "/dev/null";
+        const vector<int> gpuIdxs = {-1};
+        NNEvaluator* nnEval = new NNEvaluator(
+          "synthetic",
+          modelFile,
+          gpuIdxs,
+          &logger,
+          0, //modelFileIdx
+          maxBatchSize,
+          std::max(maxBatchSize,numThreads) * 2, //maxConcurrentEvals
+          nnXLen,
+          nnYLen,
+          false, //requireExactNNLen
+          false, //inputsUseNHWC
+          18, //nnCacheSizePowerOfTwo
+          14, //nnMutexPoolSizePowerOfTwo
+          true, //debugSkipNeuralNet
+          false, //alwaysIncludeOwnerMap
+          1.0f, //nnPolicyTemperature
+          "" //openCLTunerFile
+        );
+        nnEval->setSyntheticNN(syntheticParams);
+        nnEval->setBatchingParams(NNBatchingParams::getDefaults(batchingMode));
+        nnEval->spawnServerThreads(1,false,"benchmarkSearchSeed",0,logger,gpuIdxs,false,false);
+
+        SearchParams params = baseParams;
+        params.numThreads = numThreads;
+        Search* search = new Search(params, nnEval, "benchmarkSearchSeed");
+
+        int64_t totalVisits = 0;
+        double totalSeconds = 0.0;
+        for(size_t i = 0; i<positions.size(); i++) {
+          const BenchmarkPosition& pos = positions[i];
+          search->setPosition(pos.pla,pos.board,pos.hist);
+          ClockTimer timer;
+          search->runWholeSearch(pos.pla,logger,NULL);
+          totalSeconds += timer.getSeconds();
+          totalVisits += search->getRootVisits();
+        }
+
+        double lockWaitSeconds = search->nodeLockWaitNanos.load() * 1e-9;
+        cout << Global::strprintf(
+          "%-10s nnMaxBatchSize %3d numThreads %3d: playouts/sec %9.1f avgBatchSize %6.2f nnBatches %7llu coalesced %6llu lockWait %7.3fs (%5.2f%% of thread time) fillWait %7.3fs %s nnLatency p50 %6.2fms p99 %6.2fms",
+          batchingMode.c_str(), maxBatchSize, numThreads, totalVisits / totalSeconds,
+          nnEval->averageProcessedBatchSize(),
+          (unsigned long long)nnEval->numBatchesProcessed(),
+          (unsigned long long)nnEval->numCoalescedRequests(),
+          lockWaitSeconds,
+          100.0 * lockWaitSeconds / (totalSeconds * numThreads),
+          nnEval->totalBatchFillWaitSeconds(),
+          batchFillSummary(nnEval->getBatchSizeHistogram()).c_str(),
+          nnEval->submitLatencyPercentileSeconds(0.5) * 1000.0,
+          nnEval->submitLatencyPercentileSeconds(0.99) * 1000.0
+        ) << endl;
+
+        delete search;
+        delete nnEval;
+      }
+    }
+  }
+
+  NeuralNet::globalCleanup();
+  ScoreValue::freeTables();
+  return 0;
+}
+
+//Plays a game of random legal moves, stopping early if it runs out of them
+static void playRandomGame(Rand& rand, int boardLen, int numMoves, vector<Move>& moves) {
+  Board board(boardLen,boardLen);
+  Player pla = P_BLACK;
+  BoardHistory hist(board,pla,Rules::getTrompTaylorish(),0);
+  moves.clear();
+  for(int i = 0; i<numMoves; i++) {
+    Loc loc = Board::NULL_LOC;
+    for(int tries = 0; tries<100; tries++) {
+      Loc candidate = Location::getLoc((int)rand.nextUInt(boardLen),(int)rand.nextUInt(boardLen),boardLen);
+      if(hist.isLegal(board,candidate,pla) && !board.isSimpleEye(candidate,pla)) {
+        loc = candidate;
+        break;
+      }
+    }
+    if(loc == Board::NULL_LOC)
+      break;
+    hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+    moves.push_back(Move(loc,pla));
+    pla = getOpp(pla);
+  }
+}
+
+int MainCmds::benchmarkfeatures(int argc, const char* const* argv) {
+  Board::initHash();
+  ScoreValue::initTables();
+
+  vector<string> sgfFiles;
+  int numGames;
+  int numChildren;
+  int inputsVersion;
+  try {
+    TCLAP::CmdLine cmd("Time filling neural net input rows along games, with and without the ladder cache", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::MultiArg<string> sgfFileArg("","sgf","Sgf file of a game to walk through. Defaults to random games",false,"FILE");
+    TCLAP::ValueArg<int> numGamesArg("","num-games","Number of random 19x19 games if no sgfs are given",false,20,"N");
+    TCLAP::ValueArg<int> numChildrenArg("","children","At every position, also fill rows for this many random moves from it, as a search would",false,8,"N");
+    TCLAP::ValueArg<int> inputsVersionArg("","inputs-version","Version of the inputs to fill, 3 or 4, which have ladder features",false,4,"VERSION");
+    cmd.add(sgfFileArg);
+    cmd.add(numGamesArg);
+    cmd.add(numChildrenArg);
+    cmd.add(inputsVersionArg);
+    cmd.parse(argc,argv);
+    sgfFiles = sgfFileArg.getValue();
+    numGames = numGamesArg.getValue();
+    numChildren = numChildrenArg.getValue();
+    inputsVersion = inputsVersionArg.getValue();
+    if(numGames <= 0 || numChildren < 0)
+      throw StringError("num-games must be positive and children must be nonnegative");
+    if(inputsVersion != 3 && inputsVersion != 4)
+      throw StringError("inputs-version must be 3 or 4");
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+  catch (const StringError& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  struct Game {
+    Board board;
+    Player pla;
+    BoardHistory hist;
+    vector<Move> moves;
+  };
+  vector<Game> games;
+  for(size_t i = 0; i<sgfFiles.size(); i++) {
+    CompactSgf* sgf = CompactSgf::loadFile(sgfFiles[i]);
+    Game game;
+    Rules rules = sgf->getRulesFromSgf(Rules::getTrompTaylorish());
+    sgf->setupInitialBoardAndHist(rules, game.board, game.pla, game.hist);
+    game.moves = sgf->moves;
+    games.push_back(game);
+    delete sgf;
+  }
+  if(games.size() <= 0) {
+    Rand rand("benchmarkfeatures");
+    for(int i = 0; i<numGames; i++) {
+      Game game;
+      game.board = Board(19,19);
+      game.pla = P_BLACK;
+      game.hist = BoardHistory(game.board,game.pla,Rules::getTrompTaylorish(),0);
+      playRandomGame(rand,19,250,game.moves);
+      games.push_back(game);
+    }
+  }
+
+  int nnXLen = 0;
+  int nnYLen = 0;
+  for(size_t i = 0; i<games.size(); i++) {
+    nnXLen = std::max(nnXLen,games[i].board.x_size);
+    nnYLen = std::max(nnYLen,games[i].board.y_size);
+  }
+  int rowSpatialLen = (inputsVersion == 3 ? NNInputs::NUM_FEATURES_SPATIAL_V3 : NNInputs::NUM_FEATURES_SPATIAL_V4) * nnXLen * nnYLen;
+  int rowGlobalLen = inputsVersion == 3 ? NNInputs::NUM_FEATURES_GLOBAL_V3 : NNInputs::NUM_FEATURES_GLOBAL_V4;
+  vector<float> rowSpatial(rowSpatialLen);
+  vector<float> rowGlobal(rowGlobalLen);
+
+  //Walks every game the same way each time, filling and timing rows, and returns a hash of all of them
+  auto fillAll = [&](LadderCache* ladderCache, int64_t& numRows, double& seconds) {
+    Rand rand("benchmarkfeatures children");
+    uint64_t rowsHash = 0;
+    numRows = 0;
+    seconds = 0.0;
+    auto fill = [&](const Board& board, const BoardHistory& hist, Player pla) {
+      ClockTimer timer;
+      if(inputsVersion == 3)
+        NNInputs::fillRowV3(board,hist,pla,0.0,nnXLen,nnYLen,false,ladderCache,rowSpatial.data(),rowGlobal.data());
+      else
+        NNInputs::fillRowV4(board,hist,pla,0.0,nnXLen,nnYLen,false,ladderCache,rowSpatial.data(),rowGlobal.data());
+      seconds += timer.getSeconds();
+      numRows++;
+      for(int i = 0; i<rowSpatialLen; i++) {
+        uint32_t bits;
+        std::memcpy(&bits,&rowSpatial[i],sizeof(bits));
+        rowsHash = Hash::murmurMix(rowsHash + bits + ((uint64_t)i << 32));
+      }
+    };
+
+    for(size_t g = 0; g<games.size(); g++) {
+      Board board = games[g].board;
+      Player pla = games[g].pla;
+      BoardHistory hist = games[g].hist;
+      for(size_t m = 0; m<games[g].moves.size(); m++) {
+        fill(board,hist,pla);
+        for(int c = 0; c<numChildren; c++) {
+          Loc loc = Location::getLoc((int)rand.nextUInt(board.x_size),(int)rand.nextUInt(board.y_size),board.x_size);
+          if(!hist.isLegal(board,loc,pla))
+            continue;
+          Board childBoard = board;
+          BoardHistory childHist = hist;
+          childHist.makeBoardMoveAssumeLegal(childBoard,loc,pla,NULL);
+          fill(childBoard,childHist,getOpp(pla));
+        }
+        const Move& move = games[g].moves[m];
+        if(!hist.isLegal(board,move.loc,move.pla))
+          break;
+        hist.makeBoardMoveAssumeLegal(board,move.loc,move.pla,NULL);
+        pla = getOpp(move.pla);
+      }
+    }
+    return rowsHash;
+  };
+
+  int64_t numRowsWithout;
+  double secondsWithout;
+  uint64_t hashWithout = fillAll(NULL,numRowsWithout,secondsWithout);
+
+  LadderCache ladderCache(16,0);
+  int64_t numRowsWith;
+  double secondsWith;
+  uint64_t hashWith = fillAll(&ladderCache,numRowsWith,secondsWith);
+
+  cout << "Filled " << numRowsWithout << " rows of inputs version " << inputsVersion << " from " << games.size() << " games" << endl;
+  cout << Global::strprintf("Without ladder cache: %.2f us/row", secondsWithout / numRowsWithout * 1e6) << endl;
+  cout << Global::strprintf(
+    "With ladder cache:    %.2f us/row, chain lookups hit %.1f%%",
+    secondsWith / numRowsWith * 1e6, 100.0 * ladderCache.numHits() / std::max((uint64_t)1, ladderCache.numHits() + ladderCache.numMisses())
+  ) << endl;
+  cout << "Rows identical: " << (hashWith == hashWithout && numRowsWith == numRowsWithout ? "yes" : "NO") << endl;
+
+  ScoreValue::freeTables();
+  return hashWith == hashWithout ? 0 : 1;
+}
+
+namespace {
+  struct BoardGame {
+    Board board;
+    vector<Move> moves;
+  };
+
+  struct BoardOpTally {
+    string name;
+    int64_t numOps = 0;
+    double seconds = 0.0;
+    int64_t numAllocations = 0;
+  };
+
+  //Times a block of board operations, adding count operations to the tally
+  struct BoardOpTimer {
+    BoardOpTally& tally;
+    int64_t allocationsAtStart;
+    ClockTimer timer;
+    BoardOpTimer(BoardOpTally& t)
+      :tally(t),allocationsAtStart(AllocationCount::getThisThread()),timer()
+    {}
+    void finish(int64_t count) {
+      tally.seconds += timer.getSeconds();
+      tally.numAllocations += AllocationCount::getThisThread() - allocationsAtStart;
+      tally.numOps += count;
+    }
+  };
+}
+
+//Random legal moves that don't fill the mover's own simple eyes, until neither player has one or maxMoves
+static BoardGame makeRandomBoardGame(Rand& rand, int boardLen, int maxMoves) {
+  BoardGame game;
+  game.board = Board(boardLen,boardLen);
+  Board board = game.board;
+  Player pla = P_BLACK;
+  int numPassesInARow = 0;
+  vector<Loc> candidates;
+  while((int)game.moves.size() < maxMoves && numPassesInARow < 2) {
+    candidates.clear();
+    for(int y = 0; y<boardLen; y++) {
+      for(int x = 0; x<boardLen; x++) {
+        Loc loc = Location::getLoc(x,y,boardLen);
+        if(board.isLegal(loc,pla,false) && !board.isSimpleEye(loc,pla))
+          candidates.push_back(loc);
+      }
+    }
+    if(candidates.size() <= 0)
+      numPassesInARow++;
+    else {
+      numPassesInARow = 0;
+      Loc loc = candidates[rand.nextUInt((uint32_t)candidates.size())];
+      board.playMoveAssumeLegal(loc,pla);
+      game.moves.push_back(Move(loc,pla));
+    }
+    pla = getOpp(pla);
+  }
+  return game;
+}
+
+//Walks every game of the workload, timing each kind of board operation at every position along the way.
+//Returns a hash of the results of the operations, which should be identical from run to run.
+static uint64_t benchmarkBoardOps(const vector<BoardGame>& games, bool multiStoneSuicideLegal, vector<BoardOpTally>& tallies) {
+  tallies.clear();
+  const int numTallies = 7;
+  const char* names[numTallies] = {
+    "playMoveAssumeLegal", "isLegal", "getPosHashAfterMove", "playMoveRecorded+undo",
+    "ladder search 1 lib", "ladder search 2 libs", "calculateArea"
+  };
+  for(int i = 0; i<numTallies; i++) {
+    tallies.push_back(BoardOpTally());
+    tallies[i].name = names[i];
+  }
+  BoardOpTally& playTally = tallies[0];
+  BoardOpTally& legalTally = tallies[1];
+  BoardOpTally& hashAfterTally = tallies[2];
+  BoardOpTally& recordedTally = tallies[3];
+  BoardOpTally& ladder1Tally = tallies[4];
+  BoardOpTally& ladder2Tally = tallies[5];
+  BoardOpTally& areaTally = tallies[6];
+
+  uint64_t resultHash = 0;
+  vector<Loc> legalMoves;
+  vector<Loc> chainLocs;
+  vector<Loc> buf;
+  vector<Loc> workingMoves;
+  Color area[Board::MAX_ARR_SIZE];
+  //So that growing these is not counted as allocations of the operations
+  legalMoves.reserve(Board::MAX_ARR_SIZE);
+  chainLocs.reserve(Board::MAX_ARR_SIZE);
+  buf.reserve(Board::MAX_ARR_SIZE);
+  workingMoves.reserve(Board::MAX_ARR_SIZE);
+
+  for(size_t g = 0; g<games.size(); g++) {
+    Board board = games[g].board;
+    const int xSize = board.x_size;
+    const int ySize = board.y_size;
+    for(size_t m = 0; m<games[g].moves.size(); m++) {
+      const Move& move = games[g].moves[m];
+      Player pla = move.pla;
+
+      {
+        legalMoves.clear();
+        BoardOpTimer t(legalTally);
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            Loc loc = Location::getLoc(x,y,xSize);
+            if(board.isLegal(loc,pla,multiStoneSuicideLegal))
+              legalMoves.push_back(loc);
+          }
+        }
+        t.finish(xSize * ySize);
+      }
+      resultHash = Hash::murmurMix(resultHash + legalMoves.size());
+
+      {
+        Hash128 acc;
+        BoardOpTimer t(hashAfterTally);
+        for(size_t i = 0; i<legalMoves.size(); i++)
+          acc ^= board.getPosHashAfterMove(legalMoves[i],pla);
+        t.finish((int64_t)legalMoves.size());
+        resultHash = Hash::murmurMix(resultHash + acc.hash0);
+      }
+
+      {
+        Board copy = board;
+        BoardOpTimer t(recordedTally);
+        for(size_t i = 0; i<legalMoves.size(); i++) {
+          Board::MoveRecord record = copy.playMoveRecorded(legalMoves[i],pla);
+          resultHash += copy.pos_hash.hash1;
+          copy.undo(record);
+        }
+        t.finish((int64_t)legalMoves.size());
+      }
+
+      {
+        //One stone of every chain with 1 or 2 liberties, searching on a copy since ladder search may rearrange chains
+        chainLocs.clear();
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            Loc loc = Location::getLoc(x,y,xSize);
+            if(board.colors[loc] != C_EMPTY && board.chain_head[loc] == loc && board.chain_data[loc].num_liberties <= 2)
+              chainLocs.push_back(loc);
+          }
+        }
+        Board copy = board;
+        for(size_t i = 0; i<chainLocs.size(); i++) {
+          Loc loc = chainLocs[i];
+          bool laddered;
+          if(copy.chain_data[copy.chain_head[loc]].num_liberties == 1) {
+            BoardOpTimer t(ladder1Tally);
+            laddered = copy.searchIsLadderCaptured(loc,true,buf);
+            t.finish(1);
+          }
+          else {
+            BoardOpTimer t(ladder2Tally);
+            laddered = copy.searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+            t.finish(1);
+          }
+          resultHash = Hash::murmurMix(resultHash + (laddered ? 1 : 2));
+        }
+      }
+
+      {
+        BoardOpTimer t(areaTally);
+        board.calculateArea(area,true,true,true,multiStoneSuicideLegal);
+        t.finish(1);
+        for(int y = 0; y<ySize; y++)
+          for(int x = 0; x<xSize; x++)
+            resultHash = resultHash * 3 + area[Location::getLoc(x,y,xSize)];
+      }
+
+      if(!board.isLegal(move.loc,move.pla,multiStoneSuicideLegal))
+        break;
+      {
+        BoardOpTimer t(playTally);
+        board.playMoveAssumeLegal(move.loc,move.pla);
+        t.finish(1);
+      }
+    }
+    resultHash = Hash::murmurMix(resultHash ^ board.pos_hash.hash0);
+  }
+  return resultHash;
+}
+
+//Replays every game, checking legality of each move, until at least minMoves have been played
+static int64_t replayBoardGames(const vector<BoardGame>& games, bool multiStoneSuicideLegal, int64_t minMoves) {
+  int64_t numMoves = 0;
+  while(numMoves < minMoves) {
+    int64_t numMovesBefore = numMoves;
+    for(size_t g = 0; g<games.size(); g++) {
+      Board board = games[g].board;
+      for(size_t m = 0; m<games[g].moves.size(); m++) {
+        const Move& move = games[g].moves[m];
+        if(!board.isLegal(move.loc,move.pla,multiStoneSuicideLegal))
+          break;
+        board.playMoveAssumeLegal(move.loc,move.pla);
+        numMoves++;
+      }
+    }
+    if(numMoves == numMovesBefore)
+      break;
+  }
+  return numMoves;
+}
+
+int MainCmds::benchmarkboard(int argc, const char* const* argv) {
+  Board::initHash();
+
+  vector<int> boardSizes;
+  vector<int> threadCounts;
+  vector<string> sgfFiles;
+  int numGames;
+  int64_t minMovesPerThread;
+  try {
+    TCLAP::CmdLine cmd("Time the core board operations on random playouts and sgf replays, and moves/sec across threads", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::ValueArg<string> boardSizesArg("","board-sizes","Comma-separated board sizes for random playouts",false,"9,13,19","SIZES");
+    TCLAP::ValueArg<int> numGamesArg("","num-games","Number of random playouts per board size",false,50,"N");
+    TCLAP::MultiArg<string> sgfFileArg("","sgf","Sgf file of a game to also replay as a workload, may be given more than once",false,"FILE");
+    TCLAP::ValueArg<string> threadsArg("","threads","Comma-separated thread counts for measuring moves/sec",false,"1,2,4","THREADS");
+    TCLAP::ValueArg<int> minMovesArg("","min-moves-per-thread","Moves each thread plays when measuring moves/sec",false,2000000,"N");
+    cmd.add(boardSizesArg);
+    cmd.add(numGamesArg);
+    cmd.add(sgfFileArg);
+    cmd.add(threadsArg);
+    cmd.add(minMovesArg);
+    cmd.parse(argc,argv);
+    boardSizes = parseIntList(boardSizesArg.getValue(),"board-sizes");
+    threadCounts = parseIntList(threadsArg.getValue(),"threads");
+    sgfFiles = sgfFileArg.getValue();
+    numGames = numGamesArg.getValue();
+    minMovesPerThread = minMovesArg.getValue();
+    for(size_t i = 0; i<boardSizes.size(); i++) {
+      if(boardSizes[i] < 2 || boardSizes[i] > Board::MAX_LEN)
+        throw StringError("board-sizes must be from 2 to " + Global::intToString(Board::MAX_LEN));
+    }
+    if(numGames <= 0 || minMovesPerThread <= 0)
+      throw StringError("num-games and min-moves-per-thread must be positive");
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+  catch (const StringError& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  struct Workload {
+    string name;
+    vector<BoardGame> games;
+    bool multiStoneSuicideLegal;
+  };
+  vector<Workload> workloads;
+  for(size_t i = 0; i<boardSizes.size(); i++) {
+    Workload workload;
+    workload.name = Global::strprintf("random %dx%d", boardSizes[i], boardSizes[i]);
+    workload.multiStoneSuicideLegal = false;
+    Rand rand("benchmarkboard " + Global::intToString(boardSizes[i]));
+    for(int g = 0; g<numGames; g++)
+      workload.games.push_back(makeRandomBoardGame(rand,boardSizes[i],boardSizes[i]*boardSizes[i]*2));
+    workloads.push_back(workload);
+  }
+  try {
+    if(sgfFiles.size() > 0) {
+      Workload workload;
+      workload.name = "sgf replay";
+      workload.multiStoneSuicideLegal = false;
+      for(size_t i = 0; i<sgfFiles.size(); i++) {
+        CompactSgf* sgf = CompactSgf::loadFile(sgfFiles[i]);
+        Rules rules = sgf->getRulesFromSgf(Rules::getTrompTaylorish());
+        BoardGame game;
+        Player pla;
+        BoardHistory hist;
+        sgf->setupInitialBoardAndHist(rules, game.board, pla, hist);
+        //Passes are not board operations
+        for(size_t m = 0; m<sgf->moves.size(); m++) {
+          if(sgf->moves[m].loc != Board::PASS_LOC)
+            game.moves.push_back(sgf->moves[m]);
+        }
+        workload.games.push_back(game);
+        workload.multiStoneSuicideLegal = workload.multiStoneSuicideLegal || rules.multiStoneSuicideLegal;
+        delete sgf;
+      }
+      workloads.push_back(workload);
+    }
+
+  }
+  catch(const StringError& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  if(!AllocationCount::isEnabled())
+    cout << "Not counting allocations, compile with -DCOUNT_ALLOCATIONS=1 for allocs/op" << endl;
+  for(size_t w = 0; w<workloads.size(); w++) {
+    const Workload& workload = workloads[w];
+    int64_t numMoves = 0;
+    for(size_t g = 0; g<workload.games.size(); g++)
+      numMoves += (int64_t)workload.games[g].moves.size();
+
+    cout << "=========================================================================" << endl;
+    cout << workload.name << ": " << workload.games.size() << " games, " << numMoves << " moves" << endl;
+
+    vector<BoardOpTally> tallies;
+    uint64_t resultHash = benchmarkBoardOps(workload.games,workload.multiStoneSuicideLegal,tallies);
+    for(size_t i = 0; i<tallies.size(); i++) {
+      const BoardOpTally& tally = tallies[i];
+      int64_t n = std::max(tally.numOps,(int64_t)1);
+      string line = Global::strprintf(
+        "%-22s %10lld ops %10.1f ns/op", tally.name.c_str(), (long long)tally.numOps, tally.seconds / n * 1e9
+      );
+      if(AllocationCount::isEnabled())
+        line += Global::strprintf(" %8.3f allocs/op", (double)tally.numAllocations / n);
+      cout << line << endl;
+    }
+
+    cout << "Result hash: " << Global::uint64ToHexString(resultHash) << endl;
+
+    //Moves/sec of a single thread, extrapolated from the first thread count if that isn't 1
+    double perThreadMovesPerSec = 0.0;
+    for(size_t i = 0; i<threadCounts.size(); i++) {
+      int numThreads = threadCounts[i];
+      vector<int64_t> movesByThread(numThreads,0);
+      vector<std::thread> threads;
+      ClockTimer timer;
+      for(int t = 0; t<numThreads; t++) {
+        threads.push_back(std::thread([&workload,&movesByThread,minMovesPerThread,t]() {
+          movesByThread[t] = replayBoardGames(workload.games,workload.multiStoneSuicideLegal,minMovesPerThread);
+        }));
+      }
+      for(int t = 0; t<numThreads; t++)
+        threads[t].join();
+      double seconds = timer.getSeconds();
+
+      int64_t totalMoves = 0;
+      for(int t = 0; t<numThreads; t++)
+        totalMoves += movesByThread[t];
+      double movesPerSec = totalMoves / seconds;
+      if(i == 0)
+        perThreadMovesPerSec = movesPerSec / numThreads;
+      cout << Global::strprintf(
+        "%3d threads: %12.0f moves/sec (isLegal + playMoveAssumeLegal), %3.0f%% of linear scaling",
+        numThreads, movesPerSec, 100.0 * movesPerSec / (perThreadMovesPerSec * numThreads)
+      ) << endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include "core/global.h"
+#include "core/timer.h"
+#include "neuralnet/desc.h"
+#include "main.h"
+
+#include <fstream>
+
+#define TCLAP_NAMESTARTSTRING "-" //Use single dashes for all flags
+#include <tclap/CmdLine.h>
+
+using namespace std;
+
+static int64_t getFileBytes(const string& fileName) {
+  ifstream in(fileName.c_str(), ios::in | ios::binary | ios::ate);
+  if(!in.good())
+    return -1;
+  return (int64_t)in.tellg();
+}
+
+int MainCmds::convertmodel(int argc, const char* const* argv) {
+  string modelFile;
+  string outputFile;
+  try {
+    TCLAP::CmdLine cmd("Convert a model file to the binary format, which loads much faster", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::ValueArg<string> modelFileArg("","model-file","Model file to convert, .txt or .bin.gz or already binary",true,string(),"FILE");
+    TCLAP::ValueArg<string> outputFileArg("","output","File to write the binary model to",true,string(),"FILE");
+    cmd.add(modelFileArg);
+    cmd.add(outputFileArg);
+    cmd.parse(argc,argv);
+    modelFile = modelFileArg.getValue();
+    outputFile = outputFileArg.getValue();
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  try {
+    ModelDesc desc;
+    ClockTimer timer;
+    ModelDesc::loadFromFileMaybeGZipped(modelFile,desc);
+    double loadSeconds = timer.getSeconds();
+    desc.saveToBinaryFile(outputFile);
+
+    //Make sure the result loads back
+    timer.reset();
+    ModelDesc reloaded;
+    ModelDesc::loadFromFileMaybeGZipped(outputFile,reloaded);
+    double reloadSeconds = timer.getSeconds();
+    if(reloaded.name != desc.name || reloaded.version != desc.version)
+      throw StringError("Converted model did not load back the same");
+
+    cout << "Converted " << desc.name << " (version " << desc.version << ")" << endl;
+    cout << Global::strprintf("%s: %lld bytes, loaded in %.3f seconds", modelFile.c_str(), (long long)getFileBytes(modelFile), loadSeconds) << endl;
+    cout << Global::strprintf("%s: %lld bytes, loaded in %.3f seconds", outputFile.c_str(), (long long)getFileBytes(outputFile), reloadSeconds) << endl;
+  }
+  catch(const StringError& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+int MainCmds::benchmarkmodelload(int argc, const char* const* argv) {
+  vector<string> modelFiles;
+  int numTrials;
+  try {
+    TCLAP::CmdLine cmd("Time loading model files, such as the same model in the text and binary formats", ' ', Version::getKataGoVersionForHelp(),true);
+    TCLAP::MultiArg<string> modelFileArg("","model-file","Model file to load, may be given more than once",true,"FILE");
+    TCLAP::ValueArg<int> numTrialsArg("","num-trials","Number of times to load each file",false,3,"N");
+    cmd.add(modelFileArg);
+    cmd.add(numTrialsArg);
+    cmd.parse(argc,argv);
+    modelFiles = modelFileArg.getValue();
+    numTrials = numTrialsArg.getValue();
+    if(numTrials <= 0) {
+      cerr << "Error: num-trials must be positive" << endl;
+      return 1;
+    }
+  }
+  catch (TCLAP::ArgException &e) {
+    cerr << "Error: " << e.error() << " for argument " << e.argId() << endl;
+    return 1;
+  }
+
+  try {
+    for(size_t i = 0; i<modelFiles.size(); i++) {
+      double minSeconds = 1e30;
+      double sumSeconds = 0.0;
+      for(int trial = 0; trial<numTrials; trial++) {
+        ModelDesc desc;
+        ClockTimer timer;
+        ModelDesc::loadFromFileMaybeGZipped(modelFiles[i],desc);
+        double seconds = timer.getSeconds();
+        minSeconds = std::min(minSeconds,seconds);
+        sumSeconds += seconds;
+      }
+      cout << Global::strprintf(
+        "%s: %lld bytes, load seconds min %.4f avg %.4f over %d trials",
+        modelFiles[i].c_str(), (long long)getFileBytes(modelFiles[i]), minSeconds, sumSeconds / numTrials, numTrials
+      ) << endl;
+    }
+  }
+  catch(const StringError& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
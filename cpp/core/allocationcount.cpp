@@ -0,0 +1,78 @@
+#include "../core/allocationcount.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+static thread_local int64_t numAllocationsThisThread = 0;
+
+bool AllocationCount::isEnabled() {
+  return true;
+}
+int64_t AllocationCount::getThisThread() {
+  return numAllocationsThisThread;
+}
+
+static void* countedAlloc(size_t size) {
+  numAllocationsThisThread++;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if(p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(size_t size) {
+  return countedAlloc(size);
+}
+void* operator new[](size_t size) {
+  return countedAlloc(size);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return countedAlloc(size);
+  }
+  catch(const std::bad_alloc&) {
+    return NULL;
+  }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return countedAlloc(size);
+  }
+  catch(const std::bad_alloc&) {
+    return NULL;
+  }
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t size) noexcept {
+  (void)size;
+  std::free(p);
+}
+void operator delete[](void* p, size_t size) noexcept {
+  (void)size;
+  std::free(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+#else
+
+bool AllocationCount::isEnabled() {
+  return false;
+}
+int64_t AllocationCount::getThisThread() {
+  return 0;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * allocationcount.h
+ *
+ * Counts heap allocations through operator new, so that benchmarks can report allocations per operation.
+ * Only when compiled with COUNT_ALLOCATIONS (cmake -DCOUNT_ALLOCATIONS=1), which replaces the global operator new
+ * for the whole program, so this is meant for benchmarking builds only.
+ */
+
+#ifndef CORE_ALLOCATIONCOUNT_H_
+#define CORE_ALLOCATIONCOUNT_H_
+
+#include <stdint.h>
+
+namespace AllocationCount {
+  //Whether allocations are being counted at all in this build
+  bool isEnabled();
+  //Number of allocations made so far by the calling thread, always 0 if not enabled
+  int64_t getThisThread();
+}
+
+#endif  // CORE_ALLOCATIONCOUNT_H_
@@ -0,0 +1,3 @@
+#include "../core/lockfreequeue.h"
+
+/* This file is to ensure lockfreequeue.h compiles on its own. */
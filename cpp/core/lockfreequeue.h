@@ -0,0 +1,106 @@
+/*
+ * lockfreequeue.h
+ *
+ * A bounded multi-producer multi-consumer queue that never takes a lock. Each slot of a power of two sized ring carries
+ * a sequence number saying whether it is ready to be written or read on the current lap, so producers and consumers
+ * only contend on a single compare and swap of the tail or head position (D. Vyukov's bounded MPMC queue).
+ *
+ * Neither push nor pop block, callers decide how to wait when the queue is full or empty.
+ */
+
+#ifndef CORE_LOCKFREEQUEUE_H_
+#define CORE_LOCKFREEQUEUE_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+template<typename T>
+class LockFreeQueue
+{
+  struct Slot {
+    std::atomic<size_t> seq;
+    T elt;
+  };
+
+  Slot* slots;
+  size_t capacity;
+  size_t mask;
+  //Keep the positions on separate cache lines from each other and from the slots pointer
+  char padding0[64];
+  std::atomic<size_t> tailPos;
+  char padding1[64];
+  std::atomic<size_t> headPos;
+  char padding2[64];
+
+ public:
+  //Capacity is rounded up to a power of two
+  inline LockFreeQueue(size_t minCapacity)
+    :slots(NULL),capacity(1),mask(0),padding0(),tailPos(0),padding1(),headPos(0),padding2()
+  {
+    while(capacity < minCapacity)
+      capacity *= 2;
+    mask = capacity - 1;
+    slots = new Slot[capacity];
+    for(size_t i = 0; i<capacity; i++)
+      slots[i].seq.store(i,std::memory_order_relaxed);
+  }
+  inline ~LockFreeQueue()
+  {
+    delete[] slots;
+  }
+
+  LockFreeQueue(const LockFreeQueue&) = delete;
+  LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+  inline size_t getCapacity() const
+  {
+    return capacity;
+  }
+
+  //Returns false if the queue is full
+  inline bool tryPush(const T& elt)
+  {
+    size_t pos = tailPos.load(std::memory_order_relaxed);
+    while(true) {
+      Slot& slot = slots[pos & mask];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if(diff == 0) {
+        if(tailPos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+          slot.elt = elt;
+          slot.seq.store(pos+1, std::memory_order_release);
+          return true;
+        }
+      }
+      //The consumer from the previous lap has not emptied this slot yet
+      else if(diff < 0)
+        return false;
+      else
+        pos = tailPos.load(std::memory_order_relaxed);
+    }
+  }
+
+  //Returns false if the queue is empty, or if the oldest slot is claimed by a producer that has not finished writing it.
+  inline bool tryPop(T& buf)
+  {
+    size_t pos = headPos.load(std::memory_order_relaxed);
+    while(true) {
+      Slot& slot = slots[pos & mask];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1);
+      if(diff == 0) {
+        if(headPos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+          buf = slot.elt;
+          slot.seq.store(pos+capacity, std::memory_order_release);
+          return true;
+        }
+      }
+      else if(diff < 0)
+        return false;
+      else
+        pos = headPos.load(std::memory_order_relaxed);
+    }
+  }
+};
+
+#endif  // CORE_LOCKFREEQUEUE_H_
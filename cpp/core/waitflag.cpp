@@ -0,0 +1,125 @@
+#include "../core/waitflag.h"
+
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define WAITFLAG_CPU_RELAX() _mm_pause()
+#else
+#define WAITFLAG_CPU_RELAX() ((void)0)
+#endif
+
+using namespace std;
+
+//Roughly a few microseconds of spinning before yielding, and a few more of yielding before sleeping.
+//With only one core, spinning only takes time away from the thread that would set the flag.
+static int getNumSpins() {
+  static const int numSpins = std::thread::hardware_concurrency() > 1 ? 256 : 0;
+  return numSpins;
+}
+static int getNumYields() {
+  static const int numYields = std::thread::hardware_concurrency() > 1 ? 16 : 0;
+  return numYields;
+}
+
+static const int NOT_SET = 0;
+static const int SET = 1;
+static const int SLEEPING = 2;
+
+WaitFlag::WaitFlag()
+  :state(NOT_SET)
+{}
+
+WaitFlag::~WaitFlag()
+{}
+
+void WaitFlag::reset() {
+  state.store(NOT_SET, std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+
+bool WaitFlag::isSet() const {
+  return state.load(std::memory_order_acquire) == SET;
+}
+
+//A waiter may see SET and return, and free the flag, before the wake below is made, such as after a spurious wakeup.
+//That's harmless: a private futex wake only uses the address as a key, never touching the memory, and at worst wakes
+//some unrelated futex now at that address, whose waiters must already tolerate spurious wakeups as ours do.
+void WaitFlag::set() {
+  if(state.exchange(SET, std::memory_order_release) == SLEEPING)
+    syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+void WaitFlag::wait() {
+  const int numSpins = getNumSpins();
+  for(int i = 0; i<numSpins; i++) {
+    if(state.load(std::memory_order_acquire) == SET)
+      return;
+    WAITFLAG_CPU_RELAX();
+  }
+  const int numYields = getNumYields();
+  for(int i = 0; i<numYields; i++) {
+    if(state.load(std::memory_order_acquire) == SET)
+      return;
+    std::this_thread::yield();
+  }
+  while(true) {
+    int expected = NOT_SET;
+    if(!state.compare_exchange_strong(expected, SLEEPING, std::memory_order_acquire) && expected == SET)
+      return;
+    //Sleeps only if the state is still SLEEPING, so a set in between is never missed. Wakeups may be spurious.
+    syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAIT_PRIVATE, SLEEPING, NULL, NULL, 0);
+    if(state.load(std::memory_order_acquire) == SET)
+      return;
+  }
+}
+
+#else
+
+//The mutex is held for all of set, and a waiter that sees SET takes the mutex once before returning, so set is
+//done with the flag before the waiter can free it.
+void WaitFlag::set() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if(state.exchange(SET, std::memory_order_release) == SLEEPING)
+    condVar.notify_all();
+}
+
+bool WaitFlag::isSet() const {
+  if(state.load(std::memory_order_acquire) != SET)
+    return false;
+  std::lock_guard<std::mutex> lock(mutex);
+  return true;
+}
+
+void WaitFlag::wait() {
+  const int numSpins = getNumSpins();
+  for(int i = 0; i<numSpins; i++) {
+    if(state.load(std::memory_order_acquire) == SET)
+      break;
+    WAITFLAG_CPU_RELAX();
+  }
+  const int numYields = getNumYields();
+  for(int i = 0; i<numYields; i++) {
+    if(state.load(std::memory_order_acquire) == SET)
+      break;
+    std::this_thread::yield();
+  }
+  //Even if already SET, taking the mutex waits for set to finish with the flag
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    int expected = NOT_SET;
+    if(!state.compare_exchange_strong(expected, SLEEPING, std::memory_order_acquire) && expected == SET)
+      return;
+    condVar.wait(lock);
+  }
+}
+
+#endif
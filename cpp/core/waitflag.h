@@ -0,0 +1,42 @@
+/*
+ * waitflag.h
+ *
+ * A one-shot signal from one thread to another waiting thread, for handing back a result. Waiting spins briefly,
+ * since the result is often only microseconds away, and only then sleeps in the kernel (a futex on Linux, a mutex
+ * and condition variable elsewhere). On Linux, setting costs a single atomic exchange unless the waiter has gone to sleep.
+ *
+ * The flag may be freed by the waiting thread as soon as its wait or isSet returns true.
+ */
+
+#ifndef CORE_WAITFLAG_H_
+#define CORE_WAITFLAG_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+class WaitFlag
+{
+  //0 = not set, 1 = set, 2 = not set and a thread is or may be sleeping on it
+  std::atomic<int> state;
+#ifndef __linux__
+  mutable std::mutex mutex;
+  std::condition_variable condVar;
+#endif
+
+ public:
+  WaitFlag();
+  ~WaitFlag();
+
+  WaitFlag(const WaitFlag&) = delete;
+  WaitFlag& operator=(const WaitFlag&) = delete;
+
+  //Not threadsafe with respect to set or wait, call before handing the flag off to the setting thread.
+  void reset();
+
+  //Memory writes before set are visible to a thread after its wait or isSet returns true.
+  void set();
+  bool isSet() const;
+  void wait();
+};
+
+#endif  // CORE_WAITFLAG_H_
@@ -330,6 +330,15 @@ int MainCmds::evalsgf(int argc, const char* const* argv) {
   sout << "Time taken: " << timer.getSeconds() << "\n";
   sout << "Root visits: " << search->numRootVisits() << "\n";
   sout << "NN rows: " << nnEval->numRowsProcessed() << endl;
+  sout << "NN coalesced requests: " << nnEval->numCoalescedRequests() << endl;
+  {
+    uint64_t cacheHits, cacheMisses, cacheEvictions;
+    nnEval->getCacheStats(cacheHits,cacheMisses,cacheEvictions);
+    sout << "NN cache hits/misses/evictions: " << cacheHits << " " << cacheMisses << " " << cacheEvictions << endl;
+    uint64_t diskHits, diskMisses, diskWrites;
+    nnEval->getDiskCacheStats(diskHits,diskMisses,diskWrites);
+    sout << "NN disk cache hits/misses/writes: " << diskHits << " " << diskMisses << " " << diskWrites << endl;
+  }
   sout << "NN batches: " << nnEval->numBatchesProcessed() << endl;
   sout << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
   sout << "PV: ";
@@ -0,0 +1,188 @@
+#ifndef GAME_BITBOARD_H_
+#define GAME_BITBOARD_H_
+
+#include "../core/global.h"
+#include "../game/board.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//A set of points of a board, one bit per point, for computing things about whole regions of the board at once
+//with a handful of word operations instead of walking it point by point.
+//
+//Point (x,y) is bit x + y * STRIDE. The column x == MAX_LEN is never part of any set, so that shifting by one to the
+//left or right moves points off the end of a row into that column rather than into the next row. Operations that
+//move points around, like dilate, must be masked by the points of the board, see getOnBoard.
+struct Bitboard {
+  static const int STRIDE = Board::MAX_LEN + 1;
+  static const int NUM_BITS = STRIDE * Board::MAX_LEN;
+  static const int NUM_WORDS = (NUM_BITS + 63) / 64;
+
+  uint64_t words[NUM_WORDS];
+
+  static inline int getIdx(int x, int y) {
+    return x + y * STRIDE;
+  }
+  //Conversions to and from the (x+1) + (y+1)*(x_size+1) representation of Loc
+  static inline Loc getLocOfIdx(int idx, int x_size) {
+    return (Loc)((idx % STRIDE + 1) + (idx / STRIDE + 1) * (x_size+1));
+  }
+  static inline int getIdxOfLoc(Loc loc, int x_size) {
+    return getIdx(loc % (x_size+1) - 1, loc / (x_size+1) - 1);
+  }
+
+  //All the points of the board
+  static inline Bitboard getOnBoard(int x_size, int y_size) {
+    Bitboard b = getEmpty();
+    for(int y = 0; y<y_size; y++)
+      for(int x = 0; x<x_size; x++)
+        b.set(getIdx(x,y));
+    return b;
+  }
+  static inline Bitboard getEmpty() {
+    Bitboard b;
+    for(int i = 0; i<NUM_WORDS; i++)
+      b.words[i] = 0;
+    return b;
+  }
+
+  inline void set(int idx) {
+    words[idx >> 6] |= (uint64_t)1 << (idx & 63);
+  }
+  inline bool contains(int idx) const {
+    return ((words[idx >> 6] >> (idx & 63)) & 1) != 0;
+  }
+
+  inline bool isEmpty() const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i];
+    return acc == 0;
+  }
+  inline bool intersects(const Bitboard& other) const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i] & other.words[i];
+    return acc != 0;
+  }
+  //Whether this is a subset of other
+  inline bool isSubsetOf(const Bitboard& other) const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i] & ~other.words[i];
+    return acc == 0;
+  }
+  inline bool operator==(const Bitboard& other) const {
+    uint64_t acc = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      acc |= words[i] ^ other.words[i];
+    return acc == 0;
+  }
+  inline bool operator!=(const Bitboard& other) const {
+    return !(*this == other);
+  }
+
+  inline Bitboard operator&(const Bitboard& other) const {
+    Bitboard b;
+    for(int i = 0; i<NUM_WORDS; i++)
+      b.words[i] = words[i] & other.words[i];
+    return b;
+  }
+  inline Bitboard operator|(const Bitboard& other) const {
+    Bitboard b;
+    for(int i = 0; i<NUM_WORDS; i++)
+      b.words[i] = words[i] | other.words[i];
+    return b;
+  }
+  inline Bitboard& operator|=(const Bitboard& other) {
+    for(int i = 0; i<NUM_WORDS; i++)
+      words[i] |= other.words[i];
+    return *this;
+  }
+  //The points of this that are not in other
+  inline Bitboard andNot(const Bitboard& other) const {
+    Bitboard b;
+    for(int i = 0; i<NUM_WORDS; i++)
+      b.words[i] = words[i] & ~other.words[i];
+    return b;
+  }
+
+  //Shift towards higher or lower bit indices, for 0 < n < 64
+  inline Bitboard shiftUp(int n) const {
+    Bitboard b;
+    b.words[0] = words[0] << n;
+    for(int i = 1; i<NUM_WORDS; i++)
+      b.words[i] = (words[i] << n) | (words[i-1] >> (64-n));
+    return b;
+  }
+  inline Bitboard shiftDown(int n) const {
+    Bitboard b;
+    for(int i = 0; i<NUM_WORDS-1; i++)
+      b.words[i] = (words[i] >> n) | (words[i+1] << (64-n));
+    b.words[NUM_WORDS-1] = words[NUM_WORDS-1] >> n;
+    return b;
+  }
+
+  //This along with all points adjacent to it, restricted to within
+  inline Bitboard dilate(const Bitboard& within) const {
+    return (*this | shiftUp(1) | shiftDown(1) | shiftUp(STRIDE) | shiftDown(STRIDE)) & within;
+  }
+  //All the points of within connected to this through within
+  inline Bitboard floodFill(const Bitboard& within) const {
+    Bitboard cur = *this & within;
+    while(true) {
+      Bitboard next = cur.dilate(within);
+      if(next == cur)
+        return cur;
+      cur = next;
+    }
+  }
+
+  inline int count() const {
+    int n = 0;
+    for(int i = 0; i<NUM_WORDS; i++)
+      n += popcount64(words[i]);
+    return n;
+  }
+  //The lowest index in the set, which must not be empty
+  inline int firstIdx() const {
+    for(int i = 0; i<NUM_WORDS; i++) {
+      if(words[i] != 0)
+        return i * 64 + countTrailingZeros64(words[i]);
+    }
+    assert(false);
+    return -1;
+  }
+
+  //Calls f(idx) for every point in the set, in increasing order
+  template<typename Func>
+  inline void forEach(Func f) const {
+    for(int i = 0; i<NUM_WORDS; i++) {
+      uint64_t w = words[i];
+      while(w != 0) {
+        f(i * 64 + countTrailingZeros64(w));
+        w &= w - 1;
+      }
+    }
+  }
+
+  static inline int popcount64(uint64_t w) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(w);
+#else
+    return __builtin_popcountll(w);
+#endif
+  }
+  static inline int countTrailingZeros64(uint64_t w) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx,w);
+    return (int)idx;
+#else
+    return __builtin_ctzll(w);
+#endif
+  }
+};
+
+#endif  // GAME_BITBOARD_H_
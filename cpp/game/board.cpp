@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "../core/rand.h"
+#include "../game/bitboard.h"
 
 using namespace std;
 
@@ -1559,8 +1560,40 @@ bool Board::searchIsLadderCaptured(Loc loc, bool defenderFirst, vector<Loc>& buf
 void Board::calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const {
   for(int i = 0; i<MAX_ARR_SIZE; i++)
     result[i] = C_EMPTY;
-  calculateAreaForPla(P_BLACK,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
-  calculateAreaForPla(P_WHITE,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+
+  Bitboard onBoard = Bitboard::getOnBoard(x_size,y_size);
+  Bitboard blackBits = Bitboard::getEmpty();
+  Bitboard whiteBits = Bitboard::getEmpty();
+  for(int y = 0; y < y_size; y++) {
+    for(int x = 0; x < x_size; x++) {
+      Loc loc = Location::getLoc(x,y,x_size);
+      if(colors[loc] == C_BLACK)
+        blackBits.set(Bitboard::getIdx(x,y));
+      else if(colors[loc] == C_WHITE)
+        whiteBits.set(Bitboard::getIdx(x,y));
+    }
+  }
+  Bitboard emptyBits = onBoard.andNot(blackBits | whiteBits);
+
+  calculateAreaForPla(P_BLACK,onBoard,blackBits,whiteBits,emptyBits,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+  calculateAreaForPla(P_WHITE,onBoard,whiteBits,blackBits,emptyBits,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+
+  if(nonPassAliveStones) {
+    for(int y = 0; y < y_size; y++) {
+      for(int x = 0; x < x_size; x++) {
+        Loc loc = Location::getLoc(x,y,x_size);
+        if(result[loc] == C_EMPTY)
+          result[loc] = colors[loc];
+      }
+    }
+  }
+}
+
+void Board::calculateAreaReference(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const {
+  for(int i = 0; i<MAX_ARR_SIZE; i++)
+    result[i] = C_EMPTY;
+  calculateAreaForPlaReference(P_BLACK,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
+  calculateAreaForPlaReference(P_WHITE,safeBigTerritories,unsafeBigTerritories,isMultiStoneSuicideLegal,result);
 
   if(nonPassAliveStones) {
     for(int y = 0; y < y_size; y++) {
@@ -1583,7 +1616,168 @@ void Board::calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTe
 //The top left corner is black's pass-alive territory. It's also an empty region bordered only by white, but we should not mark
 //it as white's unsafeBigTerritory because it's already marked as black's pass alive territory.
 
-void Board::calculateAreaForPla(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const {
+void Board::calculateAreaForPla(
+  Player pla, const Bitboard& onBoard, const Bitboard& plaBits, const Bitboard& oppBits, const Bitboard& emptyBits,
+  bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result
+) const {
+  //Nothing gets marked without at least one pla stone
+  if(plaBits.isEmpty())
+    return;
+
+  //Bounds both the number of pla chains and the number of empty-or-opp regions
+  static constexpr int maxGroups = (MAX_LEN * MAX_LEN + 1)/2 + 1;
+
+  //All pla chains, along with the points adjacent to each one
+  int numChains = 0;
+  Loc chainHeads[maxGroups];
+  Bitboard chainAdjacent[maxGroups];
+  int16_t chainIdxByHead[MAX_ARR_SIZE];
+  {
+    Bitboard remaining = plaBits;
+    while(!remaining.isEmpty()) {
+      Loc head = chain_head[Bitboard::getLocOfIdx(remaining.firstIdx(),x_size)];
+      Bitboard chain = Bitboard::getEmpty();
+      Loc cur = head;
+      do {
+        chain.set(Bitboard::getIdxOfLoc(cur,x_size));
+        cur = next_in_chain[cur];
+      } while(cur != head);
+      remaining = remaining.andNot(chain);
+
+      assert(numChains < maxGroups);
+      chainIdxByHead[head] = (int16_t)numChains;
+      chainHeads[numChains] = head;
+      chainAdjacent[numChains] = chain.dilate(onBoard).andNot(chain);
+      numChains++;
+    }
+  }
+
+  //All maximal empty-or-opp regions that contain at least one empty point
+  int numRegions = 0;
+  Bitboard regionBits[maxGroups];
+  //Indices of the pla chains each region is vital for, which is when all its points are adjacent to the chain.
+  //Every point includes the first point of the region, so there can be at most 4 of these.
+  int16_t vitalFor[maxGroups][4];
+  int vitalLen[maxGroups];
+  //Whether there is at most one point of the region not adjacent to any pla
+  bool fewInternalSpaces[maxGroups];
+  bool containsOpp[maxGroups];
+  {
+    Bitboard nonPla = onBoard.andNot(plaBits);
+    Bitboard plaAndAdjacent = plaBits.dilate(onBoard);
+    Bitboard remaining = emptyBits;
+    while(!remaining.isEmpty()) {
+      int firstIdx = remaining.firstIdx();
+      Bitboard region = Bitboard::getEmpty();
+      region.set(firstIdx);
+      region = region.floodFill(nonPla);
+      remaining = remaining.andNot(region);
+
+      int regionIdx = numRegions;
+      numRegions++;
+      assert(numRegions <= maxGroups);
+      regionBits[regionIdx] = region;
+      fewInternalSpaces[regionIdx] = region.andNot(plaAndAdjacent).count() <= 1;
+      containsOpp[regionIdx] = region.intersects(oppBits);
+
+      //In the case where suicide is not allowed, only the empty points need to be adjacent
+      Bitboard mustBeAdjacent = isMultiStoneSuicideLegal ? region : (region & emptyBits);
+      Loc firstLoc = Bitboard::getLocOfIdx(firstIdx,x_size);
+      int vLen = 0;
+      for(int i = 0; i<4; i++) {
+        Loc adj = firstLoc + adj_offsets[i];
+        if(colors[adj] != pla)
+          continue;
+        int16_t chainIdx = chainIdxByHead[chain_head[adj]];
+        bool alreadyPresent = false;
+        for(int j = 0; j<vLen; j++) {
+          if(vitalFor[regionIdx][j] == chainIdx) {
+            alreadyPresent = true;
+            break;
+          }
+        }
+        if(!alreadyPresent && mustBeAdjacent.isSubsetOf(chainAdjacent[chainIdx])) {
+          vitalFor[regionIdx][vLen] = chainIdx;
+          vLen++;
+        }
+      }
+      vitalLen[regionIdx] = vLen;
+    }
+  }
+
+  //Now, we can begin the benson iteration
+  bool chainKilled[maxGroups];
+  int vitalCount[maxGroups];
+  for(int i = 0; i<numChains; i++)
+    chainKilled[i] = false;
+  //Does this region border a pla chain that has been marked as not pass alive?
+  bool bordersKilled[maxGroups];
+  for(int i = 0; i<numRegions; i++)
+    bordersKilled[i] = false;
+
+  while(true) {
+    for(int i = 0; i<numChains; i++)
+      vitalCount[i] = 0;
+    for(int i = 0; i<numRegions; i++) {
+      if(bordersKilled[i])
+        continue;
+      for(int j = 0; j<vitalLen[i]; j++)
+        vitalCount[vitalFor[i][j]] += 1;
+    }
+
+    //Kill all chains that don't have at least 2 vital regions, and then every region bordering them
+    bool killedAnything = false;
+    Bitboard killedAdjacent = Bitboard::getEmpty();
+    for(int i = 0; i<numChains; i++) {
+      if(chainKilled[i] || vitalCount[i] >= 2)
+        continue;
+      chainKilled[i] = true;
+      killedAnything = true;
+      killedAdjacent |= chainAdjacent[i];
+    }
+    if(!killedAnything)
+      break;
+
+    for(int i = 0; i<numRegions; i++) {
+      if(!bordersKilled[i] && regionBits[i].intersects(killedAdjacent))
+        bordersKilled[i] = true;
+    }
+  }
+
+  //Mark result with pass-alive groups
+  for(int i = 0; i<numChains; i++) {
+    if(!chainKilled[i]) {
+      Loc head = chainHeads[i];
+      Loc cur = head;
+      do {
+        result[cur] = pla;
+        cur = next_in_chain[cur];
+      } while(cur != head);
+    }
+  }
+
+  //Mark result with territory, see calculateAreaForPlaReference for why these conditions are safe
+  int xSize = x_size;
+  for(int i = 0; i<numRegions; i++) {
+    bool shouldMark = fewInternalSpaces[i] && !bordersKilled[i];
+    shouldMark = shouldMark || (safeBigTerritories && !containsOpp[i] && !bordersKilled[i]);
+    if(shouldMark) {
+      regionBits[i].forEach([result,pla,xSize](int idx) {
+        result[Bitboard::getLocOfIdx(idx,xSize)] = pla;
+      });
+    }
+    else if(unsafeBigTerritories && !containsOpp[i]) {
+      regionBits[i].forEach([result,pla,xSize](int idx) {
+        Loc loc = Bitboard::getLocOfIdx(idx,xSize);
+        if(result[loc] == C_EMPTY)
+          result[loc] = pla;
+      });
+    }
+  }
+}
+
+//Same as calculateAreaForPla, but walks the board point by point instead of using bitboards
+void Board::calculateAreaForPlaReference(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const {
   Color opp = getOpp(pla);
 
   //First compute all empty-or-opp regions
@@ -13,6 +13,7 @@
 //TYPES AND CONSTANTS-----------------------------------------------------------------
 
 struct Board;
+struct Bitboard;
 
 //Player
 typedef int8_t Player;
@@ -206,6 +207,8 @@ struct Board
   //All other points are marked as C_EMPTY.
   //[result] must be a buffer of size MAX_ARR_SIZE and will get filled with the result
   void calculateArea(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const;
+  //Same as calculateArea, but walks the board point by point instead of using bitboards. Slower, kept for testing.
+  void calculateAreaReference(Color* result, bool nonPassAliveStones, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal) const;
 
   //Run some basic sanity checks on the board state, throws an exception if not consistent, for testing/debugging
   void checkConsistency() const;
@@ -255,7 +258,11 @@ struct Board
   int findLibertyGainingCaptures(Loc loc, std::vector<Loc>& buf, int bufStart, int bufIdx) const;
   bool hasLibertyGainingCaptures(Loc loc) const;
 
-  void calculateAreaForPla(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const;
+  void calculateAreaForPla(
+    Player pla, const Bitboard& onBoard, const Bitboard& plaBits, const Bitboard& oppBits, const Bitboard& emptyBits,
+    bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result
+  ) const;
+  void calculateAreaForPlaReference(Player pla, bool safeBigTerritories, bool unsafeBigTerritories, bool isMultiStoneSuicideLegal, Color* result) const;
 
   //static void monteCarloOwner(Player player, Board* board, int mc_counts[]);
 };
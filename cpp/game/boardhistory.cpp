@@ -30,8 +30,10 @@ BoardHistory::BoardHistory()
    koHistoryLastClearedBeginningMoveIdx(0),
    initialBoard(),
    initialPla(P_BLACK),
-   recentBoards(),
-   currentRecentBoardIdx(0),
+   latestBoard(),
+   recentMoveRecords(),
+   numRecentMoveRecords(0),
+   latestMoveRecordIdx(0),
    consecutiveEndingPasses(0),
    hashesAfterBlackPass(),hashesAfterWhitePass(),
    encorePhase(0),koProhibitHash(),
@@ -56,8 +58,10 @@ BoardHistory::BoardHistory(const Board& board, Player pla, const Rules& r, int e
    koHistoryLastClearedBeginningMoveIdx(0),
    initialBoard(),
    initialPla(),
-   recentBoards(),
-   currentRecentBoardIdx(0),
+   latestBoard(),
+   recentMoveRecords(),
+   numRecentMoveRecords(0),
+   latestMoveRecordIdx(0),
    consecutiveEndingPasses(0),
    hashesAfterBlackPass(),hashesAfterWhitePass(),
    encorePhase(0),koProhibitHash(),
@@ -81,8 +85,10 @@ BoardHistory::BoardHistory(const BoardHistory& other)
    koHistoryLastClearedBeginningMoveIdx(other.koHistoryLastClearedBeginningMoveIdx),
    initialBoard(other.initialBoard),
    initialPla(other.initialPla),
-   recentBoards(),
-   currentRecentBoardIdx(other.currentRecentBoardIdx),
+   latestBoard(other.latestBoard),
+   recentMoveRecords(),
+   numRecentMoveRecords(other.numRecentMoveRecords),
+   latestMoveRecordIdx(other.latestMoveRecordIdx),
    consecutiveEndingPasses(other.consecutiveEndingPasses),
    hashesAfterBlackPass(other.hashesAfterBlackPass),hashesAfterWhitePass(other.hashesAfterWhitePass),
    encorePhase(other.encorePhase),koProhibitHash(other.koProhibitHash),
@@ -91,7 +97,7 @@ BoardHistory::BoardHistory(const BoardHistory& other)
    isGameFinished(other.isGameFinished),winner(other.winner),finalWhiteMinusBlackScore(other.finalWhiteMinusBlackScore),
    isNoResult(other.isNoResult),isResignation(other.isResignation)
 {
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
+  std::copy(other.recentMoveRecords, other.recentMoveRecords+NUM_RECENT_BOARDS-1, recentMoveRecords);
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   std::copy(other.blackKoProhibited, other.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
@@ -110,8 +116,10 @@ BoardHistory& BoardHistory::operator=(const BoardHistory& other)
   koHistoryLastClearedBeginningMoveIdx = other.koHistoryLastClearedBeginningMoveIdx;
   initialBoard = other.initialBoard;
   initialPla = other.initialPla;
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
-  currentRecentBoardIdx = other.currentRecentBoardIdx;
+  latestBoard = other.latestBoard;
+  std::copy(other.recentMoveRecords, other.recentMoveRecords+NUM_RECENT_BOARDS-1, recentMoveRecords);
+  numRecentMoveRecords = other.numRecentMoveRecords;
+  latestMoveRecordIdx = other.latestMoveRecordIdx;
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   consecutiveEndingPasses = other.consecutiveEndingPasses;
@@ -139,8 +147,10 @@ BoardHistory::BoardHistory(BoardHistory&& other) noexcept
   koHistoryLastClearedBeginningMoveIdx(other.koHistoryLastClearedBeginningMoveIdx),
   initialBoard(other.initialBoard),
   initialPla(other.initialPla),
-  recentBoards(),
-  currentRecentBoardIdx(other.currentRecentBoardIdx),
+  latestBoard(other.latestBoard),
+  recentMoveRecords(),
+  numRecentMoveRecords(other.numRecentMoveRecords),
+  latestMoveRecordIdx(other.latestMoveRecordIdx),
   consecutiveEndingPasses(other.consecutiveEndingPasses),
   hashesAfterBlackPass(std::move(other.hashesAfterBlackPass)),hashesAfterWhitePass(std::move(other.hashesAfterWhitePass)),
   encorePhase(other.encorePhase),koProhibitHash(other.koProhibitHash),
@@ -149,7 +159,7 @@ BoardHistory::BoardHistory(BoardHistory&& other) noexcept
   isGameFinished(other.isGameFinished),winner(other.winner),finalWhiteMinusBlackScore(other.finalWhiteMinusBlackScore),
   isNoResult(other.isNoResult),isResignation(other.isResignation)
 {
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
+  std::copy(other.recentMoveRecords, other.recentMoveRecords+NUM_RECENT_BOARDS-1, recentMoveRecords);
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   std::copy(other.blackKoProhibited, other.blackKoProhibited+Board::MAX_ARR_SIZE, blackKoProhibited);
@@ -165,8 +175,10 @@ BoardHistory& BoardHistory::operator=(BoardHistory&& other) noexcept
   koHistoryLastClearedBeginningMoveIdx = other.koHistoryLastClearedBeginningMoveIdx;
   initialBoard = other.initialBoard;
   initialPla = other.initialPla;
-  std::copy(other.recentBoards, other.recentBoards+NUM_RECENT_BOARDS, recentBoards);
-  currentRecentBoardIdx = other.currentRecentBoardIdx;
+  latestBoard = other.latestBoard;
+  std::copy(other.recentMoveRecords, other.recentMoveRecords+NUM_RECENT_BOARDS-1, recentMoveRecords);
+  numRecentMoveRecords = other.numRecentMoveRecords;
+  latestMoveRecordIdx = other.latestMoveRecordIdx;
   std::copy(other.wasEverOccupiedOrPlayed, other.wasEverOccupiedOrPlayed+Board::MAX_ARR_SIZE, wasEverOccupiedOrPlayed);
   std::copy(other.superKoBanned, other.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
   consecutiveEndingPasses = other.consecutiveEndingPasses;
@@ -197,11 +209,11 @@ void BoardHistory::clear(const Board& board, Player pla, const Rules& r, int ePh
   initialBoard = board;
   initialPla = pla;
   
-  //This makes it so that if we ask for recent boards with a lookback beyond what we have a history for,
-  //we simply return copies of the starting board.
-  for(int i = 0; i<NUM_RECENT_BOARDS; i++)
-    recentBoards[i] = board;
-  currentRecentBoardIdx = 0;
+  //With no move records, asking for recent boards with a lookback beyond what we have a history for
+  //simply returns copies of the starting board.
+  latestBoard = board;
+  numRecentMoveRecords = 0;
+  latestMoveRecordIdx = 0;
 
   for(int y = 0; y<board.y_size; y++) {
     for(int x = 0; x<board.x_size; x++) {
@@ -272,10 +284,15 @@ void BoardHistory::printDebugInfo(ostream& out, const Board& board) const {
 }
 
 
-const Board& BoardHistory::getRecentBoard(int numMovesAgo) const {
+Board BoardHistory::getRecentBoard(int numMovesAgo) const {
   assert(numMovesAgo >= 0 && numMovesAgo < NUM_RECENT_BOARDS);
-  int idx = (currentRecentBoardIdx - numMovesAgo + NUM_RECENT_BOARDS) % NUM_RECENT_BOARDS;
-  return recentBoards[idx];
+  Board board(latestBoard);
+  int numToUndo = std::min(numMovesAgo, numRecentMoveRecords);
+  for(int i = 0; i<numToUndo; i++) {
+    int idx = (latestMoveRecordIdx - i + (NUM_RECENT_BOARDS-1)) % (NUM_RECENT_BOARDS-1);
+    board.undo(recentMoveRecords[idx]);
+  }
+  return board;
 }
 
 
@@ -290,17 +307,17 @@ void BoardHistory::setKomi(float newKomi) {
 }
 
 
-//If rootKoHashTable is provided, will take advantage of rootKoHashTable rather than search within the first
-//rootKoHashTable->size() moves of koHashHistory.
+//If koHashTable is provided, will take advantage of koHashTable rather than search within the first
+//koHashTable->size() moves of koHashHistory.
 //ALSO counts the most recent ko hash!
-bool BoardHistory::koHashOccursInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const {
+bool BoardHistory::koHashOccursInHistory(Hash128 koHash, const KoHashTable* koHashTable) const {
   size_t start = 0;
-  if(rootKoHashTable != NULL &&
-     koHistoryLastClearedBeginningMoveIdx == rootKoHashTable->koHistoryLastClearedBeginningMoveIdx
+  if(koHashTable != NULL &&
+     koHistoryLastClearedBeginningMoveIdx == koHashTable->koHistoryLastClearedBeginningMoveIdx
   ) {
-    size_t tableSize = rootKoHashTable->size();
+    size_t tableSize = koHashTable->size();
     assert(tableSize < koHashHistory.size());
-    if(rootKoHashTable->containsHash(koHash))
+    if(koHashTable->containsHash(koHash))
       return true;
     start = tableSize;
   }
@@ -312,18 +329,18 @@ bool BoardHistory::koHashOccursInHistory(Hash128 koHash, const KoHashTable* root
   return false;
 }
 
-//If rootKoHashTable is provided, will take advantage of rootKoHashTable rather than search within the first
-//rootKoHashTable->size() moves of koHashHistory.
+//If koHashTable is provided, will take advantage of koHashTable rather than search within the first
+//koHashTable->size() moves of koHashHistory.
 //ALSO counts the most recent ko hash!
-int BoardHistory::numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const {
+int BoardHistory::numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHashTable* koHashTable) const {
   int count = 0;
   size_t start = 0;
-  if(rootKoHashTable != NULL &&
-     koHistoryLastClearedBeginningMoveIdx == rootKoHashTable->koHistoryLastClearedBeginningMoveIdx
+  if(koHashTable != NULL &&
+     koHistoryLastClearedBeginningMoveIdx == koHashTable->koHistoryLastClearedBeginningMoveIdx
   ) {
-    size_t tableSize = rootKoHashTable->size();
+    size_t tableSize = koHashTable->size();
     assert(tableSize < koHashHistory.size());
-    count += rootKoHashTable->numberOfOccurrencesOfHash(koHash);
+    count += koHashTable->numberOfOccurrencesOfHash(koHash);
     start = tableSize;
   }
   size_t koHashHistorySize = koHashHistory.size();
@@ -565,7 +582,88 @@ bool BoardHistory::passWouldEndPhase(const Board& board, Player movePla) const {
   return false;
 }
 
-void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable) {
+void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* koHashTable) {
+  makeBoardMoveHelper(board,moveLoc,movePla,koHashTable,NULL);
+}
+
+BoardHistory::MoveRecord BoardHistory::makeBoardMoveRecorded(Board& board, Loc moveLoc, Player movePla, const KoHashTable* koHashTable) {
+  MoveRecord record;
+  record.moveLoc = moveLoc;
+  record.wasEverOccupiedOrPlayedBefore = moveLoc != Board::PASS_LOC && wasEverOccupiedOrPlayed[moveLoc];
+  record.koHistoryLastClearedBeginningMoveIdx = koHistoryLastClearedBeginningMoveIdx;
+  record.koHashHistorySize = (uint32_t)koHashHistory.size();
+  record.hashesAfterBlackPassSize = (uint32_t)hashesAfterBlackPass.size();
+  record.hashesAfterWhitePassSize = (uint32_t)hashesAfterWhitePass.size();
+  record.koCapturesInEncoreSize = (uint32_t)koCapturesInEncore.size();
+  record.consecutiveEndingPasses = consecutiveEndingPasses;
+  record.encorePhase = encorePhase;
+  record.whiteBonusScore = whiteBonusScore;
+  record.isGameFinished = isGameFinished;
+  record.winner = winner;
+  record.finalWhiteMinusBlackScore = finalWhiteMinusBlackScore;
+  record.isNoResult = isNoResult;
+  record.isResignation = isResignation;
+  Hash128 koProhibitHashBeforeMove = koProhibitHash;
+
+  makeBoardMoveHelper(board,moveLoc,movePla,koHashTable,&record.boardRecord);
+
+  //Everything that only got appended to can be undone by truncation, anything else cannot.
+  record.isCheaplyUndoable =
+    koHashHistory.size() == record.koHashHistorySize + 1 &&
+    koHistoryLastClearedBeginningMoveIdx == record.koHistoryLastClearedBeginningMoveIdx &&
+    hashesAfterBlackPass.size() >= record.hashesAfterBlackPassSize &&
+    hashesAfterWhitePass.size() >= record.hashesAfterWhitePassSize &&
+    koCapturesInEncore.size() >= record.koCapturesInEncoreSize &&
+    encorePhase == record.encorePhase &&
+    koProhibitHash == koProhibitHashBeforeMove;
+  return record;
+}
+
+void BoardHistory::undoRecordedMoves(Board& board, const vector<MoveRecord>& records, const Board& refBoard, const BoardHistory& refHist) {
+  if(records.size() <= 0)
+    return;
+
+  for(size_t i = 0; i<records.size(); i++) {
+    if(!records[i].isCheaplyUndoable) {
+      board = refBoard;
+      *this = refHist;
+      return;
+    }
+  }
+
+  for(size_t i = records.size(); i > 0; i--) {
+    const MoveRecord& record = records[i-1];
+    board.undo(record.boardRecord);
+    if(record.moveLoc != Board::PASS_LOC)
+      wasEverOccupiedOrPlayed[record.moveLoc] = record.wasEverOccupiedOrPlayedBefore;
+  }
+
+  //The first record contains the state prior to all the moves
+  const MoveRecord& first = records[0];
+  assert(moveHistory.size() >= records.size());
+  moveHistory.resize(moveHistory.size() - records.size());
+  koHashHistory.resize(first.koHashHistorySize);
+  koHistoryLastClearedBeginningMoveIdx = first.koHistoryLastClearedBeginningMoveIdx;
+  hashesAfterBlackPass.resize(first.hashesAfterBlackPassSize);
+  hashesAfterWhitePass.resize(first.hashesAfterWhitePassSize);
+  koCapturesInEncore.resize(first.koCapturesInEncoreSize);
+  consecutiveEndingPasses = first.consecutiveEndingPasses;
+  encorePhase = first.encorePhase;
+  whiteBonusScore = first.whiteBonusScore;
+  isGameFinished = first.isGameFinished;
+  winner = first.winner;
+  finalWhiteMinusBlackScore = first.finalWhiteMinusBlackScore;
+  isNoResult = first.isNoResult;
+  isResignation = first.isResignation;
+
+  latestBoard = refHist.latestBoard;
+  std::copy(refHist.recentMoveRecords, refHist.recentMoveRecords+NUM_RECENT_BOARDS-1, recentMoveRecords);
+  numRecentMoveRecords = refHist.numRecentMoveRecords;
+  latestMoveRecordIdx = refHist.latestMoveRecordIdx;
+  std::copy(refHist.superKoBanned, refHist.superKoBanned+Board::MAX_ARR_SIZE, superKoBanned);
+}
+
+void BoardHistory::makeBoardMoveHelper(Board& board, Loc moveLoc, Player movePla, const KoHashTable* koHashTable, Board::MoveRecord* boardRecord) {
   Loc koLocBeforeMove = board.ko_loc;
   Hash128 posHashBeforeMove = board.pos_hash;
 
@@ -576,6 +674,9 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
   isNoResult = false;
   isResignation = false;
 
+  //Record of the move from the board's perspective, for reconstructing recent boards
+  Board::MoveRecord moveRecord;
+
   //Handle pass-for-ko moves in the encore. Pass for ko lifts a ko prohibition and does nothing else.
   bool wasPassForKo = false;
   if(encorePhase > 0 && moveLoc != Board::PASS_LOC) {
@@ -583,6 +684,11 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
        (movePla == P_WHITE && whiteKoProhibited[moveLoc] && board.wouldBeKoCapture(moveLoc,P_WHITE))) {
       setKoProhibited(movePla,moveLoc,false);
       wasPassForKo = true;
+      //From the board's perspective, this is only a change of the simple ko loc, same as a pass
+      moveRecord.pla = movePla;
+      moveRecord.loc = Board::PASS_LOC;
+      moveRecord.ko_loc = board.ko_loc;
+      moveRecord.capDirs = 0;
       //Clear simple ko loc to stop it from banning the other player from moving there!
       //Since we aren't otherwise touching the board, from the board's perspective a player will be moving twice in a row.
       board.clearSimpleKoLoc();
@@ -590,7 +696,7 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
   }
   //Otherwise handle regular moves
   if(!wasPassForKo) {
-    board.playMoveAssumeLegal(moveLoc,movePla);
+    moveRecord = board.playMoveRecorded(moveLoc,movePla);
 
     if(encorePhase > 0) {
       //Update ko prohibitions and record that this was a ko capture
@@ -619,8 +725,12 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
   }
 
   //Update recent boards
-  currentRecentBoardIdx = (currentRecentBoardIdx + 1) % NUM_RECENT_BOARDS;
-  recentBoards[currentRecentBoardIdx] = board;
+  latestBoard = board;
+  latestMoveRecordIdx = (latestMoveRecordIdx + 1) % (NUM_RECENT_BOARDS-1);
+  recentMoveRecords[latestMoveRecordIdx] = moveRecord;
+  numRecentMoveRecords = std::min(numRecentMoveRecords + 1, (int)NUM_RECENT_BOARDS-1);
+  if(boardRecord != NULL)
+    *boardRecord = moveRecord;
 
   //Passes clear ko history in the main phase with spight ko rules and in the encore
   //This lifts bans in spight ko rules and lifts 3-fold-repetition checking in the encore for no-resultifying infinite cycles
@@ -655,7 +765,7 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
         else {
           Hash128 posHashAfterMove = board.getPosHashAfterMove(loc,nextPla);
           Hash128 koHashAfterMove = getKoHashAfterMoveNonEncore(rules, posHashAfterMove, getOpp(nextPla));
-          superKoBanned[loc] = koHashOccursInHistory(koHashAfterMove,rootKoHashTable);
+          superKoBanned[loc] = koHashOccursInHistory(koHashAfterMove,koHashTable);
         }
       }
     }
@@ -730,7 +840,7 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
 
   //Break long cycles with no-result
   if(moveLoc != Board::PASS_LOC && (encorePhase > 0 || rules.koRule == Rules::KO_SIMPLE)) {
-    if(numberOfKoHashOccurrencesInHistory(koHashHistory[koHashHistory.size()-1], rootKoHashTable) >= 3) {
+    if(numberOfKoHashOccurrencesInHistory(koHashHistory[koHashHistory.size()-1], koHashTable) >= 3) {
       isNoResult = true;
       isGameFinished = true;
     }
@@ -740,69 +850,129 @@ void BoardHistory::makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player mo
 
 
 KoHashTable::KoHashTable()
-  :koHashHistorySortedByLowBits(),
-   koHistoryLastClearedBeginningMoveIdx(0)
+  :koHashes(),
+   koHistoryLastClearedBeginningMoveIdx(0),
+   slotHashes(),
+   slotCounts(),
+   slotMask(0),
+   numDistinct(0)
 {
-  idxTable = new uint32_t[TABLE_SIZE];
+  resizeSlots(INITIAL_NUM_SLOTS);
 }
 KoHashTable::~KoHashTable() {
-  delete[] idxTable;
 }
 
 size_t KoHashTable::size() const {
-  return koHashHistorySortedByLowBits.size();
+  return koHashes.size();
 }
 
 void KoHashTable::recompute(const BoardHistory& history) {
-  koHashHistorySortedByLowBits = history.koHashHistory;
+  const vector<Hash128>& newKoHashes = history.koHashHistory;
+  size_t numInCommon = 0;
+  if(koHistoryLastClearedBeginningMoveIdx == history.koHistoryLastClearedBeginningMoveIdx) {
+    size_t maxInCommon = std::min(koHashes.size(), newKoHashes.size());
+    while(numInCommon < maxInCommon && koHashes[numInCommon] == newKoHashes[numInCommon])
+      numInCommon++;
+  }
   koHistoryLastClearedBeginningMoveIdx = history.koHistoryLastClearedBeginningMoveIdx;
 
-  auto cmpFirstByLowBits = [](const Hash128& a, const Hash128& b) {
-    if((a.hash0 & TABLE_MASK) < (b.hash0 & TABLE_MASK))
-      return true;
-    if((a.hash0 & TABLE_MASK) > (b.hash0 & TABLE_MASK))
-      return false;
-    return a < b;
-  };
-
-  std::sort(koHashHistorySortedByLowBits.begin(),koHashHistorySortedByLowBits.end(),cmpFirstByLowBits);
-
-  //Just in case, since we're using 32 bits for indices.
-  if(koHashHistorySortedByLowBits.size() > 1000000000)
+  if(numInCommon <= 0) {
+    koHashes.clear();
+    std::fill(slotCounts.begin(), slotCounts.end(), 0);
+    numDistinct = 0;
+  }
+  while(koHashes.size() > numInCommon)
+    removeLast();
+  for(size_t i = numInCommon; i<newKoHashes.size(); i++)
+    add(newKoHashes[i]);
+}
+
+void KoHashTable::update(const BoardHistory& history) {
+  //The history was cleared since, such as by a pass during a search. Keep covering the history from before the clear,
+  //the moves since the clear are few enough to be checked linearly, and this is up to date again once they are undone.
+  if(koHistoryLastClearedBeginningMoveIdx != history.koHistoryLastClearedBeginningMoveIdx)
+    return;
+  const vector<Hash128>& newKoHashes = history.koHashHistory;
+  while(koHashes.size() > newKoHashes.size())
+    removeLast();
+  for(size_t i = koHashes.size(); i<newKoHashes.size(); i++)
+    add(newKoHashes[i]);
+}
+
+size_t KoHashTable::findSlot(Hash128 hash) const {
+  size_t slot = (size_t)hash.hash0 & slotMask;
+  while(slotCounts[slot] != 0 && slotHashes[slot] != hash)
+    slot = (slot + 1) & slotMask;
+  return slot;
+}
+
+void KoHashTable::add(Hash128 hash) {
+  //Just in case, since we're using 32 bits for counts.
+  if(koHashes.size() >= 1000000000)
     throw StringError("Board history length longer than 1000000000, not supported");
-  uint32_t size = (uint32_t)koHashHistorySortedByLowBits.size();
+  koHashes.push_back(hash);
+  size_t slot = findSlot(hash);
+  if(slotCounts[slot] == 0) {
+    slotHashes[slot] = hash;
+    numDistinct++;
+    //Keep the table at most half full
+    if(numDistinct * 2 > slotCounts.size()) {
+      slotCounts[slot] = 1;
+      resizeSlots(slotCounts.size() * 2);
+      return;
+    }
+  }
+  slotCounts[slot] += 1;
+}
+
+void KoHashTable::removeLast() {
+  assert(koHashes.size() > 0);
+  Hash128 hash = koHashes.back();
+  koHashes.pop_back();
+  size_t slot = findSlot(hash);
+  assert(slotCounts[slot] > 0);
+  slotCounts[slot] -= 1;
+  if(slotCounts[slot] > 0)
+    return;
+  numDistinct--;
+
+  //Shift back later entries of the same probe sequence into the hole, so that no probe sequence passes an empty slot
+  size_t hole = slot;
+  size_t cur = (slot + 1) & slotMask;
+  while(slotCounts[cur] != 0) {
+    size_t home = (size_t)slotHashes[cur].hash0 & slotMask;
+    //Can move into the hole unless its home is cyclically within (hole,cur]
+    if(((cur - home) & slotMask) >= ((cur - hole) & slotMask)) {
+      slotHashes[hole] = slotHashes[cur];
+      slotCounts[hole] = slotCounts[cur];
+      slotCounts[cur] = 0;
+      hole = cur;
+    }
+    cur = (cur + 1) & slotMask;
+  }
+}
 
-  uint32_t idx = 0;
-  for(uint32_t bits = 0; bits<TABLE_SIZE; bits++) {
-    while(idx < size && ((koHashHistorySortedByLowBits[idx].hash0 & TABLE_MASK) < bits))
-      idx++;
-    idxTable[bits] = idx;
+void KoHashTable::resizeSlots(size_t numSlots) {
+  vector<Hash128> oldSlotHashes;
+  vector<uint32_t> oldSlotCounts;
+  oldSlotHashes.swap(slotHashes);
+  oldSlotCounts.swap(slotCounts);
+  slotHashes.assign(numSlots, Hash128());
+  slotCounts.assign(numSlots, 0);
+  slotMask = numSlots - 1;
+  for(size_t i = 0; i<oldSlotCounts.size(); i++) {
+    if(oldSlotCounts[i] != 0) {
+      size_t slot = findSlot(oldSlotHashes[i]);
+      slotHashes[slot] = oldSlotHashes[i];
+      slotCounts[slot] = oldSlotCounts[i];
+    }
   }
 }
 
 bool KoHashTable::containsHash(Hash128 hash) const {
-  uint32_t bits = hash.hash0 & TABLE_MASK;
-  size_t idx = idxTable[bits];
-  size_t size = koHashHistorySortedByLowBits.size();
-  while(idx < size && ((koHashHistorySortedByLowBits[idx].hash0 & TABLE_MASK) == bits)) {
-    if(hash == koHashHistorySortedByLowBits[idx])
-      return true;
-    idx++;
-  }
-  return false;
+  return slotCounts[findSlot(hash)] != 0;
 }
 
 int KoHashTable::numberOfOccurrencesOfHash(Hash128 hash) const {
-  uint32_t bits = hash.hash0 & TABLE_MASK;
-  size_t idx = idxTable[bits];
-  size_t size = koHashHistorySortedByLowBits.size();
-  int count = 0;
-  while(idx < size && ((koHashHistorySortedByLowBits[idx].hash0 & TABLE_MASK) == bits)) {
-    if(hash == koHashHistorySortedByLowBits[idx])
-      count++;
-    idx++;
-  }
-  return count;
+  return (int)slotCounts[findSlot(hash)];
 }
-
-
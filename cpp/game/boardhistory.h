@@ -23,9 +23,15 @@ struct BoardHistory {
   Board initialBoard;
   Player initialPla;
 
+  //Rather than copies of the last few boards, keeps the latest board and the records of the moves that led to it,
+  //from which getRecentBoard reconstructs the earlier boards on demand by undoing moves.
   static const int NUM_RECENT_BOARDS = 6;
-  Board recentBoards[NUM_RECENT_BOARDS];
-  int currentRecentBoardIdx;
+  Board latestBoard;
+  Board::MoveRecord recentMoveRecords[NUM_RECENT_BOARDS-1];
+  //Number of recentMoveRecords in use, fewer than all of them within the first few moves since clear
+  int numRecentMoveRecords;
+  //Index in recentMoveRecords of the record of the latest move
+  int latestMoveRecordIdx;
 
   //Did this board location ever have a stone there before, or was it ever played?
   //(Also includes locations of suicides)
@@ -86,20 +92,55 @@ struct BoardHistory {
   float whiteKomiAdjustmentForDraws(double drawEquivalentWinsForWhite) const;
   float currentSelfKomi(Player pla, double drawEquivalentWinsForWhite) const;
 
-  //Returns a reference a recent board state, where 0 is the current board, 1 is 1 move ago, etc.
-  //Requires that numMovesAgo < NUM_RECENT_BOARDS
-  const Board& getRecentBoard(int numMovesAgo) const;
+  //Returns a recent board state, where 0 is the current board, 1 is 1 move ago, etc.
+  //Looking back past the start of the history returns the initial board.
+  //Requires that numMovesAgo < NUM_RECENT_BOARDS. Costs a board copy plus undoing numMovesAgo moves.
+  Board getRecentBoard(int numMovesAgo) const;
 
   //Check if a move on the board is legal, taking into account the full game state and superko
   bool isLegal(const Board& board, Loc moveLoc, Player movePla) const;
   //Check if passing right now would end the current phase of play
   bool passWouldEndPhase(const Board& board, Player movePla) const;
 
-  //For all of the below, rootKoHashTable is optional and if provided will slightly speedup superko searches
+  //For all of the below, koHashTable is optional and if provided will speed up superko and repetition checks.
+  //It should cover this history as of before the move, or a prefix of it, see KoHashTable.
   //This function should behave gracefully so long as it is pseudolegal (board.isLegal, but also still ok if the move is on board.ko_loc)
   //even if the move violates superko or encore ko recapture prohibitions, or is past when the game is ended.
   //This allows for robustness when this code is being used for analysis or with external data sources.
-  void makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* rootKoHashTable);
+  void makeBoardMoveAssumeLegal(Board& board, Loc moveLoc, Player movePla, const KoHashTable* koHashTable);
+
+  //Compact record of the parts of the board and history changed by a move, so that the move can be undone.
+  //Does NOT record the per-location arrays or the recent move records, see undoRecordedMoves.
+  struct MoveRecord {
+    Board::MoveRecord boardRecord;
+    Loc moveLoc;
+    bool wasEverOccupiedOrPlayedBefore;
+    //False if the move cleared any of the history vectors or changed the encore phase or ko prohibitions,
+    //in which case undoRecordedMoves falls back to a full copy.
+    bool isCheaplyUndoable;
+
+    int koHistoryLastClearedBeginningMoveIdx;
+    uint32_t koHashHistorySize;
+    uint32_t hashesAfterBlackPassSize;
+    uint32_t hashesAfterWhitePassSize;
+    uint32_t koCapturesInEncoreSize;
+    int consecutiveEndingPasses;
+    int encorePhase;
+    int whiteBonusScore;
+    bool isGameFinished;
+    Player winner;
+    float finalWhiteMinusBlackScore;
+    bool isNoResult;
+    bool isResignation;
+  };
+
+  //Same as makeBoardMoveAssumeLegal, but also returns a record of the move for undoRecordedMoves.
+  MoveRecord makeBoardMoveRecorded(Board& board, Loc moveLoc, Player movePla, const KoHashTable* koHashTable);
+  //Undo all of the moves in records, which must be every move made via makeBoardMoveRecorded since board and this
+  //history were equal to refBoard and refHist, in the order they were made. Afterwards, board and this history
+  //will be equivalent to refBoard and refHist (although as with Board::undo, not necessarily identical in representation).
+  //Costs O(number of moves) plus copying the latest board of refHist, rather than a full copy of refHist.
+  void undoRecordedMoves(Board& board, const std::vector<MoveRecord>& records, const Board& refBoard, const BoardHistory& refHist);
 
   //Slightly expensive, check if the entire game is all pass-alive-territory, and if so, declare the game finished
   void endGameIfAllPassAlive(const Board& board);
@@ -112,8 +153,9 @@ struct BoardHistory {
   void printDebugInfo(std::ostream& out, const Board& board) const;
 
 private:
-  bool koHashOccursInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const;
-  int numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHashTable* rootKoHashTable) const;
+  void makeBoardMoveHelper(Board& board, Loc moveLoc, Player movePla, const KoHashTable* koHashTable, Board::MoveRecord* boardRecord);
+  bool koHashOccursInHistory(Hash128 koHash, const KoHashTable* koHashTable) const;
+  int numberOfKoHashOccurrencesInHistory(Hash128 koHash, const KoHashTable* koHashTable) const;
   void setKoProhibited(Player pla, Loc loc, bool b);
   int countAreaScoreWhiteMinusBlack(const Board& board, Color area[Board::MAX_ARR_SIZE]) const;
   int countTerritoryAreaScoreWhiteMinusBlack(const Board& board, Color area[Board::MAX_ARR_SIZE]) const;
@@ -121,14 +163,15 @@ private:
   bool wouldBeSimpleSpightOrEncoreEndingPass(Loc moveLoc, Player movePla, Hash128 koHashAfterMove) const;
 };
 
+//Set of the ko hashes of a history, along with how many times each occurs, for fast superko and repetition checks.
+//Covers koHashHistory up to size(), for a history with the same koHistoryLastClearedBeginningMoveIdx, the rest of
+//the history being checked linearly. Updating it for a history that only differs from the one it covers by a few
+//moves at the end only adds or removes those moves' hashes.
 struct KoHashTable {
-  uint32_t* idxTable;
-  std::vector<Hash128> koHashHistorySortedByLowBits;
+  //The hashes covered, in order
+  std::vector<Hash128> koHashes;
   int koHistoryLastClearedBeginningMoveIdx;
 
-  static const int TABLE_SIZE = 1 << 10;
-  static const uint64_t TABLE_MASK = TABLE_SIZE-1;
-
   KoHashTable();
   ~KoHashTable();
 
@@ -137,10 +180,30 @@ struct KoHashTable {
 
   size_t size() const;
 
+  //Cover all of history. Compares history against the hashes covered so far to find what changed.
   void recompute(const BoardHistory& history);
+  //Same as recompute, but assumes without checking that history is the history last covered with moves only made
+  //or only undone since, such as for the board of a search thread. Constant time per move made or undone.
+  //If the history's ko history was cleared since, leaves the table as is, no longer covering the history until the
+  //moves back to before the clear are undone.
+  void update(const BoardHistory& history);
+
   bool containsHash(Hash128 hash) const;
   int numberOfOccurrencesOfHash(Hash128 hash) const;
 
+ private:
+  //Open addressing with linear probing. A slot is empty if its count is 0.
+  std::vector<Hash128> slotHashes;
+  std::vector<uint32_t> slotCounts;
+  size_t slotMask;
+  size_t numDistinct;
+
+  static const size_t INITIAL_NUM_SLOTS = 1 << 10;
+
+  size_t findSlot(Hash128 hash) const;
+  void add(Hash128 hash);
+  void removeLast();
+  void resizeSlots(size_t numSlots);
 };
 
 
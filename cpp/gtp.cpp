@@ -160,8 +160,27 @@ static void printGenmoveLog(ostream& out, const AsyncBot* bot, const NNEvaluator
   out << "Time taken: " << timeTaken << "\n";
   out << "Root visits: " << search->numRootVisits() << "\n";
   out << "NN rows: " << nnEval->numRowsProcessed() << endl;
+  out << "NN coalesced requests: " << nnEval->numCoalescedRequests() << endl;
+  {
+    uint64_t cacheHits, cacheMisses, cacheEvictions;
+    nnEval->getCacheStats(cacheHits,cacheMisses,cacheEvictions);
+    out << "NN cache hits/misses/evictions: " << cacheHits << " " << cacheMisses << " " << cacheEvictions << endl;
+    uint64_t diskHits, diskMisses, diskWrites;
+    nnEval->getDiskCacheStats(diskHits,diskMisses,diskWrites);
+    out << "NN disk cache hits/misses/writes: " << diskHits << " " << diskMisses << " " << diskWrites << endl;
+  }
   out << "NN batches: " << nnEval->numBatchesProcessed() << endl;
   out << "NN avg batch size: " << nnEval->averageProcessedBatchSize() << endl;
+  SearchNodeArenaStats arenaStats = search->getNodeArenaStats();
+  out << "Search nodes allocated: " << arenaStats.numNodes
+      << " children arrays: " << arenaStats.numChildrenArrays
+      << " slabs: " << arenaStats.numSlabs
+      << " MB: " << Global::strprintf("%.1f", arenaStats.bytesReserved / 1048576.0) << endl;
+  out << "Search nodes compacted: " << search->numNodesCompacted << " released: " << search->numNodesReleased.load() << endl;
+  out << "Search threads spawned: " << search->numSearchThreadsSpawned
+      << " startup ms: " << Global::strprintf("%.3f", search->lastSearchStartupSeconds * 1000.0) << endl;
+  if(search->searchParams.useGraphSearch)
+    out << "Graph search transpositions shared: " << search->numGraphNodesShared.load() << endl;
   out << "PV: ";
   search->printPV(out, search->rootNode, 25);
   out << "\n";
@@ -24,6 +24,7 @@ static void printHelp(int argc, const char* argv[]) {
 gtp : Runs GTP engine that can be plugged into any standard Go GUI for play/analysis.
 match : Run self-play match games based on a config, more efficient than gtp due to batching.
 evalsgf : Utility/debug tool, analyze a single position of a game from an SGF file.
+convertmodel : Convert a model file to the binary format, which loads much faster.
 version : Print version and exit.
 
 tuner : (OpenCL only) Run tuning to find and optimize parameters that work on your GPU.
@@ -44,6 +45,12 @@ runoutputtests : Run a bunch of things and dump details to stdout
 runsearchtests : Run a bunch of things using a neural net and dump details to stdout
 runsearchtestsv3 : Run a bunch more things using a neural net and dump details to stdout
 runselfplayinittests : Run some tests involving selfplay training init using a neural net and dump details to stdout
+runsearchstresstests : Run multithreaded searches at increasing thread counts, check tree consistency, report playouts/sec
+runselectionbenchmark : Time vectorized vs scalar search child selection
+benchmarksearch : Measure search playouts/sec at various thread counts and batch sizes using a synthetic neural net
+benchmarkfeatures : Time filling neural net input rows, with and without the ladder cache
+benchmarkboard : Time the core board operations on random playouts and sgf replays
+benchmarkmodelload : Time loading model files, such as the same model in the text and binary formats
 
 ---Dev/experimental subcommands-------------
 demoplay
@@ -82,6 +89,20 @@ static int handleSubcommand(const string& subcommand, int argc, const char* argv
     return MainCmds::runsearchtestsv3(argc-1,&argv[1]);
   else if(subcommand == "runselfplayinittests")
     return MainCmds::runselfplayinittests(argc-1,&argv[1]);
+  else if(subcommand == "runsearchstresstests")
+    return MainCmds::runsearchstresstests(argc-1,&argv[1]);
+  else if(subcommand == "runselectionbenchmark")
+    return MainCmds::runselectionbenchmark(argc-1,&argv[1]);
+  else if(subcommand == "benchmarksearch")
+    return MainCmds::benchmarksearch(argc-1,&argv[1]);
+  else if(subcommand == "benchmarkfeatures")
+    return MainCmds::benchmarkfeatures(argc-1,&argv[1]);
+  else if(subcommand == "benchmarkboard")
+    return MainCmds::benchmarkboard(argc-1,&argv[1]);
+  else if(subcommand == "benchmarkmodelload")
+    return MainCmds::benchmarkmodelload(argc-1,&argv[1]);
+  else if(subcommand == "convertmodel")
+    return MainCmds::convertmodel(argc-1,&argv[1]);
   else if(subcommand == "lzcost")
     return MainCmds::lzcost(argc-1,&argv[1]);
   else if(subcommand == "demoplay")
@@ -96,6 +117,8 @@ static int handleSubcommand(const string& subcommand, int argc, const char* argv
     cout << "Using CUDA backend" << endl;
     #elif defined(USE_OPENCL_BACKEND)
     cout << "Using OpenCL backend" << endl;
+    #elif defined(USE_CPU_BACKEND)
+    cout << "Using CPU backend" << endl;
     #else
     cout << "Using dummy backend" << endl;
     #endif
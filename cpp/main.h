@@ -15,6 +15,13 @@ namespace MainCmds {
   int runsearchtests(int argc, const char* const* argv);
   int runsearchtestsv3(int argc, const char* const* argv);
   int runselfplayinittests(int argc, const char* const* argv);
+  int runsearchstresstests(int argc, const char* const* argv);
+  int runselectionbenchmark(int argc, const char* const* argv);
+  int benchmarksearch(int argc, const char* const* argv);
+  int benchmarkfeatures(int argc, const char* const* argv);
+  int benchmarkboard(int argc, const char* const* argv);
+  int benchmarkmodelload(int argc, const char* const* argv);
+  int convertmodel(int argc, const char* const* argv);
 
   int lzcost(int argc, const char* const* argv);
   int demoplay(int argc, const char* const* argv);
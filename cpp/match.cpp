@@ -236,6 +236,13 @@ int MainCmds::match(int argc, const char* const* argv) {
     if(nnEvals[i] != NULL) {
       logger.write(nnEvals[i]->getModelFileName());
       logger.write("NN rows: " + Global::int64ToString(nnEvals[i]->numRowsProcessed()));
+      logger.write("NN coalesced requests: " + Global::int64ToString(nnEvals[i]->numCoalescedRequests()));
+      uint64_t cacheHits, cacheMisses, cacheEvictions;
+      nnEvals[i]->getCacheStats(cacheHits,cacheMisses,cacheEvictions);
+      logger.write(
+        "NN cache hits/misses/evictions: " + Global::uint64ToString(cacheHits) + " " +
+        Global::uint64ToString(cacheMisses) + " " + Global::uint64ToString(cacheEvictions)
+      );
       logger.write("NN batches: " + Global::int64ToString(nnEvals[i]->numBatchesProcessed()));
       logger.write("NN avg batch size: " + Global::doubleToString(nnEvals[i]->averageProcessedBatchSize()));
       delete nnEvals[i];
@@ -0,0 +1,1694 @@
+#ifdef USE_CPU_BACKEND
+
+#include "../neuralnet/nninterface.h"
+#include "../neuralnet/nninputs.h"
+#include "../neuralnet/modelversion.h"
+#include "../neuralnet/cpukernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+//A multithreaded CPU implementation of the neural net, in NCHW layout and fp32 only.
+//Convolutions and matrix multiplies go through CPUKernels, and every layer splits its work across a pool of threads
+//shared by all handles, so a single evaluation can use all cores without several handles oversubscribing them.
+
+//---------------------------------------------------------------------------------------------------------
+
+void NeuralNet::globalInitialize() {
+}
+
+void NeuralNet::globalCleanup() {
+}
+
+//------------------------------------------------------------------------------
+
+struct LoadedModel {
+  ModelDesc modelDesc;
+
+  LoadedModel(const string& fileName) {
+    ModelDesc::loadFromFileMaybeGZipped(fileName,modelDesc);
+  }
+
+  LoadedModel() = delete;
+  LoadedModel(const LoadedModel&) = delete;
+  LoadedModel& operator=(const LoadedModel&) = delete;
+};
+
+LoadedModel* NeuralNet::loadModelFile(const string& file, int modelFileIdx) {
+  (void)modelFileIdx;
+  LoadedModel* loadedModel = new LoadedModel(file);
+  return loadedModel;
+}
+
+void NeuralNet::freeLoadedModel(LoadedModel* loadedModel) {
+  delete loadedModel;
+}
+
+int NeuralNet::getModelVersion(const LoadedModel* loadedModel) {
+  return loadedModel->modelDesc.version;
+}
+
+Rules NeuralNet::getSupportedRules(const LoadedModel* loadedModel, const Rules& desiredRules, bool& supported) {
+  return loadedModel->modelDesc.getSupportedRules(desiredRules, supported);
+}
+
+//---------------------------------------------------------------------------------------------------------
+
+struct ComputeContext {
+  int nnXLen;
+  int nnYLen;
+
+  ComputeContext(int nnX, int nnY)
+    :nnXLen(nnX),nnYLen(nnY)
+  {}
+
+  ComputeContext() = delete;
+  ComputeContext(const ComputeContext&) = delete;
+  ComputeContext& operator=(const ComputeContext&) = delete;
+};
+
+ComputeContext* NeuralNet::createComputeContext(
+  const std::vector<int>& gpuIdxs,
+  Logger* logger,
+  int nnXLen,
+  int nnYLen,
+  string openCLTunerFile,
+  const LoadedModel* loadedModel
+) {
+  (void)gpuIdxs;
+  (void)logger;
+  (void)openCLTunerFile;
+  (void)loadedModel;
+  return new ComputeContext(nnXLen,nnYLen);
+}
+
+void NeuralNet::freeComputeContext(ComputeContext* computeContext) {
+  delete computeContext;
+}
+
+//--------------------------------------------------------------
+
+//Persistent pool of threads for splitting up the work of a single layer, shared by every handle in the process so
+//that several models or server threads do not each start a thread per core.
+//Any number of threads may call parallelFor at once. Each caller works on its own tasks as thread 0, and the pool's
+//workers join in on whichever caller's tasks have the fewest of them helping, so a pool of one thread never
+//context switches.
+struct IntraOpThreadPool {
+  struct Job {
+    const std::function<void(int,int)>* task;
+    int numTasks;
+    std::atomic<int> nextTask;
+    int numWorkersRunning;
+  };
+
+  vector<std::thread> workers;
+  //Packing scratch space for CPUKernels, one per worker, indexed by threadIdx-1
+  vector<vector<float>> packBufs;
+
+  std::mutex mutex;
+  std::condition_variable workCV;
+  std::condition_variable doneCV;
+  bool shouldStop;
+  vector<Job*> jobs;
+
+  IntraOpThreadPool(int numThreads)
+    :workers(),
+     packBufs(std::max(numThreads-1,0), vector<float>(CPUKernels::packBufferElts())),
+     mutex(),
+     workCV(),
+     doneCV(),
+     shouldStop(false),
+     jobs()
+  {
+    for(int threadIdx = 1; threadIdx<numThreads; threadIdx++)
+      workers.push_back(std::thread(&IntraOpThreadPool::workerLoop, this, threadIdx));
+  }
+
+  ~IntraOpThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shouldStop = true;
+    }
+    workCV.notify_all();
+    for(size_t i = 0; i<workers.size(); i++)
+      workers[i].join();
+  }
+
+  IntraOpThreadPool() = delete;
+  IntraOpThreadPool(const IntraOpThreadPool&) = delete;
+  IntraOpThreadPool& operator=(const IntraOpThreadPool&) = delete;
+
+  int getNumThreads() const {
+    return (int)workers.size() + 1;
+  }
+  float* getWorkerPackBuf(int threadIdx) {
+    return packBufs[threadIdx-1].data();
+  }
+
+  static void runTasks(Job* job, int threadIdx) {
+    while(true) {
+      int taskIdx = job->nextTask.fetch_add(1,std::memory_order_relaxed);
+      if(taskIdx >= job->numTasks)
+        break;
+      (*(job->task))(taskIdx,threadIdx);
+    }
+  }
+
+  //Requires mutex. The job with tasks left to start that has the fewest workers on it, or NULL.
+  Job* findJob() const {
+    Job* best = NULL;
+    for(size_t i = 0; i<jobs.size(); i++) {
+      Job* job = jobs[i];
+      if(job->nextTask.load(std::memory_order_relaxed) >= job->numTasks)
+        continue;
+      if(best == NULL || job->numWorkersRunning < best->numWorkersRunning)
+        best = job;
+    }
+    return best;
+  }
+
+  void workerLoop(int threadIdx) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+      Job* job = NULL;
+      while(!shouldStop && (job = findJob()) == NULL)
+        workCV.wait(lock);
+      if(shouldStop)
+        return;
+      job->numWorkersRunning++;
+      lock.unlock();
+      runTasks(job,threadIdx);
+      lock.lock();
+      job->numWorkersRunning--;
+      if(job->numWorkersRunning == 0)
+        doneCV.notify_all();
+    }
+  }
+
+  //Calls f(taskIdx,threadIdx) for every taskIdx in [0,n), returning once all have finished.
+  //threadIdx is 0 for the calling thread, else in [1,getNumThreads()) and identifies the worker, for use of
+  //per-thread scratch space.
+  void parallelFor(int n, const std::function<void(int,int)>& f) {
+    if(workers.size() <= 0 || n <= 1) {
+      for(int i = 0; i<n; i++)
+        f(i,0);
+      return;
+    }
+    Job job;
+    job.task = &f;
+    job.numTasks = n;
+    job.nextTask.store(0,std::memory_order_relaxed);
+    job.numWorkersRunning = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(&job);
+    }
+    workCV.notify_all();
+    runTasks(&job,0);
+    //All tasks are started, so no more workers are needed, wait for the ones still finishing theirs
+    std::unique_lock<std::mutex> lock(mutex);
+    jobs.erase(std::find(jobs.begin(),jobs.end(),&job));
+    while(job.numWorkersRunning > 0)
+      doneCV.wait(lock);
+  }
+};
+
+static int getDefaultNumThreads() {
+  int numThreads = (int)std::thread::hardware_concurrency();
+  return std::max(numThreads,1);
+}
+
+static std::mutex sharedPoolMutex;
+static IntraOpThreadPool* sharedPool = NULL;
+static int sharedPoolNumUsers = 0;
+
+//The pool exists while any handle does
+static IntraOpThreadPool* acquireSharedPool() {
+  std::lock_guard<std::mutex> lock(sharedPoolMutex);
+  if(sharedPool == NULL)
+    sharedPool = new IntraOpThreadPool(getDefaultNumThreads());
+  sharedPoolNumUsers++;
+  return sharedPool;
+}
+static void releaseSharedPool() {
+  std::lock_guard<std::mutex> lock(sharedPoolMutex);
+  sharedPoolNumUsers--;
+  if(sharedPoolNumUsers == 0) {
+    delete sharedPool;
+    sharedPool = NULL;
+  }
+}
+
+struct ComputeHandleInternal {
+  IntraOpThreadPool& pool;
+  //Packing scratch space for CPUKernels for the thread using this handle, thread 0 of the pool
+  vector<float> packBuf;
+
+  ComputeHandleInternal()
+    :pool(*acquireSharedPool()),
+     packBuf(CPUKernels::packBufferElts())
+  {}
+  ~ComputeHandleInternal() {
+    releaseSharedPool();
+  }
+
+  ComputeHandleInternal(const ComputeHandleInternal&) = delete;
+  ComputeHandleInternal& operator=(const ComputeHandleInternal&) = delete;
+
+  int getNumThreads() const {
+    return pool.getNumThreads();
+  }
+  float* getPackBuf(int threadIdx) {
+    return threadIdx == 0 ? packBuf.data() : pool.getWorkerPackBuf(threadIdx);
+  }
+};
+
+//--------------------------------------------------------------
+
+//Elementwise and pooling operations, each parallelized over the (batch,channel) planes
+
+static void addPointWise(ComputeHandleInternal* handle, float* acc, const float* values, size_t numFloats, int numPlanes) {
+  size_t planeSize = numFloats / numPlanes;
+  handle->pool.parallelFor(numPlanes, [=](int plane, int threadIdx) {
+    (void)threadIdx;
+    float* a = acc + plane * planeSize;
+    const float* v = values + plane * planeSize;
+    for(size_t i = 0; i<planeSize; i++)
+      a[i] += v[i];
+  });
+}
+
+//buf is N,C,HW and biases is N,C
+static void addChannelBiases(ComputeHandleInternal* handle, int batchSize, int cSize, int xySize, float* buf, const float* biases) {
+  handle->pool.parallelFor(batchSize * cSize, [=](int nc, int threadIdx) {
+    (void)threadIdx;
+    float* plane = buf + (size_t)nc * xySize;
+    float bias = biases[nc];
+    for(int xy = 0; xy<xySize; xy++)
+      plane[xy] += bias;
+  });
+}
+
+static void computeMaskSums(int batchSize, int xySize, const float* mask, float* maskSum) {
+  for(int n = 0; n<batchSize; n++) {
+    float sum = 0.0f;
+    for(int xy = 0; xy<xySize; xy++)
+      sum += mask[n * xySize + xy];
+    maskSum[n] = sum;
+  }
+}
+
+//input is N,C,HW, output is N,3C - mean, mean scaled by board size, and max
+static void gPoolChannels(
+  ComputeHandleInternal* handle, int batchSize, int cSize, int xySize, const float* input, float* output, const float* maskSum
+) {
+  handle->pool.parallelFor(batchSize * cSize, [=](int nc, int threadIdx) {
+    (void)threadIdx;
+    int n = nc / cSize;
+    int c = nc % cSize;
+    const float* plane = input + (size_t)nc * xySize;
+    float sum = 0.0f;
+    float maxValue = 0.0f;
+    for(int xy = 0; xy<xySize; xy++) {
+      sum += plane[xy];
+      maxValue = std::max(maxValue,plane[xy]);
+    }
+    float div = maskSum[n];
+    float sqrtdiv = sqrt(div);
+    float mean = sum / div;
+    float* out = output + (size_t)n * cSize * 3;
+    out[c] = mean;
+    out[c + cSize] = mean * (sqrtdiv - 14.0f) * 0.1f;
+    out[c + cSize * 2] = maxValue;
+  });
+}
+
+//input is N,C,HW, output is N,3C - mean, and mean scaled linearly and quadratically by board size
+static void valueHeadPoolChannels(
+  ComputeHandleInternal* handle, int batchSize, int cSize, int xySize, const float* input, float* output, const float* maskSum
+) {
+  handle->pool.parallelFor(batchSize * cSize, [=](int nc, int threadIdx) {
+    (void)threadIdx;
+    int n = nc / cSize;
+    int c = nc % cSize;
+    const float* plane = input + (size_t)nc * xySize;
+    float sum = 0.0f;
+    for(int xy = 0; xy<xySize; xy++)
+      sum += plane[xy];
+    float div = maskSum[n];
+    float sqrtdiv = sqrt(div);
+    float mean = sum / div;
+    float* out = output + (size_t)n * cSize * 3;
+    out[c] = mean;
+    out[c + cSize] = mean * (sqrtdiv - 14.0f) * 0.1f;
+    out[c + cSize * 2] = mean * ((sqrtdiv - 14.0f) * (sqrtdiv - 14.0f) * 0.01f - 0.1f);
+  });
+}
+
+//Applies each row's symmetry to every HW plane of that row of buf, which is N,C,HW. scratch must be as large as buf.
+//The forward direction mirrors and then transposes, the inverse transposes and then mirrors.
+static void applySymmetriesNCHW(
+  ComputeHandleInternal* handle,
+  const int* symmetries, bool inverse, int batchSize, int cSize, int nnXLen, int nnYLen,
+  float* buf, float* scratch
+) {
+  bool anySymmetry = false;
+  for(int n = 0; n<batchSize; n++)
+    anySymmetry |= symmetries[n] != 0;
+  if(!anySymmetry)
+    return;
+
+  int xySize = nnXLen * nnYLen;
+  handle->pool.parallelFor(batchSize * cSize, [=](int nc, int threadIdx) {
+    (void)threadIdx;
+    int symmetry = symmetries[nc / cSize];
+    bool flipY = (symmetry & 0x1) != 0;
+    bool flipX = (symmetry & 0x2) != 0;
+    bool transpose = (symmetry & 0x4) != 0 && nnXLen == nnYLen;
+    if(!flipY && !flipX && !transpose)
+      return;
+    const float* src = buf + (size_t)nc * xySize;
+    float* dst = scratch + (size_t)nc * xySize;
+    for(int y = 0; y<nnYLen; y++) {
+      for(int x = 0; x<nnXLen; x++) {
+        int srcY;
+        int srcX;
+        if(!transpose) {
+          srcY = flipY ? nnYLen-1-y : y;
+          srcX = flipX ? nnXLen-1-x : x;
+        }
+        else if(!inverse) {
+          srcY = flipY ? nnYLen-1-x : x;
+          srcX = flipX ? nnXLen-1-y : y;
+        }
+        else {
+          srcY = flipX ? nnXLen-1-x : x;
+          srcX = flipY ? nnYLen-1-y : y;
+        }
+        dst[y * nnXLen + x] = src[srcY * nnXLen + srcX];
+      }
+    }
+    std::memcpy(buf + (size_t)nc * xySize, dst, sizeof(float) * xySize);
+  });
+}
+
+//--------------------------------------------------------------
+
+struct ConvLayer {
+  string name;
+  int convYSize;
+  int convXSize;
+  int inChannels;
+  int outChannels;
+  int dilationY;
+  int dilationX;
+  int nnXLen;
+  int nnYLen;
+  vector<float> weights;
+
+  ConvLayer() = delete;
+  ConvLayer(const ConvLayer&) = delete;
+  ConvLayer& operator=(const ConvLayer&) = delete;
+
+  ConvLayer(const ConvLayerDesc* desc, int nnX, int nnY) {
+    name = desc->name;
+    convYSize = desc->convYSize;
+    convXSize = desc->convXSize;
+    inChannels = desc->inChannels;
+    outChannels = desc->outChannels;
+    dilationY = desc->dilationY;
+    dilationX = desc->dilationX;
+    nnXLen = nnX;
+    nnYLen = nnY;
+    weights = desc->weights;
+
+    if(convYSize % 2 != 1 || convXSize % 2 != 1)
+      throw StringError("CPU backend: Conv layer " + name + " has even convolution size, not supported");
+    assert(weights.size() == (size_t)outChannels * inChannels * convYSize * convXSize);
+  }
+
+  //output for batch element n starts at output + n * outputBatchStride, which allows several convolutions to write
+  //different channel ranges of the same buffer.
+  void apply(ComputeHandleInternal* handle, int batchSize, const float* input, float* output, size_t outputBatchStride) const {
+    int xySize = nnXLen * nnYLen;
+    //Split the board into enough column ranges to keep all threads busy even for small batches.
+    //Ranges are multiples of 16 columns, the width of the kernels' register block.
+    int numThreads = handle->getNumThreads();
+    int numChunks = 1;
+    if(numThreads > 1) {
+      int chunksWanted = (numThreads * 4 + batchSize - 1) / batchSize;
+      numChunks = std::max(1, std::min(chunksWanted, (xySize + 15) / 16));
+    }
+    int chunkSize = (xySize + numChunks - 1) / numChunks;
+    chunkSize = (chunkSize + 15) / 16 * 16;
+    numChunks = (xySize + chunkSize - 1) / chunkSize;
+
+    handle->pool.parallelFor(batchSize * numChunks, [&](int taskIdx, int threadIdx) {
+      int n = taskIdx / numChunks;
+      int xyStart = (taskIdx % numChunks) * chunkSize;
+      int xyEnd = std::min(xySize, xyStart + chunkSize);
+      CPUKernels::conv(
+        weights.data(), inChannels, outChannels,
+        convYSize, convXSize, dilationY, dilationX,
+        nnYLen, nnXLen,
+        input + (size_t)n * inChannels * xySize,
+        output + (size_t)n * outputBatchStride,
+        xyStart, xyEnd,
+        handle->getPackBuf(threadIdx)
+      );
+    });
+  }
+
+  void apply(ComputeHandleInternal* handle, int batchSize, const float* input, float* output) const {
+    apply(handle, batchSize, input, output, (size_t)outChannels * nnXLen * nnYLen);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct BatchNormLayer {
+  string name;
+  int numChannels;
+  int nnXLen;
+  int nnYLen;
+  vector<float> mergedScale;
+  vector<float> mergedBias;
+
+  BatchNormLayer() = delete;
+  BatchNormLayer(const BatchNormLayer&) = delete;
+  BatchNormLayer& operator=(const BatchNormLayer&) = delete;
+
+  BatchNormLayer(const BatchNormLayerDesc* desc, int nnX, int nnY) {
+    name = desc->name;
+    numChannels = desc->numChannels;
+    nnXLen = nnX;
+    nnYLen = nnY;
+
+    float epsilon = desc->epsilon;
+    mergedScale.resize(numChannels);
+    mergedBias.resize(numChannels);
+    for(int i = 0; i<numChannels; i++) {
+      mergedScale[i] = desc->scale[i] / sqrt(desc->variance[i] + epsilon);
+      mergedBias[i] = desc->bias[i] - mergedScale[i] * desc->mean[i];
+    }
+  }
+
+  //input and output may be the same buffer
+  void apply(ComputeHandleInternal* handle, int batchSize, bool applyRelu, const float* input, float* output, const float* mask) const {
+    int xySize = nnXLen * nnYLen;
+    int cSize = numChannels;
+    handle->pool.parallelFor(batchSize * cSize, [=](int nc, int threadIdx) {
+      (void)threadIdx;
+      int n = nc / cSize;
+      int c = nc % cSize;
+      const float* in = input + (size_t)nc * xySize;
+      float* out = output + (size_t)nc * xySize;
+      const float* m = mask + (size_t)n * xySize;
+      float scale = mergedScale[c];
+      float bias = mergedBias[c];
+      if(applyRelu) {
+        for(int xy = 0; xy<xySize; xy++)
+          out[xy] = std::max(in[xy] * scale + bias, 0.0f) * m[xy];
+      }
+      else {
+        for(int xy = 0; xy<xySize; xy++)
+          out[xy] = (in[xy] * scale + bias) * m[xy];
+      }
+    });
+  }
+};
+
+//--------------------------------------------------------------
+
+struct MatMulLayer {
+  string name;
+  int inChannels;
+  int outChannels;
+  vector<float> weights;
+
+  MatMulLayer() = delete;
+  MatMulLayer(const MatMulLayer&) = delete;
+  MatMulLayer& operator=(const MatMulLayer&) = delete;
+
+  MatMulLayer(const MatMulLayerDesc* desc) {
+    name = desc->name;
+    inChannels = desc->inChannels;
+    outChannels = desc->outChannels;
+    weights = desc->weights;
+    assert(weights.size() == (size_t)inChannels * outChannels);
+  }
+
+  //input is N,inChannels, output is N,outChannels. Small enough that it isn't worth splitting across threads.
+  void apply(ComputeHandleInternal* handle, int batchSize, const float* input, float* output) const {
+    CPUKernels::gemm(
+      batchSize, outChannels, inChannels,
+      input, inChannels,
+      weights.data(), outChannels,
+      output, outChannels,
+      false,
+      handle->getPackBuf(0)
+    );
+  }
+};
+
+//--------------------------------------------------------------
+
+struct MatBiasLayer {
+  string name;
+  int numChannels;
+  vector<float> biases;
+
+  MatBiasLayer() = delete;
+  MatBiasLayer(const MatBiasLayer&) = delete;
+  MatBiasLayer& operator=(const MatBiasLayer&) = delete;
+
+  MatBiasLayer(const MatBiasLayerDesc* desc) {
+    name = desc->name;
+    numChannels = desc->numChannels;
+    biases = desc->weights;
+  }
+
+  void apply(int batchSize, bool applyRelu, float* buf) const {
+    for(int n = 0; n<batchSize; n++) {
+      float* row = buf + (size_t)n * numChannels;
+      for(int c = 0; c<numChannels; c++) {
+        row[c] += biases[c];
+        if(applyRelu)
+          row[c] = std::max(row[c],0.0f);
+      }
+    }
+  }
+};
+
+//--------------------------------------------------------------
+
+struct ResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  int nnXLen;
+  int nnYLen;
+  int regularChannels;
+  int trunkChannels;
+
+  ResidualBlock() = delete;
+  ResidualBlock(const ResidualBlock&) = delete;
+  ResidualBlock& operator=(const ResidualBlock&) = delete;
+
+  ResidualBlock(const ResidualBlockDesc* desc, int nnX, int nnY)
+    :name(desc->name),
+     preBN(&desc->preBN,nnX,nnY),
+     regularConv(&desc->regularConv,nnX,nnY),
+     midBN(&desc->midBN,nnX,nnY),
+     finalConv(&desc->finalConv,nnX,nnY),
+     nnXLen(nnX),
+     nnYLen(nnY),
+     regularChannels(desc->regularConv.outChannels),
+     trunkChannels(desc->preBN.numChannels)
+  {
+  }
+
+  void apply(
+    ComputeHandleInternal* handle,
+    int batchSize,
+    float* trunk,
+    float* trunkScratch,
+    float* mid,
+    float* midScratch,
+    const float* mask
+  ) const {
+    preBN.apply(handle,batchSize,true,trunk,trunkScratch,mask);
+    regularConv.apply(handle,batchSize,trunkScratch,mid);
+    midBN.apply(handle,batchSize,true,mid,midScratch,mask);
+    finalConv.apply(handle,batchSize,midScratch,trunkScratch);
+    addPointWise(handle, trunk, trunkScratch, (size_t)batchSize * trunkChannels * nnXLen * nnYLen, batchSize * trunkChannels);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct DilatedResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  ConvLayer dilatedConv;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  int nnXLen;
+  int nnYLen;
+  int regularChannels;
+  int dilatedChannels;
+  int trunkChannels;
+
+  DilatedResidualBlock() = delete;
+  DilatedResidualBlock(const DilatedResidualBlock&) = delete;
+  DilatedResidualBlock& operator=(const DilatedResidualBlock&) = delete;
+
+  DilatedResidualBlock(const DilatedResidualBlockDesc* desc, int nnX, int nnY)
+    :name(desc->name),
+     preBN(&desc->preBN,nnX,nnY),
+     regularConv(&desc->regularConv,nnX,nnY),
+     dilatedConv(&desc->dilatedConv,nnX,nnY),
+     midBN(&desc->midBN,nnX,nnY),
+     finalConv(&desc->finalConv,nnX,nnY),
+     nnXLen(nnX),
+     nnYLen(nnY),
+     regularChannels(desc->regularConv.outChannels),
+     dilatedChannels(desc->dilatedConv.outChannels),
+     trunkChannels(desc->preBN.numChannels)
+  {
+  }
+
+  void apply(
+    ComputeHandleInternal* handle,
+    int batchSize,
+    float* trunk,
+    float* trunkScratch,
+    float* mid,
+    float* midScratch,
+    const float* mask
+  ) const {
+    int xySize = nnXLen * nnYLen;
+    size_t midBatchStride = (size_t)(regularChannels + dilatedChannels) * xySize;
+    preBN.apply(handle,batchSize,true,trunk,trunkScratch,mask);
+    //Both convolutions write directly into their channels of the concatenated mid buffer
+    regularConv.apply(handle,batchSize,trunkScratch,mid,midBatchStride);
+    dilatedConv.apply(handle,batchSize,trunkScratch,mid + (size_t)regularChannels * xySize,midBatchStride);
+    midBN.apply(handle,batchSize,true,mid,midScratch,mask);
+    finalConv.apply(handle,batchSize,midScratch,trunkScratch);
+    addPointWise(handle, trunk, trunkScratch, (size_t)batchSize * trunkChannels * xySize, batchSize * trunkChannels);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct GlobalPoolingResidualBlock {
+  string name;
+  BatchNormLayer preBN;
+  ConvLayer regularConv;
+  ConvLayer gpoolConv;
+  BatchNormLayer gpoolBN;
+  MatMulLayer gpoolToBiasMul;
+  BatchNormLayer midBN;
+  ConvLayer finalConv;
+
+  int nnXLen;
+  int nnYLen;
+  int regularChannels;
+  int gpoolChannels;
+  int trunkChannels;
+
+  GlobalPoolingResidualBlock() = delete;
+  GlobalPoolingResidualBlock(const GlobalPoolingResidualBlock&) = delete;
+  GlobalPoolingResidualBlock& operator=(const GlobalPoolingResidualBlock&) = delete;
+
+  GlobalPoolingResidualBlock(const GlobalPoolingResidualBlockDesc* desc, int nnX, int nnY)
+    :name(desc->name),
+     preBN(&desc->preBN,nnX,nnY),
+     regularConv(&desc->regularConv,nnX,nnY),
+     gpoolConv(&desc->gpoolConv,nnX,nnY),
+     gpoolBN(&desc->gpoolBN,nnX,nnY),
+     gpoolToBiasMul(&desc->gpoolToBiasMul),
+     midBN(&desc->midBN,nnX,nnY),
+     finalConv(&desc->finalConv,nnX,nnY),
+     nnXLen(nnX),
+     nnYLen(nnY),
+     regularChannels(desc->regularConv.outChannels),
+     gpoolChannels(desc->gpoolConv.outChannels),
+     trunkChannels(desc->preBN.numChannels)
+  {
+  }
+
+  void apply(
+    ComputeHandleInternal* handle,
+    int batchSize,
+    float* trunk,
+    float* trunkScratch,
+    float* mid,
+    float* midScratch,
+    float* gpoolOut,
+    float* gpoolOut2,
+    float* gpoolConcat,
+    float* gpoolBias,
+    const float* mask,
+    const float* maskSum
+  ) const {
+    int xySize = nnXLen * nnYLen;
+    preBN.apply(handle,batchSize,true,trunk,trunkScratch,mask);
+    regularConv.apply(handle,batchSize,trunkScratch,mid);
+    gpoolConv.apply(handle,batchSize,trunkScratch,gpoolOut);
+    gpoolBN.apply(handle,batchSize,true,gpoolOut,gpoolOut2,mask);
+    gPoolChannels(handle,batchSize,gpoolChannels,xySize,gpoolOut2,gpoolConcat,maskSum);
+    gpoolToBiasMul.apply(handle,batchSize,gpoolConcat,gpoolBias);
+    addChannelBiases(handle,batchSize,regularChannels,xySize,mid,gpoolBias);
+    midBN.apply(handle,batchSize,true,mid,midScratch,mask);
+    finalConv.apply(handle,batchSize,midScratch,trunkScratch);
+    addPointWise(handle, trunk, trunkScratch, (size_t)batchSize * trunkChannels * xySize, batchSize * trunkChannels);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct Trunk {
+  string name;
+  int version;
+  int numBlocks;
+  int trunkNumChannels;
+  int midNumChannels;
+  int regularNumChannels;
+  int dilatedNumChannels;
+  int gpoolNumChannels;
+
+  int maxBatchSize;
+  int nnXLen;
+  int nnYLen;
+
+  ConvLayer initialConv;
+  MatMulLayer initialMatMul;
+  vector<pair<int,void*>> blocks;
+  BatchNormLayer trunkTipBN;
+
+  Trunk() = delete;
+  Trunk(const Trunk&) = delete;
+  Trunk& operator=(const Trunk&) = delete;
+
+  Trunk(const TrunkDesc* desc, int maxBatchSz, int nnX, int nnY)
+    :name(desc->name),
+     version(desc->version),
+     numBlocks(desc->numBlocks),
+     trunkNumChannels(desc->trunkNumChannels),
+     midNumChannels(desc->midNumChannels),
+     regularNumChannels(desc->regularNumChannels),
+     dilatedNumChannels(desc->dilatedNumChannels),
+     gpoolNumChannels(desc->gpoolNumChannels),
+     maxBatchSize(maxBatchSz),
+     nnXLen(nnX),
+     nnYLen(nnY),
+     initialConv(&desc->initialConv,nnX,nnY),
+     initialMatMul(&desc->initialMatMul),
+     blocks(),
+     trunkTipBN(&desc->trunkTipBN,nnX,nnY)
+  {
+    for(int i = 0; i<numBlocks; i++) {
+      if(desc->blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlockDesc* blockDesc = (ResidualBlockDesc*)desc->blocks[i].second;
+        ResidualBlock* block = new ResidualBlock(blockDesc,nnXLen,nnYLen);
+        blocks.push_back(make_pair(ORDINARY_BLOCK_KIND,(void*)block));
+      }
+      else if(desc->blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlockDesc* blockDesc = (DilatedResidualBlockDesc*)desc->blocks[i].second;
+        DilatedResidualBlock* block = new DilatedResidualBlock(blockDesc,nnXLen,nnYLen);
+        blocks.push_back(make_pair(DILATED_BLOCK_KIND,(void*)block));
+      }
+      else if(desc->blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlockDesc* blockDesc = (GlobalPoolingResidualBlockDesc*)desc->blocks[i].second;
+        GlobalPoolingResidualBlock* block = new GlobalPoolingResidualBlock(blockDesc,nnXLen,nnYLen);
+        blocks.push_back(make_pair(GLOBAL_POOLING_BLOCK_KIND,(void*)block));
+      }
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+  }
+
+  ~Trunk() {
+    for(int i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlock* block = (ResidualBlock*)blocks[i].second;
+        delete block;
+      }
+      else if(blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlock* block = (DilatedResidualBlock*)blocks[i].second;
+        delete block;
+      }
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlock* block = (GlobalPoolingResidualBlock*)blocks[i].second;
+        delete block;
+      }
+    }
+  }
+
+  //Leaves the final output of the trunk in trunk
+  void apply(
+    ComputeHandleInternal* handle,
+    int batchSize,
+    const float* input,
+    const float* inputGlobal,
+    float* trunk,
+    float* trunkScratch,
+    float* mid,
+    float* midScratch,
+    float* gpoolOut,
+    float* gpoolOut2,
+    float* gpoolConcat,
+    float* gpoolBias,
+    const float* mask,
+    const float* maskSum
+  ) const {
+    int xySize = nnXLen * nnYLen;
+    initialConv.apply(handle,batchSize,input,trunk);
+    initialMatMul.apply(handle,batchSize,inputGlobal,gpoolBias);
+    addChannelBiases(handle,batchSize,trunkNumChannels,xySize,trunk,gpoolBias);
+
+    for(int i = 0; i<blocks.size(); i++) {
+      if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+        ResidualBlock* block = (ResidualBlock*)blocks[i].second;
+        block->apply(handle,batchSize,trunk,trunkScratch,mid,midScratch,mask);
+      }
+      else if(blocks[i].first == DILATED_BLOCK_KIND) {
+        DilatedResidualBlock* block = (DilatedResidualBlock*)blocks[i].second;
+        block->apply(handle,batchSize,trunk,trunkScratch,mid,midScratch,mask);
+      }
+      else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+        GlobalPoolingResidualBlock* block = (GlobalPoolingResidualBlock*)blocks[i].second;
+        block->apply(handle,batchSize,trunk,trunkScratch,mid,midScratch,gpoolOut,gpoolOut2,gpoolConcat,gpoolBias,mask,maskSum);
+      }
+      else {
+        ASSERT_UNREACHABLE;
+      }
+    }
+
+    trunkTipBN.apply(handle,batchSize,true,trunk,trunk,mask);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct PolicyHead {
+  string name;
+  int version;
+  int nnXLen;
+  int nnYLen;
+  int p1Channels;
+  int g1Channels;
+  int p2Channels;
+
+  ConvLayer p1Conv;
+  ConvLayer g1Conv;
+  BatchNormLayer g1BN;
+  MatMulLayer gpoolToBiasMul;
+  BatchNormLayer p1BN;
+  ConvLayer p2Conv;
+  MatMulLayer gpoolToPassMul;
+
+  PolicyHead() = delete;
+  PolicyHead(const PolicyHead&) = delete;
+  PolicyHead& operator=(const PolicyHead&) = delete;
+
+  PolicyHead(const PolicyHeadDesc* desc, int nnX, int nnY)
+    :name(desc->name),
+     version(desc->version),
+     nnXLen(nnX),
+     nnYLen(nnY),
+     p1Channels(desc->p1Conv.outChannels),
+     g1Channels(desc->g1Conv.outChannels),
+     p2Channels(desc->p2Conv.outChannels),
+     p1Conv(&desc->p1Conv,nnX,nnY),
+     g1Conv(&desc->g1Conv,nnX,nnY),
+     g1BN(&desc->g1BN,nnX,nnY),
+     gpoolToBiasMul(&desc->gpoolToBiasMul),
+     p1BN(&desc->p1BN,nnX,nnY),
+     p2Conv(&desc->p2Conv,nnX,nnY),
+     gpoolToPassMul(&desc->gpoolToPassMul)
+  {
+  }
+
+  void apply(
+    ComputeHandleInternal* handle,
+    const int* symmetriesBuffer,
+    int batchSize,
+    const float* mask,
+    const float* maskSum,
+    const float* trunk,
+    float* p1Out,
+    float* p1Out2,
+    float* g1Out,
+    float* g1Out2,
+    float* g1Concat,
+    float* g1Bias,
+    float* p2Out,
+    float* policyPass,
+    float* policy
+  ) const {
+    int xySize = nnXLen * nnYLen;
+    p1Conv.apply(handle,batchSize,trunk,p1Out);
+    g1Conv.apply(handle,batchSize,trunk,g1Out);
+    g1BN.apply(handle,batchSize,true,g1Out,g1Out2,mask);
+    gPoolChannels(handle,batchSize,g1Channels,xySize,g1Out2,g1Concat,maskSum);
+    gpoolToBiasMul.apply(handle,batchSize,g1Concat,g1Bias);
+    addChannelBiases(handle,batchSize,p1Channels,xySize,p1Out,g1Bias);
+    p1BN.apply(handle,batchSize,true,p1Out,p1Out2,mask);
+    p2Conv.apply(handle,batchSize,p1Out2,policy);
+
+    bool inverse = true;
+    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, p2Channels, nnXLen, nnYLen, policy, p2Out);
+
+    gpoolToPassMul.apply(handle,batchSize,g1Concat,policyPass);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct ValueHead {
+  string name;
+  int version;
+  int nnXLen;
+  int nnYLen;
+  int v1Channels;
+  int v2Channels;
+  int valueChannels;
+  int scoreValueChannels;
+  int ownershipChannels;
+
+  ConvLayer v1Conv;
+  BatchNormLayer v1BN;
+  MatMulLayer v2Mul;
+  MatBiasLayer v2Bias;
+  MatMulLayer v3Mul;
+  MatBiasLayer v3Bias;
+  MatMulLayer sv3Mul;
+  MatBiasLayer sv3Bias;
+  ConvLayer vOwnershipConv;
+
+  ValueHead() = delete;
+  ValueHead(const ValueHead&) = delete;
+  ValueHead& operator=(const ValueHead&) = delete;
+
+  ValueHead(const ValueHeadDesc* desc, int nnX, int nnY)
+    :name(desc->name),
+     version(desc->version),
+     nnXLen(nnX),
+     nnYLen(nnY),
+     v1Channels(desc->v1Conv.outChannels),
+     v2Channels(desc->v2Mul.outChannels),
+     valueChannels(desc->v3Mul.outChannels),
+     scoreValueChannels(desc->sv3Mul.outChannels),
+     ownershipChannels(desc->vOwnershipConv.outChannels),
+     v1Conv(&desc->v1Conv,nnX,nnY),
+     v1BN(&desc->v1BN,nnX,nnY),
+     v2Mul(&desc->v2Mul),
+     v2Bias(&desc->v2Bias),
+     v3Mul(&desc->v3Mul),
+     v3Bias(&desc->v3Bias),
+     sv3Mul(&desc->sv3Mul),
+     sv3Bias(&desc->sv3Bias),
+     vOwnershipConv(&desc->vOwnershipConv,nnX,nnY)
+  {
+  }
+
+  void apply(
+    ComputeHandleInternal* handle,
+    const int* symmetriesBuffer,
+    int batchSize,
+    const float* mask,
+    const float* maskSum,
+    const float* trunk,
+    float* v1Out,
+    float* v1Out2,
+    float* v1Mean,
+    float* v2Out,
+    float* value,
+    float* scoreValue,
+    float* ownership,
+    float* ownershipScratch
+  ) const {
+    int xySize = nnXLen * nnYLen;
+    v1Conv.apply(handle,batchSize,trunk,v1Out);
+    v1BN.apply(handle,batchSize,true,v1Out,v1Out2,mask);
+    valueHeadPoolChannels(handle,batchSize,v1Channels,xySize,v1Out2,v1Mean,maskSum);
+    v2Mul.apply(handle,batchSize,v1Mean,v2Out);
+    v2Bias.apply(batchSize,true,v2Out);
+    v3Mul.apply(handle,batchSize,v2Out,value);
+    v3Bias.apply(batchSize,false,value);
+    sv3Mul.apply(handle,batchSize,v2Out,scoreValue);
+    sv3Bias.apply(batchSize,false,scoreValue);
+
+    vOwnershipConv.apply(handle,batchSize,v1Out2,ownership);
+    bool inverse = true;
+    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, ownershipChannels, nnXLen, nnYLen, ownership, ownershipScratch);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct Model {
+  string name;
+  int version;
+  int maxBatchSize;
+  int nnXLen;
+  int nnYLen;
+  int numInputChannels;
+  int numInputGlobalChannels;
+  int numValueChannels;
+  int numScoreValueChannels;
+  int numOwnershipChannels;
+
+  Trunk* trunk;
+  PolicyHead* policyHead;
+  ValueHead* valueHead;
+
+  Model() = delete;
+  Model(const Model&) = delete;
+  Model& operator=(const Model&) = delete;
+
+  Model(const ModelDesc* desc, int maxBatchSz, int nnX, int nnY) {
+    name = desc->name;
+    version = desc->version;
+    maxBatchSize = maxBatchSz;
+
+    nnXLen = nnX;
+    nnYLen = nnY;
+    if(nnXLen > NNPos::MAX_BOARD_LEN)
+      throw StringError(Global::strprintf("nnXLen (%d) is greater than NNPos::MAX_BOARD_LEN (%d)",
+        nnXLen, NNPos::MAX_BOARD_LEN
+      ));
+    if(nnYLen > NNPos::MAX_BOARD_LEN)
+      throw StringError(Global::strprintf("nnYLen (%d) is greater than NNPos::MAX_BOARD_LEN (%d)",
+        nnYLen, NNPos::MAX_BOARD_LEN
+      ));
+    if(version < 3)
+      throw StringError("CPU backend: neural net versions below 3 are not supported, got version " + Global::intToString(version));
+
+    numInputChannels = desc->numInputChannels;
+    numInputGlobalChannels = desc->numInputGlobalChannels;
+    numValueChannels = desc->numValueChannels;
+    numScoreValueChannels = desc->numScoreValueChannels;
+    numOwnershipChannels = desc->numOwnershipChannels;
+
+    int numFeatures = NNModelVersion::getNumSpatialFeatures(version);
+    if(numInputChannels != numFeatures)
+      throw StringError(Global::strprintf("Neural net numInputChannels (%d) was not the expected number based on version (%d)",
+        numInputChannels, numFeatures
+      ));
+    int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(version);
+    if(numInputGlobalChannels != numGlobalFeatures)
+      throw StringError(Global::strprintf("Neural net numInputGlobalChannels (%d) was not the expected number based on version (%d)",
+        numInputGlobalChannels, numGlobalFeatures
+      ));
+
+    trunk = new Trunk(&desc->trunk,maxBatchSize,nnXLen,nnYLen);
+    policyHead = new PolicyHead(&desc->policyHead,nnXLen,nnYLen);
+    valueHead = new ValueHead(&desc->valueHead,nnXLen,nnYLen);
+  }
+
+  ~Model()
+  {
+    delete valueHead;
+    delete policyHead;
+    delete trunk;
+  }
+};
+
+//--------------------------------------------------------------
+
+struct Buffers {
+  vector<float> input;
+  vector<float> inputScratch;
+  vector<float> inputGlobal;
+
+  vector<float> mask;
+  vector<float> maskSum;
+
+  vector<float> trunk;
+  vector<float> trunkScratch;
+  vector<float> mid;
+  vector<float> midScratch;
+  vector<float> gpoolOut;
+  vector<float> gpoolOut2;
+  vector<float> gpoolConcat;
+  vector<float> gpoolBias;
+
+  vector<float> p1Out;
+  vector<float> p1Out2;
+  vector<float> p2Out;
+  vector<float> policyPass;
+  vector<float> policy;
+
+  vector<float> v1Out;
+  vector<float> v1Out2;
+  vector<float> v1Mean;
+  vector<float> v2Out;
+  vector<float> value;
+  vector<float> scoreValue;
+  vector<float> ownership;
+  vector<float> ownershipScratch;
+
+  Buffers() = delete;
+  Buffers(const Buffers&) = delete;
+  Buffers& operator=(const Buffers&) = delete;
+
+  Buffers(const Model& m) {
+    size_t batchXYElts = (size_t)m.maxBatchSize * m.nnXLen * m.nnYLen;
+    size_t batchElts = (size_t)m.maxBatchSize;
+
+    input.resize(m.numInputChannels * batchXYElts);
+    inputScratch.resize(m.numInputChannels * batchXYElts);
+    inputGlobal.resize(m.numInputGlobalChannels * batchElts);
+
+    mask.resize(batchXYElts);
+    maskSum.resize(batchElts);
+
+    const Trunk& t = *(m.trunk);
+    const PolicyHead& p = *(m.policyHead);
+    const ValueHead& v = *(m.valueHead);
+
+    int maxMidChannels = std::max(t.midNumChannels, std::max(t.regularNumChannels + t.dilatedNumChannels, t.regularNumChannels));
+    int maxGPoolChannels = std::max(t.gpoolNumChannels, p.g1Channels);
+    int maxBiasChannels = std::max(t.trunkNumChannels, std::max(t.regularNumChannels, p.p1Channels));
+
+    trunk.resize(t.trunkNumChannels * batchXYElts);
+    trunkScratch.resize(t.trunkNumChannels * batchXYElts);
+    mid.resize(maxMidChannels * batchXYElts);
+    midScratch.resize(maxMidChannels * batchXYElts);
+    gpoolOut.resize(maxGPoolChannels * batchXYElts);
+    gpoolOut2.resize(maxGPoolChannels * batchXYElts);
+    gpoolConcat.resize(maxGPoolChannels * 3 * batchElts);
+    gpoolBias.resize(maxBiasChannels * batchElts);
+
+    p1Out.resize(p.p1Channels * batchXYElts);
+    p1Out2.resize(p.p1Channels * batchXYElts);
+    p2Out.resize(p.p2Channels * batchXYElts);
+    policyPass.resize(batchElts);
+    policy.resize(p.p2Channels * batchXYElts);
+
+    v1Out.resize(v.v1Channels * batchXYElts);
+    v1Out2.resize(v.v1Channels * batchXYElts);
+    v1Mean.resize(v.v1Channels * 3 * batchElts);
+    v2Out.resize(v.v2Channels * batchElts);
+    value.resize(v.valueChannels * batchElts);
+    scoreValue.resize(v.scoreValueChannels * batchElts);
+    ownership.resize(v.ownershipChannels * batchXYElts);
+    ownershipScratch.resize(v.ownershipChannels * batchXYElts);
+  }
+};
+
+//--------------------------------------------------------------
+
+struct ComputeHandle {
+  ComputeHandleInternal* handle;
+  Model* model;
+  Buffers* buffers;
+  int nnXLen;
+  int nnYLen;
+  int policySize;
+  bool inputsUseNHWC;
+
+  ComputeHandle(const LoadedModel* loadedModel, int maxBatchSize, int nnX, int nnY, bool inputsNHWC) {
+    handle = new ComputeHandleInternal();
+    model = new Model(&(loadedModel->modelDesc), maxBatchSize, nnX, nnY);
+    buffers = new Buffers(*model);
+    nnXLen = nnX;
+    nnYLen = nnY;
+    policySize = NNPos::getPolicySize(nnXLen, nnYLen);
+    inputsUseNHWC = inputsNHWC;
+  }
+
+  ~ComputeHandle() {
+    delete buffers;
+    delete model;
+    delete handle;
+  }
+
+  ComputeHandle() = delete;
+  ComputeHandle(const ComputeHandle&) = delete;
+  ComputeHandle& operator=(const ComputeHandle&) = delete;
+};
+
+ComputeHandle* NeuralNet::createComputeHandle(
+  ComputeContext* context,
+  const LoadedModel* loadedModel,
+  Logger* logger,
+  int maxBatchSize,
+  int nnXLen,
+  int nnYLen,
+  bool requireExactNNLen,
+  bool inputsUseNHWC,
+  int gpuIdxForThisThread,
+  bool useFP16,
+  bool useNHWC
+) {
+  (void)context;
+  (void)gpuIdxForThisThread;
+  //Current implementation always tolerates excess nn len
+  (void)requireExactNNLen;
+
+  if(useNHWC != false)
+    throw StringError("CPU backend: useNHWC = false required, other configurations not supported");
+  if(useFP16 != false)
+    throw StringError("CPU backend: useFP16 = false required, other configurations not supported");
+
+  ComputeHandle* handle = new ComputeHandle(loadedModel,maxBatchSize,nnXLen,nnYLen,inputsUseNHWC);
+  if(logger != NULL) {
+    logger->write("CPU backend: Model version " + Global::intToString(loadedModel->modelDesc.version));
+    logger->write(
+      "CPU backend: Using " + Global::intToString(handle->handle->getNumThreads()) +
+      " threads shared by all server threads, " + CPUKernels::getImplementationName() + " kernels"
+    );
+  }
+  return handle;
+}
+
+void NeuralNet::freeComputeHandle(ComputeHandle* handle) {
+  delete handle;
+}
+
+//--------------------------------------------------------------
+
+struct InputBuffers {
+  int maxBatchSize;
+
+  size_t singleInputElts;
+  size_t singleInputGlobalElts;
+
+  size_t userInputBufferElts;
+  size_t userInputGlobalBufferElts;
+
+  float* userInputBuffer;
+  float* userInputGlobalBuffer;
+  int* symmetriesBuffer;
+
+  InputBuffers(const LoadedModel* loadedModel, int maxBatchSz, int nnXLen, int nnYLen) {
+    const ModelDesc& m = loadedModel->modelDesc;
+
+    maxBatchSize = maxBatchSz;
+    singleInputElts = (size_t)m.numInputChannels * nnXLen * nnYLen;
+    singleInputGlobalElts = (size_t)m.numInputGlobalChannels;
+
+    assert(NNModelVersion::getNumSpatialFeatures(m.version) == m.numInputChannels);
+    assert(NNModelVersion::getNumGlobalFeatures(m.version) == m.numInputGlobalChannels);
+
+    userInputBufferElts = singleInputElts * maxBatchSize;
+    userInputGlobalBufferElts = singleInputGlobalElts * maxBatchSize;
+
+    userInputBuffer = new float[userInputBufferElts];
+    userInputGlobalBuffer = new float[userInputGlobalBufferElts];
+    symmetriesBuffer = new int[maxBatchSize];
+    std::fill(symmetriesBuffer, symmetriesBuffer + maxBatchSize, 0);
+  }
+
+  ~InputBuffers() {
+    delete[] userInputBuffer;
+    delete[] userInputGlobalBuffer;
+    delete[] symmetriesBuffer;
+  }
+
+  InputBuffers() = delete;
+  InputBuffers(const InputBuffers&) = delete;
+  InputBuffers& operator=(const InputBuffers&) = delete;
+
+};
+
+InputBuffers* NeuralNet::createInputBuffers(const LoadedModel* loadedModel, int maxBatchSize, int nnXLen, int nnYLen) {
+  return new InputBuffers(loadedModel,maxBatchSize,nnXLen,nnYLen);
+}
+void NeuralNet::freeInputBuffers(InputBuffers* inputBuffers) {
+  delete inputBuffers;
+}
+
+float* NeuralNet::getBatchEltSpatialInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->userInputBuffer + (inputBuffers->singleInputElts * nIdx);
+}
+
+float* NeuralNet::getBatchEltGlobalInplace(InputBuffers* inputBuffers, int nIdx) {
+  assert(nIdx < inputBuffers->maxBatchSize);
+  return inputBuffers->userInputGlobalBuffer + (inputBuffers->singleInputGlobalElts * nIdx);
+}
+
+int NeuralNet::getBatchEltSpatialLen(const InputBuffers* inputBuffers) {
+  return inputBuffers->singleInputElts;
+}
+int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
+  return inputBuffers->singleInputGlobalElts;
+}
+
+int* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
+  return inputBuffers->symmetriesBuffer;
+}
+
+//--------------------------------------------------------------
+
+void NeuralNet::getOutput(
+  ComputeHandle* computeHandle,
+  InputBuffers* inputBuffers,
+  int numBatchEltsFilled,
+  vector<NNOutput*>& outputs
+) {
+  assert(numBatchEltsFilled <= inputBuffers->maxBatchSize);
+  assert(numBatchEltsFilled > 0);
+  int batchSize = numBatchEltsFilled;
+  int nnXLen = computeHandle->nnXLen;
+  int nnYLen = computeHandle->nnYLen;
+  int xySize = nnXLen * nnYLen;
+  int version = computeHandle->model->version;
+  const Model* model = computeHandle->model;
+  Buffers* buffers = computeHandle->buffers;
+  ComputeHandleInternal* handle = computeHandle->handle;
+
+  assert(inputBuffers->userInputBufferElts == buffers->input.size());
+  assert(inputBuffers->userInputGlobalBufferElts == buffers->inputGlobal.size());
+
+  int numInputChannels = model->numInputChannels;
+  if(computeHandle->inputsUseNHWC) {
+    const float* src = inputBuffers->userInputBuffer;
+    float* dst = buffers->input.data();
+    handle->pool.parallelFor(batchSize, [=](int n, int threadIdx) {
+      (void)threadIdx;
+      const float* s = src + (size_t)n * numInputChannels * xySize;
+      float* d = dst + (size_t)n * numInputChannels * xySize;
+      for(int xy = 0; xy<xySize; xy++)
+        for(int c = 0; c<numInputChannels; c++)
+          d[c * xySize + xy] = s[xy * numInputChannels + c];
+    });
+  }
+  else {
+    std::copy(
+      inputBuffers->userInputBuffer,
+      inputBuffers->userInputBuffer + inputBuffers->singleInputElts * batchSize,
+      buffers->input.data()
+    );
+  }
+  std::copy(
+    inputBuffers->userInputGlobalBuffer,
+    inputBuffers->userInputGlobalBuffer + inputBuffers->singleInputGlobalElts * batchSize,
+    buffers->inputGlobal.data()
+  );
+
+  const int* symmetriesBuffer = inputBuffers->symmetriesBuffer;
+  bool inverse = false;
+  applySymmetriesNCHW(
+    handle, symmetriesBuffer, inverse, batchSize, numInputChannels, nnXLen, nnYLen, buffers->input.data(), buffers->inputScratch.data()
+  );
+
+  //The mask is the on-board feature, channel 0 of the input
+  for(int n = 0; n<batchSize; n++) {
+    const float* channel0 = buffers->input.data() + (size_t)n * numInputChannels * xySize;
+    std::copy(channel0, channel0 + xySize, buffers->mask.data() + (size_t)n * xySize);
+  }
+  computeMaskSums(batchSize, xySize, buffers->mask.data(), buffers->maskSum.data());
+
+  model->trunk->apply(
+    handle,
+    batchSize,
+    buffers->input.data(),
+    buffers->inputGlobal.data(),
+    buffers->trunk.data(),
+    buffers->trunkScratch.data(),
+    buffers->mid.data(),
+    buffers->midScratch.data(),
+    buffers->gpoolOut.data(),
+    buffers->gpoolOut2.data(),
+    buffers->gpoolConcat.data(),
+    buffers->gpoolBias.data(),
+    buffers->mask.data(),
+    buffers->maskSum.data()
+  );
+  model->policyHead->apply(
+    handle,
+    symmetriesBuffer,
+    batchSize,
+    buffers->mask.data(),
+    buffers->maskSum.data(),
+    buffers->trunk.data(),
+    buffers->p1Out.data(),
+    buffers->p1Out2.data(),
+    buffers->gpoolOut.data(),
+    buffers->gpoolOut2.data(),
+    buffers->gpoolConcat.data(),
+    buffers->gpoolBias.data(),
+    buffers->p2Out.data(),
+    buffers->policyPass.data(),
+    buffers->policy.data()
+  );
+  model->valueHead->apply(
+    handle,
+    symmetriesBuffer,
+    batchSize,
+    buffers->mask.data(),
+    buffers->maskSum.data(),
+    buffers->trunk.data(),
+    buffers->v1Out.data(),
+    buffers->v1Out2.data(),
+    buffers->v1Mean.data(),
+    buffers->v2Out.data(),
+    buffers->value.data(),
+    buffers->scoreValue.data(),
+    buffers->ownership.data(),
+    buffers->ownershipScratch.data()
+  );
+
+  assert(outputs.size() == batchSize);
+
+  for(int row = 0; row < batchSize; row++) {
+    NNOutput* output = outputs[row];
+    assert(output->nnXLen == nnXLen);
+    assert(output->nnYLen == nnYLen);
+
+    float* policyProbs = output->policyProbs;
+
+    //These are not actually correct, the client does the postprocessing to turn them into
+    //policy probabilities and white game outcome probabilities
+    //Also we don't fill in the nnHash here either
+    std::copy(
+      buffers->policy.data() + row * xySize,
+      buffers->policy.data() + (row+1) * xySize,
+      policyProbs
+    );
+    assert(computeHandle->policySize == xySize + 1);
+    policyProbs[xySize] = buffers->policyPass[row];
+
+    int numValueChannels = model->numValueChannels;
+    assert(numValueChannels == 3);
+    output->whiteWinProb = buffers->value[row * numValueChannels];
+    output->whiteLossProb = buffers->value[row * numValueChannels + 1];
+    output->whiteNoResultProb = buffers->value[row * numValueChannels + 2];
+
+    //As above, these are NOT actually from white's perspective, but rather the player to move.
+    //As usual the client does the postprocessing.
+    if(output->whiteOwnerMap != NULL) {
+      assert(model->numOwnershipChannels == 1);
+      std::copy(
+        buffers->ownership.data() + row * xySize,
+        buffers->ownership.data() + (row+1) * xySize,
+        output->whiteOwnerMap
+      );
+    }
+
+    if(version >= 4) {
+      int numScoreValueChannels = model->numScoreValueChannels;
+      assert(numScoreValueChannels == 2);
+      output->whiteScoreMean = buffers->scoreValue[row * numScoreValueChannels];
+      output->whiteScoreMeanSq = buffers->scoreValue[row * numScoreValueChannels + 1];
+    }
+    else if(version >= 3) {
+      int numScoreValueChannels = model->numScoreValueChannels;
+      assert(numScoreValueChannels == 1);
+      output->whiteScoreMean = buffers->scoreValue[row * numScoreValueChannels];
+      //Version 3 neural nets don't have any second moment output, implicitly already folding it in, so we just use the mean squared
+      output->whiteScoreMeanSq = output->whiteScoreMean * output->whiteScoreMean;
+    }
+    else {
+      ASSERT_UNREACHABLE;
+    }
+  }
+}
+
+//--------------------------------------------------------------
+
+bool NeuralNet::testEvaluateConv(
+  const ConvLayerDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const std::vector<float>& inputBuffer,
+  std::vector<float>& outputBuffer
+) {
+  if(useFP16 != false)
+    return false;
+  if(useNHWC != false)
+    return false;
+
+  ComputeHandleInternal handle;
+  ConvLayer layer(desc, nnXLen, nnYLen);
+
+  size_t numInputFloats = (size_t)batchSize * nnXLen * nnYLen * desc->inChannels;
+  size_t numOutputFloats = (size_t)batchSize * nnXLen * nnYLen * desc->outChannels;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateConv: unexpected input buffer size");
+  outputBuffer.resize(numOutputFloats);
+
+  layer.apply(&handle, batchSize, inputBuffer.data(), outputBuffer.data());
+  return true;
+}
+
+//Mask should be in 'NHW' format (no "C" channel).
+bool NeuralNet::testEvaluateBatchNorm(
+  const BatchNormLayerDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const std::vector<float>& inputBuffer,
+  const std::vector<float>& maskBuffer,
+  std::vector<float>& outputBuffer
+) {
+  if(useFP16 != false)
+    return false;
+  if(useNHWC != false)
+    return false;
+
+  ComputeHandleInternal handle;
+  BatchNormLayer layer(desc, nnXLen, nnYLen);
+
+  size_t numInputFloats = (size_t)batchSize * nnXLen * nnYLen * desc->numChannels;
+  size_t numOutputFloats = (size_t)batchSize * nnXLen * nnYLen * desc->numChannels;
+  if(numInputFloats != inputBuffer.size())
+    throw StringError("testEvaluateBatchNorm: unexpected input buffer size");
+  outputBuffer.resize(numOutputFloats);
+
+  bool applyRelu = false;
+  layer.apply(&handle, batchSize, applyRelu, inputBuffer.data(), outputBuffer.data(), maskBuffer.data());
+  return true;
+}
+
+bool NeuralNet::testEvaluateResidualBlock(
+  const ResidualBlockDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const std::vector<float>& inputBuffer,
+  const std::vector<float>& maskBuffer,
+  std::vector<float>& outputBuffer
+) {
+  if(useFP16 != false)
+    return false;
+  if(useNHWC != false)
+    return false;
+
+  ComputeHandleInternal handle;
+  ResidualBlock layer(desc, nnXLen, nnYLen);
+
+  size_t numTrunkFloats = (size_t)batchSize * nnXLen * nnYLen * desc->preBN.numChannels;
+  size_t numMaskFloats = (size_t)batchSize * nnXLen * nnYLen;
+  size_t numMidFloats = (size_t)batchSize * nnXLen * nnYLen * desc->finalConv.inChannels;
+  if(numTrunkFloats != inputBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected mask buffer size");
+
+  outputBuffer = inputBuffer;
+  vector<float> trunkScratch(numTrunkFloats);
+  vector<float> mid(numMidFloats);
+  vector<float> midScratch(numMidFloats);
+
+  layer.apply(&handle, batchSize, outputBuffer.data(), trunkScratch.data(), mid.data(), midScratch.data(), maskBuffer.data());
+  return true;
+}
+
+bool NeuralNet::testEvaluateGlobalPoolingResidualBlock(
+  const GlobalPoolingResidualBlockDesc* desc,
+  int batchSize,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const std::vector<float>& inputBuffer,
+  const std::vector<float>& maskBuffer,
+  std::vector<float>& outputBuffer
+) {
+  if(useFP16 != false)
+    return false;
+  if(useNHWC != false)
+    return false;
+
+  ComputeHandleInternal handle;
+  GlobalPoolingResidualBlock layer(desc, nnXLen, nnYLen);
+
+  size_t numTrunkFloats = (size_t)batchSize * nnXLen * nnYLen * desc->preBN.numChannels;
+  size_t numMaskFloats = (size_t)batchSize * nnXLen * nnYLen;
+  size_t numMaskSumFloats = (size_t)batchSize;
+  size_t numMidFloats = (size_t)batchSize * nnXLen * nnYLen * desc->finalConv.inChannels;
+  size_t numGPoolOutFloats = (size_t)batchSize * nnXLen * nnYLen * desc->gpoolConv.outChannels;
+  size_t numGPoolConcatFloats = (size_t)batchSize * 3 * desc->gpoolConv.outChannels;
+  size_t numGPoolBiasFloats = (size_t)batchSize * desc->regularConv.outChannels;
+
+  if(numTrunkFloats != inputBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected input buffer size");
+  if(numMaskFloats != maskBuffer.size())
+    throw StringError("testEvaluateResidualBlock: unexpected mask buffer size");
+
+  outputBuffer = inputBuffer;
+  vector<float> maskSum(numMaskSumFloats);
+  vector<float> trunkScratch(numTrunkFloats);
+  vector<float> mid(numMidFloats);
+  vector<float> midScratch(numMidFloats);
+  vector<float> gpoolOut(numGPoolOutFloats);
+  vector<float> gpoolOut2(numGPoolOutFloats);
+  vector<float> gpoolConcat(numGPoolConcatFloats);
+  vector<float> gpoolBias(numGPoolBiasFloats);
+
+  computeMaskSums(batchSize, nnXLen * nnYLen, maskBuffer.data(), maskSum.data());
+
+  layer.apply(
+    &handle,
+    batchSize,
+    outputBuffer.data(),
+    trunkScratch.data(),
+    mid.data(),
+    midScratch.data(),
+    gpoolOut.data(),
+    gpoolOut2.data(),
+    gpoolConcat.data(),
+    gpoolBias.data(),
+    maskBuffer.data(),
+    maskSum.data()
+  );
+  return true;
+}
+
+bool NeuralNet::testEvaluateSymmetry(
+  int batchSize,
+  int numChannels,
+  int nnXLen,
+  int nnYLen,
+  bool useFP16,
+  bool useNHWC,
+  const int* symmetries,
+  const std::vector<float>& inputBuffer,
+  std::vector<float>& outputBuffer
+) {
+  if(useFP16 != false)
+    return false;
+  if(useNHWC != false)
+    return false;
+
+  ComputeHandleInternal handle;
+
+  size_t numFloats = (size_t)batchSize * nnXLen * nnYLen * numChannels;
+  if(numFloats != inputBuffer.size())
+    throw StringError("testEvaluateSymmetry: unexpected input buffer size");
+
+  outputBuffer = inputBuffer;
+  vector<float> scratch(numFloats);
+  applySymmetriesNCHW(&handle, symmetries, false, batchSize, numChannels, nnXLen, nnYLen, outputBuffer.data(), scratch.data());
+  return true;
+}
+
+#endif  // USE_CPU_BACKEND
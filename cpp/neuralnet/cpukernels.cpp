@@ -0,0 +1,246 @@
+#include "../neuralnet/cpukernels.h"
+
+#include <cstring>
+
+//MSVC has no macro for FMA, but /arch:AVX2 enables it
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#define CPUKERNELS_USE_AVX2_FMA
+#endif
+
+using namespace std;
+
+//Register block of the output computed by a single microkernel call
+static const int MR = 6;
+static const int NR = 16;
+//Cache blocks. A packed KC x NC block of the right hand side should sit comfortably in L2, and MR rows of KC of
+//the left hand side in L1.
+static const int KC = 256;
+static const int NC = 64;
+
+size_t CPUKernels::packBufferElts() {
+  return (size_t)KC * NC;
+}
+
+//Packed layout of a kc x nc block of the right hand side: consecutive panels of NR columns, each panel stored as
+//kc rows of NR contiguous floats, with columns past nc zero-filled.
+
+#ifdef CPUKERNELS_USE_AVX2_FMA
+
+const char* CPUKernels::getImplementationName() {
+  return "AVX2+FMA";
+}
+
+template<int R>
+static inline void microKernel(
+  int kc, const float* A, int lda, const float* panel, float* C, int ldc, int cols, bool accumulate
+) {
+  static_assert(R >= 1 && R <= MR, "");
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+  for(int kk = 0; kk<kc; kk++) {
+    __m256 b0 = _mm256_loadu_ps(panel + kk * NR);
+    __m256 b1 = _mm256_loadu_ps(panel + kk * NR + 8);
+    __m256 a;
+    a = _mm256_broadcast_ss(A + kk);
+    c00 = _mm256_fmadd_ps(a,b0,c00); c01 = _mm256_fmadd_ps(a,b1,c01);
+    if(R > 1) { a = _mm256_broadcast_ss(A + lda + kk);   c10 = _mm256_fmadd_ps(a,b0,c10); c11 = _mm256_fmadd_ps(a,b1,c11); }
+    if(R > 2) { a = _mm256_broadcast_ss(A + 2*lda + kk); c20 = _mm256_fmadd_ps(a,b0,c20); c21 = _mm256_fmadd_ps(a,b1,c21); }
+    if(R > 3) { a = _mm256_broadcast_ss(A + 3*lda + kk); c30 = _mm256_fmadd_ps(a,b0,c30); c31 = _mm256_fmadd_ps(a,b1,c31); }
+    if(R > 4) { a = _mm256_broadcast_ss(A + 4*lda + kk); c40 = _mm256_fmadd_ps(a,b0,c40); c41 = _mm256_fmadd_ps(a,b1,c41); }
+    if(R > 5) { a = _mm256_broadcast_ss(A + 5*lda + kk); c50 = _mm256_fmadd_ps(a,b0,c50); c51 = _mm256_fmadd_ps(a,b1,c51); }
+  }
+
+  const __m256 acc[MR][2] = {{c00,c01},{c10,c11},{c20,c21},{c30,c31},{c40,c41},{c50,c51}};
+  for(int r = 0; r<R; r++) {
+    float* row = C + r * ldc;
+    if(cols == NR) {
+      __m256 v0 = acc[r][0];
+      __m256 v1 = acc[r][1];
+      if(accumulate) {
+        v0 = _mm256_add_ps(v0,_mm256_loadu_ps(row));
+        v1 = _mm256_add_ps(v1,_mm256_loadu_ps(row+8));
+      }
+      _mm256_storeu_ps(row,v0);
+      _mm256_storeu_ps(row+8,v1);
+    }
+    else {
+      float tmp[NR];
+      _mm256_storeu_ps(tmp,acc[r][0]);
+      _mm256_storeu_ps(tmp+8,acc[r][1]);
+      for(int j = 0; j<cols; j++)
+        row[j] = accumulate ? row[j] + tmp[j] : tmp[j];
+    }
+  }
+}
+
+#else
+
+const char* CPUKernels::getImplementationName() {
+  return "scalar";
+}
+
+template<int R>
+static inline void microKernel(
+  int kc, const float* A, int lda, const float* panel, float* C, int ldc, int cols, bool accumulate
+) {
+  static_assert(R >= 1 && R <= MR, "");
+  float acc[R][NR];
+  for(int r = 0; r<R; r++)
+    for(int j = 0; j<NR; j++)
+      acc[r][j] = 0.0f;
+
+  for(int kk = 0; kk<kc; kk++) {
+    const float* b = panel + kk * NR;
+    for(int r = 0; r<R; r++) {
+      float a = A[r * lda + kk];
+      for(int j = 0; j<NR; j++)
+        acc[r][j] += a * b[j];
+    }
+  }
+
+  for(int r = 0; r<R; r++) {
+    float* row = C + r * ldc;
+    for(int j = 0; j<cols; j++)
+      row[j] = accumulate ? row[j] + acc[r][j] : acc[r][j];
+  }
+}
+
+#endif
+
+//Multiply the rows of A against a packed block of B, for every panel of the block
+static void multiplyPackedBlock(
+  int M, int kc, int nc, const float* A, int lda, const float* packed, float* C, int ldc, bool accumulate
+) {
+  int numPanels = (nc + NR - 1) / NR;
+  for(int i = 0; i<M; i += MR) {
+    int rows = std::min(MR, M - i);
+    const float* aRows = A + (size_t)i * lda;
+    for(int p = 0; p<numPanels; p++) {
+      const float* panel = packed + (size_t)p * kc * NR;
+      float* cBlock = C + (size_t)i * ldc + p * NR;
+      int cols = std::min(NR, nc - p * NR);
+      switch(rows) {
+      case 6: microKernel<6>(kc,aRows,lda,panel,cBlock,ldc,cols,accumulate); break;
+      case 5: microKernel<5>(kc,aRows,lda,panel,cBlock,ldc,cols,accumulate); break;
+      case 4: microKernel<4>(kc,aRows,lda,panel,cBlock,ldc,cols,accumulate); break;
+      case 3: microKernel<3>(kc,aRows,lda,panel,cBlock,ldc,cols,accumulate); break;
+      case 2: microKernel<2>(kc,aRows,lda,panel,cBlock,ldc,cols,accumulate); break;
+      default: microKernel<1>(kc,aRows,lda,panel,cBlock,ldc,cols,accumulate); break;
+      }
+    }
+  }
+}
+
+//packB(k0,kc,n0,nc,dst) must fill dst with the packed block of rows [k0,k0+kc) and columns [n0,n0+nc) of B.
+template<typename PackB>
+static void gemmBlocked(
+  int M, int N, int K, const float* A, int lda, float* C, int ldc, bool accumulate, float* packBuf, PackB packB
+) {
+  for(int n0 = 0; n0<N; n0 += NC) {
+    int nc = std::min(NC, N - n0);
+    for(int k0 = 0; k0<K; k0 += KC) {
+      int kc = std::min(KC, K - k0);
+      packB(k0,kc,n0,nc,packBuf);
+      multiplyPackedBlock(M, kc, nc, A + k0, lda, packBuf, C + n0, ldc, accumulate || k0 > 0);
+    }
+  }
+}
+
+static void packDense(const float* B, int ldb, int k0, int kc, int n0, int nc, float* dst) {
+  for(int p = 0; p*NR < nc; p++) {
+    int cols = std::min(NR, nc - p * NR);
+    float* panel = dst + (size_t)p * kc * NR;
+    for(int kk = 0; kk<kc; kk++) {
+      const float* src = B + (size_t)(k0 + kk) * ldb + n0 + p * NR;
+      float* out = panel + kk * NR;
+      std::memcpy(out, src, sizeof(float) * cols);
+      for(int j = cols; j<NR; j++)
+        out[j] = 0.0f;
+    }
+  }
+}
+
+void CPUKernels::gemm(
+  int M, int N, int K,
+  const float* A, int lda,
+  const float* B, int ldb,
+  float* C, int ldc,
+  bool accumulate,
+  float* packBuf
+) {
+  if(M <= 0 || N <= 0)
+    return;
+  if(K <= 0) {
+    if(!accumulate) {
+      for(int i = 0; i<M; i++)
+        std::fill(C + (size_t)i * ldc, C + (size_t)i * ldc + N, 0.0f);
+    }
+    return;
+  }
+  gemmBlocked(
+    M, N, K, A, lda, C, ldc, accumulate, packBuf,
+    [B,ldb](int k0, int kc, int n0, int nc, float* dst) { packDense(B,ldb,k0,kc,n0,nc,dst); }
+  );
+}
+
+void CPUKernels::conv(
+  const float* weights, int inChannels, int outChannels,
+  int convYSize, int convXSize, int dilationY, int dilationX,
+  int ySize, int xSize,
+  const float* input, float* output,
+  int xyStart, int xyEnd,
+  float* packBuf
+) {
+  const int xySize = ySize * xSize;
+  const int N = xyEnd - xyStart;
+  const int K = inChannels * convYSize * convXSize;
+  if(N <= 0)
+    return;
+
+  //A 1x1 convolution is just a matrix product against the input
+  if(convYSize == 1 && convXSize == 1) {
+    gemm(outChannels, N, K, weights, K, input + xyStart, xySize, output + xyStart, xySize, false, packBuf);
+    return;
+  }
+
+  const int convYRadius = convYSize / 2;
+  const int convXRadius = convXSize / 2;
+  //Pack directly from the input image, so the im2col matrix is never materialized
+  auto packIm2col = [=](int k0, int kc, int n0, int nc, float* dst) {
+    for(int p = 0; p*NR < nc; p++) {
+      int cols = std::min(NR, nc - p * NR);
+      int ys[NR];
+      int xs[NR];
+      for(int j = 0; j<cols; j++) {
+        int xy = xyStart + n0 + p * NR + j;
+        ys[j] = xy / xSize;
+        xs[j] = xy % xSize;
+      }
+      float* panel = dst + (size_t)p * kc * NR;
+      for(int kk = 0; kk<kc; kk++) {
+        int k = k0 + kk;
+        int kx = k % convXSize;
+        int ky = (k / convXSize) % convYSize;
+        int ic = k / (convXSize * convYSize);
+        int dy = (ky - convYRadius) * dilationY;
+        int dx = (kx - convXRadius) * dilationX;
+        const float* channel = input + (size_t)ic * xySize;
+        float* out = panel + kk * NR;
+        for(int j = 0; j<cols; j++) {
+          int y = ys[j] + dy;
+          int x = xs[j] + dx;
+          out[j] = (y >= 0 && y < ySize && x >= 0 && x < xSize) ? channel[y * xSize + x] : 0.0f;
+        }
+        for(int j = cols; j<NR; j++)
+          out[j] = 0.0f;
+      }
+    }
+  };
+  gemmBlocked(outChannels, N, K, weights, K, output + xyStart, xySize, false, packBuf, packIm2col);
+}
@@ -0,0 +1,39 @@
+#ifndef NEURALNET_CPUKERNELS_H_
+#define NEURALNET_CPUKERNELS_H_
+
+#include "../core/global.h"
+
+//Matrix multiplication and convolution kernels for the CPU neural net backend.
+//Single-threaded - the backend splits work across its own threads by calling these on disjoint ranges of the output.
+//Uses AVX2 and FMA when compiled with USE_AVX2, and plain scalar code otherwise.
+//All matrices are row-major.
+namespace CPUKernels {
+  //Number of floats of scratch space that gemm and conv need for packing their right hand side
+  size_t packBufferElts();
+
+  //C[M x N] = A[M x K] * B[K x N], or C += A * B if accumulate.
+  void gemm(
+    int M, int N, int K,
+    const float* A, int lda,
+    const float* B, int ldb,
+    float* C, int ldc,
+    bool accumulate,
+    float* packBuf
+  );
+
+  //Convolution of a single CHW image, with zero padding so that the output has the same size as the input.
+  //weights are in oc,ic,y,x order, exactly as in ConvLayerDesc, so the convolution is a gemm with an implicit im2col
+  //matrix of inChannels*convYSize*convXSize rows. Only output positions [xyStart,xyEnd) are computed, for all outChannels.
+  void conv(
+    const float* weights, int inChannels, int outChannels,
+    int convYSize, int convXSize, int dilationY, int dilationX,
+    int ySize, int xSize,
+    const float* input, float* output,
+    int xyStart, int xyEnd,
+    float* packBuf
+  );
+
+  const char* getImplementationName();
+}
+
+#endif  // NEURALNET_CPUKERNELS_H_
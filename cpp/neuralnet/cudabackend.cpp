@@ -1439,28 +1439,51 @@ struct Trunk {
 
 //------------------------------------------------------------------------------
 
+//Returns true and sets symmetry if every row of the batch uses the same symmetry.
+static bool getUniformSymmetry(const int* symmetriesBuffer, int batchSize, int& symmetry) {
+  symmetry = symmetriesBuffer[0];
+  for(int i = 1; i<batchSize; i++) {
+    if(symmetriesBuffer[i] != symmetry)
+      return false;
+  }
+  return true;
+}
+
+//symmetriesBuffer is the host copy of the per-row symmetries, deviceSymmetriesBuffer the same values on the GPU.
+//When every row shares a symmetry, use the mirror and transpose kernels on the whole batch, else gather each row separately.
 template <typename T>
 static void applySymmetriesNCHW(
-  const bool* symmetriesBuffer, bool inverse, int batchSize, int cSize, int xSize, int ySize,
+  const int* symmetriesBuffer, const int* deviceSymmetriesBuffer, bool inverse, int batchSize, int cSize, int xSize, int ySize,
   T* inputBuf, T* inputScratchBuf
 ) {
-  if(!symmetriesBuffer[0] && !symmetriesBuffer[1] && !symmetriesBuffer[2])
+  int symmetry;
+  if(!getUniformSymmetry(symmetriesBuffer,batchSize,symmetry)) {
+    customCudaApplySymmetriesNCHW(inputBuf,inputScratchBuf,deviceSymmetriesBuffer,batchSize,cSize,ySize,xSize,inverse);
+    CUDA_ERR("applySymmetriesNCHW",cudaPeekAtLastError());
+    cudaMemcpyAsync(inputBuf,inputScratchBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
+    CUDA_ERR("applySymmetriesNCHW",cudaPeekAtLastError());
+    return;
+  }
+  if(symmetry == 0)
     return;
+  bool flipY = (symmetry & 0x1) != 0;
+  bool flipX = (symmetry & 0x2) != 0;
+  bool transpose = (symmetry & 0x4) != 0 && xSize == ySize;
 
   if(inverse) {
-    if(symmetriesBuffer[2] && xSize == ySize)
+    if(transpose)
       customCudaNCHWTranspose(inputBuf,inputScratchBuf,xSize,ySize,batchSize*cSize);
     else
       cudaMemcpyAsync(inputScratchBuf,inputBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
     CUDA_ERR("applySymmetriesNCHW",cudaPeekAtLastError());
 
-    customCudaMirrorNCHW(inputScratchBuf, inputBuf, batchSize, cSize, ySize, xSize, symmetriesBuffer[0], symmetriesBuffer[1]);
+    customCudaMirrorNCHW(inputScratchBuf, inputBuf, batchSize, cSize, ySize, xSize, flipY, flipX);
     CUDA_ERR("applySymmetriesNCHW",cudaPeekAtLastError());
   }
   else {
-    customCudaMirrorNCHW(inputBuf, inputScratchBuf, batchSize, cSize, ySize, xSize, symmetriesBuffer[0], symmetriesBuffer[1]);
+    customCudaMirrorNCHW(inputBuf, inputScratchBuf, batchSize, cSize, ySize, xSize, flipY, flipX);
     CUDA_ERR("applySymmetriesNCHW",cudaPeekAtLastError());
-    if(symmetriesBuffer[2] && xSize == ySize)
+    if(transpose)
       customCudaNCHWTranspose(inputScratchBuf,inputBuf,xSize,ySize,batchSize*cSize);
     else
       cudaMemcpyAsync(inputBuf,inputScratchBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
@@ -1470,26 +1493,37 @@ static void applySymmetriesNCHW(
 
 template <typename T>
 static void applySymmetriesNHWC(
-  const bool* symmetriesBuffer, bool inverse, int batchSize, int cSize, int xSize, int ySize,
+  const int* symmetriesBuffer, const int* deviceSymmetriesBuffer, bool inverse, int batchSize, int cSize, int xSize, int ySize,
   T* inputBuf, T* inputScratchBuf
 ) {
-  if(!symmetriesBuffer[0] && !symmetriesBuffer[1] && !symmetriesBuffer[2])
+  int symmetry;
+  if(!getUniformSymmetry(symmetriesBuffer,batchSize,symmetry)) {
+    customCudaApplySymmetriesNHWC(inputBuf,inputScratchBuf,deviceSymmetriesBuffer,batchSize,ySize,xSize,cSize,inverse);
+    CUDA_ERR("applySymmetriesNHWC",cudaPeekAtLastError());
+    cudaMemcpyAsync(inputBuf,inputScratchBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
+    CUDA_ERR("applySymmetriesNHWC",cudaPeekAtLastError());
+    return;
+  }
+  if(symmetry == 0)
     return;
+  bool flipY = (symmetry & 0x1) != 0;
+  bool flipX = (symmetry & 0x2) != 0;
+  bool transpose = (symmetry & 0x4) != 0 && xSize == ySize;
 
   if(inverse) {
-    if(symmetriesBuffer[2] && xSize == ySize)
+    if(transpose)
       customCudaNHWCTranspose(inputBuf,inputScratchBuf,xSize,ySize,cSize,batchSize);
     else
       cudaMemcpyAsync(inputScratchBuf,inputBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
     CUDA_ERR("applySymmetriesNHWC",cudaPeekAtLastError());
 
-    customCudaMirrorNHWC(inputScratchBuf, inputBuf, batchSize, ySize, xSize, cSize, symmetriesBuffer[0], symmetriesBuffer[1]);
+    customCudaMirrorNHWC(inputScratchBuf, inputBuf, batchSize, ySize, xSize, cSize, flipY, flipX);
     CUDA_ERR("applySymmetriesNHWC",cudaPeekAtLastError());
   }
   else {
-    customCudaMirrorNHWC(inputBuf, inputScratchBuf, batchSize, ySize, xSize, cSize, symmetriesBuffer[0], symmetriesBuffer[1]);
+    customCudaMirrorNHWC(inputBuf, inputScratchBuf, batchSize, ySize, xSize, cSize, flipY, flipX);
     CUDA_ERR("applySymmetriesNHWC",cudaPeekAtLastError());
-    if(symmetriesBuffer[2] && xSize == ySize)
+    if(transpose)
       customCudaNHWCTranspose(inputScratchBuf,inputBuf,xSize,ySize,cSize,batchSize);
     else
       cudaMemcpyAsync(inputBuf,inputScratchBuf,sizeof(T)*batchSize*cSize*ySize*xSize,cudaMemcpyDeviceToDevice);
@@ -1715,7 +1749,8 @@ struct PolicyHead {
   void apply(
     CudaHandles* cudaHandles,
     const cudnnTensorDescriptor_t& trunkDescriptor,
-    const bool* symmetriesBuffer,
+    const int* symmetriesBuffer,
+    const int* deviceSymmetriesBuffer,
     int batchSize,
     void* maskBuf,
     float* maskFloatBuf,
@@ -1796,9 +1831,9 @@ struct PolicyHead {
 
     bool inverse = true;
     if(!usingNHWC)
-      applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
+      applySymmetriesNCHW<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
     else
-      applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
+      applySymmetriesNHWC<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, p2Channels, xSize, ySize, p2OutBuf, policyBuf);
 
     gpoolToPassMul->apply(cudaHandles,batchSize,g1ConcatBuf,g1PassBuf,&zero,&one,workspaceBuf,workspaceBytes);
 
@@ -1996,7 +2031,8 @@ struct ValueHead {
   void apply(
     CudaHandles* cudaHandles,
     const cudnnTensorDescriptor_t& trunkDescriptor,
-    const bool* symmetriesBuffer,
+    const int* symmetriesBuffer,
+    const int* deviceSymmetriesBuffer,
     int batchSize,
     void* maskBuf,
     float* maskSumBuf,
@@ -2056,16 +2092,16 @@ struct ValueHead {
     if(!usingFP16) {
       vOwnershipConv->apply(cudaHandles,v1OutDescriptor,vOwnershipOutDescriptor,batchSize,false,v1OutBuf2,ownershipBuf,workspaceBuf,workspaceBytes);
       if(!usingNHWC)
-        applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
+        applySymmetriesNCHW<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
       else
-        applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
+        applySymmetriesNHWC<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (float*)ownershipBuf, (float*)workspaceBuf);
     }
     else {
       vOwnershipConv->apply(cudaHandles,v1OutDescriptor,vOwnershipOutDescriptor,batchSize,false,v1OutBuf2,ownershipScratchBuf,workspaceBuf,workspaceBytes);
       if(!usingNHWC)
-        applySymmetriesNCHW<half>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
+        applySymmetriesNCHW<half>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
       else
-        applySymmetriesNHWC<half>(symmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
+        applySymmetriesNHWC<half>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, ownershipChannels, xSize, ySize, (half*)ownershipScratchBuf, (half*)workspaceBuf);
 
       customCudaCopyFromHalf((const half*)ownershipScratchBuf,(float*)ownershipBuf,batchSize*ownershipChannels*xSize*ySize);
       CUDA_ERR("vOwnership copy",cudaPeekAtLastError());
@@ -2210,7 +2246,8 @@ struct Model {
     CudaHandles* cudaHandles,
     int batchSize,
     bool requireExactNNLen,
-    bool* symmetriesBuffer,
+    const int* symmetriesBuffer,
+    const int* deviceSymmetriesBuffer,
 
     void* inputBuf,
     void* inputScratchBuf,
@@ -2261,16 +2298,16 @@ struct Model {
     if(!usingFP16) {
       bool inverse = false;
       if(inputsUsingNHWC)
-        applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
+        applySymmetriesNHWC<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
       else
-        applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
+        applySymmetriesNCHW<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (float*)inputBuf, (float*)inputScratchBuf);
     }
     else {
       bool inverse = false;
       if(inputsUsingNHWC)
-        applySymmetriesNHWC<half>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
+        applySymmetriesNHWC<half>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
       else
-        applySymmetriesNCHW<half>(symmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
+        applySymmetriesNCHW<half>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numInputChannels, xSize, ySize, (half*)inputBuf, (half*)inputScratchBuf);
     }
 
     if(!usingFP16) {
@@ -2327,6 +2364,7 @@ struct Model {
       cudaHandles,
       trunkDescriptor,
       symmetriesBuffer,
+      deviceSymmetriesBuffer,
       batchSize,
       maskBuf,
       maskFloatBuf,
@@ -2348,6 +2386,7 @@ struct Model {
       cudaHandles,
       trunkDescriptor,
       symmetriesBuffer,
+      deviceSymmetriesBuffer,
       batchSize,
       maskBuf,
       maskSumBuf,
@@ -2419,6 +2458,8 @@ struct Buffers {
   float* maskFloatBuf;
   float* maskSumBuf;
 
+  int* symmetriesBuf;
+
   void* trunkBuf;
   void* trunkScratchBuf;
   void* regularOutBuf;
@@ -2486,6 +2527,8 @@ struct Buffers {
     CUDA_ERR("Buffers",cudaMalloc(&maskFloatBuf, batchXYFloatBytes));
     CUDA_ERR("Buffers",cudaMalloc(&maskSumBuf, batchFloatBytes));
 
+    CUDA_ERR("Buffers",cudaMalloc(&symmetriesBuf, m.maxBatchSize * sizeof(int)));
+
     CUDA_ERR("Buffers",cudaMalloc(&trunkBuf, m.trunk->trunkNumChannels * batchXYBytes));
     CUDA_ERR("Buffers",cudaMalloc(&trunkScratchBuf, m.trunk->trunkNumChannels * batchXYBytes));
     CUDA_ERR("Buffers",cudaMalloc(&regularOutBuf, m.trunk->regularNumChannels * batchXYBytes));
@@ -2554,6 +2597,8 @@ struct Buffers {
     cudaFree(maskFloatBuf);
     cudaFree(maskSumBuf);
 
+    cudaFree(symmetriesBuf);
+
     cudaFree(trunkBuf);
     cudaFree(trunkScratchBuf);
     cudaFree(regularOutBuf);
@@ -2732,7 +2777,7 @@ struct InputBuffers {
 
   float* userInputBuffer; //Host pointer
   float* userInputGlobalBuffer; //Host pointer
-  bool* symmetriesBuffer; //Host pointer
+  int* symmetriesBuffer; //Host pointer
 
   float* policyResults; //Host pointer
   float* valueResults; //Host pointer
@@ -2771,7 +2816,8 @@ struct InputBuffers {
 
     userInputBuffer = new float[(size_t)m.numInputChannels * maxBatchSize * xSize * ySize];
     userInputGlobalBuffer = new float[(size_t)m.numInputGlobalChannels * maxBatchSize];
-    symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS];
+    symmetriesBuffer = new int[maxBatchSize];
+    std::fill(symmetriesBuffer,symmetriesBuffer+maxBatchSize,0);
 
     policyResults = new float[(size_t)maxBatchSize * (1 + xSize * ySize)];
     valueResults = new float[(size_t)maxBatchSize * m.numValueChannels];
@@ -2820,7 +2866,7 @@ int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
   return inputBuffers->singleInputGlobalElts;
 }
 
-bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
+int* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
   return inputBuffers->symmetriesBuffer;
 }
 
@@ -2879,11 +2925,14 @@ void NeuralNet::getOutput(ComputeHandle* gpuHandle, InputBuffers* inputBuffers,
     CUDA_ERR("getOutput",cudaPeekAtLastError());
   }
 
+  CUDA_ERR("getOutput",cudaMemcpy(buffers->symmetriesBuf, inputBuffers->symmetriesBuffer, sizeof(int)*batchSize, cudaMemcpyHostToDevice));
+
   gpuHandle->model->apply(
     gpuHandle->cudaHandles,
     batchSize,
     gpuHandle->requireExactNNLen,
     inputBuffers->symmetriesBuffer,
+    buffers->symmetriesBuf,
 
     buffers->inputBuf,
     buffers->inputScratchBuf,
@@ -3446,7 +3495,7 @@ bool NeuralNet::testEvaluateSymmetry(
   int nnYLen,
   bool useFP16,
   bool useNHWC,
-  const bool* symmetriesBuffer,
+  const int* symmetriesBuffer,
   const std::vector<float>& inputBuffer,
   std::vector<float>& outputBuffer
 ) {
@@ -3464,20 +3513,23 @@ bool NeuralNet::testEvaluateSymmetry(
   void* deviceInputScratch;
   mallocAndCopyToDevice("deviceInput", inputBuffer.data(), numFloats, deviceInput, useFP16);
   mallocOnDevice("deviceInputScratch", numFloats, deviceInputScratch, useFP16);
+  int* deviceSymmetriesBuffer;
+  CUDA_ERR("testEvaluateSymmetry",cudaMalloc(&deviceSymmetriesBuffer, batchSize * sizeof(int)));
+  CUDA_ERR("testEvaluateSymmetry",cudaMemcpy(deviceSymmetriesBuffer, symmetriesBuffer, batchSize * sizeof(int), cudaMemcpyHostToDevice));
 
   if(!useFP16) {
     bool inverse = false;
     if(useNHWC)
-      applySymmetriesNHWC<float>(symmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (float*)deviceInput, (float*)deviceInputScratch);
+      applySymmetriesNHWC<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (float*)deviceInput, (float*)deviceInputScratch);
     else
-      applySymmetriesNCHW<float>(symmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (float*)deviceInput, (float*)deviceInputScratch);
+      applySymmetriesNCHW<float>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (float*)deviceInput, (float*)deviceInputScratch);
   }
   else {
     bool inverse = false;
     if(useNHWC)
-      applySymmetriesNHWC<half>(symmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (half*)deviceInput, (half*)deviceInputScratch);
+      applySymmetriesNHWC<half>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (half*)deviceInput, (half*)deviceInputScratch);
     else
-      applySymmetriesNCHW<half>(symmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (half*)deviceInput, (half*)deviceInputScratch);
+      applySymmetriesNCHW<half>(symmetriesBuffer, deviceSymmetriesBuffer, inverse, batchSize, numChannels, xSize, ySize, (half*)deviceInput, (half*)deviceInputScratch);
   }
 
   outputBuffer.resize(numFloats);
@@ -3485,6 +3537,7 @@ bool NeuralNet::testEvaluateSymmetry(
 
   cudaFree(deviceInput);
   cudaFree(deviceInputScratch);
+  cudaFree(deviceSymmetriesBuffer);
   delete cudaHandles;
 
   return true;
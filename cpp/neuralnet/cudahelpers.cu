@@ -2,6 +2,7 @@
 #include "../neuralnet/cudahelpers.h"
 
 #include <stdexcept>
+#include <algorithm>
 
 #if __CUDA_ARCH__ >= 530
 #define CUDA_SUPPORTS_FP16
@@ -1051,6 +1052,104 @@ void customCudaMirrorNHWC(const half *in, half* out, int batchSize, int ySize, i
   customCudaMirrorNHWCTemplate<half>(in,out,batchSize,ySize,xSize,cSize,mirrorY,mirrorX);
 }
 
+//--------------------------------------------------------------------------------------------------------------
+
+//Location in the input that lands at (y,x) in the output under the given symmetry, see NeuralNet::getSymmetriesInplace.
+//The forward transformation mirrors and then transposes, the inverse transposes and then mirrors.
+__device__ __forceinline__
+void symmetrySrcYX(int symmetry, bool inverse, int ySize, int xSize, int y, int x, int& srcY, int& srcX)
+{
+  bool flipY = (symmetry & 0x1) != 0;
+  bool flipX = (symmetry & 0x2) != 0;
+  bool transpose = (symmetry & 0x4) != 0 && xSize == ySize;
+  if(!transpose) {
+    srcY = flipY ? ySize-1-y : y;
+    srcX = flipX ? xSize-1-x : x;
+  }
+  else if(!inverse) {
+    srcY = flipY ? ySize-1-x : x;
+    srcX = flipX ? xSize-1-y : y;
+  }
+  else {
+    srcY = flipX ? xSize-1-x : x;
+    srcX = flipY ? ySize-1-y : y;
+  }
+}
+
+template <typename T>
+__global__
+void symmetriesNCHWKernel(const T *in, T* out, const int* symmetries, int cSize, int ySize, int xSize, bool inverse)
+{
+  int xyIdx = blockIdx.x * blockDim.x + threadIdx.x;
+  int cIdx = blockIdx.y;
+  int nIdx = blockIdx.z;
+  int xySize = xSize * ySize;
+  if(xyIdx < xySize) {
+    int srcY;
+    int srcX;
+    symmetrySrcYX(symmetries[nIdx],inverse,ySize,xSize,xyIdx / xSize,xyIdx % xSize,srcY,srcX);
+    int base = (nIdx * cSize + cIdx) * xySize;
+    out[base + xyIdx] = in[base + srcY * xSize + srcX];
+  }
+}
+
+template <typename T>
+__global__
+void symmetriesNHWCKernel(const T *in, T* out, const int* symmetries, int ySize, int xSize, int cSize, bool inverse)
+{
+  int xycIdx = blockIdx.x * blockDim.x + threadIdx.x;
+  int nIdx = blockIdx.z;
+  int xycSize = xSize * ySize * cSize;
+  if(xycIdx < xycSize) {
+    int xyIdx = xycIdx / cSize;
+    int cIdx = xycIdx % cSize;
+    int srcY;
+    int srcX;
+    symmetrySrcYX(symmetries[nIdx],inverse,ySize,xSize,xyIdx / xSize,xyIdx % xSize,srcY,srcX);
+    int base = nIdx * xycSize;
+    out[base + xycIdx] = in[base + (srcY * xSize + srcX) * cSize + cIdx];
+  }
+}
+
+template <typename T>
+void customCudaApplySymmetriesNCHWTemplate(const T *in, T* out, const int* symmetries, int batchSize, int cSize, int ySize, int xSize, bool inverse) {
+  if(batchSize > 65536)
+    throw std::runtime_error("customCudaApplySymmetriesNCHW: batchSize too large");
+  if(cSize > 65536)
+    throw std::runtime_error("customCudaApplySymmetriesNCHW: cSize too large");
+  int xySize = xSize * ySize;
+  int xyThreads = std::min(xySize,targetNumThreads);
+  int xyBlocks = (xySize + xyThreads - 1) / xyThreads;
+  dim3 grid(xyBlocks,cSize,batchSize);
+  dim3 threads(xyThreads,1,1);
+  symmetriesNCHWKernel<<<grid,threads>>>(in,out,symmetries,cSize,ySize,xSize,inverse);
+}
+
+template <typename T>
+void customCudaApplySymmetriesNHWCTemplate(const T *in, T* out, const int* symmetries, int batchSize, int ySize, int xSize, int cSize, bool inverse) {
+  if(batchSize > 65536)
+    throw std::runtime_error("customCudaApplySymmetriesNHWC: batchSize too large");
+  int xycSize = xSize * ySize * cSize;
+  int xycThreads = std::min(xycSize,targetNumThreads);
+  int xycBlocks = (xycSize + xycThreads - 1) / xycThreads;
+  dim3 grid(xycBlocks,1,batchSize);
+  dim3 threads(xycThreads,1,1);
+  symmetriesNHWCKernel<<<grid,threads>>>(in,out,symmetries,ySize,xSize,cSize,inverse);
+}
+
+void customCudaApplySymmetriesNCHW(const float *in, float* out, const int* symmetries, int batchSize, int cSize, int ySize, int xSize, bool inverse) {
+  customCudaApplySymmetriesNCHWTemplate<float>(in,out,symmetries,batchSize,cSize,ySize,xSize,inverse);
+}
+void customCudaApplySymmetriesNHWC(const float *in, float* out, const int* symmetries, int batchSize, int ySize, int xSize, int cSize, bool inverse) {
+  customCudaApplySymmetriesNHWCTemplate<float>(in,out,symmetries,batchSize,ySize,xSize,cSize,inverse);
+}
+void customCudaApplySymmetriesNCHW(const half *in, half* out, const int* symmetries, int batchSize, int cSize, int ySize, int xSize, bool inverse) {
+  customCudaApplySymmetriesNCHWTemplate<half>(in,out,symmetries,batchSize,cSize,ySize,xSize,inverse);
+}
+void customCudaApplySymmetriesNHWC(const half *in, half* out, const int* symmetries, int batchSize, int ySize, int xSize, int cSize, bool inverse) {
+  customCudaApplySymmetriesNHWCTemplate<half>(in,out,symmetries,batchSize,ySize,xSize,cSize,inverse);
+}
+
 
 //--------------------------------------------------------------------------------------------------------------
 
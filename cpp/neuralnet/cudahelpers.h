@@ -41,6 +41,13 @@ void customCudaMirror(const half *in, half* out, int batchSize, int mSize, int s
 void customCudaMirrorNCHW(const half *in, half* out, int batchSize, int cSize, int ySize, int xSize, bool mirrorY, bool mirrorX);
 void customCudaMirrorNHWC(const half *in, half* out, int batchSize, int ySize, int xSize, int cSize, bool mirrorY, bool mirrorX);
 
+//Transform each batch element n of a tensor by symmetries[n] (on the GPU, see NeuralNet::getSymmetriesInplace),
+//or undo that transformation if inverse. Transposition is skipped when xSize != ySize. Not inplace.
+void customCudaApplySymmetriesNCHW(const float *in, float* out, const int* symmetries, int batchSize, int cSize, int ySize, int xSize, bool inverse);
+void customCudaApplySymmetriesNHWC(const float *in, float* out, const int* symmetries, int batchSize, int ySize, int xSize, int cSize, bool inverse);
+void customCudaApplySymmetriesNCHW(const half *in, half* out, const int* symmetries, int batchSize, int cSize, int ySize, int xSize, bool inverse);
+void customCudaApplySymmetriesNHWC(const half *in, half* out, const int* symmetries, int batchSize, int ySize, int xSize, int cSize, bool inverse);
+
 void customCudaCopyToHalf(const float* in, half* out, int n);
 void customCudaCopyFromHalf(const half* in, float* out, int n);
 
@@ -1,13 +1,23 @@
 #include "../neuralnet/desc.h"
 
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <zlib.h>
 
 #include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/os.h"
 #include "../neuralnet/modelversion.h"
 #include "../neuralnet/nninterface.h"
 
+#ifdef OS_IS_UNIX_OR_APPLE
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
 using namespace std;
 
 static void checkWeightFinite(float f, const string& name) {
@@ -31,15 +41,7 @@ ConvLayerDesc::ConvLayerDesc(istream& in) {
 
   if(in.fail())
     throw StringError(name + ": convlayer failed to parse sizes and channels and dilations");
-
-  if(convXSize <= 0 || convYSize <= 0)
-    throw StringError(name + ": convolution filter sizes must be positive");
-  if(inChannels <= 0 || outChannels <= 0)
-    throw StringError(name + ": number of in and out channels must be positive");
-  if(dilationX <= 0 || dilationY <= 0)
-    throw StringError(name + ": dilation factors must be positive");
-  if(convXSize % 2 != 1 || convYSize % 2 != 1)
-    throw StringError(name + ": convolution filter sizes must be odd, found even sizes");
+  validate();
 
   // Model file order is y,x,ic,oc
   // Cuda's order is oc,ic,y,x
@@ -66,6 +68,17 @@ ConvLayerDesc::ConvLayerDesc(istream& in) {
     throw StringError(name + ": convlayer failed to expected number of float weights");
 }
 
+void ConvLayerDesc::validate() const {
+  if(convXSize <= 0 || convYSize <= 0)
+    throw StringError(name + ": convolution filter sizes must be positive");
+  if(inChannels <= 0 || outChannels <= 0)
+    throw StringError(name + ": number of in and out channels must be positive");
+  if(dilationX <= 0 || dilationY <= 0)
+    throw StringError(name + ": dilation factors must be positive");
+  if(convXSize % 2 != 1 || convYSize % 2 != 1)
+    throw StringError(name + ": convolution filter sizes must be odd, found even sizes");
+}
+
 ConvLayerDesc::ConvLayerDesc(ConvLayerDesc&& other) {
   *this = std::move(other);
 }
@@ -95,11 +108,7 @@ BatchNormLayerDesc::BatchNormLayerDesc(istream& in) {
 
   if(in.fail())
     throw StringError(name + ": bnlayer failed to parse num channels and epsilon and hasScale and hasBias");
-
-  if(numChannels < 1)
-    throw StringError(name + ": numChannels (" + Global::intToString(numChannels) + ") < 1");
-  if(epsilon <= 0)
-    throw StringError(name + ": epsilon (" + Global::floatToString(epsilon) + ") <= 0");
+  validate();
 
   float w;
   mean.resize(numChannels);
@@ -138,6 +147,13 @@ BatchNormLayerDesc::BatchNormLayerDesc(istream& in) {
       name + ": bnlayer failed to parse expected number of batch norm mean, variance, bias, scale values");
 }
 
+void BatchNormLayerDesc::validate() const {
+  if(numChannels < 1)
+    throw StringError(name + ": numChannels (" + Global::intToString(numChannels) + ") < 1");
+  if(epsilon <= 0)
+    throw StringError(name + ": epsilon (" + Global::floatToString(epsilon) + ") <= 0");
+}
+
 BatchNormLayerDesc::BatchNormLayerDesc(BatchNormLayerDesc&& other) {
   *this = std::move(other);
 }
@@ -183,8 +199,7 @@ MatMulLayerDesc::MatMulLayerDesc(istream& in) {
 
   if(in.fail())
     throw StringError(name + ": matmullayer failed to parse num channels");
-  if(inChannels <= 0 || outChannels <= 0)
-    throw StringError(name + ": number of in and out channels must be positive");
+  validate();
 
   // Model file order is ic,oc
   // Cublas order used is also ic,oc since we transpose
@@ -205,6 +220,11 @@ MatMulLayerDesc::MatMulLayerDesc(istream& in) {
     throw StringError(name + ": matmullayer failed to parse expected number of matmul weights");
 }
 
+void MatMulLayerDesc::validate() const {
+  if(inChannels <= 0 || outChannels <= 0)
+    throw StringError(name + ": number of in and out channels must be positive");
+}
+
 MatMulLayerDesc::MatMulLayerDesc(MatMulLayerDesc&& other) {
   *this = std::move(other);
 }
@@ -227,8 +247,7 @@ MatBiasLayerDesc::MatBiasLayerDesc(istream& in) {
 
   if(in.fail())
     throw StringError(name + ": matbiaslayer failed to parse num channels");
-  if(numChannels <= 0)
-    throw StringError(name + ": number of channels must be positive");
+  validate();
 
   weights.resize(numChannels);
 
@@ -242,6 +261,11 @@ MatBiasLayerDesc::MatBiasLayerDesc(istream& in) {
     throw StringError(name + ": matbiaslayer failed to parse expected number of matbias weights");
 }
 
+void MatBiasLayerDesc::validate() const {
+  if(numChannels <= 0)
+    throw StringError(name + ": number of channels must be positive");
+}
+
 MatBiasLayerDesc::MatBiasLayerDesc(MatBiasLayerDesc&& other) {
   *this = std::move(other);
 }
@@ -269,6 +293,18 @@ ResidualBlockDesc::ResidualBlockDesc(istream& in) {
   midActivation = ActivationLayerDesc(in);
   finalConv = ConvLayerDesc(in);
 
+  validate();
+
+  if(in.fail())
+    throw StringError(name + ": res block parse failure (istream fail() return true)");
+}
+
+void ResidualBlockDesc::validate() const {
+  preBN.validate();
+  regularConv.validate();
+  midBN.validate();
+  finalConv.validate();
+
   if(preBN.numChannels != regularConv.inChannels)
     throw StringError(
       name + Global::strprintf(
@@ -281,9 +317,6 @@ ResidualBlockDesc::ResidualBlockDesc(istream& in) {
     throw StringError(
       name + Global::strprintf(
                ": midBN.numChannels (%d) != finalConv.inChannels (%d)", midBN.numChannels, finalConv.inChannels));
-
-  if(in.fail())
-    throw StringError(name + ": res block parse failure (istream fail() return true)");
 }
 
 ResidualBlockDesc::ResidualBlockDesc(ResidualBlockDesc&& other) {
@@ -323,6 +356,19 @@ DilatedResidualBlockDesc::DilatedResidualBlockDesc(istream& in) {
   midActivation = ActivationLayerDesc(in);
   finalConv = ConvLayerDesc(in);
 
+  validate();
+
+  if(in.fail())
+    throw StringError(name + ": dilated res block parse failure (istream fail() return true)");
+}
+
+void DilatedResidualBlockDesc::validate() const {
+  preBN.validate();
+  regularConv.validate();
+  dilatedConv.validate();
+  midBN.validate();
+  finalConv.validate();
+
   if(preBN.numChannels != regularConv.inChannels)
     throw StringError(
       name + Global::strprintf(
@@ -342,9 +388,6 @@ DilatedResidualBlockDesc::DilatedResidualBlockDesc(istream& in) {
     throw StringError(
       name + Global::strprintf(
                ": midBN.numChannels (%d) != finalConv.inChannels (%d)", midBN.numChannels, finalConv.inChannels));
-
-  if(in.fail())
-    throw StringError(name + ": dilated res block parse failure (istream fail() return true)");
 }
 
 DilatedResidualBlockDesc::DilatedResidualBlockDesc(DilatedResidualBlockDesc&& other) {
@@ -389,6 +432,21 @@ GlobalPoolingResidualBlockDesc::GlobalPoolingResidualBlockDesc(istream& in, int
   midActivation = ActivationLayerDesc(in);
   finalConv = ConvLayerDesc(in);
 
+  validate();
+
+  if(in.fail())
+    throw StringError(name + ": gpool res block parse failure (istream fail() return true)");
+}
+
+void GlobalPoolingResidualBlockDesc::validate() const {
+  preBN.validate();
+  regularConv.validate();
+  gpoolConv.validate();
+  gpoolBN.validate();
+  gpoolToBiasMul.validate();
+  midBN.validate();
+  finalConv.validate();
+
   if(preBN.numChannels != regularConv.inChannels)
     throw StringError(
       name + Global::strprintf(
@@ -429,9 +487,6 @@ GlobalPoolingResidualBlockDesc::GlobalPoolingResidualBlockDesc(istream& in, int
     throw StringError(
       name + Global::strprintf(
                ": midBN.numChannels (%d) != finalConv.inChannels (%d)", midBN.numChannels, finalConv.inChannels));
-
-  if(in.fail())
-    throw StringError(name + ": gpool res block parse failure (istream fail() return true)");
 }
 
 GlobalPoolingResidualBlockDesc::GlobalPoolingResidualBlockDesc(GlobalPoolingResidualBlockDesc&& other) {
@@ -482,6 +537,42 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
 
   if(in.fail())
     throw StringError(name + ": trunk failed to parse num blocks or various channel parameters");
+
+  initialConv = ConvLayerDesc(in);
+  if(version >= 3)
+    initialMatMul = MatMulLayerDesc(in);
+
+  string kind;
+  for(int i = 0; i < numBlocks; i++) {
+    in >> kind;
+    if(in.fail())
+      throw StringError(name + ": failed to parse block kind");
+    if(kind == "ordinary_block") {
+      ResidualBlockDesc* desc = new ResidualBlockDesc(in);
+      blocks.push_back(make_pair(ORDINARY_BLOCK_KIND, (void*)desc));
+    } else if(kind == "dilated_block") {
+      DilatedResidualBlockDesc* desc = new DilatedResidualBlockDesc(in);
+      blocks.push_back(make_pair(DILATED_BLOCK_KIND, (void*)desc));
+    } else if(kind == "gpool_block") {
+      GlobalPoolingResidualBlockDesc* desc = new GlobalPoolingResidualBlockDesc(in, version);
+      blocks.push_back(make_pair(GLOBAL_POOLING_BLOCK_KIND, (void*)desc));
+    } else
+      throw StringError(name + ": found unknown block kind: " + kind);
+
+    if(in.fail())
+      throw StringError(name + ": trunk istream fail after parsing block");
+  }
+
+  trunkTipBN = BatchNormLayerDesc(in);
+  trunkTipActivation = ActivationLayerDesc(in);
+
+  if(in.fail())
+    throw StringError(name + ": trunk istream fail after parsing tip");
+
+  validate();
+}
+
+void TrunkDesc::validate() const {
   if(numBlocks < 1)
     throw StringError(name + ": trunk num blocks must be positive");
   if(
@@ -490,8 +581,11 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
     throw StringError(name + ": all numbers of channels must be positive");
   if(midNumChannels != regularNumChannels + dilatedNumChannels)
     throw StringError(name + ": midNumChannels != regularNumChannels + dilatedNumChannels");
+  if((int)blocks.size() != numBlocks)
+    throw StringError(
+      name + Global::strprintf(": number of blocks (%d) != numBlocks (%d)", (int)blocks.size(), numBlocks));
 
-  initialConv = ConvLayerDesc(in);
+  initialConv.validate();
   if(initialConv.outChannels != trunkNumChannels)
     throw StringError(
       name + Global::strprintf(
@@ -499,9 +593,8 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
                initialConv.name.c_str(),
                initialConv.outChannels,
                trunkNumChannels));
-
   if(version >= 3) {
-    initialMatMul = MatMulLayerDesc(in);
+    initialMatMul.validate();
     if(initialMatMul.outChannels != trunkNumChannels)
       throw StringError(
         name + Global::strprintf(
@@ -511,14 +604,10 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
                  trunkNumChannels));
   }
 
-  string kind;
-  for(int i = 0; i < numBlocks; i++) {
-    in >> kind;
-    if(in.fail())
-      throw StringError(name + ": failed to parse block kind");
-    if(kind == "ordinary_block") {
-      ResidualBlockDesc* desc = new ResidualBlockDesc(in);
-
+  for(int i = 0; i < blocks.size(); i++) {
+    if(blocks[i].first == ORDINARY_BLOCK_KIND) {
+      const ResidualBlockDesc* desc = (const ResidualBlockDesc*)blocks[i].second;
+      desc->validate();
       if(desc->preBN.numChannels != trunkNumChannels)
         throw StringError(
           name + Global::strprintf(
@@ -547,11 +636,9 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
                    desc->name.c_str(),
                    desc->finalConv.outChannels,
                    trunkNumChannels));
-
-      blocks.push_back(make_pair(ORDINARY_BLOCK_KIND, (void*)desc));
-    } else if(kind == "dilated_block") {
-      DilatedResidualBlockDesc* desc = new DilatedResidualBlockDesc(in);
-
+    } else if(blocks[i].first == DILATED_BLOCK_KIND) {
+      const DilatedResidualBlockDesc* desc = (const DilatedResidualBlockDesc*)blocks[i].second;
+      desc->validate();
       if(desc->preBN.numChannels != trunkNumChannels)
         throw StringError(
           name + Global::strprintf(
@@ -580,11 +667,12 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
                    desc->name.c_str(),
                    desc->finalConv.outChannels,
                    trunkNumChannels));
-
-      blocks.push_back(make_pair(DILATED_BLOCK_KIND, (void*)desc));
-    } else if(kind == "gpool_block") {
-      GlobalPoolingResidualBlockDesc* desc = new GlobalPoolingResidualBlockDesc(in, version);
-
+    } else if(blocks[i].first == GLOBAL_POOLING_BLOCK_KIND) {
+      const GlobalPoolingResidualBlockDesc* desc = (const GlobalPoolingResidualBlockDesc*)blocks[i].second;
+      desc->validate();
+      if(desc->version != version)
+        throw StringError(
+          name + Global::strprintf(": %s version (%d) != trunk version (%d)", desc->name.c_str(), desc->version, version));
       if(desc->preBN.numChannels != trunkNumChannels)
         throw StringError(
           name + Global::strprintf(
@@ -613,25 +701,15 @@ TrunkDesc::TrunkDesc(istream& in, int vrsn) {
                    desc->name.c_str(),
                    desc->finalConv.outChannels,
                    trunkNumChannels));
-
-      blocks.push_back(make_pair(GLOBAL_POOLING_BLOCK_KIND, (void*)desc));
     } else
-      throw StringError(name + ": found unknown block kind: " + kind);
-
-    if(in.fail())
-      throw StringError(name + ": trunk istream fail after parsing block");
+      throw StringError(name + ": found unknown block kind");
   }
 
-  trunkTipBN = BatchNormLayerDesc(in);
-  trunkTipActivation = ActivationLayerDesc(in);
-
+  trunkTipBN.validate();
   if(trunkTipBN.numChannels != trunkNumChannels)
     throw StringError(
       name + Global::strprintf(
                ": trunkTipBN.numChannels (%d) != trunkNumChannels (%d)", trunkTipBN.numChannels, trunkNumChannels));
-
-  if(in.fail())
-    throw StringError(name + ": trunk istream fail after parsing tip");
 }
 
 TrunkDesc::~TrunkDesc() {
@@ -739,6 +817,18 @@ PolicyHeadDesc::PolicyHeadDesc(istream& in, int vrsn) {
   if(in.fail())
     throw StringError(name + ": policy head istream fail after parsing layers");
 
+  validate();
+}
+
+void PolicyHeadDesc::validate() const {
+  p1Conv.validate();
+  g1Conv.validate();
+  g1BN.validate();
+  gpoolToBiasMul.validate();
+  p1BN.validate();
+  p2Conv.validate();
+  gpoolToPassMul.validate();
+
   if(p1Conv.outChannels != p1BN.numChannels)
     throw StringError(
       name +
@@ -855,6 +945,22 @@ ValueHeadDesc::ValueHeadDesc(istream& in, int vrsn) {
   if(in.fail())
     throw StringError(name + ": value head istream fail after parsing layers");
 
+  validate();
+}
+
+void ValueHeadDesc::validate() const {
+  v1Conv.validate();
+  v1BN.validate();
+  v2Mul.validate();
+  v2Bias.validate();
+  v3Mul.validate();
+  v3Bias.validate();
+  if(version >= 3) {
+    sv3Mul.validate();
+    sv3Bias.validate();
+    vOwnershipConv.validate();
+  }
+
   if(v1Conv.outChannels != v1BN.numChannels)
     throw StringError(
       name +
@@ -1017,6 +1123,43 @@ ModelDesc::ModelDesc(istream& in) {
   if(in.fail())
     throw StringError(name + ": model desc istream fail after parsing model");
 
+  validate();
+}
+
+void ModelDesc::validate() const {
+  if(version < 1 || version > NNModelVersion::latestModelVersionImplemented)
+    throw StringError(name + ": model found unsupported version " + Global::intToString(version));
+  if(version < 3 && (xSizePreV3 <= 0 || ySizePreV3 <= 0))
+    throw StringError(name + ": model xSize and ySize must be positive");
+  if(numInputChannels <= 0)
+    throw StringError(name + ": model numInputChannels must be positive");
+  if(version >= 3 && numInputGlobalChannels <= 0)
+    throw StringError(name + ": model numInputGlobalChannels must be positive");
+  if(trunk.version != version || policyHead.version != version || valueHead.version != version)
+    throw StringError(name + ": trunk and head versions do not match model version");
+
+  trunk.validate();
+  policyHead.validate();
+  valueHead.validate();
+
+  if(numValueChannels != valueHead.v3Mul.outChannels)
+    throw StringError(
+      name + Global::strprintf(
+               ": numValueChannels (%d) != valueHead.v3Mul.outChannels (%d)",
+               numValueChannels,
+               valueHead.v3Mul.outChannels));
+  if(numScoreValueChannels != valueHead.sv3Mul.outChannels)
+    throw StringError(
+      name + Global::strprintf(
+               ": numScoreValueChannels (%d) != valueHead.sv3Mul.outChannels (%d)",
+               numScoreValueChannels,
+               valueHead.sv3Mul.outChannels));
+  if(numOwnershipChannels != valueHead.vOwnershipConv.outChannels)
+    throw StringError(
+      name + Global::strprintf(
+               ": numOwnershipChannels (%d) != valueHead.vOwnershipConv.outChannels (%d)",
+               numOwnershipChannels,
+               valueHead.vOwnershipConv.outChannels));
   if(numInputChannels != trunk.initialConv.inChannels)
     throw StringError(
       name + Global::strprintf(
@@ -1118,11 +1261,483 @@ struct NonCopyingStreamBuf : public std::streambuf
   }
 };
 
+//-----------------------------------------------------------------------------
+
+//Binary model file layout, little endian:
+//Header, BINARY_HEADER_BYTES long
+//  char[8] magic
+//  uint32 formatVersion
+//  uint32 byteOrderMark
+//  uint64 structureOffset, structureBytes
+//  uint64 tensorOffset, tensorBytes
+//  uint64 checksum of everything after the header
+//  uint64 unused, zero
+//Structure section
+//  Every field of every desc in the order of the serialize functions below. Ints and floats are 4 bytes, bools 1 byte,
+//  strings a uint32 length followed by the chars, and weight vectors a uint64 offset into the tensor section followed
+//  by a uint64 number of floats.
+//Tensor section
+//  The weights, already in the order the descs store them, each vector starting at a multiple of BINARY_ALIGN bytes.
+//  The file is padded to a multiple of BINARY_ALIGN bytes.
+//
+//Loading a binary file is fully validated. The header and checksum are checked, every length and offset in the
+//structure is checked against the file so that nothing is read out of bounds, and the resulting desc then goes through
+//the same consistency checks as parsing the text format.
+
+static const char BINARY_MAGIC[8] = {'K','G','M','O','D','E','L','B'};
+static const uint32_t BINARY_FORMAT_VERSION = 1;
+static const uint32_t BINARY_BYTE_ORDER_MARK = 0x01020304;
+static const uint64_t BINARY_HEADER_BYTES = 64;
+static const uint64_t BINARY_ALIGN = 64;
+
+static bool isLittleEndianHost() {
+  uint32_t x = BINARY_BYTE_ORDER_MARK;
+  uint8_t firstByte;
+  std::memcpy(&firstByte, &x, 1);
+  return firstByte == 0x04;
+}
+
+static uint64_t roundUpToAlign(uint64_t x) {
+  return (x + BINARY_ALIGN - 1) / BINARY_ALIGN * BINARY_ALIGN;
+}
+
+static uint64_t computeBinaryChecksum(const char* data, uint64_t numBytes) {
+  assert(numBytes % 8 == 0);
+  uint64_t checksum = Hash::murmurMix(BINARY_FORMAT_VERSION);
+  uint64_t word;
+  for(uint64_t i = 0; i < numBytes; i += 8) {
+    std::memcpy(&word, data + i, sizeof(word));
+    checksum = Hash::murmurMix(checksum ^ word);
+  }
+  return checksum;
+}
+
+namespace {
+  struct BinaryModelWriter {
+    string structure;
+    string tensors;
+
+    void putBytes(const void* p, size_t n) {
+      structure.append((const char*)p, n);
+    }
+    void field(const string& s) {
+      uint32_t len = (uint32_t)s.size();
+      putBytes(&len, sizeof(len));
+      putBytes(s.data(), s.size());
+    }
+    void field(int x) {
+      int32_t v = x;
+      putBytes(&v, sizeof(v));
+    }
+    void field(float x) {
+      putBytes(&x, sizeof(x));
+    }
+    void field(bool x) {
+      uint8_t v = x ? 1 : 0;
+      putBytes(&v, sizeof(v));
+    }
+    void field(const vector<float>& v) {
+      tensors.resize(roundUpToAlign(tensors.size()), '\0');
+      uint64_t offset = tensors.size();
+      uint64_t count = v.size();
+      putBytes(&offset, sizeof(offset));
+      putBytes(&count, sizeof(count));
+      tensors.append((const char*)v.data(), v.size() * sizeof(float));
+    }
+    void checkCount(const vector<float>& v, int64_t expected, const string& name) {
+      (void)v;
+      (void)expected;
+      (void)name;
+    }
+    void blockKinds(const vector<pair<int, void*>>& blocks) {
+      for(size_t i = 0; i < blocks.size(); i++)
+        field(blocks[i].first);
+    }
+  };
+
+  struct BinaryModelReader {
+    const char* structure;
+    uint64_t structureBytes;
+    uint64_t pos;
+    const char* tensors;
+    uint64_t tensorBytes;
+
+    void getBytes(void* p, uint64_t n) {
+      if(n > structureBytes - pos)
+        throw StringError("binary model structure section is truncated");
+      std::memcpy(p, structure + pos, n);
+      pos += n;
+    }
+    void field(string& s) {
+      uint32_t len;
+      getBytes(&len, sizeof(len));
+      if(len > structureBytes - pos)
+        throw StringError("binary model structure section is truncated");
+      s.assign(structure + pos, len);
+      pos += len;
+    }
+    void field(int& x) {
+      int32_t v;
+      getBytes(&v, sizeof(v));
+      x = v;
+    }
+    void field(float& x) {
+      getBytes(&x, sizeof(x));
+    }
+    void field(bool& x) {
+      uint8_t v;
+      getBytes(&v, sizeof(v));
+      if(v > 1)
+        throw StringError("binary model has an invalid bool");
+      x = v != 0;
+    }
+    void field(vector<float>& v) {
+      uint64_t offset;
+      uint64_t count;
+      getBytes(&offset, sizeof(offset));
+      getBytes(&count, sizeof(count));
+      if(offset % BINARY_ALIGN != 0 || offset > tensorBytes || count > (tensorBytes - offset) / sizeof(float))
+        throw StringError("binary model has a tensor out of bounds of the tensor section");
+      v.resize(count);
+      std::memcpy(v.data(), tensors + offset, count * sizeof(float));
+    }
+    void checkCount(const vector<float>& v, int64_t expected, const string& name) {
+      if((int64_t)v.size() != expected)
+        throw StringError(name + ": binary model tensor size does not match its dimensions");
+    }
+    void blockKinds(vector<pair<int, void*>>& blocks, int numBlocks) {
+      if(numBlocks < 0 || (uint64_t)numBlocks > (structureBytes - pos) / sizeof(int32_t))
+        throw StringError("binary model has an invalid number of blocks");
+      for(int i = 0; i < numBlocks; i++) {
+        int kind;
+        field(kind);
+        if(kind == ORDINARY_BLOCK_KIND)
+          blocks.push_back(make_pair(kind, (void*)new ResidualBlockDesc()));
+        else if(kind == DILATED_BLOCK_KIND)
+          blocks.push_back(make_pair(kind, (void*)new DilatedResidualBlockDesc()));
+        else if(kind == GLOBAL_POOLING_BLOCK_KIND)
+          blocks.push_back(make_pair(kind, (void*)new GlobalPoolingResidualBlockDesc()));
+        else
+          throw StringError("binary model has an unknown block kind");
+      }
+    }
+  };
+}
+
+static void serializeBlockKinds(BinaryModelWriter& ar, const TrunkDesc& d) {
+  ar.blockKinds(d.blocks);
+}
+static void serializeBlockKinds(BinaryModelReader& ar, TrunkDesc& d) {
+  ar.blockKinds(d.blocks, d.numBlocks);
+}
+
+//Each of these is used both to write, with Desc const, and to read.
+template <typename Archive, typename Desc>
+static void serializeConv(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.convYSize);
+  ar.field(d.convXSize);
+  ar.field(d.inChannels);
+  ar.field(d.outChannels);
+  ar.field(d.dilationY);
+  ar.field(d.dilationX);
+  ar.field(d.weights);
+  ar.checkCount(d.weights, (int64_t)d.convYSize * d.convXSize * d.inChannels * d.outChannels, d.name);
+}
+
+template <typename Archive, typename Desc>
+static void serializeBN(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.numChannels);
+  ar.field(d.epsilon);
+  ar.field(d.hasScale);
+  ar.field(d.hasBias);
+  ar.field(d.mean);
+  ar.field(d.variance);
+  ar.field(d.scale);
+  ar.field(d.bias);
+  ar.checkCount(d.mean, d.numChannels, d.name);
+  ar.checkCount(d.variance, d.numChannels, d.name);
+  ar.checkCount(d.scale, d.numChannels, d.name);
+  ar.checkCount(d.bias, d.numChannels, d.name);
+}
+
+template <typename Archive, typename Desc>
+static void serializeActivation(Archive& ar, Desc& d) {
+  ar.field(d.name);
+}
+
+template <typename Archive, typename Desc>
+static void serializeMatMul(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.inChannels);
+  ar.field(d.outChannels);
+  ar.field(d.weights);
+  ar.checkCount(d.weights, (int64_t)d.inChannels * d.outChannels, d.name);
+}
+
+template <typename Archive, typename Desc>
+static void serializeMatBias(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.numChannels);
+  ar.field(d.weights);
+  ar.checkCount(d.weights, d.numChannels, d.name);
+}
+
+template <typename Archive, typename Desc>
+static void serializeResidualBlock(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  serializeBN(ar, d.preBN);
+  serializeActivation(ar, d.preActivation);
+  serializeConv(ar, d.regularConv);
+  serializeBN(ar, d.midBN);
+  serializeActivation(ar, d.midActivation);
+  serializeConv(ar, d.finalConv);
+}
+
+template <typename Archive, typename Desc>
+static void serializeDilatedResidualBlock(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  serializeBN(ar, d.preBN);
+  serializeActivation(ar, d.preActivation);
+  serializeConv(ar, d.regularConv);
+  serializeConv(ar, d.dilatedConv);
+  serializeBN(ar, d.midBN);
+  serializeActivation(ar, d.midActivation);
+  serializeConv(ar, d.finalConv);
+}
+
+template <typename Archive, typename Desc>
+static void serializeGlobalPoolingResidualBlock(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.version);
+  serializeBN(ar, d.preBN);
+  serializeActivation(ar, d.preActivation);
+  serializeConv(ar, d.regularConv);
+  serializeConv(ar, d.gpoolConv);
+  serializeBN(ar, d.gpoolBN);
+  serializeActivation(ar, d.gpoolActivation);
+  serializeMatMul(ar, d.gpoolToBiasMul);
+  serializeBN(ar, d.midBN);
+  serializeActivation(ar, d.midActivation);
+  serializeConv(ar, d.finalConv);
+}
+
+template <typename Archive, typename Desc>
+static void serializeTrunk(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.version);
+  ar.field(d.numBlocks);
+  ar.field(d.trunkNumChannels);
+  ar.field(d.midNumChannels);
+  ar.field(d.regularNumChannels);
+  ar.field(d.dilatedNumChannels);
+  ar.field(d.gpoolNumChannels);
+  serializeConv(ar, d.initialConv);
+  serializeMatMul(ar, d.initialMatMul);
+  serializeBlockKinds(ar, d);
+  for(size_t i = 0; i < d.blocks.size(); i++) {
+    if(d.blocks[i].first == ORDINARY_BLOCK_KIND)
+      serializeResidualBlock(ar, *(ResidualBlockDesc*)d.blocks[i].second);
+    else if(d.blocks[i].first == DILATED_BLOCK_KIND)
+      serializeDilatedResidualBlock(ar, *(DilatedResidualBlockDesc*)d.blocks[i].second);
+    else if(d.blocks[i].first == GLOBAL_POOLING_BLOCK_KIND)
+      serializeGlobalPoolingResidualBlock(ar, *(GlobalPoolingResidualBlockDesc*)d.blocks[i].second);
+    else
+      ASSERT_UNREACHABLE;
+  }
+  serializeBN(ar, d.trunkTipBN);
+  serializeActivation(ar, d.trunkTipActivation);
+}
+
+template <typename Archive, typename Desc>
+static void serializePolicyHead(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.version);
+  serializeConv(ar, d.p1Conv);
+  serializeConv(ar, d.g1Conv);
+  serializeBN(ar, d.g1BN);
+  serializeActivation(ar, d.g1Activation);
+  serializeMatMul(ar, d.gpoolToBiasMul);
+  serializeBN(ar, d.p1BN);
+  serializeActivation(ar, d.p1Activation);
+  serializeConv(ar, d.p2Conv);
+  serializeMatMul(ar, d.gpoolToPassMul);
+}
+
+template <typename Archive, typename Desc>
+static void serializeValueHead(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.version);
+  serializeConv(ar, d.v1Conv);
+  serializeBN(ar, d.v1BN);
+  serializeActivation(ar, d.v1Activation);
+  serializeMatMul(ar, d.v2Mul);
+  serializeMatBias(ar, d.v2Bias);
+  serializeActivation(ar, d.v2Activation);
+  serializeMatMul(ar, d.v3Mul);
+  serializeMatBias(ar, d.v3Bias);
+  serializeMatMul(ar, d.sv3Mul);
+  serializeMatBias(ar, d.sv3Bias);
+  serializeConv(ar, d.vOwnershipConv);
+}
+
+template <typename Archive, typename Desc>
+static void serializeModel(Archive& ar, Desc& d) {
+  ar.field(d.name);
+  ar.field(d.version);
+  ar.field(d.xSizePreV3);
+  ar.field(d.ySizePreV3);
+  ar.field(d.numInputChannels);
+  ar.field(d.numInputGlobalChannels);
+  ar.field(d.numValueChannels);
+  ar.field(d.numScoreValueChannels);
+  ar.field(d.numOwnershipChannels);
+  serializeTrunk(ar, d.trunk);
+  serializePolicyHead(ar, d.policyHead);
+  serializeValueHead(ar, d.valueHead);
+}
+
+static bool hasBinaryModelMagic(const string& fileName) {
+  ifstream in(fileName.c_str(), ios::in | ios::binary);
+  if(!in.good())
+    throw StringError("Could not open file - does not exist or invalid permissions?");
+  char magic[sizeof(BINARY_MAGIC)];
+  in.read(magic, sizeof(magic));
+  return in.gcount() == sizeof(magic) && std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+static void parseBinaryModel(const char* data, uint64_t numBytes, ModelDesc& descBuf) {
+  if(!isLittleEndianHost())
+    throw StringError("Binary model files are only supported on little endian machines");
+  if(numBytes < BINARY_HEADER_BYTES)
+    throw StringError("Binary model file is truncated");
+
+  uint32_t formatVersion;
+  uint32_t byteOrderMark;
+  uint64_t structureOffset;
+  uint64_t structureBytes;
+  uint64_t tensorOffset;
+  uint64_t tensorBytes;
+  uint64_t checksum;
+  uint64_t unused;
+  std::memcpy(&formatVersion, data + 8, sizeof(uint32_t));
+  std::memcpy(&byteOrderMark, data + 12, sizeof(uint32_t));
+  std::memcpy(&structureOffset, data + 16, sizeof(uint64_t));
+  std::memcpy(&structureBytes, data + 24, sizeof(uint64_t));
+  std::memcpy(&tensorOffset, data + 32, sizeof(uint64_t));
+  std::memcpy(&tensorBytes, data + 40, sizeof(uint64_t));
+  std::memcpy(&checksum, data + 48, sizeof(uint64_t));
+  std::memcpy(&unused, data + 56, sizeof(uint64_t));
+
+  if(formatVersion != BINARY_FORMAT_VERSION)
+    throw StringError("Binary model file has unsupported format version " + Global::uint64ToString(formatVersion));
+  if(byteOrderMark != BINARY_BYTE_ORDER_MARK)
+    throw StringError("Binary model file has the wrong byte order");
+  if(
+    structureOffset != BINARY_HEADER_BYTES || structureBytes > numBytes - structureOffset ||
+    tensorOffset != roundUpToAlign(structureOffset + structureBytes) || tensorOffset > numBytes ||
+    tensorBytes != numBytes - tensorOffset || tensorBytes % BINARY_ALIGN != 0 || unused != 0)
+    throw StringError("Binary model file is truncated or has an inconsistent header");
+  if(computeBinaryChecksum(data + BINARY_HEADER_BYTES, numBytes - BINARY_HEADER_BYTES) != checksum)
+    throw StringError("Binary model file is corrupt, checksum does not match");
+
+  BinaryModelReader reader;
+  reader.structure = data + structureOffset;
+  reader.structureBytes = structureBytes;
+  reader.pos = 0;
+  reader.tensors = data + tensorOffset;
+  reader.tensorBytes = tensorBytes;
+
+  ModelDesc desc;
+  serializeModel(reader, desc);
+  if(reader.pos != structureBytes)
+    throw StringError("Binary model file has unexpected extra data in its structure section");
+  //The same checks as loading the text format, so that the backends can rely on the channels being consistent
+  desc.validate();
+  descBuf = std::move(desc);
+}
+
+static void loadBinaryModelFile(const string& fileName, ModelDesc& descBuf) {
+#ifdef OS_IS_UNIX_OR_APPLE
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw StringError("Could not open file - does not exist or invalid permissions?");
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw StringError("Could not stat file");
+  }
+  uint64_t numBytes = (uint64_t)st.st_size;
+  if(numBytes < BINARY_HEADER_BYTES) {
+    close(fd);
+    throw StringError("Binary model file is truncated");
+  }
+  void* ptr = mmap(NULL, numBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(ptr == MAP_FAILED)
+    throw StringError("Could not memory map file");
+  //The checksum and then the copy each make one pass front to back
+  madvise(ptr, numBytes, MADV_SEQUENTIAL);
+  try {
+    parseBinaryModel((const char*)ptr, numBytes, descBuf);
+  }
+  catch(...) {
+    munmap(ptr, numBytes);
+    throw;
+  }
+  munmap(ptr, numBytes);
+#else
+  string contents;
+  readEntireFileIntoString(fileName, contents);
+  parseBinaryModel(contents.data(), contents.size(), descBuf);
+#endif
+}
+
+void ModelDesc::saveToBinaryFile(const string& fileName) const {
+  if(!isLittleEndianHost())
+    throw StringError("Binary model files are only supported on little endian machines");
+
+  BinaryModelWriter writer;
+  serializeModel(writer, *this);
+
+  uint64_t structureOffset = BINARY_HEADER_BYTES;
+  uint64_t structureBytes = writer.structure.size();
+  uint64_t tensorOffset = roundUpToAlign(structureOffset + structureBytes);
+  writer.tensors.resize(roundUpToAlign(writer.tensors.size()), '\0');
+  uint64_t tensorBytes = writer.tensors.size();
+
+  string contents(tensorOffset + tensorBytes, '\0');
+  std::memcpy(&contents[structureOffset], writer.structure.data(), structureBytes);
+  std::memcpy(&contents[tensorOffset], writer.tensors.data(), tensorBytes);
+
+  uint64_t checksum = computeBinaryChecksum(&contents[BINARY_HEADER_BYTES], contents.size() - BINARY_HEADER_BYTES);
+  std::memcpy(&contents[0], BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  std::memcpy(&contents[8], &BINARY_FORMAT_VERSION, sizeof(uint32_t));
+  std::memcpy(&contents[12], &BINARY_BYTE_ORDER_MARK, sizeof(uint32_t));
+  std::memcpy(&contents[16], &structureOffset, sizeof(uint64_t));
+  std::memcpy(&contents[24], &structureBytes, sizeof(uint64_t));
+  std::memcpy(&contents[32], &tensorOffset, sizeof(uint64_t));
+  std::memcpy(&contents[40], &tensorBytes, sizeof(uint64_t));
+  std::memcpy(&contents[48], &checksum, sizeof(uint64_t));
+
+  ofstream out(fileName.c_str(), ios::out | ios::binary | ios::trunc);
+  if(!out.good())
+    throw StringError("Could not open file for writing: " + fileName);
+  out.write(contents.data(), contents.size());
+  out.close();
+  if(out.fail())
+    throw StringError("Error writing binary model file: " + fileName);
+}
+
 void ModelDesc::loadFromFileMaybeGZipped(const string& fileName, ModelDesc& descBuf) {
   try {
     string lower = Global::toLower(fileName);
+    if(hasBinaryModelMagic(fileName)) {
+      loadBinaryModelFile(fileName, descBuf);
+    }
     //Read model file with no compression if it's directly named .txt
-    if(Global::isSuffix(lower,".txt")) {
+    else if(Global::isSuffix(lower,".txt")) {
       std::ifstream in(fileName);
       if(!in.good())
         throw StringError("Could not open file - does not exist or invalid permissions?");
@@ -28,6 +28,8 @@ struct ConvLayerDesc {
   ConvLayerDesc& operator=(const ConvLayerDesc&) = delete;
 
   ConvLayerDesc& operator=(ConvLayerDesc&& other);
+
+  void validate() const;
 };
 
 struct BatchNormLayerDesc {
@@ -49,6 +51,8 @@ struct BatchNormLayerDesc {
   BatchNormLayerDesc& operator=(const BatchNormLayerDesc&) = delete;
 
   BatchNormLayerDesc& operator=(BatchNormLayerDesc&& other);
+
+  void validate() const;
 };
 
 struct ActivationLayerDesc {
@@ -78,6 +82,8 @@ struct MatMulLayerDesc {
   MatMulLayerDesc& operator=(const MatMulLayerDesc&) = delete;
 
   MatMulLayerDesc& operator=(MatMulLayerDesc&& other);
+
+  void validate() const;
 };
 
 struct MatBiasLayerDesc {
@@ -93,6 +99,8 @@ struct MatBiasLayerDesc {
   MatBiasLayerDesc& operator=(const MatBiasLayerDesc&) = delete;
 
   MatBiasLayerDesc& operator=(MatBiasLayerDesc&& other);
+
+  void validate() const;
 };
 
 struct ResidualBlockDesc {
@@ -113,6 +121,8 @@ struct ResidualBlockDesc {
 
   ResidualBlockDesc& operator=(ResidualBlockDesc&& other);
 
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
 };
 
@@ -135,6 +145,8 @@ struct DilatedResidualBlockDesc {
 
   DilatedResidualBlockDesc& operator=(DilatedResidualBlockDesc&& other);
 
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
 };
 
@@ -161,6 +173,8 @@ struct GlobalPoolingResidualBlockDesc {
 
   GlobalPoolingResidualBlockDesc& operator=(GlobalPoolingResidualBlockDesc&& other);
 
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
 };
 
@@ -193,6 +207,8 @@ struct TrunkDesc {
 
   TrunkDesc& operator=(TrunkDesc&& other);
 
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
 };
 
@@ -219,6 +235,8 @@ struct PolicyHeadDesc {
 
   PolicyHeadDesc& operator=(PolicyHeadDesc&& other);
 
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
 };
 
@@ -247,6 +265,8 @@ struct ValueHeadDesc {
 
   ValueHeadDesc& operator=(ValueHeadDesc&& other);
 
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
 };
 
@@ -275,11 +295,18 @@ struct ModelDesc {
 
   ModelDesc& operator=(ModelDesc&& other);
 
+  //Throws a StringError if the sizes and channels of any layers are inconsistent with each other.
+  //Loading either format already calls this.
+  void validate() const;
+
   void iterConvLayers(std::function<void(const ConvLayerDesc& dest)> f) const;
   int maxConvChannels(int convXSize, int convYSize) const;
 
-  //Loads a model from a file that may or may not be gzipped, storing it in descBuf
+  //Loads a model from a file that may or may not be gzipped, or that is in the binary format, storing it in descBuf
   static void loadFromFileMaybeGZipped(const std::string& fileName, ModelDesc& descBuf);
+  //Writes the model in a binary format with the weights already laid out as in memory, which loads far faster than
+  //parsing the text format. Loading a binary file is also done by loadFromFileMaybeGZipped.
+  void saveToBinaryFile(const std::string& fileName) const;
 
   //Return the "nearest" supported ruleset to desiredRules by this model.
   //Fills supported with true if desiredRules itself was exactly supported, false if some modifications had to be made.
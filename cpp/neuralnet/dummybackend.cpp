@@ -114,7 +114,7 @@ float* NeuralNet::getBatchEltGlobalInplace(InputBuffers* buffers, int nIdx) {
   throw StringError("Dummy neural net backend: NeuralNet::getBatchEltGlobalInplace unimplemented");
 }
 
-bool* NeuralNet::getSymmetriesInplace(InputBuffers* buffers) {
+int* NeuralNet::getSymmetriesInplace(InputBuffers* buffers) {
   (void)buffers;
   throw StringError("Dummy neural net backend: NeuralNet::getSymmetriesInplace unimplemented");
 }
@@ -242,7 +242,7 @@ bool NeuralNet::testEvaluateSymmetry(
   int nnYLen,
   bool useFP16,
   bool useNHWC,
-  const bool* symmetriesBuffer,
+  const int* symmetriesBuffer,
   const std::vector<float>& inputBuffer,
   std::vector<float>& outputBuffer
 ) {
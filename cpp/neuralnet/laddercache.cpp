@@ -0,0 +1,85 @@
+#include "../neuralnet/laddercache.h"
+
+using namespace std;
+
+LadderCache::LadderCache(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo)
+  :m_numHits(0),
+   m_numMisses(0)
+{
+  if(sizePowerOfTwo < 0 || sizePowerOfTwo > 40)
+    throw StringError("LadderCache: Invalid sizePowerOfTwo: " + Global::intToString(sizePowerOfTwo));
+  if(mutexPoolSizePowerOfTwo < 0 || mutexPoolSizePowerOfTwo > 31)
+    throw StringError("LadderCache: Invalid mutexPoolSizePowerOfTwo: " + Global::intToString(mutexPoolSizePowerOfTwo));
+
+  uint64_t tableSize = ((uint64_t)1) << sizePowerOfTwo;
+  tableMask = tableSize-1;
+  entries = new Entry[tableSize];
+  uint32_t mutexPoolSize = ((uint32_t)1) << mutexPoolSizePowerOfTwo;
+  mutexPoolMask = mutexPoolSize-1;
+  mutexPool = new MutexPool(mutexPoolSize);
+  clear();
+}
+
+LadderCache::~LadderCache() {
+  delete[] entries;
+  delete mutexPool;
+}
+
+Hash128 LadderCache::getBoardHash(const Board& board) {
+  //The ko matters for the attacker's first move against a 2 liberty chain
+  Hash128 hash = board.pos_hash;
+  if(board.ko_loc != Board::NULL_LOC)
+    hash ^= Board::ZOBRIST_KO_LOC_HASH[board.ko_loc];
+  return hash;
+}
+
+uint64_t LadderCache::getEntryIdx(Hash128 boardHash, Loc loc) const {
+  return Hash::murmurMix(boardHash.hash0 + (uint64_t)loc) & tableMask;
+}
+
+bool LadderCache::get(Hash128 boardHash, Loc loc, bool& laddered, vector<Loc>& workingMoves) {
+  uint64_t idx = getEntryIdx(boardHash,loc);
+  std::mutex& mutex = mutexPool->getMutex((uint32_t)idx & mutexPoolMask);
+  std::lock_guard<std::mutex> lock(mutex);
+  const Entry& entry = entries[idx];
+  if(entry.loc != loc || entry.boardHash != boardHash) {
+    m_numMisses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  laddered = entry.laddered;
+  workingMoves.assign(entry.workingMoves, entry.workingMoves + entry.numWorkingMoves);
+  m_numHits.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void LadderCache::set(Hash128 boardHash, Loc loc, bool laddered, const vector<Loc>& workingMoves) {
+  assert(loc != Board::NULL_LOC);
+  assert(workingMoves.size() <= MAX_WORKING_MOVES);
+  uint64_t idx = getEntryIdx(boardHash,loc);
+  std::mutex& mutex = mutexPool->getMutex((uint32_t)idx & mutexPoolMask);
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry& entry = entries[idx];
+  entry.boardHash = boardHash;
+  entry.loc = loc;
+  entry.laddered = laddered;
+  entry.numWorkingMoves = (uint8_t)workingMoves.size();
+  std::copy(workingMoves.begin(), workingMoves.end(), entry.workingMoves);
+}
+
+void LadderCache::clear() {
+  for(uint64_t idx = 0; idx <= tableMask; idx++) {
+    std::mutex& mutex = mutexPool->getMutex((uint32_t)idx & mutexPoolMask);
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[idx].loc = Board::NULL_LOC;
+  }
+}
+
+int64_t LadderCache::getNumBytes() const {
+  return (int64_t)((tableMask+1) * sizeof(Entry));
+}
+uint64_t LadderCache::numHits() const {
+  return m_numHits.load(std::memory_order_relaxed);
+}
+uint64_t LadderCache::numMisses() const {
+  return m_numMisses.load(std::memory_order_relaxed);
+}
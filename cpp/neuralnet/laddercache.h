@@ -0,0 +1,58 @@
+#ifndef NEURALNET_LADDERCACHE_H_
+#define NEURALNET_LADDERCACHE_H_
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/multithread.h"
+#include "../game/board.h"
+#include "../search/mutexpool.h"
+
+//Ladder statuses of chains, for computing the ladder features of neural net inputs. Those need the statuses on the
+//current board and the previous two, and the previous ones were usually already featurized a ply or two earlier, so
+//most of the ladder searches for a position can be skipped by looking them up here.
+//
+//Keyed by the hash of the board, including the ko, and by any stone of the chain, since that determines the chain
+//given the position. Entries are in a fixed size table, where a new entry simply replaces whatever was in its slot.
+class LadderCache {
+ public:
+  //A 2 liberty chain has at most 2 working moves, its liberties
+  static const int MAX_WORKING_MOVES = 2;
+
+  LadderCache(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo);
+  ~LadderCache();
+
+  LadderCache(const LadderCache& other) = delete;
+  LadderCache& operator=(const LadderCache& other) = delete;
+
+  static Hash128 getBoardHash(const Board& board);
+
+  //These are thread-safe. For a 2 liberty chain, workingMoves are the moves that put it in a working ladder.
+  bool get(Hash128 boardHash, Loc loc, bool& laddered, std::vector<Loc>& workingMoves);
+  void set(Hash128 boardHash, Loc loc, bool laddered, const std::vector<Loc>& workingMoves);
+  void clear();
+
+  int64_t getNumBytes() const;
+  uint64_t numHits() const;
+  uint64_t numMisses() const;
+
+ private:
+  struct Entry {
+    Hash128 boardHash;
+    Loc loc; //NULL_LOC if the entry is empty
+    bool laddered;
+    uint8_t numWorkingMoves;
+    Loc workingMoves[MAX_WORKING_MOVES];
+  };
+
+  Entry* entries;
+  uint64_t tableMask;
+  uint32_t mutexPoolMask;
+  MutexPool* mutexPool;
+
+  std::atomic<uint64_t> m_numHits;
+  std::atomic<uint64_t> m_numMisses;
+
+  uint64_t getEntryIdx(Hash128 boardHash, Loc loc) const;
+};
+
+#endif  // NEURALNET_LADDERCACHE_H_
@@ -0,0 +1,179 @@
+#include "../neuralnet/nnbatching.h"
+
+#include <cmath>
+
+using namespace std;
+
+//Weight of the newest batch in the latency fit, and of the newest wait in the usefulness average
+static const double FIT_DECAY = 0.05;
+static const double USEFULNESS_DECAY = 0.05;
+//Keep probing with short waits even when waiting has stopped gaining rows, so that the policy notices when it starts to again.
+static const double MIN_USEFULNESS = 0.05;
+
+NNBatchingParams::NNBatchingParams()
+  :maxWaitMicros(0),
+   targetFill(1.0),
+   overheadWaitFactor(0.0)
+{}
+
+NNBatchingParams NNBatchingParams::getDefaults(const string& mode) {
+  NNBatchingParams params;
+  if(mode == "immediate") {
+  }
+  else if(mode == "latency") {
+    params.maxWaitMicros = 500;
+    params.targetFill = 0.5;
+    params.overheadWaitFactor = 0.25;
+  }
+  else if(mode == "throughput") {
+    params.maxWaitMicros = 5000;
+    params.targetFill = 1.0;
+    params.overheadWaitFactor = 1.0;
+  }
+  else
+    throw StringError("Unknown nn batching mode, expected immediate, latency, or throughput: " + mode);
+  return params;
+}
+
+NNBatchingPolicy::NNBatchingPolicy(const NNBatchingParams& p, int maxBatchSz)
+  :params(p),
+   targetRows(std::max(1, std::min(maxBatchSz, (int)ceil(p.targetFill * maxBatchSz - 1e-9)))),
+   mutex(),
+   weightSum(0.0),
+   rowsSum(0.0),
+   secondsSum(0.0),
+   rowsSqSum(0.0),
+   rowsSecondsSum(0.0),
+   fixedSeconds(0.0),
+   perRowSeconds(0.0),
+   usefulness(1.0),
+   waitMicros(0)
+{
+  if(params.maxWaitMicros < 0)
+    throw StringError("NNBatchingPolicy: maxWaitMicros must be nonnegative");
+  if(!(params.targetFill > 0.0 && params.targetFill <= 1.0))
+    throw StringError("NNBatchingPolicy: targetFill must be in (0,1]");
+  if(!(params.overheadWaitFactor >= 0.0))
+    throw StringError("NNBatchingPolicy: overheadWaitFactor must be nonnegative");
+}
+
+NNBatchingPolicy::~NNBatchingPolicy()
+{}
+
+const NNBatchingParams& NNBatchingPolicy::getParams() const {
+  return params;
+}
+
+bool NNBatchingPolicy::isImmediate() const {
+  return params.maxWaitMicros <= 0 || params.overheadWaitFactor <= 0.0 || targetRows <= 1;
+}
+
+int NNBatchingPolicy::getTargetRows() const {
+  return targetRows;
+}
+
+int64_t NNBatchingPolicy::getWaitMicros() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return waitMicros;
+}
+
+//Must be called with the mutex held
+void NNBatchingPolicy::updateWaitMicros() {
+  double micros = fixedSeconds * 1e6 * params.overheadWaitFactor * usefulness;
+  waitMicros = std::min(params.maxWaitMicros, (int64_t)micros);
+}
+
+void NNBatchingPolicy::recordBatch(int numRows, double seconds) {
+  if(numRows <= 0 || !(seconds >= 0.0))
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  double n = numRows;
+  weightSum = weightSum * (1.0 - FIT_DECAY) + 1.0;
+  rowsSum = rowsSum * (1.0 - FIT_DECAY) + n;
+  secondsSum = secondsSum * (1.0 - FIT_DECAY) + seconds;
+  rowsSqSum = rowsSqSum * (1.0 - FIT_DECAY) + n * n;
+  rowsSecondsSum = rowsSecondsSum * (1.0 - FIT_DECAY) + n * seconds;
+
+  double meanRows = rowsSum / weightSum;
+  double meanSeconds = secondsSum / weightSum;
+  double varRows = rowsSqSum / weightSum - meanRows * meanRows;
+  double covar = rowsSecondsSum / weightSum - meanRows * meanSeconds;
+  //If recent batches were all about the same size, there is no way to tell fixed from per-row cost, so assume
+  //the worst case that it's all fixed cost. The usefulness of waiting limits the damage if that's wrong.
+  if(varRows < 0.25) {
+    perRowSeconds = 0.0;
+    fixedSeconds = meanSeconds;
+  }
+  else {
+    perRowSeconds = std::max(0.0, covar / varRows);
+    fixedSeconds = std::min(meanSeconds, std::max(0.0, meanSeconds - perRowSeconds * meanRows));
+  }
+  updateWaitMicros();
+}
+
+void NNBatchingPolicy::recordWait(int rowsBefore, int rowsAfter) {
+  std::lock_guard<std::mutex> lock(mutex);
+  double gained = rowsAfter > rowsBefore ? 1.0 : 0.0;
+  usefulness = std::max(MIN_USEFULNESS, usefulness * (1.0 - USEFULNESS_DECAY) + gained * USEFULNESS_DECAY);
+  updateWaitMicros();
+}
+
+void NNBatchingPolicy::getLatencyModel(double& fixed, double& perRow) {
+  std::lock_guard<std::mutex> lock(mutex);
+  fixed = fixedSeconds;
+  perRow = perRowSeconds;
+}
+
+//-------------------------------------------------------------------------------------
+
+static const double HISTOGRAM_MIN_SECONDS = 1e-7;
+static const double HISTOGRAM_BUCKETS_PER_OCTAVE = 4.0;
+
+LatencyHistogram::LatencyHistogram() {
+  clear();
+}
+
+LatencyHistogram::~LatencyHistogram()
+{}
+
+void LatencyHistogram::add(double seconds) {
+  int bucket = 0;
+  if(seconds > HISTOGRAM_MIN_SECONDS)
+    bucket = std::min(NUM_BUCKETS-1, (int)(log2(seconds / HISTOGRAM_MIN_SECONDS) * HISTOGRAM_BUCKETS_PER_OCTAVE));
+  counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::clear() {
+  for(int i = 0; i<NUM_BUCKETS; i++)
+    counts[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::numSamples() const {
+  uint64_t total = 0;
+  for(int i = 0; i<NUM_BUCKETS; i++)
+    total += counts[i].load(std::memory_order_relaxed);
+  return total;
+}
+
+double LatencyHistogram::getPercentileSeconds(double fraction) const {
+  uint64_t bucketCounts[NUM_BUCKETS];
+  uint64_t total = 0;
+  for(int i = 0; i<NUM_BUCKETS; i++) {
+    bucketCounts[i] = counts[i].load(std::memory_order_relaxed);
+    total += bucketCounts[i];
+  }
+  if(total <= 0)
+    return 0.0;
+  fraction = std::max(0.0, std::min(1.0, fraction));
+  uint64_t rank = std::max((uint64_t)1, (uint64_t)ceil(fraction * total));
+  uint64_t cumulative = 0;
+  int bucket = NUM_BUCKETS-1;
+  for(int i = 0; i<NUM_BUCKETS; i++) {
+    cumulative += bucketCounts[i];
+    if(cumulative >= rank) {
+      bucket = i;
+      break;
+    }
+  }
+  return HISTOGRAM_MIN_SECONDS * exp2((bucket + 1) / HISTOGRAM_BUCKETS_PER_OCTAVE);
+}
@@ -0,0 +1,99 @@
+#ifndef NEURALNET_NNBATCHING_H_
+#define NEURALNET_NNBATCHING_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+//Controls how long an NNEvaluator server thread holds back a partially filled batch, hoping for more rows,
+//before launching it on the backend.
+struct NNBatchingParams {
+  //Never hold back a batch longer than this, in microseconds. 0 means always launch immediately.
+  int64_t maxWaitMicros;
+  //Launch as soon as this fraction of nnMaxBatchSize rows are queued.
+  double targetFill;
+  //Hold back a batch at most this multiple of the estimated fixed per-batch latency of the backend.
+  double overheadWaitFactor;
+
+  //Launch immediately, the behavior when nothing is configured.
+  NNBatchingParams();
+
+  //Defaults for "immediate", "latency" (short waits, for interactive analysis) or "throughput" (for selfplay).
+  static NNBatchingParams getDefaults(const std::string& mode);
+};
+
+//Decides how long to wait for a batch to fill, adapting online to the measured latency of the backend.
+//
+//Backend latency is modeled as fixed + perRow * numRows, fit by exponentially weighted least squares over recent
+//batches. Holding a batch back is only worthwhile to amortize the fixed part, and waiting at most that long for
+//rows that may not come never costs more than twice the best choice in hindsight (the ski rental argument), so the
+//wait is the fixed latency times overheadWaitFactor, capped at maxWaitMicros. The wait is further scaled down when
+//recent waits mostly ended without any new rows arriving, such as when there are too few search threads to fill batches.
+//
+//Threadsafe.
+class NNBatchingPolicy {
+ public:
+  NNBatchingPolicy(const NNBatchingParams& params, int maxBatchSize);
+  ~NNBatchingPolicy();
+
+  NNBatchingPolicy(const NNBatchingPolicy& other) = delete;
+  NNBatchingPolicy& operator=(const NNBatchingPolicy& other) = delete;
+
+  const NNBatchingParams& getParams() const;
+  bool isImmediate() const;
+
+  //Launch without waiting further once this many rows are queued.
+  int getTargetRows() const;
+  //How long to wait for a partial batch to reach getTargetRows before launching it anyways.
+  int64_t getWaitMicros();
+
+  //Report the time the backend took on a batch.
+  void recordBatch(int numRows, double seconds);
+  //Report whether waiting for a batch to fill gained any rows.
+  void recordWait(int rowsBefore, int rowsAfter);
+  //Current fit of the backend latency, both zero until a batch has been recorded.
+  void getLatencyModel(double& fixedSeconds, double& perRowSeconds);
+
+ private:
+  const NNBatchingParams params;
+  const int targetRows;
+
+  std::mutex mutex;
+  //Exponentially weighted sums for the least squares fit of seconds against numRows
+  double weightSum;
+  double rowsSum;
+  double secondsSum;
+  double rowsSqSum;
+  double rowsSecondsSum;
+  double fixedSeconds;
+  double perRowSeconds;
+  //Exponentially weighted fraction of recent waits that gained rows
+  double usefulness;
+  int64_t waitMicros;
+
+  void updateWaitMicros();
+};
+
+//Counts durations in buckets a quarter of an octave wide, from 100 nanoseconds up to several minutes, to report
+//percentiles to within about 20%.
+//Threadsafe and lock-free.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+  ~LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram& other) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram& other) = delete;
+
+  void add(double seconds);
+  void clear();
+
+  uint64_t numSamples() const;
+  //Upper edge of the bucket containing the given fraction (in [0,1]) of samples, or 0 if there are no samples.
+  double getPercentileSeconds(double fraction) const;
+
+ private:
+  static const int NUM_BUCKETS = 128;
+  std::atomic<uint64_t> counts[NUM_BUCKETS];
+};
+
+#endif  // NEURALNET_NNBATCHING_H_
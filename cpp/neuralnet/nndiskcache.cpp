@@ -0,0 +1,547 @@
+#include "../neuralnet/nndiskcache.h"
+
+#include "../core/os.h"
+#include "../core/sha2.h"
+
+#ifdef OS_IS_UNIX_OR_APPLE
+  #include <fcntl.h>
+  #include <sys/file.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+//File layout, all in native byte order, which the byte order mark checks:
+//Header
+//  char[8] magic
+//  uint32 formatVersion
+//  uint32 byteOrderMark
+//  int32 nnXLen, nnYLen, policySize, recordBytes
+//  uint64[4] sha256 of the model key
+//Records, each recordBytes long
+//  uint64 hash0, hash1
+//  uint64 checksum of everything after it, seeded with the model key
+//  uint32 flags
+//  uint32 unused
+//  float[6] whiteWinProb, whiteLossProb, whiteNoResultProb, whiteScoreMean, whiteScoreMeanSq, unused
+//  uint16[policySize] policy, fp16
+//  uint16[nnXLen*nnYLen] ownerMap, fp16, valid only if flags has RECORD_HAS_OWNERMAP
+//  padding up to a multiple of 8 bytes
+
+static const char FILE_MAGIC[8] = {'K','G','N','N','D','I','S','K'};
+static const uint32_t FORMAT_VERSION = 1;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const int64_t HEADER_BYTES = 64;
+
+static const int64_t RECORD_CHECKSUM_OFFSET = 16;
+static const int64_t RECORD_FLAGS_OFFSET = 24;
+static const int64_t RECORD_VALUES_OFFSET = 32;
+static const int64_t RECORD_POLICY_OFFSET = 56;
+static const uint32_t RECORD_HAS_OWNERMAP = 0x1;
+
+static const int64_t MAX_RECORD_BYTES =
+  (RECORD_POLICY_OFFSET + (NNPos::MAX_NN_POLICY_SIZE + NNPos::MAX_BOARD_AREA) * sizeof(uint16_t) + 7) / 8 * 8;
+
+static uint64_t computeChecksum(const char* record, int64_t recordBytes, uint64_t seed) {
+  uint64_t checksum = Hash::murmurMix(seed);
+  uint64_t word;
+  for(int64_t i = 0; i < RECORD_CHECKSUM_OFFSET; i += 8) {
+    std::memcpy(&word, record + i, sizeof(word));
+    checksum = Hash::murmurMix(checksum ^ word);
+  }
+  for(int64_t i = RECORD_FLAGS_OFFSET; i < recordBytes; i += 8) {
+    std::memcpy(&word, record + i, sizeof(word));
+    checksum = Hash::murmurMix(checksum ^ word);
+  }
+  return checksum;
+}
+
+//COMMON IMPLEMENTATION---------------------------------------------------------------
+
+int64_t NNDiskCache::getNumEntries() const {
+  return m_numEntries.load(std::memory_order_relaxed);
+}
+int64_t NNDiskCache::getFileBytes() const {
+  return appendOffset.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::numHits() const {
+  return m_numHits.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::numMisses() const {
+  return m_numMisses.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::numWrites() const {
+  return m_numWrites.load(std::memory_order_relaxed);
+}
+uint64_t NNDiskCache::numCorrupt() const {
+  return m_numCorrupt.load(std::memory_order_relaxed);
+}
+
+void NNDiskCache::encodeRecord(const NNOutput& output, char* record) const {
+  std::memset(record, 0, recordBytes);
+  std::memcpy(record, &output.nnHash.hash0, sizeof(uint64_t));
+  std::memcpy(record + 8, &output.nnHash.hash1, sizeof(uint64_t));
+
+  uint32_t flags = output.whiteOwnerMap != NULL ? RECORD_HAS_OWNERMAP : 0;
+  std::memcpy(record + RECORD_FLAGS_OFFSET, &flags, sizeof(flags));
+  float values[5] = {
+    output.whiteWinProb, output.whiteLossProb, output.whiteNoResultProb, output.whiteScoreMean, output.whiteScoreMeanSq
+  };
+  std::memcpy(record + RECORD_VALUES_OFFSET, values, sizeof(values));
+
+  uint16_t buf[NNPos::MAX_NN_POLICY_SIZE];
+  for(int i = 0; i<policySize; i++)
+    buf[i] = NNCompress::floatToHalf(output.policyProbs[i]);
+  std::memcpy(record + RECORD_POLICY_OFFSET, buf, policySize * sizeof(uint16_t));
+  if(output.whiteOwnerMap != NULL) {
+    for(int i = 0; i<ownerMapSize; i++)
+      buf[i] = NNCompress::floatToHalf(output.whiteOwnerMap[i]);
+    std::memcpy(record + RECORD_POLICY_OFFSET + policySize * sizeof(uint16_t), buf, ownerMapSize * sizeof(uint16_t));
+  }
+
+  uint64_t checksum = computeChecksum(record, recordBytes, modelKeyHash[0]);
+  std::memcpy(record + RECORD_CHECKSUM_OFFSET, &checksum, sizeof(checksum));
+}
+
+bool NNDiskCache::decodeRecord(const char* record, Hash128 nnHash, shared_ptr<NNOutput>& ret) const {
+  Hash128 recordHash;
+  std::memcpy(&recordHash.hash0, record, sizeof(uint64_t));
+  std::memcpy(&recordHash.hash1, record + 8, sizeof(uint64_t));
+  uint64_t checksum;
+  std::memcpy(&checksum, record + RECORD_CHECKSUM_OFFSET, sizeof(checksum));
+  if(recordHash != nnHash || checksum != computeChecksum(record, recordBytes, modelKeyHash[0]))
+    return false;
+
+  uint32_t flags;
+  std::memcpy(&flags, record + RECORD_FLAGS_OFFSET, sizeof(flags));
+  float values[5];
+  std::memcpy(values, record + RECORD_VALUES_OFFSET, sizeof(values));
+
+  ret = std::make_shared<NNOutput>();
+  NNOutput& output = *ret;
+  output.nnHash = nnHash;
+  output.whiteWinProb = values[0];
+  output.whiteLossProb = values[1];
+  output.whiteNoResultProb = values[2];
+  output.whiteScoreMean = values[3];
+  output.whiteScoreMeanSq = values[4];
+  output.nnXLen = nnXLen;
+  output.nnYLen = nnYLen;
+
+  uint16_t buf[NNPos::MAX_NN_POLICY_SIZE];
+  std::memcpy(buf, record + RECORD_POLICY_OFFSET, policySize * sizeof(uint16_t));
+  NNCompress::decompressPolicy(buf, policySize, output.policyProbs);
+  if(flags & RECORD_HAS_OWNERMAP) {
+    std::memcpy(buf, record + RECORD_POLICY_OFFSET + policySize * sizeof(uint16_t), ownerMapSize * sizeof(uint16_t));
+    output.whiteOwnerMap = new float[ownerMapSize];
+    for(int i = 0; i<ownerMapSize; i++)
+      output.whiteOwnerMap[i] = NNCompress::halfToFloat(buf[i]);
+  }
+  return true;
+}
+
+//WINDOWS IMPLMENTATIION-------------------------------------------------------------
+
+#ifdef OS_IS_WINDOWS
+
+NNDiskCache::NNDiskCache(
+  const string& fName, const string& modelKey, int xLen, int yLen, int64_t maxBytes, Logger* logger
+) {
+  (void)fName;
+  (void)modelKey;
+  (void)xLen;
+  (void)yLen;
+  (void)maxBytes;
+  (void)logger;
+  throw StringError("NN disk cache files are not supported on Windows");
+}
+NNDiskCache::~NNDiskCache()
+{}
+
+bool NNDiskCache::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
+  (void)nnHash;
+  ret = nullptr;
+  return false;
+}
+void NNDiskCache::set(const shared_ptr<NNOutput>& p) {
+  (void)p;
+}
+void NNDiskCache::flush() {
+}
+
+#endif
+
+//UNIX IMPLEMENTATION------------------------------------------------------------------
+
+#ifdef OS_IS_UNIX_OR_APPLE
+
+NNDiskCache::NNDiskCache(
+  const string& fName, const string& modelKey, int xLen, int yLen, int64_t maxBytes, Logger* logger
+)
+  :fileName(fName),
+   nnXLen(xLen),
+   nnYLen(yLen),
+   policySize(NNPos::getPolicySize(xLen,yLen)),
+   ownerMapSize(xLen*yLen),
+   maxFileBytes(maxBytes),
+   fd(-1),
+   mapped(NULL),
+   mappedBytes(0),
+   index(),
+   ownRecordShards(NULL),
+   ownRecordMutexPool(NULL),
+   ownRecordShardMask(0),
+   queueMutex(),
+   queueCV(),
+   flushedCV(),
+   queue(),
+   appenderBusy(false),
+   shouldStop(false),
+   appender(),
+   isFull(false),
+   appendOffset(HEADER_BYTES),
+   m_numEntries(0),
+   m_numHits(0),
+   m_numMisses(0),
+   m_numWrites(0),
+   m_numCorrupt(0)
+{
+  if(nnXLen <= 0 || nnXLen > NNPos::MAX_BOARD_LEN || nnYLen <= 0 || nnYLen > NNPos::MAX_BOARD_LEN)
+    throw StringError("NNDiskCache: Invalid board size");
+  recordBytes = (RECORD_POLICY_OFFSET + (policySize + ownerMapSize) * sizeof(uint16_t) + 7) / 8 * 8;
+  assert(recordBytes <= MAX_RECORD_BYTES);
+  SHA2::get256(modelKey.c_str(), modelKeyHash);
+
+  openFile(logger);
+
+  const uint32_t numShards = 64;
+  ownRecordShards = new std::unordered_map<Hash128,OwnRecord,Hash128Hasher>[numShards];
+  ownRecordMutexPool = new MutexPool(numShards);
+  ownRecordShardMask = numShards-1;
+  appender = std::thread(&NNDiskCache::appenderLoop, this);
+}
+
+NNDiskCache::~NNDiskCache() {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    shouldStop = true;
+  }
+  queueCV.notify_all();
+  appender.join();
+  delete[] ownRecordShards;
+  delete ownRecordMutexPool;
+  closeFile();
+}
+
+void NNDiskCache::closeFile() {
+  if(mapped != NULL)
+    munmap(const_cast<char*>(mapped), mappedBytes);
+  mapped = NULL;
+  mappedBytes = 0;
+  if(fd >= 0)
+    close(fd);
+  fd = -1;
+}
+
+static void fillHeader(char* header, int nnXLen, int nnYLen, int policySize, int64_t recordBytes, const uint64_t modelKeyHash[4]) {
+  std::memset(header, 0, HEADER_BYTES);
+  std::memcpy(header, FILE_MAGIC, sizeof(FILE_MAGIC));
+  std::memcpy(header + 8, &FORMAT_VERSION, sizeof(uint32_t));
+  std::memcpy(header + 12, &BYTE_ORDER_MARK, sizeof(uint32_t));
+  int32_t dims[4] = {nnXLen, nnYLen, policySize, (int32_t)recordBytes};
+  std::memcpy(header + 16, dims, sizeof(dims));
+  std::memcpy(header + 32, modelKeyHash, 4 * sizeof(uint64_t));
+}
+
+static bool readFully(int fd, char* buf, int64_t bytes, int64_t offset) {
+  while(bytes > 0) {
+    ssize_t numRead = pread(fd, buf, bytes, offset);
+    if(numRead <= 0) {
+      if(numRead < 0 && errno == EINTR)
+        continue;
+      return false;
+    }
+    buf += numRead;
+    bytes -= numRead;
+    offset += numRead;
+  }
+  return true;
+}
+
+static bool writeFully(int fd, const char* buf, int64_t bytes, int64_t offset) {
+  while(bytes > 0) {
+    ssize_t numWritten = pwrite(fd, buf, bytes, offset);
+    if(numWritten <= 0) {
+      if(numWritten < 0 && errno == EINTR)
+        continue;
+      return false;
+    }
+    buf += numWritten;
+    bytes -= numWritten;
+    offset += numWritten;
+  }
+  return true;
+}
+
+void NNDiskCache::openFile(Logger* logger) {
+  //Lock the file, retrying if another process replaced it in the meantime
+  while(true) {
+    fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0)
+      throw StringError("Could not open nn disk cache file " + fileName + ": " + strerror(errno));
+    if(flock(fd, LOCK_EX) != 0) {
+      close(fd);
+      throw StringError("Could not lock nn disk cache file " + fileName + ": " + strerror(errno));
+    }
+    struct stat fdStat;
+    struct stat pathStat;
+    if(fstat(fd, &fdStat) == 0 && stat(fileName.c_str(), &pathStat) == 0 &&
+       fdStat.st_dev == pathStat.st_dev && fdStat.st_ino == pathStat.st_ino)
+      break;
+    close(fd);
+  }
+
+  char header[HEADER_BYTES];
+  char expectedHeader[HEADER_BYTES];
+  fillHeader(expectedHeader, nnXLen, nnYLen, policySize, recordBytes, modelKeyHash);
+  struct stat fdStat;
+  if(fstat(fd, &fdStat) != 0) {
+    closeFile();
+    throw StringError("Could not stat nn disk cache file " + fileName + ": " + strerror(errno));
+  }
+  bool headerMatches =
+    fdStat.st_size >= HEADER_BYTES &&
+    readFully(fd, header, HEADER_BYTES, 0) &&
+    std::memcmp(header, expectedHeader, HEADER_BYTES) == 0;
+
+  if(!headerMatches) {
+    if(fdStat.st_size > 0 && logger != NULL)
+      logger->write("NN disk cache file " + fileName + " is for a different model, settings or format, or is corrupt, replacing it");
+    replaceFile();
+  }
+
+  scanRecords();
+  flock(fd, LOCK_UN);
+  m_numEntries.store((int64_t)index.size());
+
+  if(logger != NULL) {
+    logger->write(
+      "NN disk cache file " + fileName + " loaded " + Global::int64ToString((int64_t)index.size()) + " entries" +
+      (m_numCorrupt.load() > 0 ? ", skipped " + Global::uint64ToString(m_numCorrupt.load()) + " corrupt entries" : "")
+    );
+  }
+}
+
+//Must be called with the file locked. Writes a new file with only the header and renames it over the old one, so that
+//other processes that still have the old one open or mapped are unaffected.
+void NNDiskCache::replaceFile() {
+  string tmpFileName = fileName + ".tmp." + Global::int64ToString((int64_t)getpid());
+  int newFd = open(tmpFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(newFd < 0) {
+    closeFile();
+    throw StringError("Could not create nn disk cache file " + tmpFileName + ": " + strerror(errno));
+  }
+  char header[HEADER_BYTES];
+  fillHeader(header, nnXLen, nnYLen, policySize, recordBytes, modelKeyHash);
+  if(flock(newFd, LOCK_EX) != 0 || !writeFully(newFd, header, HEADER_BYTES, 0) ||
+     rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+    string err = strerror(errno);
+    close(newFd);
+    unlink(tmpFileName.c_str());
+    closeFile();
+    throw StringError("Could not replace nn disk cache file " + fileName + ": " + err);
+  }
+  close(fd);
+  fd = newFd;
+}
+
+//Must be called with the file locked
+void NNDiskCache::scanRecords() {
+  struct stat fdStat;
+  if(fstat(fd, &fdStat) != 0) {
+    closeFile();
+    throw StringError("Could not stat nn disk cache file " + fileName + ": " + strerror(errno));
+  }
+  int64_t numRecords = ((int64_t)fdStat.st_size - HEADER_BYTES) / recordBytes;
+  //A partial record at the end, from an interrupted write, will be overwritten by the next append
+  int64_t endOffset = HEADER_BYTES + std::max((int64_t)0, numRecords) * recordBytes;
+  appendOffset.store(endOffset);
+  isFull.store(endOffset + recordBytes > maxFileBytes);
+  if(numRecords <= 0)
+    return;
+
+  void* ptr = mmap(NULL, endOffset, PROT_READ, MAP_SHARED, fd, 0);
+  if(ptr == MAP_FAILED) {
+    closeFile();
+    throw StringError("Could not map nn disk cache file " + fileName + ": " + strerror(errno));
+  }
+  mapped = (const char*)ptr;
+  mappedBytes = endOffset;
+
+  index.reserve(numRecords);
+  for(int64_t offset = HEADER_BYTES; offset + recordBytes <= mappedBytes; offset += recordBytes) {
+    const char* record = mapped + offset;
+    Hash128 recordHash;
+    std::memcpy(&recordHash.hash0, record, sizeof(uint64_t));
+    std::memcpy(&recordHash.hash1, record + 8, sizeof(uint64_t));
+    uint64_t checksum;
+    std::memcpy(&checksum, record + RECORD_CHECKSUM_OFFSET, sizeof(checksum));
+    if(checksum != computeChecksum(record, recordBytes, modelKeyHash[0])) {
+      m_numCorrupt.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    index[recordHash] = offset;
+  }
+}
+
+bool NNDiskCache::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
+  if(ret != nullptr)
+    ret.reset();
+
+  //Records are never modified once written, so they can be read without holding any lock
+  char buf[MAX_RECORD_BYTES];
+  const char* record = NULL;
+  auto iter = index.find(nnHash);
+  if(iter != index.end())
+    record = mapped + iter->second;
+  else {
+    uint32_t shardIdx = (uint32_t)nnHash.hash0 & ownRecordShardMask;
+    std::unordered_map<Hash128,OwnRecord,Hash128Hasher>& shard = ownRecordShards[shardIdx];
+    int64_t offset = -1;
+    {
+      std::lock_guard<std::mutex> lock(ownRecordMutexPool->getMutex(shardIdx));
+      auto ownIter = shard.find(nnHash);
+      if(ownIter != shard.end()) {
+        if(ownIter->second.pending != nullptr) {
+          std::memcpy(buf, ownIter->second.pending->data(), recordBytes);
+          record = buf;
+        }
+        else
+          offset = ownIter->second.offset;
+      }
+    }
+    if(offset >= 0 && readFully(fd, buf, recordBytes, offset))
+      record = buf;
+  }
+  if(record == NULL) {
+    m_numMisses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  if(!decodeRecord(record, nnHash, ret)) {
+    m_numCorrupt.fetch_add(1, std::memory_order_relaxed);
+    m_numMisses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  m_numHits.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void NNDiskCache::set(const shared_ptr<NNOutput>& p) {
+  assert(p->nnXLen == nnXLen && p->nnYLen == nnYLen);
+  if(isFull.load(std::memory_order_relaxed) || index.find(p->nnHash) != index.end())
+    return;
+
+  std::shared_ptr<std::vector<char>> record = std::make_shared<std::vector<char>>(recordBytes);
+  encodeRecord(*p, record->data());
+
+  uint32_t shardIdx = (uint32_t)p->nnHash.hash0 & ownRecordShardMask;
+  std::unordered_map<Hash128,OwnRecord,Hash128Hasher>& shard = ownRecordShards[shardIdx];
+  {
+    std::lock_guard<std::mutex> lock(ownRecordMutexPool->getMutex(shardIdx));
+    if(shard.find(p->nnHash) != shard.end())
+      return;
+    OwnRecord& ownRecord = shard[p->nnHash];
+    ownRecord.offset = -1;
+    ownRecord.pending = record;
+  }
+  m_numEntries.fetch_add(1, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queue.push_back(std::make_pair(p->nnHash, std::shared_ptr<const std::vector<char>>(record)));
+  }
+  queueCV.notify_one();
+}
+
+void NNDiskCache::flush() {
+  std::unique_lock<std::mutex> lock(queueMutex);
+  while(queue.size() > 0 || appenderBusy)
+    flushedCV.wait(lock);
+}
+
+void NNDiskCache::appenderLoop() {
+  vector<std::pair<Hash128,std::shared_ptr<const std::vector<char>>>> records;
+  std::unique_lock<std::mutex> lock(queueMutex);
+  while(true) {
+    while(!shouldStop && queue.size() <= 0)
+      queueCV.wait(lock);
+    //Write out everything queued before stopping
+    if(queue.size() <= 0) {
+      assert(shouldStop);
+      return;
+    }
+    records.clear();
+    records.swap(queue);
+    appenderBusy = true;
+    lock.unlock();
+    appendRecords(records);
+    lock.lock();
+    appenderBusy = false;
+    if(queue.size() <= 0)
+      flushedCV.notify_all();
+  }
+}
+
+void NNDiskCache::appendRecords(const vector<std::pair<Hash128,std::shared_ptr<const std::vector<char>>>>& records) {
+  int64_t numWritten = 0;
+  int64_t offset = -1;
+  if(!isFull.load()) {
+    vector<char> batch(records.size() * recordBytes);
+    for(size_t i = 0; i<records.size(); i++)
+      std::memcpy(batch.data() + i * recordBytes, records[i].second->data(), recordBytes);
+
+    if(flock(fd, LOCK_EX) == 0) {
+      //Other processes may have appended since we last looked
+      struct stat fdStat;
+      if(fstat(fd, &fdStat) == 0 && fdStat.st_size >= HEADER_BYTES) {
+        offset = HEADER_BYTES + ((int64_t)fdStat.st_size - HEADER_BYTES) / recordBytes * recordBytes;
+        int64_t numFit = std::max((int64_t)0, (maxFileBytes - offset) / recordBytes);
+        numWritten = std::min((int64_t)records.size(), numFit);
+        if(numWritten > 0 && !writeFully(fd, batch.data(), numWritten * recordBytes, offset))
+          numWritten = 0;
+      }
+      flock(fd, LOCK_UN);
+    }
+    //Stop trying on any failure, such as running out of space, or on reaching the size limit
+    if(numWritten < (int64_t)records.size())
+      isFull.store(true);
+    if(numWritten > 0) {
+      appendOffset.store(offset + numWritten * recordBytes);
+      m_numWrites.fetch_add((uint64_t)numWritten, std::memory_order_relaxed);
+    }
+  }
+
+  //Written records are read back from the file from now on, the rest are forgotten
+  for(size_t i = 0; i<records.size(); i++) {
+    Hash128 nnHash = records[i].first;
+    uint32_t shardIdx = (uint32_t)nnHash.hash0 & ownRecordShardMask;
+    std::unordered_map<Hash128,OwnRecord,Hash128Hasher>& shard = ownRecordShards[shardIdx];
+    std::lock_guard<std::mutex> lock(ownRecordMutexPool->getMutex(shardIdx));
+    if((int64_t)i < numWritten) {
+      OwnRecord& ownRecord = shard[nnHash];
+      ownRecord.offset = offset + (int64_t)i * recordBytes;
+      ownRecord.pending = nullptr;
+    }
+    else {
+      shard.erase(nnHash);
+      m_numEntries.fetch_add(-1, std::memory_order_relaxed);
+    }
+  }
+}
+
+#endif
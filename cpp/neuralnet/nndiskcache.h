@@ -0,0 +1,121 @@
+#ifndef NEURALNET_NNDISKCACHE_H_
+#define NEURALNET_NNDISKCACHE_H_
+
+#include <memory>
+#include <unordered_map>
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/logger.h"
+#include "../core/multithread.h"
+#include "../neuralnet/nninputs.h"
+#include "../search/mutexpool.h"
+
+//A file of neural net outputs that persists across runs, to save reevaluating the same positions, such as common
+//openings, every time a program starts.
+//
+//The file is a header identifying the model and settings the outputs came from, followed by fixed-size records
+//appended one at a time, each with a checksum. Upon opening, the records already in the file are memory mapped
+//and indexed. Records with a bad checksum, such as a partial write from a crash, are skipped. If the header does
+//not match, the file is replaced with an empty one rather than reusing outputs from a different model.
+//Several processes can share a file, appends are serialized with a file lock, although each process only sees
+//the records that were in the file when it opened it, along with its own.
+//
+//set only queues a record, a background thread appends queued records in batches, so that no thread finishing an
+//evaluation waits on the file. Records queued but not yet written are still found by get.
+//
+//Not supported on Windows.
+class NNDiskCache {
+ public:
+  //modelKey should identify everything the outputs depend on, such as the model file and policy temperature.
+  //Stops appending once the file would exceed maxFileBytes.
+  NNDiskCache(
+    const std::string& fileName,
+    const std::string& modelKey,
+    int nnXLen,
+    int nnYLen,
+    int64_t maxFileBytes,
+    Logger* logger
+  );
+  //Writes any records still queued
+  ~NNDiskCache();
+
+  NNDiskCache(const NNDiskCache& other) = delete;
+  NNDiskCache& operator=(const NNDiskCache& other) = delete;
+
+  //These are thread-safe. For get, ret will be set to nullptr upon a failure to find.
+  //Outputs must have the nnXLen and nnYLen of the cache. Does nothing if the hash is already stored.
+  bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
+  void set(const std::shared_ptr<NNOutput>& p);
+  //Wait until every record queued so far has been written or given up on
+  void flush();
+
+  int64_t getNumEntries() const;
+  int64_t getFileBytes() const;
+  uint64_t numHits() const;
+  uint64_t numMisses() const;
+  uint64_t numWrites() const;
+  //Records found to have a bad checksum, on opening or reading later
+  uint64_t numCorrupt() const;
+
+ private:
+  struct Hash128Hasher {
+    size_t operator()(const Hash128& h) const {
+      return (size_t)h.hash0;
+    }
+  };
+  //A record added by this process, either waiting to be written or at offset in the file
+  struct OwnRecord {
+    int64_t offset;
+    std::shared_ptr<const std::vector<char>> pending;
+  };
+
+  std::string fileName;
+  int nnXLen;
+  int nnYLen;
+  int policySize;
+  int ownerMapSize;
+  int64_t recordBytes;
+  int64_t maxFileBytes;
+  uint64_t modelKeyHash[4];
+
+  int fd;
+  const char* mapped;
+  int64_t mappedBytes;
+
+  //Offset in the file of each record found upon opening, never modified afterwards so that it can be read without
+  //locking
+  std::unordered_map<Hash128,int64_t,Hash128Hasher> index;
+  //Records added since, sharded by hash
+  std::unordered_map<Hash128,OwnRecord,Hash128Hasher>* ownRecordShards;
+  MutexPool* ownRecordMutexPool;
+  uint32_t ownRecordShardMask;
+
+  //Records for the appender thread to write
+  std::mutex queueMutex;
+  std::condition_variable queueCV;
+  std::condition_variable flushedCV;
+  std::vector<std::pair<Hash128,std::shared_ptr<const std::vector<char>>>> queue;
+  bool appenderBusy;
+  bool shouldStop;
+  std::thread appender;
+
+  std::atomic<bool> isFull;
+  std::atomic<int64_t> appendOffset;
+  std::atomic<int64_t> m_numEntries;
+  std::atomic<uint64_t> m_numHits;
+  std::atomic<uint64_t> m_numMisses;
+  std::atomic<uint64_t> m_numWrites;
+  std::atomic<uint64_t> m_numCorrupt;
+
+  void openFile(Logger* logger);
+  void replaceFile();
+  void scanRecords();
+  void closeFile();
+  void encodeRecord(const NNOutput& output, char* record) const;
+  bool decodeRecord(const char* record, Hash128 nnHash, std::shared_ptr<NNOutput>& ret) const;
+  void appenderLoop();
+  void appendRecords(const std::vector<std::pair<Hash128,std::shared_ptr<const std::vector<char>>>>& records);
+};
+
+#endif  // NEURALNET_NNDISKCACHE_H_
@@ -1,23 +1,39 @@
 #include "../neuralnet/nneval.h"
 #include "../neuralnet/modelversion.h"
 
+#include <deque>
+
+#include "../core/os.h"
+#include "../core/sha2.h"
+#include "../core/timer.h"
+
+#ifdef OS_IS_UNIX_OR_APPLE
+  #include <sys/resource.h>
+#endif
+
 using namespace std;
 
 //-------------------------------------------------------------------------------------
 
 NNResultBuf::NNResultBuf()
-  : clientWaitingForResult(),
-    resultMutex(),
-    hasResult(false),
+  : resultReady(),
     includeOwnerMap(false),
+    symmetry(NNInputs::SYMMETRY_NOTSPECIFIED),
     boardXSizeForServer(0),
     boardYSizeForServer(0),
+    nnHashForServer(),
     rowSpatialSize(0),
     rowGlobalSize(0),
     rowSpatial(NULL),
     rowGlobal(NULL),
     result(nullptr),
-    errorLogLockout(false)
+    errorLogLockout(false),
+    nextCoalesced(NULL),
+    boardForServer(NULL),
+    historyForServer(NULL),
+    nextPlayerForServer(C_EMPTY),
+    drawEquivalentWinsForWhiteForServer(0.0),
+    modelGenerationForServer(0)
 {}
 
 NNResultBuf::~NNResultBuf() {
@@ -29,6 +45,24 @@ NNResultBuf::~NNResultBuf() {
 
 //-------------------------------------------------------------------------------------
 
+NNBatchQuery::NNBatchQuery()
+  :board(NULL),
+   history(NULL),
+   nextPlayer(C_EMPTY),
+   drawEquivalentWinsForWhite(0.5),
+   includeOwnerMap(false)
+{}
+
+NNBatchQuery::NNBatchQuery(const Board& b, const BoardHistory& h, Player pla, double drawEquiv, bool includeOwner)
+  :board(&b),
+   history(&h),
+   nextPlayer(pla),
+   drawEquivalentWinsForWhite(drawEquiv),
+   includeOwnerMap(includeOwner)
+{}
+
+//-------------------------------------------------------------------------------------
+
 NNServerBuf::NNServerBuf(const NNEvaluator& nnEval, const LoadedModel* model)
   :inputBuffers(NULL),
    resultBufs(NULL)
@@ -52,6 +86,12 @@ NNServerBuf::~NNServerBuf() {
 
 //-------------------------------------------------------------------------------------
 
+//Few evaluations are ever in flight at once, so there is little to gain from as many shards as the cache has mutexes
+static const int IN_FLIGHT_SHARDS_POWER_OF_TWO = 8;
+//Only needs to hold the chains of the boards featurized in the last few plies of every search thread
+static const int LADDER_CACHE_SIZE_POWER_OF_TWO = 16;
+static const int LADDER_CACHE_MUTEX_POOL_POWER_OF_TWO = 8;
+
 NNEvaluator::NNEvaluator(
   const string& mName,
   const string& mFileName,
@@ -71,7 +111,8 @@ NNEvaluator::NNEvaluator(
   float nnPolicyTemp,
   string openCLTunerFile
 )
-  :modelName(mName),
+  :modelMutex(),
+   modelName(mName),
    modelFileName(mFileName),
    nnXLen(xLen),
    nnYLen(yLen),
@@ -81,22 +122,35 @@ NNEvaluator::NNEvaluator(
    computeContext(NULL),
    loadedModel(NULL),
    nnCacheTable(NULL),
+   nnInFlightTable(NULL),
+   cacheMutexPoolSizePowerOfTwo(nnMutexPoolSizePowerofTwo),
+   nnDiskCache(NULL),
+   ladderCache(NULL),
+   diskCacheModelGeneration(0),
    debugSkipNeuralNet(skipNeuralNet),
+   syntheticNNParams(NULL),
    alwaysIncludeOwnerMap(alwaysOwnerMap),
    nnPolicyInvTemperature(1.0/nnPolicyTemp),
    serverThreads(),
-   serverWaitingForBatchStart(),
-   bufferMutex(),
+   modelGeneration(0),
+   serverSpawnGeneration(0),
+   numServersWithHandle(0),
+   m_numServersOnOldModel(0),
+   oldModelReleased(),
+   serverWaitingForRows(),
+   serverSleepMutex(),
    isKilled(false),
+   m_numServersSleeping(0),
+   batchingPolicy(NULL),
    maxNumRows(maxBatchSize),
-   numResultBufss(),
-   numResultBufssMask(),
    m_numRowsProcessed(0),
+   m_numCoalescedRequests(0),
    m_numBatchesProcessed(0),
-   m_resultBufss(NULL),
-   m_currentResultBufsLen(0),
-   m_currentResultBufsIdx(0),
-   m_oldestResultBufsIdx(0)
+   m_batchSizeCounts(NULL),
+   m_batchFillWaitNanos(0),
+   m_submitLatency(),
+   m_queue(NULL),
+   m_numQueuedRows(0)
 {
   if(nnXLen > NNPos::MAX_BOARD_LEN)
     throw StringError("Maximum supported nnEval board size is " + Global::intToString(NNPos::MAX_BOARD_LEN));
@@ -107,49 +161,44 @@ NNEvaluator::NNEvaluator(
   if(maxBatchSize <= 0)
     throw StringError("maxBatchSize is negative: " + Global::intToString(maxBatchSize));
 
-  //Add three, just to give a bit of extra headroom, and make it a power of two
-  numResultBufss = maxConcurrentEvals / maxBatchSize + 3;
-  {
-    int x = 1;
-    while (x < numResultBufss)
-      x *= 2;
-    numResultBufss = x;
-  }
-  numResultBufssMask = numResultBufss - 1;
+  m_numRowsOfGeneration[0].store(0);
+  m_numRowsOfGeneration[1].store(0);
+
+  //Add a batch, just to give a bit of extra headroom
+  m_queue = new LockFreeQueue<NNResultBuf*>((size_t)maxConcurrentEvals + maxBatchSize);
+
+  batchingPolicy = new NNBatchingPolicy(NNBatchingParams(), maxBatchSize);
+  m_batchSizeCounts = new std::atomic<uint64_t>[maxBatchSize+1];
+  for(int i = 0; i <= maxBatchSize; i++)
+    m_batchSizeCounts[i].store(0);
 
-  if(nnCacheSizePowerOfTwo >= 0)
-    nnCacheTable = new NNCacheTable(nnCacheSizePowerOfTwo, nnMutexPoolSizePowerofTwo);
+  if(nnCacheSizePowerOfTwo >= 0) {
+    nnCacheTable = new NNCacheTable(
+      (int64_t)1 << nnCacheSizePowerOfTwo, nnXLen, nnYLen, getCacheOwnerMapFraction(), nnMutexPoolSizePowerofTwo
+    );
+    nnInFlightTable = new NNInFlightTable(std::min(nnMutexPoolSizePowerofTwo, IN_FLIGHT_SHARDS_POWER_OF_TWO));
+  }
 
   if(!debugSkipNeuralNet) {
     loadedModel = NeuralNet::loadModelFile(modelFileName, modelFileIdx);
     modelVersion = NeuralNet::getModelVersion(loadedModel);
     inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
     computeContext = NeuralNet::createComputeContext(gpuIdxs,logger,nnXLen,nnYLen,openCLTunerFile,loadedModel);
+    if(inputsVersion == 3 || inputsVersion == 4)
+      ladderCache = new LadderCache(LADDER_CACHE_SIZE_POWER_OF_TWO,LADDER_CACHE_MUTEX_POOL_POWER_OF_TWO);
   }
   else {
     modelVersion = NNModelVersion::defaultModelVersion;
     inputsVersion = NNModelVersion::getInputsVersion(modelVersion);
   }
-
-  m_resultBufss = new NNResultBuf**[numResultBufss];
-  for(int i = 0; i < numResultBufss; i++) {
-    m_resultBufss[i] = new NNResultBuf*[maxBatchSize];
-    for(int j = 0; j < maxBatchSize; j++)
-      m_resultBufss[i][j] = NULL;
-  }
 }
 
 NNEvaluator::~NNEvaluator() {
   killServerThreads();
 
-  for(int i = 0; i < numResultBufss; i++) {
-    NNResultBuf** resultBufs = m_resultBufss[i];
-    //Pointers inside here don't need to be deleted, they simply point to the clients waiting for results
-    delete[] resultBufs;
-    m_resultBufss[i] = NULL;
-  }
-  delete[] m_resultBufss;
-  m_resultBufss = NULL;
+  //Pointers inside here don't need to be deleted, they simply point to the clients waiting for results
+  delete m_queue;
+  m_queue = NULL;
 
   if(loadedModel != NULL)
     NeuralNet::freeLoadedModel(loadedModel);
@@ -160,14 +209,25 @@ NNEvaluator::~NNEvaluator() {
   computeContext = NULL;
 
   delete nnCacheTable;
+  delete nnInFlightTable;
+  delete nnDiskCache;
+  delete ladderCache;
+  delete syntheticNNParams;
+  delete batchingPolicy;
+  delete[] m_batchSizeCounts;
 }
 
 string NNEvaluator::getModelName() const {
+  std::lock_guard<std::mutex> lock(modelMutex);
   return modelName;
 }
 string NNEvaluator::getModelFileName() const {
+  std::lock_guard<std::mutex> lock(modelMutex);
   return modelFileName;
 }
+uint32_t NNEvaluator::getModelGeneration() const {
+  return modelGeneration.load();
+}
 int NNEvaluator::getMaxBatchSize() const {
   return maxNumRows;
 }
@@ -178,12 +238,83 @@ int NNEvaluator::getNNYLen() const {
   return nnYLen;
 }
 Rules NNEvaluator::getSupportedRules(const Rules& desiredRules, bool& supported) {
+  std::lock_guard<std::mutex> lock(modelMutex);
   return NeuralNet::getSupportedRules(loadedModel, desiredRules, supported);
 }
 
+//Peak resident memory of this process so far, or -1 if unknown
+static double getPeakResidentMB() {
+#ifdef OS_IS_UNIX_OR_APPLE
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF,&usage) != 0)
+    return -1;
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+#else
+  return -1;
+#endif
+}
+
+void NNEvaluator::swapModel(const string& newModelName, const string& newModelFileName, int modelFileIdx, Logger* logger) {
+  if(loadedModel == NULL) {
+    {
+      std::lock_guard<std::mutex> lock(modelMutex);
+      modelName = newModelName;
+      modelFileName = newModelFileName;
+    }
+    modelGeneration.fetch_add(1);
+    if(logger != NULL)
+      logger->write("NN eval swapped to model " + newModelName + " (no neural net)");
+    return;
+  }
+
+  ClockTimer timer;
+  LoadedModel* newModel = NeuralNet::loadModelFile(newModelFileName, modelFileIdx);
+  int newModelVersion = NeuralNet::getModelVersion(newModel);
+  if(newModelVersion != modelVersion) {
+    NeuralNet::freeLoadedModel(newModel);
+    throw StringError(
+      "Cannot swap to model " + newModelFileName + " with model version " + Global::intToString(newModelVersion) +
+      ", the current model has version " + Global::intToString(modelVersion)
+    );
+  }
+  double loadSeconds = timer.getSeconds();
+
+  timer.reset();
+  LoadedModel* oldModel;
+  {
+    std::unique_lock<std::mutex> lock(modelMutex);
+    oldModel = loadedModel;
+    loadedModel = newModel;
+    modelName = newModelName;
+    modelFileName = newModelFileName;
+    m_numServersOnOldModel.store(numServersWithHandle);
+    modelGeneration.fetch_add(1);
+    wakeServers();
+    //Server threads switch between batches, and free their handle for the old model once its rows are done
+    while(m_numServersOnOldModel.load() > 0)
+      oldModelReleased.wait(lock);
+  }
+  NeuralNet::freeLoadedModel(oldModel);
+  double switchSeconds = timer.getSeconds();
+
+  if(logger != NULL) {
+    logger->write(Global::strprintf(
+      "NN eval swapped to model %s, loaded in %.3f seconds, switched in %.3f seconds, peak resident memory %.0f MB",
+      newModelName.c_str(), loadSeconds, switchSeconds, getPeakResidentMB()
+    ));
+  }
+}
+
 uint64_t NNEvaluator::numRowsProcessed() const {
   return m_numRowsProcessed.load(std::memory_order_relaxed);
 }
+uint64_t NNEvaluator::numCoalescedRequests() const {
+  return m_numCoalescedRequests.load(std::memory_order_relaxed);
+}
 uint64_t NNEvaluator::numBatchesProcessed() const {
   return m_numBatchesProcessed.load(std::memory_order_relaxed);
 }
@@ -191,9 +322,61 @@ double NNEvaluator::averageProcessedBatchSize() const {
   return (double)numRowsProcessed() / (double)numBatchesProcessed();
 }
 
+vector<uint64_t> NNEvaluator::getBatchSizeHistogram() const {
+  vector<uint64_t> counts(maxNumRows+1);
+  for(int i = 0; i <= maxNumRows; i++)
+    counts[i] = m_batchSizeCounts[i].load(std::memory_order_relaxed);
+  return counts;
+}
+double NNEvaluator::totalBatchFillWaitSeconds() const {
+  return m_batchFillWaitNanos.load(std::memory_order_relaxed) * 1e-9;
+}
+void NNEvaluator::getBatchLatencyModel(double& fixedSeconds, double& perRowSeconds) const {
+  batchingPolicy->getLatencyModel(fixedSeconds,perRowSeconds);
+}
+double NNEvaluator::submitLatencyPercentileSeconds(double fraction) const {
+  return m_submitLatency.getPercentileSeconds(fraction);
+}
+
+void NNEvaluator::getCacheStats(uint64_t& hits, uint64_t& misses, uint64_t& evictions) const {
+  hits = 0;
+  misses = 0;
+  evictions = 0;
+  if(nnCacheTable != NULL) {
+    hits = nnCacheTable->numHits();
+    misses = nnCacheTable->numMisses();
+    evictions = nnCacheTable->numEvictions();
+  }
+}
+
+void NNEvaluator::getDiskCacheStats(uint64_t& hits, uint64_t& misses, uint64_t& writes) const {
+  hits = 0;
+  misses = 0;
+  writes = 0;
+  if(nnDiskCache != NULL) {
+    hits = nnDiskCache->numHits();
+    misses = nnDiskCache->numMisses();
+    writes = nnDiskCache->numWrites();
+  }
+}
+
 void NNEvaluator::clearStats() {
+  if(nnCacheTable != NULL)
+    nnCacheTable->clearStats();
   m_numRowsProcessed.store(0);
+  m_numCoalescedRequests.store(0);
   m_numBatchesProcessed.store(0);
+  for(int i = 0; i <= maxNumRows; i++)
+    m_batchSizeCounts[i].store(0);
+  m_batchFillWaitNanos.store(0);
+  m_submitLatency.clear();
+}
+
+void NNEvaluator::recordBatchProcessed(int numRows, double seconds) {
+  m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
+  m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+  m_batchSizeCounts[numRows].fetch_add(1, std::memory_order_relaxed);
+  batchingPolicy->recordBatch(numRows, seconds);
 }
 
 void NNEvaluator::clearCache() {
@@ -201,6 +384,56 @@ void NNEvaluator::clearCache() {
     nnCacheTable->clear();
 }
 
+//Whole-board ownership is only occasionally requested unless always computed, so most entries need no ownermap slot
+double NNEvaluator::getCacheOwnerMapFraction() const {
+  return alwaysIncludeOwnerMap ? 1.0 : 0.25;
+}
+
+void NNEvaluator::setCacheSizeMB(double megabytes) {
+  if(serverThreads.size() != 0)
+    throw StringError("NNEvaluator::setCacheSizeMB called when server threads already spawned");
+  if(!(megabytes > 0.0))
+    throw StringError("NNEvaluator::setCacheSizeMB: Invalid cache size: " + Global::doubleToString(megabytes));
+  int64_t numEntries = NNCacheTable::getNumEntriesForBytes(
+    (int64_t)(megabytes * 1024.0 * 1024.0), nnXLen, nnYLen, getCacheOwnerMapFraction()
+  );
+  delete nnCacheTable;
+  nnCacheTable = NULL;
+  nnCacheTable = new NNCacheTable(numEntries, nnXLen, nnYLen, getCacheOwnerMapFraction(), cacheMutexPoolSizePowerOfTwo);
+  if(nnInFlightTable == NULL)
+    nnInFlightTable = new NNInFlightTable(std::min(cacheMutexPoolSizePowerOfTwo, IN_FLIGHT_SHARDS_POWER_OF_TWO));
+}
+
+void NNEvaluator::setDiskCache(const string& fileName, int64_t maxFileBytes, Logger* logger) {
+  if(serverThreads.size() != 0)
+    throw StringError("NNEvaluator::setDiskCache called when server threads already spawned");
+  if(nnCacheTable == NULL)
+    throw StringError("NNEvaluator::setDiskCache: the nn disk cache requires the nn cache to be enabled");
+
+  //Cached outputs are postprocessed, so they depend on the policy temperature as well as the exact model
+  string modelKey;
+  if(debugSkipNeuralNet)
+    modelKey = "debugSkipNeuralNet";
+  else {
+    string modelBytes = Global::readFile(modelFileName);
+    char modelHash[65];
+    SHA2::get256((const uint8_t*)modelBytes.data(), modelBytes.size(), modelHash);
+    modelKey = string(modelHash);
+  }
+  modelKey += Global::strprintf(" modelVersion %d nnPolicyInvTemperature %.9g", modelVersion, nnPolicyInvTemperature);
+
+  delete nnDiskCache;
+  nnDiskCache = NULL;
+  nnDiskCache = new NNDiskCache(fileName, modelKey, nnXLen, nnYLen, maxFileBytes, logger);
+  diskCacheModelGeneration = modelGeneration.load();
+}
+
+int64_t NNEvaluator::getCacheSizeBytes() const {
+  if(nnCacheTable == NULL)
+    return 0;
+  return nnCacheTable->getNumBytes();
+}
+
 static void serveEvals(
   int threadIdx, bool doRandomize, string randSeed, int defaultSymmetry, Logger* logger,
   NNEvaluator* nnEval, const LoadedModel* loadedModel,
@@ -214,7 +447,7 @@ static void serveEvals(
   //Used to have a try catch around this but actually we're in big trouble if this raises an exception
   //and causes possibly the only nnEval thread to die, so actually go ahead and let the exception escape to
   //toplevel for easier debugging
-  nnEval->serve(*buf,rand,logger,doRandomize,defaultSymmetry,gpuIdxForThisThread,useFP16,useNHWC);
+  nnEval->serve(*buf,loadedModel,rand,logger,doRandomize,defaultSymmetry,gpuIdxForThisThread,useFP16,useNHWC);
   delete buf;
 }
 
@@ -233,6 +466,14 @@ void NNEvaluator::spawnServerThreads(
   if(gpuIdxByServerThread.size() != numThreads)
     throw StringError("gpuIdxByServerThread.size() != numThreads");
 
+  //Count the threads as holding a handle for this model right away, so that a swapModel waits for them to start up
+  {
+    lock_guard<std::mutex> lock(modelMutex);
+    serverSpawnGeneration = modelGeneration.load();
+    if(loadedModel != NULL)
+      numServersWithHandle += numThreads;
+  }
+
   for(int i = 0; i<numThreads; i++) {
     int gpuIdxForThisThread = gpuIdxByServerThread[i];
     std::thread* thread = new std::thread(
@@ -242,11 +483,25 @@ void NNEvaluator::spawnServerThreads(
   }
 }
 
+void NNEvaluator::setSyntheticNN(const SyntheticNNParams& params) {
+  if(!debugSkipNeuralNet)
+    throw StringError("NNEvaluator::setSyntheticNN requires debugSkipNeuralNet");
+  if(serverThreads.size() != 0)
+    throw StringError("NNEvaluator::setSyntheticNN called when threads were already running!");
+  delete syntheticNNParams;
+  syntheticNNParams = new SyntheticNNParams(params);
+}
+
+void NNEvaluator::setBatchingParams(const NNBatchingParams& params) {
+  if(serverThreads.size() != 0)
+    throw StringError("NNEvaluator::setBatchingParams called when threads were already running!");
+  delete batchingPolicy;
+  batchingPolicy = new NNBatchingPolicy(params, maxNumRows);
+}
+
 void NNEvaluator::killServerThreads() {
-  unique_lock<std::mutex> lock(bufferMutex);
-  isKilled = true;
-  lock.unlock();
-  serverWaitingForBatchStart.notify_all();
+  isKilled.store(true);
+  wakeServers();
 
   for(size_t i = 0; i<serverThreads.size(); i++)
     serverThreads[i]->join();
@@ -255,19 +510,72 @@ void NNEvaluator::killServerThreads() {
   serverThreads.clear();
 
   //Can unset now that threads are dead
-  isKilled = false;
+  isKilled.store(false);
+}
+
+void NNEvaluator::wakeServers() {
+  //Taking the mutex ensures that any server thread that registered itself as sleeping before we got here is either
+  //inside its wait and will get the notification, or has not checked for rows yet and will see them.
+  {
+    lock_guard<std::mutex> lock(serverSleepMutex);
+  }
+  serverWaitingForRows.notify_all();
+}
+
+bool NNEvaluator::waitForQueuedRows(
+  int minRows, const std::chrono::steady_clock::time_point* deadline, uint32_t handleGeneration, bool hasOldHandle
+) {
+  if(m_numQueuedRows.load() >= minRows)
+    return !isKilled.load();
+  unique_lock<std::mutex> lock(serverSleepMutex);
+  //Clients increment m_numQueuedRows and then check m_numServersSleeping, we do the reverse, so that at least one of
+  //us sees the other.
+  m_numServersSleeping.fetch_add(1);
+  while(!isKilled.load() && m_numQueuedRows.load() < minRows && !serverNeedsModelSwitch(handleGeneration,hasOldHandle)) {
+    if(deadline == NULL)
+      serverWaitingForRows.wait(lock);
+    else if(serverWaitingForRows.wait_until(lock,*deadline) == std::cv_status::timeout)
+      break;
+  }
+  m_numServersSleeping.fetch_sub(1);
+  return !isKilled.load();
+}
+
+//Whether a server thread whose compute handle is for handleGeneration should create one for a newly swapped in model,
+//or free the one it kept for the old model now that no rows for it remain
+bool NNEvaluator::serverNeedsModelSwitch(uint32_t handleGeneration, bool hasOldHandle) const {
+  if(debugSkipNeuralNet)
+    return false;
+  if(modelGeneration.load() != handleGeneration)
+    return true;
+  return hasOldHandle && m_numRowsOfGeneration[(handleGeneration - 1) & 1].load() <= 0;
+}
+
+void NNEvaluator::releaseRowGeneration(uint32_t generation) {
+  //The last row for a replaced model lets server threads free their handles for it
+  if(m_numRowsOfGeneration[generation & 1].fetch_sub(1) == 1 && generation != modelGeneration.load())
+    wakeServers();
+}
+
+int NNEvaluator::claimQueuedRows() {
+  int numQueued = m_numQueuedRows.load();
+  while(numQueued > 0) {
+    int numRows = std::min(numQueued, maxNumRows);
+    if(m_numQueuedRows.compare_exchange_weak(numQueued, numQueued - numRows))
+      return numRows;
+  }
+  return 0;
 }
 
 void NNEvaluator::serve(
-  NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
+  NNServerBuf& buf, const LoadedModel* model, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
   int gpuIdxForThisThread, bool useFP16, bool useNHWC
 ) {
 
-  ComputeHandle* gpuHandle = NULL;
-  if(loadedModel != NULL)
-    gpuHandle = NeuralNet::createComputeHandle(
+  auto createGpuHandle = [&](const LoadedModel* modelForHandle) {
+    return NeuralNet::createComputeHandle(
       computeContext,
-      loadedModel,
+      modelForHandle,
       logger,
       maxNumRows,
       nnXLen,
@@ -278,35 +586,113 @@ void NNEvaluator::serve(
       useFP16,
       useNHWC
     );
+  };
+
+  //Start on the model as of spawnServerThreads, even if it has been swapped since, see swapModel
+  ComputeHandle* gpuHandle = NULL;
+  uint32_t handleGeneration = serverSpawnGeneration;
+  if(model != NULL)
+    gpuHandle = createGpuHandle(model);
+  //After swapModel, the handle for the previous model, kept until no rows submitted for it remain
+  ComputeHandle* oldGpuHandle = NULL;
+
+  //Only ever called between batches
+  auto switchModelIfNeeded = [&]() {
+    if(gpuHandle == NULL)
+      return;
+    uint32_t generation = modelGeneration.load();
+    if(generation != handleGeneration) {
+      //swapModel waits for every server thread to free its old handle before allowing another swap
+      assert(oldGpuHandle == NULL);
+      assert(generation == handleGeneration + 1);
+      oldGpuHandle = gpuHandle;
+      handleGeneration = generation;
+      {
+        lock_guard<std::mutex> lock(modelMutex);
+        model = loadedModel;
+      }
+      gpuHandle = createGpuHandle(model);
+    }
+    if(oldGpuHandle != NULL && m_numRowsOfGeneration[(handleGeneration - 1) & 1].load() <= 0) {
+      NeuralNet::freeComputeHandle(oldGpuHandle);
+      oldGpuHandle = NULL;
+      if(m_numServersOnOldModel.fetch_sub(1) == 1) {
+        lock_guard<std::mutex> lock(modelMutex);
+        oldModelReleased.notify_all();
+      }
+    }
+  };
 
   vector<NNOutput*> outputBuf;
 
-  unique_lock<std::mutex> lock(bufferMutex,std::defer_lock);
   while(true) {
-    lock.lock();
-    while(m_currentResultBufsLen <= 0 && m_currentResultBufsIdx == m_oldestResultBufsIdx && !isKilled)
-      serverWaitingForBatchStart.wait(lock);
-
-    if(isKilled)
+    switchModelIfNeeded();
+    if(!waitForQueuedRows(1,NULL,handleGeneration,oldGpuHandle != NULL))
       break;
 
-    std::swap(m_resultBufss[m_oldestResultBufsIdx],buf.resultBufs);
-
-    int numRows;
-    //We grabbed everything in the latest buffer, so clients should move on to an entirely new buffer
-    if(m_currentResultBufsIdx == m_oldestResultBufsIdx) {
-      m_oldestResultBufsIdx = (m_oldestResultBufsIdx + 1) & numResultBufssMask;
-      m_currentResultBufsIdx = m_oldestResultBufsIdx;
-      numRows = m_currentResultBufsLen;
-      m_currentResultBufsLen = 0;
+    //If only a partial batch is available, hold it back a little to see if more rows arrive
+    int rowsBeforeWait = -1;
+    if(!batchingPolicy->isImmediate()) {
+      int targetRows = batchingPolicy->getTargetRows();
+      int64_t waitMicros = batchingPolicy->getWaitMicros();
+      int rowsBefore = m_numQueuedRows.load();
+      if(rowsBefore < targetRows && waitMicros > 0) {
+        ClockTimer waitTimer;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(waitMicros);
+        bool stillAlive = waitForQueuedRows(targetRows,&deadline,handleGeneration,oldGpuHandle != NULL);
+        rowsBeforeWait = rowsBefore;
+        m_batchFillWaitNanos.fetch_add((uint64_t)(waitTimer.getSeconds() * 1e9), std::memory_order_relaxed);
+        if(!stillAlive)
+          break;
+      }
     }
-    //We grabbed a buffer that clients have already entirely moved onward from.
-    else {
-      m_oldestResultBufsIdx = (m_oldestResultBufsIdx + 1) & numResultBufssMask;
-      numRows = maxNumRows;
+
+    //Another server thread may have taken the rows in the meantime
+    int numRows = claimQueuedRows();
+    if(numRows <= 0)
+      continue;
+    if(rowsBeforeWait >= 0)
+      batchingPolicy->recordWait(rowsBeforeWait,numRows);
+    for(int row = 0; row < numRows; row++) {
+      //A claimed row may belong to a client that has reserved its slot but not quite finished writing it
+      while(!m_queue->tryPop(buf.resultBufs[row]))
+        std::this_thread::yield();
     }
+    //Rows may have been submitted after a swap that we have not caught up to yet
+    switchModelIfNeeded();
+
+    if(syntheticNNParams != NULL) {
+      ClockTimer timer;
+      for(int row = 0; row < numRows; row++) {
+        NNResultBuf* resultBuf = buf.resultBufs[row];
+        assert(resultBuf != NULL);
+        NNOutput* output = new NNOutput();
+        output->whiteOwnerMap = resultBuf->includeOwnerMap ? new float[nnXLen*nnYLen] : NULL;
+        SyntheticNN::fillOutput(
+          resultBuf->nnHashForServer, resultBuf->boardXSizeForServer, resultBuf->boardYSizeForServer,
+          nnXLen, nnYLen, resultBuf->includeOwnerMap, *output
+        );
+        outputBuf.push_back(output);
+      }
+      //Simulate the time the device would take on this batch, less what we already spent producing the outputs
+      double remaining = SyntheticNN::getBatchLatencySeconds(*syntheticNNParams, numRows) - timer.getSeconds();
+      if(remaining > 0)
+        std::this_thread::sleep_for(std::chrono::duration<double>(remaining));
+
+      recordBatchProcessed(numRows, timer.getSeconds());
+
+      for(int row = 0; row < numRows; row++) {
+        NNResultBuf* resultBuf = buf.resultBufs[row];
+        buf.resultBufs[row] = NULL;
 
-    lock.unlock();
+        assert(!resultBuf->resultReady.isSet());
+        resultBuf->result = std::shared_ptr<NNOutput>(outputBuf[row]);
+        releaseRowGeneration(resultBuf->modelGenerationForServer);
+        resultBuf->resultReady.set();
+      }
+      outputBuf.clear();
+      continue;
+    }
 
     if(debugSkipNeuralNet) {
       for(int row = 0; row < numRows; row++) {
@@ -317,8 +703,7 @@ void NNEvaluator::serve(
         int boardXSize = resultBuf->boardXSizeForServer;
         int boardYSize = resultBuf->boardYSizeForServer;
 
-        unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
-        assert(resultBuf->hasResult == false);
+        assert(!resultBuf->resultReady.isSet());
         resultBuf->result = std::make_shared<NNOutput>();
 
         float* policyProbs = resultBuf->result->policyProbs;
@@ -365,74 +750,108 @@ void NNEvaluator::serve(
         resultBuf->result->whiteNoResultProb = whiteNoResultProb;
         resultBuf->result->whiteScoreMean = whiteScoreMean;
         resultBuf->result->whiteScoreMeanSq = whiteScoreMeanSq;
-        resultBuf->hasResult = true;
-        resultBuf->clientWaitingForResult.notify_all();
-        resultLock.unlock();
+        releaseRowGeneration(resultBuf->modelGenerationForServer);
+        resultBuf->resultReady.set();
       }
       continue;
     }
 
-    int symmetry = defaultSymmetry;
-    if(doRandomize)
-      symmetry = rand.nextUInt(NNInputs::NUM_SYMMETRY_COMBINATIONS);
-    bool* symmetriesBuffer = NeuralNet::getSymmetriesInplace(buf.inputBuffers);
-    symmetriesBuffer[0] = (symmetry & 0x1) != 0;
-    symmetriesBuffer[1] = (symmetry & 0x2) != 0;
-    symmetriesBuffer[2] = (symmetry & 0x4) != 0;
-
-    outputBuf.clear();
-    for(int row = 0; row<numRows; row++) {
-      NNOutput* emptyOutput = new NNOutput();
-      assert(buf.resultBufs[row] != NULL);
-      emptyOutput->nnXLen = nnXLen;
-      emptyOutput->nnYLen = nnYLen;
-      if(buf.resultBufs[row]->includeOwnerMap)
-        emptyOutput->whiteOwnerMap = new float[nnXLen*nnYLen];
-      else
-        emptyOutput->whiteOwnerMap = NULL;
-      outputBuf.push_back(emptyOutput);
+    //Rows submitted before a swap are still evaluated with the old model, as a separate batch from the rest
+    int numOldRows = 0;
+    if(oldGpuHandle != NULL) {
+      uint32_t generation = handleGeneration;
+      NNResultBuf** oldRowsEnd = std::stable_partition(
+        buf.resultBufs, buf.resultBufs + numRows,
+        [generation](const NNResultBuf* resultBuf) { return resultBuf->modelGenerationForServer != generation; }
+      );
+      numOldRows = (int)(oldRowsEnd - buf.resultBufs);
     }
 
-    int numSpatialFeatures = NNModelVersion::getNumSpatialFeatures(modelVersion);
-    int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(modelVersion);
-    int rowSpatialLen = numSpatialFeatures * nnXLen * nnYLen;
-    int rowGlobalLen = numGlobalFeatures;
-    assert(rowSpatialLen == NeuralNet::getBatchEltSpatialLen(buf.inputBuffers));
-    assert(rowGlobalLen == NeuralNet::getBatchEltGlobalLen(buf.inputBuffers));
+    for(int groupStart = 0; groupStart < numRows; ) {
+      int groupEnd = groupStart < numOldRows ? numOldRows : numRows;
+      ComputeHandle* groupGpuHandle = groupStart < numOldRows ? oldGpuHandle : gpuHandle;
+      int groupRows = groupEnd - groupStart;
+      NNResultBuf** resultBufs = buf.resultBufs + groupStart;
+
+      //Pick independently for each row, so that rows evaluated together do not share the same orientation noise
+      int* symmetriesBuffer = NeuralNet::getSymmetriesInplace(buf.inputBuffers);
+      for(int row = 0; row<groupRows; row++) {
+        int symmetry = resultBufs[row]->symmetry;
+        if(symmetry == NNInputs::SYMMETRY_NOTSPECIFIED)
+          symmetry = doRandomize ? (int)rand.nextUInt(NNInputs::NUM_SYMMETRY_COMBINATIONS) : defaultSymmetry;
+        symmetriesBuffer[row] = symmetry;
+      }
 
-    for(int row = 0; row<numRows; row++) {
-      float* rowSpatialInput = NeuralNet::getBatchEltSpatialInplace(buf.inputBuffers,row);
-      float* rowGlobalInput = NeuralNet::getBatchEltGlobalInplace(buf.inputBuffers,row);
+      outputBuf.clear();
+      for(int row = 0; row<groupRows; row++) {
+        NNOutput* emptyOutput = new NNOutput();
+        assert(resultBufs[row] != NULL);
+        emptyOutput->nnXLen = nnXLen;
+        emptyOutput->nnYLen = nnYLen;
+        if(resultBufs[row]->includeOwnerMap)
+          emptyOutput->whiteOwnerMap = new float[nnXLen*nnYLen];
+        else
+          emptyOutput->whiteOwnerMap = NULL;
+        outputBuf.push_back(emptyOutput);
+      }
 
-      const float* rowSpatial = buf.resultBufs[row]->rowSpatial;
-      const float* rowGlobal = buf.resultBufs[row]->rowGlobal;
-      std::copy(rowSpatial,rowSpatial+rowSpatialLen,rowSpatialInput);
-      std::copy(rowGlobal,rowGlobal+rowGlobalLen,rowGlobalInput);
-    }
+      int numSpatialFeatures = NNModelVersion::getNumSpatialFeatures(modelVersion);
+      int numGlobalFeatures = NNModelVersion::getNumGlobalFeatures(modelVersion);
+      int rowSpatialLen = numSpatialFeatures * nnXLen * nnYLen;
+      int rowGlobalLen = numGlobalFeatures;
+      assert(rowSpatialLen == NeuralNet::getBatchEltSpatialLen(buf.inputBuffers));
+      assert(rowGlobalLen == NeuralNet::getBatchEltGlobalLen(buf.inputBuffers));
+
+      for(int row = 0; row<groupRows; row++) {
+        float* rowSpatialInput = NeuralNet::getBatchEltSpatialInplace(buf.inputBuffers,row);
+        float* rowGlobalInput = NeuralNet::getBatchEltGlobalInplace(buf.inputBuffers,row);
+
+        const NNResultBuf* resultBuf = resultBufs[row];
+        if(resultBuf->boardForServer != NULL) {
+          fillRow(
+            *(resultBuf->boardForServer), *(resultBuf->historyForServer), resultBuf->nextPlayerForServer,
+            resultBuf->drawEquivalentWinsForWhiteForServer, rowSpatialInput, rowGlobalInput
+          );
+        }
+        else {
+          const float* rowSpatial = resultBuf->rowSpatial;
+          const float* rowGlobal = resultBuf->rowGlobal;
+          std::copy(rowSpatial,rowSpatial+rowSpatialLen,rowSpatialInput);
+          std::copy(rowGlobal,rowGlobal+rowGlobalLen,rowGlobalInput);
+        }
+      }
 
-    NeuralNet::getOutput(gpuHandle, buf.inputBuffers, numRows, outputBuf);
-    assert(outputBuf.size() == numRows);
+      ClockTimer timer;
+      NeuralNet::getOutput(groupGpuHandle, buf.inputBuffers, groupRows, outputBuf);
+      assert(outputBuf.size() == groupRows);
 
-    m_numRowsProcessed.fetch_add(numRows, std::memory_order_relaxed);
-    m_numBatchesProcessed.fetch_add(1, std::memory_order_relaxed);
+      recordBatchProcessed(groupRows, timer.getSeconds());
 
-    for(int row = 0; row < numRows; row++) {
-      assert(buf.resultBufs[row] != NULL);
-      NNResultBuf* resultBuf = buf.resultBufs[row];
-      buf.resultBufs[row] = NULL;
+      for(int row = 0; row < groupRows; row++) {
+        assert(resultBufs[row] != NULL);
+        NNResultBuf* resultBuf = resultBufs[row];
+        resultBufs[row] = NULL;
 
-      unique_lock<std::mutex> resultLock(resultBuf->resultMutex);
-      assert(resultBuf->hasResult == false);
-      resultBuf->result = std::shared_ptr<NNOutput>(outputBuf[row]);
-      resultBuf->hasResult = true;
-      resultBuf->clientWaitingForResult.notify_all();
-      resultLock.unlock();
+        assert(!resultBuf->resultReady.isSet());
+        resultBuf->result = std::shared_ptr<NNOutput>(outputBuf[row]);
+        releaseRowGeneration(resultBuf->modelGenerationForServer);
+        resultBuf->resultReady.set();
+      }
+      groupStart = groupEnd;
     }
 
     continue;
   }
 
+  if(oldGpuHandle != NULL)
+    NeuralNet::freeComputeHandle(oldGpuHandle);
   NeuralNet::freeComputeHandle(gpuHandle);
+  if(gpuHandle != NULL) {
+    lock_guard<std::mutex> lock(modelMutex);
+    numServersWithHandle -= 1;
+    if(oldGpuHandle != NULL && m_numServersOnOldModel.fetch_sub(1) == 1)
+      oldModelReleased.notify_all();
+  }
 }
 
 void NNEvaluator::evaluate(
@@ -445,111 +864,345 @@ void NNEvaluator::evaluate(
   bool skipCache,
   bool includeOwnerMap
 ) {
-  assert(!isKilled);
-  buf.hasResult = false;
+  evaluate(board,history,nextPlayer,drawEquivalentWinsForWhite,buf,logger,skipCache,includeOwnerMap,NNInputs::SYMMETRY_NOTSPECIFIED);
+}
 
-  if(board.x_size > nnXLen || board.y_size > nnYLen)
-    throw StringError("NNEvaluator was configured with nnXLen = " + Global::intToString(nnXLen) +
-                      " nnYLen = " + Global::intToString(nnYLen) +
-                      " but was asked to evaluate board with larger x or y size");
-  if(requireExactNNLen) {
-    if(board.x_size != nnXLen || board.y_size != nnYLen)
-      throw StringError("NNEvaluator was configured with nnXLen = " + Global::intToString(nnXLen) +
-                        " nnYLen = " + Global::intToString(nnYLen) +
-                        " and requireExactNNLen, but was asked to evaluate board with different x or y size");
-  }
+void NNEvaluator::evaluate(
+  Board& board,
+  const BoardHistory& history,
+  Player nextPlayer,
+  double drawEquivalentWinsForWhite,
+  NNResultBuf& buf,
+  Logger* logger,
+  bool skipCache,
+  bool includeOwnerMap,
+  int symmetry
+) {
+  assert(!isKilled.load());
+  if(symmetry != NNInputs::SYMMETRY_NOTSPECIFIED && (symmetry < 0 || symmetry >= NNInputs::NUM_SYMMETRY_COMBINATIONS))
+    throw StringError("NNEvaluator: invalid symmetry " + Global::intToString(symmetry));
+  //The cache does not know which symmetry its entries came from
+  bool useCache = nnCacheTable != NULL && symmetry == NNInputs::SYMMETRY_NOTSPECIFIED;
 
-  static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
-  Hash128 nnHash;
-  if(inputsVersion == 3)
-    nnHash = NNInputs::getHashV3(board, history, nextPlayer, drawEquivalentWinsForWhite);
-  else if(inputsVersion == 4)
-    nnHash = NNInputs::getHashV4(board, history, nextPlayer, drawEquivalentWinsForWhite);
-  else if(inputsVersion == 5)
-    nnHash = NNInputs::getHashV5(board, history, nextPlayer, drawEquivalentWinsForWhite);
-  else
-    ASSERT_UNREACHABLE;
+  checkBoardSize(board);
+  Hash128 nnHash = computeNNHash(board, history, nextPlayer, drawEquivalentWinsForWhite);
 
   includeOwnerMap |= alwaysIncludeOwnerMap;
 
-  bool hadResultWithoutOwnerMap = false;
+  uint32_t generation = modelGeneration.load();
   shared_ptr<NNOutput> resultWithoutOwnerMap;
-  if(nnCacheTable != NULL && !skipCache && nnCacheTable->get(nnHash,buf.result)) {
-    if(!(includeOwnerMap && buf.result->whiteOwnerMap == NULL))
-    {
-      buf.hasResult = true;
+  if(useCache && !skipCache && lookupCache(nnHash,generation,includeOwnerMap,buf.result,resultWithoutOwnerMap))
+    return;
+  bool hadResultWithoutOwnerMap = resultWithoutOwnerMap != nullptr;
+
+  //If an identical evaluation is already in flight, wait for its result rather than taking up another row.
+  //Not if we only lack the ownermap, since then we want to keep the policy and values we already have, see below.
+  bool isInFlightLeader = false;
+  if(useCache) {
+    bool canJoin = !skipCache && !hadResultWithoutOwnerMap;
+    if(nnInFlightTable->joinOrLead(nnHash,generation,includeOwnerMap,canJoin,buf,isInFlightLeader)) {
+      buf.resultReady.wait();
+      m_numCoalescedRequests.fetch_add(1, std::memory_order_relaxed);
+      if(buf.result == nullptr)
+        throw StringError("NNEvaluator: evaluation that this request was waiting on failed");
       return;
     }
-    else {
-      hadResultWithoutOwnerMap = true;
-      resultWithoutOwnerMap = std::move(buf.result);
-      buf.result = nullptr;
-    }
   }
+
   buf.includeOwnerMap = includeOwnerMap;
+  buf.symmetry = symmetry;
 
   buf.boardXSizeForServer = board.x_size;
   buf.boardYSizeForServer = board.y_size;
+  buf.nnHashForServer = nnHash;
+  buf.boardForServer = NULL;
 
-  if(!debugSkipNeuralNet) {
-    int rowSpatialLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * nnXLen * nnYLen;
-    if(buf.rowSpatial == NULL) {
-      buf.rowSpatial = new float[rowSpatialLen];
-      buf.rowSpatialSize = rowSpatialLen;
-    }
-    else {
-      if(buf.rowSpatialSize != rowSpatialLen)
-        throw StringError("Cannot reuse an nnResultBuf with different dimensions or model version");
-    }
-    int rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
-    if(buf.rowGlobal == NULL) {
-      buf.rowGlobal = new float[rowGlobalLen];
-      buf.rowGlobalSize = rowGlobalLen;
+  if(!debugSkipNeuralNet || syntheticNNParams != NULL) {
+    allocateRowBuffers(buf);
+    fillRow(board, history, nextPlayer, drawEquivalentWinsForWhite, buf.rowSpatial, buf.rowGlobal);
+  }
+
+  std::chrono::steady_clock::time_point submitTime = std::chrono::steady_clock::now();
+  pushQueuedRow(buf);
+
+  buf.resultReady.wait();
+  m_submitLatency.add(std::chrono::duration<double>(std::chrono::steady_clock::now() - submitTime).count());
+
+  //Requests coalesced onto this one must be released even if postprocessing fails
+  try {
+    postprocessResult(board,history,nextPlayer,buf,logger,hadResultWithoutOwnerMap,resultWithoutOwnerMap);
+  }
+  catch(...) {
+    if(isInFlightLeader)
+      nnInFlightTable->finish(nnHash,nullptr);
+    throw;
+  }
+
+  //And record the nnHash in the result and put it into the table
+  buf.result->nnHash = nnHash;
+  if(useCache)
+    nnCacheTable->set(buf.result,buf.modelGenerationForServer);
+  //After the cache, so that a request arriving once we are no longer in flight finds the result there
+  if(isInFlightLeader)
+    nnInFlightTable->finish(nnHash,buf.result);
+  //Last, since it writes to a file and any coalesced requests need not wait on it
+  if(useCache && nnDiskCache != NULL && buf.modelGenerationForServer == diskCacheModelGeneration)
+    nnDiskCache->set(buf.result);
+}
+
+void NNEvaluator::evaluateBatch(
+  const vector<NNBatchQuery>& queries,
+  vector<shared_ptr<NNOutput>>& results,
+  Logger* logger,
+  bool skipCache
+) {
+  assert(!isKilled.load());
+  bool useCache = nnCacheTable != NULL;
+  results.assign(queries.size(),nullptr);
+
+  //A query that missed the cache, either submitted as a row of its own or waiting on an identical evaluation in flight
+  struct Pending {
+    size_t queryIdx;
+    NNResultBuf* buf;
+    Hash128 nnHash;
+    bool coalesced;
+    bool isInFlightLeader;
+    shared_ptr<NNOutput> resultWithoutOwnerMap;
+    std::chrono::steady_clock::time_point submitTime;
+  };
+  //Finished in the order submitted, so at most maxNumRows are outstanding and each can use the buf at its position
+  //in a ring. Since a query can only coalesce onto one submitted before it, this never waits on itself.
+  std::unique_ptr<NNResultBuf[]> bufs(new NNResultBuf[maxNumRows]);
+  std::deque<Pending> outstanding;
+  size_t numStarted = 0;
+
+  auto finishOldest = [&]() {
+    Pending& pending = outstanding.front();
+    NNResultBuf& buf = *(pending.buf);
+    buf.resultReady.wait();
+    if(pending.coalesced) {
+      m_numCoalescedRequests.fetch_add(1, std::memory_order_relaxed);
+      if(buf.result == nullptr)
+        throw StringError("NNEvaluator: evaluation that this request was waiting on failed");
     }
     else {
-      if(buf.rowGlobalSize != rowGlobalLen)
-        throw StringError("Cannot reuse an nnResultBuf with different dimensions or model version");
+      m_submitLatency.add(std::chrono::duration<double>(std::chrono::steady_clock::now() - pending.submitTime).count());
+      const NNBatchQuery& query = queries[pending.queryIdx];
+      bool hadResultWithoutOwnerMap = pending.resultWithoutOwnerMap != nullptr;
+      postprocessResult(
+        *(query.board),*(query.history),query.nextPlayer,buf,logger,hadResultWithoutOwnerMap,pending.resultWithoutOwnerMap
+      );
+      buf.result->nnHash = pending.nnHash;
+      if(useCache)
+        nnCacheTable->set(buf.result,buf.modelGenerationForServer);
+      if(pending.isInFlightLeader) {
+        pending.isInFlightLeader = false;
+        nnInFlightTable->finish(pending.nnHash,buf.result);
+      }
+      if(useCache && nnDiskCache != NULL && buf.modelGenerationForServer == diskCacheModelGeneration)
+        nnDiskCache->set(buf.result);
     }
+    results[pending.queryIdx] = std::move(buf.result);
+    outstanding.pop_front();
+  };
+
+  try {
+    for(size_t i = 0; i<queries.size(); i++) {
+      const NNBatchQuery& query = queries[i];
+      const Board& board = *(query.board);
+      checkBoardSize(board);
+      Hash128 nnHash = computeNNHash(board, *(query.history), query.nextPlayer, query.drawEquivalentWinsForWhite);
+      bool includeOwnerMap = query.includeOwnerMap || alwaysIncludeOwnerMap;
+
+      uint32_t generation = modelGeneration.load();
+      shared_ptr<NNOutput> resultWithoutOwnerMap;
+      if(useCache && !skipCache && lookupCache(nnHash,generation,includeOwnerMap,results[i],resultWithoutOwnerMap))
+        continue;
+
+      if(outstanding.size() >= (size_t)maxNumRows)
+        finishOldest();
+      NNResultBuf& buf = bufs[numStarted % maxNumRows];
+      numStarted++;
+      buf.result = nullptr;
 
-    static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
-    if(inputsVersion == 3) {
-      NNInputs::fillRowV3(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, buf.rowSpatial, buf.rowGlobal);
+      Pending pending;
+      pending.queryIdx = i;
+      pending.buf = &buf;
+      pending.nnHash = nnHash;
+      pending.coalesced = false;
+      pending.isInFlightLeader = false;
+      pending.resultWithoutOwnerMap = std::move(resultWithoutOwnerMap);
+
+      if(useCache) {
+        bool canJoin = !skipCache && pending.resultWithoutOwnerMap == nullptr;
+        if(nnInFlightTable->joinOrLead(nnHash,generation,includeOwnerMap,canJoin,buf,pending.isInFlightLeader)) {
+          pending.coalesced = true;
+          outstanding.push_back(std::move(pending));
+          continue;
+        }
+      }
+
+      buf.includeOwnerMap = includeOwnerMap;
+      buf.symmetry = NNInputs::SYMMETRY_NOTSPECIFIED;
+      buf.boardXSizeForServer = board.x_size;
+      buf.boardYSizeForServer = board.y_size;
+      buf.nnHashForServer = nnHash;
+      buf.boardForServer = NULL;
+      //Synthetic servers have no input buffers, so featurize here as evaluate does to still include the cost
+      if(syntheticNNParams != NULL) {
+        allocateRowBuffers(buf);
+        fillRow(board, *(query.history), query.nextPlayer, query.drawEquivalentWinsForWhite, buf.rowSpatial, buf.rowGlobal);
+      }
+      else if(!debugSkipNeuralNet) {
+        buf.boardForServer = &board;
+        buf.historyForServer = query.history;
+        buf.nextPlayerForServer = query.nextPlayer;
+        buf.drawEquivalentWinsForWhiteForServer = query.drawEquivalentWinsForWhite;
+      }
+
+      pending.submitTime = std::chrono::steady_clock::now();
+      outstanding.push_back(std::move(pending));
+      pushQueuedRow(buf);
     }
-    else if(inputsVersion == 4) {
-      NNInputs::fillRowV4(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, buf.rowSpatial, buf.rowGlobal);
+    while(!outstanding.empty())
+      finishOldest();
+  }
+  catch(...) {
+    //Server threads may still be writing to the bufs, and other requests may be coalesced onto ours.
+    //Release ours first, since what we are coalesced onto may be among them.
+    for(Pending& pending: outstanding) {
+      if(!pending.coalesced) {
+        pending.buf->resultReady.wait();
+        if(pending.isInFlightLeader)
+          nnInFlightTable->finish(pending.nnHash,nullptr);
+      }
     }
-    else if(inputsVersion == 5) {
-      NNInputs::fillRowV5(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, buf.rowSpatial, buf.rowGlobal);
+    for(Pending& pending: outstanding) {
+      if(pending.coalesced)
+        pending.buf->resultReady.wait();
     }
-    else
-      ASSERT_UNREACHABLE;
+    throw;
   }
+}
 
-  unique_lock<std::mutex> lock(bufferMutex);
+void NNEvaluator::checkBoardSize(const Board& board) const {
+  if(board.x_size > nnXLen || board.y_size > nnYLen)
+    throw StringError("NNEvaluator was configured with nnXLen = " + Global::intToString(nnXLen) +
+                      " nnYLen = " + Global::intToString(nnYLen) +
+                      " but was asked to evaluate board with larger x or y size");
+  if(requireExactNNLen) {
+    if(board.x_size != nnXLen || board.y_size != nnYLen)
+      throw StringError("NNEvaluator was configured with nnXLen = " + Global::intToString(nnXLen) +
+                        " nnYLen = " + Global::intToString(nnYLen) +
+                        " and requireExactNNLen, but was asked to evaluate board with different x or y size");
+  }
+}
 
-  m_resultBufss[m_currentResultBufsIdx][m_currentResultBufsLen] = &buf;
-  m_currentResultBufsLen += 1;
-  if(m_currentResultBufsLen == 1 && m_currentResultBufsIdx == m_oldestResultBufsIdx)
-    serverWaitingForBatchStart.notify_one();
+Hash128 NNEvaluator::computeNNHash(const Board& board, const BoardHistory& history, Player nextPlayer, double drawEquivalentWinsForWhite) const {
+  static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
+  if(inputsVersion == 3)
+    return NNInputs::getHashV3(board, history, nextPlayer, drawEquivalentWinsForWhite);
+  else if(inputsVersion == 4)
+    return NNInputs::getHashV4(board, history, nextPlayer, drawEquivalentWinsForWhite);
+  else if(inputsVersion == 5)
+    return NNInputs::getHashV5(board, history, nextPlayer, drawEquivalentWinsForWhite);
+  ASSERT_UNREACHABLE;
+  return Hash128();
+}
 
-  bool overlooped = false;
-  if(m_currentResultBufsLen >= maxNumRows) {
-    m_currentResultBufsLen = 0;
-    m_currentResultBufsIdx = (m_currentResultBufsIdx + 1) & numResultBufssMask;
-    overlooped = m_currentResultBufsIdx == m_oldestResultBufsIdx;
+void NNEvaluator::fillRow(
+  const Board& board, const BoardHistory& history, Player nextPlayer, double drawEquivalentWinsForWhite,
+  float* rowSpatial, float* rowGlobal
+) const {
+  static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
+  if(inputsVersion == 3) {
+    NNInputs::fillRowV3(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, ladderCache, rowSpatial, rowGlobal);
+  }
+  else if(inputsVersion == 4) {
+    NNInputs::fillRowV4(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, ladderCache, rowSpatial, rowGlobal);
   }
-  lock.unlock();
+  else if(inputsVersion == 5) {
+    NNInputs::fillRowV5(board, history, nextPlayer, drawEquivalentWinsForWhite, nnXLen, nnYLen, inputsUseNHWC, rowSpatial, rowGlobal);
+  }
+  else
+    ASSERT_UNREACHABLE;
+}
 
-  //This should only fire if we have more than maxConcurrentEvals evaluating, such that they wrap the
-  //circular buffer.
-  assert(!overlooped);
-  (void)overlooped; //Avoid unused variable when asserts disabled
+void NNEvaluator::allocateRowBuffers(NNResultBuf& buf) const {
+  int rowSpatialLen = NNModelVersion::getNumSpatialFeatures(modelVersion) * nnXLen * nnYLen;
+  if(buf.rowSpatial == NULL) {
+    buf.rowSpatial = new float[rowSpatialLen];
+    buf.rowSpatialSize = rowSpatialLen;
+  }
+  else {
+    if(buf.rowSpatialSize != rowSpatialLen)
+      throw StringError("Cannot reuse an nnResultBuf with different dimensions or model version");
+  }
+  int rowGlobalLen = NNModelVersion::getNumGlobalFeatures(modelVersion);
+  if(buf.rowGlobal == NULL) {
+    buf.rowGlobal = new float[rowGlobalLen];
+    buf.rowGlobalSize = rowGlobalLen;
+  }
+  else {
+    if(buf.rowGlobalSize != rowGlobalLen)
+      throw StringError("Cannot reuse an nnResultBuf with different dimensions or model version");
+  }
+}
 
-  unique_lock<std::mutex> resultLock(buf.resultMutex);
-  while(!buf.hasResult)
-    buf.clientWaitingForResult.wait(resultLock);
-  resultLock.unlock();
+bool NNEvaluator::lookupCache(
+  Hash128 nnHash, uint32_t generation, bool includeOwnerMap,
+  shared_ptr<NNOutput>& result, shared_ptr<NNOutput>& resultWithoutOwnerMap
+) {
+  if(nnCacheTable->get(nnHash,generation,result)) {
+    if(!(includeOwnerMap && result->whiteOwnerMap == NULL))
+      return true;
+    resultWithoutOwnerMap = std::move(result);
+    result = nullptr;
+  }
+  //Then the disk cache, which if hit, also refills the cache in RAM
+  if(nnDiskCache != NULL && generation == diskCacheModelGeneration) {
+    shared_ptr<NNOutput> diskResult;
+    if(nnDiskCache->get(nnHash,diskResult) && !(includeOwnerMap && diskResult->whiteOwnerMap == NULL)) {
+      nnCacheTable->set(diskResult,generation);
+      result = std::move(diskResult);
+      resultWithoutOwnerMap = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
 
+void NNEvaluator::pushQueuedRow(NNResultBuf& buf) {
+  buf.resultReady.reset();
+  //Count the row before checking that the generation is still current, so that any server thread that sees a newer
+  //generation also sees every row of the older one and keeps the old model around for it.
+  while(true) {
+    uint32_t generation = modelGeneration.load();
+    m_numRowsOfGeneration[generation & 1].fetch_add(1);
+    if(modelGeneration.load() == generation) {
+      buf.modelGenerationForServer = generation;
+      break;
+    }
+    releaseRowGeneration(generation);
+  }
+  //The queue holds maxConcurrentEvals plus a batch, so it only fills if several threads call evaluateBatch at once
+  while(!m_queue->tryPush(&buf))
+    std::this_thread::yield();
+  int numQueued = m_numQueuedRows.fetch_add(1) + 1;
+  //Servers only ever sleep waiting for the queue to become nonempty or to reach the fill target
+  if(m_numServersSleeping.load() > 0 && (numQueued == 1 || numQueued == batchingPolicy->getTargetRows()))
+    wakeServers();
+}
+
+void NNEvaluator::postprocessResult(
+  const Board& board,
+  const BoardHistory& history,
+  Player nextPlayer,
+  NNResultBuf& buf,
+  Logger* logger,
+  bool hadResultWithoutOwnerMap,
+  const shared_ptr<NNOutput>& resultWithoutOwnerMap
+) {
   //Perform postprocessing on the result - turn the nn output into probabilities
   //As a hack though, if the only thing we were missing was the ownermap, just grab the old policy and values
   //and use those. This avoids recomputing in a randomly different orientation when we just need the ownermap
@@ -776,99 +1429,314 @@ void NNEvaluator::evaluate(
     }
   }
 
-
-  //And record the nnHash in the result and put it into the table
-  buf.result->nnHash = nnHash;
-  if(nnCacheTable != NULL)
-    nnCacheTable->set(buf.result);
-
 }
 
-//Uncomment this to lower the effective hash size down to one where we get true collisions
-//#define SIMULATE_TRUE_HASH_COLLISIONS
+static const uint8_t SLOT_OCCUPIED = 0x1;
+static const uint8_t SLOT_REFERENCED = 0x2;
+static const int NUM_CACHED_VALUES = 5;
 
-NNCacheTable::Entry::Entry()
-  :ptr(nullptr)
-{}
-NNCacheTable::Entry::~Entry()
-{}
+static int64_t getSlotBytes(int policySize) {
+  return sizeof(Hash128) + sizeof(uint32_t) + sizeof(uint8_t) + NUM_CACHED_VALUES * sizeof(float) + policySize * sizeof(uint16_t);
+}
+static int64_t getOwnerSlotBytes(int ownerMapSize) {
+  return sizeof(Hash128) + sizeof(uint32_t) + sizeof(bool) + ownerMapSize * sizeof(uint16_t);
+}
 
-NNCacheTable::NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo) {
-  if(sizePowerOfTwo < 0 || sizePowerOfTwo > 63)
-    throw StringError("NNCacheTable: Invalid sizePowerOfTwo: " + Global::intToString(sizePowerOfTwo));
+NNCacheTable::NNCacheTable(int64_t numEntries, int xLen, int yLen, double ownerMapFraction, int mutexPoolSizePowerOfTwo)
+  :nnXLen(xLen),
+   nnYLen(yLen),
+   policySize(NNPos::getPolicySize(xLen,yLen)),
+   ownerMapSize(xLen*yLen),
+   m_numHits(0),
+   m_numMisses(0),
+   m_numEvictions(0)
+{
+  if(numEntries <= 0)
+    throw StringError("NNCacheTable: Invalid numEntries: " + Global::int64ToString(numEntries));
+  if(!(ownerMapFraction > 0.0 && ownerMapFraction <= 1.0))
+    throw StringError("NNCacheTable: Invalid ownerMapFraction: " + Global::doubleToString(ownerMapFraction));
   if(mutexPoolSizePowerOfTwo < 0 || mutexPoolSizePowerOfTwo > 31)
     throw StringError("NNCacheTable: Invalid mutexPoolSizePowerOfTwo: " + Global::intToString(mutexPoolSizePowerOfTwo));
-#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
-  sizePowerOfTwo = sizePowerOfTwo > 12 ? 12 : sizePowerOfTwo;
-#endif
 
-  tableSize = ((uint64_t)1) << sizePowerOfTwo;
-  tableMask = tableSize-1;
-  entries = new Entry[tableSize];
-  uint32_t mutexPoolSize = ((uint32_t)1) << mutexPoolSizePowerOfTwo;
-  mutexPoolMask = mutexPoolSize-1;
-  mutexPool = new MutexPool(mutexPoolSize);
+  numBuckets = std::max((uint64_t)1, (uint64_t)numEntries / NUM_WAYS);
+  numOwnerBuckets = std::max((uint64_t)1, (uint64_t)(numBuckets * ownerMapFraction));
+  //Entries that share an ownermap slot must also share a mutex, so mutexes are picked by ownermap bucket
+  numMutexes = (uint32_t)std::min((uint64_t)1 << mutexPoolSizePowerOfTwo, numOwnerBuckets);
+
+  uint64_t numSlots = numBuckets * NUM_WAYS;
+  uint64_t numOwnerSlots = numOwnerBuckets * NUM_WAYS;
+  slotHashes = new Hash128[numSlots];
+  slotGenerations = new uint32_t[numSlots];
+  std::fill(slotGenerations, slotGenerations + numSlots, (uint32_t)0);
+  slotFlags = new uint8_t[numSlots];
+  std::fill(slotFlags, slotFlags + numSlots, (uint8_t)0);
+  slotValues = new float[numSlots * NUM_CACHED_VALUES];
+  slotPolicies = new uint16_t[numSlots * policySize];
+  clockHands = new uint8_t[numBuckets];
+  std::fill(clockHands, clockHands + numBuckets, (uint8_t)0);
+  ownerHashes = new Hash128[numOwnerSlots];
+  ownerGenerations = new uint32_t[numOwnerSlots];
+  ownerValid = new bool[numOwnerSlots];
+  std::fill(ownerValid, ownerValid + numOwnerSlots, false);
+  ownerMaps = new uint16_t[numOwnerSlots * ownerMapSize];
+
+  mutexPool = new MutexPool(numMutexes);
 }
+
 NNCacheTable::~NNCacheTable() {
-  delete[] entries;
+  delete[] slotHashes;
+  delete[] slotGenerations;
+  delete[] slotFlags;
+  delete[] slotValues;
+  delete[] slotPolicies;
+  delete[] clockHands;
+  delete[] ownerHashes;
+  delete[] ownerGenerations;
+  delete[] ownerValid;
+  delete[] ownerMaps;
   delete mutexPool;
 }
 
-bool NNCacheTable::get(Hash128 nnHash, shared_ptr<NNOutput>& ret) {
+int64_t NNCacheTable::getNumEntriesForBytes(int64_t bytes, int xLen, int yLen, double ownerMapFraction) {
+  double bytesPerEntry =
+    getSlotBytes(NNPos::getPolicySize(xLen,yLen)) + sizeof(uint8_t) / (double)NUM_WAYS +
+    getOwnerSlotBytes(xLen*yLen) * ownerMapFraction;
+  return std::max((int64_t)NUM_WAYS, (int64_t)(bytes / bytesPerEntry));
+}
+
+int64_t NNCacheTable::getNumEntries() const {
+  return (int64_t)(numBuckets * NUM_WAYS);
+}
+int64_t NNCacheTable::getNumBytes() const {
+  return (int64_t)(
+    numBuckets * NUM_WAYS * getSlotBytes(policySize) + numBuckets * sizeof(uint8_t) +
+    numOwnerBuckets * NUM_WAYS * getOwnerSlotBytes(ownerMapSize)
+  );
+}
+uint64_t NNCacheTable::numHits() const {
+  return m_numHits.load(std::memory_order_relaxed);
+}
+uint64_t NNCacheTable::numMisses() const {
+  return m_numMisses.load(std::memory_order_relaxed);
+}
+uint64_t NNCacheTable::numEvictions() const {
+  return m_numEvictions.load(std::memory_order_relaxed);
+}
+void NNCacheTable::clearStats() {
+  m_numHits.store(0);
+  m_numMisses.store(0);
+  m_numEvictions.store(0);
+}
+
+bool NNCacheTable::get(Hash128 nnHash, uint32_t modelGeneration, shared_ptr<NNOutput>& ret) {
   //Free ret BEFORE locking, to avoid any expensive operations while locked.
   if(ret != nullptr)
     ret.reset();
 
-  uint64_t idx = nnHash.hash0 & tableMask;
-  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-  Entry& entry = entries[idx];
-  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  uint64_t bucketIdx = nnHash.hash0 % numBuckets;
+  uint64_t ownerBucketIdx = bucketIdx % numOwnerBuckets;
+  std::mutex& mutex = mutexPool->getMutex((uint32_t)(ownerBucketIdx % numMutexes));
 
-  std::lock_guard<std::mutex> lock(mutex);
-
-  bool found = false;
-#if defined(SIMULATE_TRUE_HASH_COLLISIONS)
-  if(entry.ptr != nullptr && ((entry.ptr->nnHash.hash0 ^ nnHash.hash0) & 0xFFF) == 0) {
-    ret = entry.ptr;
-    found = true;
+  //Copy out the compressed entry under the lock, and decompress and allocate after
+  float values[NUM_CACHED_VALUES];
+  uint16_t policy[NNPos::MAX_NN_POLICY_SIZE];
+  uint16_t ownerMap[NNPos::MAX_BOARD_AREA];
+  bool hasOwnerMap = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t slotIdx = bucketIdx * NUM_WAYS;
+    int way = 0;
+    for(; way < NUM_WAYS; way++) {
+      if(
+        (slotFlags[slotIdx+way] & SLOT_OCCUPIED) &&
+        slotHashes[slotIdx+way] == nnHash &&
+        slotGenerations[slotIdx+way] == modelGeneration
+      )
+        break;
+    }
+    if(way >= NUM_WAYS) {
+      m_numMisses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slotIdx += way;
+    slotFlags[slotIdx] |= SLOT_REFERENCED;
+    std::copy(slotValues + slotIdx * NUM_CACHED_VALUES, slotValues + (slotIdx+1) * NUM_CACHED_VALUES, values);
+    std::copy(slotPolicies + slotIdx * policySize, slotPolicies + (slotIdx+1) * policySize, policy);
+
+    uint64_t ownerSlotIdx = ownerBucketIdx * NUM_WAYS + way;
+    if(ownerValid[ownerSlotIdx] && ownerHashes[ownerSlotIdx] == nnHash && ownerGenerations[ownerSlotIdx] == modelGeneration) {
+      hasOwnerMap = true;
+      std::copy(ownerMaps + ownerSlotIdx * ownerMapSize, ownerMaps + (ownerSlotIdx+1) * ownerMapSize, ownerMap);
+    }
   }
-#else
-  if(entry.ptr != nullptr && entry.ptr->nnHash == nnHash) {
-    ret = entry.ptr;
-    found = true;
+  m_numHits.fetch_add(1, std::memory_order_relaxed);
+
+  ret = std::make_shared<NNOutput>();
+  NNOutput& output = *ret;
+  output.nnHash = nnHash;
+  output.whiteWinProb = values[0];
+  output.whiteLossProb = values[1];
+  output.whiteNoResultProb = values[2];
+  output.whiteScoreMean = values[3];
+  output.whiteScoreMeanSq = values[4];
+  NNCompress::decompressPolicy(policy, policySize, output.policyProbs);
+  output.nnXLen = nnXLen;
+  output.nnYLen = nnYLen;
+  if(hasOwnerMap) {
+    output.whiteOwnerMap = new float[ownerMapSize];
+    for(int i = 0; i<ownerMapSize; i++)
+      output.whiteOwnerMap[i] = NNCompress::halfToFloat(ownerMap[i]);
   }
-#endif
-  return found;
+  return true;
 }
 
-void NNCacheTable::set(const shared_ptr<NNOutput>& p) {
-  //Immediately copy p right now, before locking, to avoid any expensive operations while locked.
-  shared_ptr<NNOutput> buf(p);
+void NNCacheTable::set(const shared_ptr<NNOutput>& p, uint32_t modelGeneration) {
+  NNOutput& output = *p;
+  assert(output.nnXLen == nnXLen && output.nnYLen == nnYLen);
+  Hash128 nnHash = output.nnHash;
+
+  //Compress before locking, to avoid any expensive operations while locked.
+  float values[NUM_CACHED_VALUES] = {
+    output.whiteWinProb, output.whiteLossProb, output.whiteNoResultProb, output.whiteScoreMean, output.whiteScoreMeanSq
+  };
+  uint16_t policy[NNPos::MAX_NN_POLICY_SIZE];
+  for(int i = 0; i<policySize; i++)
+    policy[i] = NNCompress::floatToHalf(output.policyProbs[i]);
+  uint16_t ownerMap[NNPos::MAX_BOARD_AREA];
+  bool hasOwnerMap = output.whiteOwnerMap != NULL;
+  if(hasOwnerMap) {
+    for(int i = 0; i<ownerMapSize; i++)
+      ownerMap[i] = NNCompress::floatToHalf(output.whiteOwnerMap[i]);
+  }
+  //Give the caller exactly what later lookups will get, so that results do not depend on hitting or missing
+  NNCompress::decompressPolicy(policy, policySize, output.policyProbs);
+  if(hasOwnerMap) {
+    for(int i = 0; i<ownerMapSize; i++)
+      output.whiteOwnerMap[i] = NNCompress::halfToFloat(ownerMap[i]);
+  }
 
-  uint64_t idx = p->nnHash.hash0 & tableMask;
-  uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-  Entry& entry = entries[idx];
-  std::mutex& mutex = mutexPool->getMutex(mutexIdx);
+  uint64_t bucketIdx = nnHash.hash0 % numBuckets;
+  uint64_t ownerBucketIdx = bucketIdx % numOwnerBuckets;
+  std::mutex& mutex = mutexPool->getMutex((uint32_t)(ownerBucketIdx % numMutexes));
 
-  {
-    std::lock_guard<std::mutex> lock(mutex);
-    //Perform a swap, to avoid any expensive free under the mutex.
-    entry.ptr.swap(buf);
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t slotIdx = bucketIdx * NUM_WAYS;
+  int way = -1;
+  //Replace the same hash if present, else take an empty slot or one from another model generation
+  for(int i = 0; i < NUM_WAYS; i++) {
+    bool occupied = (slotFlags[slotIdx+i] & SLOT_OCCUPIED) != 0;
+    bool sameGeneration = slotGenerations[slotIdx+i] == modelGeneration;
+    if(occupied && sameGeneration && slotHashes[slotIdx+i] == nnHash) {
+      way = i;
+      break;
+    }
+    if(way < 0 && !(occupied && sameGeneration))
+      way = i;
+  }
+  //Else sweep the clock hand, giving referenced entries a second chance
+  if(way < 0) {
+    uint8_t hand = clockHands[bucketIdx];
+    while(slotFlags[slotIdx+hand] & SLOT_REFERENCED) {
+      slotFlags[slotIdx+hand] &= ~SLOT_REFERENCED;
+      hand = (hand + 1) % NUM_WAYS;
+    }
+    way = hand;
+    clockHands[bucketIdx] = (uint8_t)((hand + 1) % NUM_WAYS);
+    m_numEvictions.fetch_add(1, std::memory_order_relaxed);
   }
 
-  //No longer locked, allow buf to fall out of scope now, will free whatever used to be present in the table.
+  slotIdx += way;
+  slotHashes[slotIdx] = nnHash;
+  slotGenerations[slotIdx] = modelGeneration;
+  slotFlags[slotIdx] = SLOT_OCCUPIED;
+  std::copy(values, values + NUM_CACHED_VALUES, slotValues + slotIdx * NUM_CACHED_VALUES);
+  std::copy(policy, policy + policySize, slotPolicies + slotIdx * policySize);
+  if(hasOwnerMap) {
+    uint64_t ownerSlotIdx = ownerBucketIdx * NUM_WAYS + way;
+    ownerHashes[ownerSlotIdx] = nnHash;
+    ownerGenerations[ownerSlotIdx] = modelGeneration;
+    ownerValid[ownerSlotIdx] = true;
+    std::copy(ownerMap, ownerMap + ownerMapSize, ownerMaps + ownerSlotIdx * ownerMapSize);
+  }
 }
 
 void NNCacheTable::clear() {
-  shared_ptr<NNOutput> buf;
-  for(size_t idx = 0; idx<tableSize; idx++) {
-    Entry& entry = entries[idx];
-    uint32_t mutexIdx = (uint32_t)idx & mutexPoolMask;
-    std::mutex& mutex = mutexPool->getMutex(mutexIdx);
-    {
-      std::lock_guard<std::mutex> lock(mutex);
-      entry.ptr.swap(buf);
+  for(uint64_t bucketIdx = 0; bucketIdx < numBuckets; bucketIdx++) {
+    uint64_t ownerBucketIdx = bucketIdx % numOwnerBuckets;
+    std::mutex& mutex = mutexPool->getMutex((uint32_t)(ownerBucketIdx % numMutexes));
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int way = 0; way < NUM_WAYS; way++) {
+      slotFlags[bucketIdx * NUM_WAYS + way] = 0;
+      ownerValid[ownerBucketIdx * NUM_WAYS + way] = false;
     }
-    buf.reset();
+    clockHands[bucketIdx] = 0;
+  }
+}
+
+//-------------------------------------------------------------------------------------
+
+NNInFlightTable::NNInFlightTable(int numShardsPowerOfTwo) {
+  if(numShardsPowerOfTwo < 0 || numShardsPowerOfTwo > 31)
+    throw StringError("NNInFlightTable: Invalid numShardsPowerOfTwo: " + Global::intToString(numShardsPowerOfTwo));
+  uint32_t numShards = ((uint32_t)1) << numShardsPowerOfTwo;
+  shardMask = numShards-1;
+  shards = new std::map<Hash128,Pending>[numShards];
+  mutexPool = new MutexPool(numShards);
+}
+NNInFlightTable::~NNInFlightTable() {
+  delete[] shards;
+  delete mutexPool;
+}
+
+bool NNInFlightTable::joinOrLead(
+  Hash128 nnHash, uint32_t modelGeneration, bool includeOwnerMap, bool canJoin, NNResultBuf& buf, bool& isLeader
+) {
+  uint32_t shardIdx = (uint32_t)nnHash.hash0 & shardMask;
+  std::map<Hash128,Pending>& shard = shards[shardIdx];
+  std::mutex& mutex = mutexPool->getMutex(shardIdx);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  isLeader = false;
+  auto iter = shard.find(nnHash);
+  if(iter == shard.end()) {
+    Pending pending;
+    pending.modelGeneration = modelGeneration;
+    pending.includeOwnerMap = includeOwnerMap;
+    pending.waiting = NULL;
+    shard[nnHash] = pending;
+    isLeader = true;
+    return false;
+  }
+  if(!canJoin || iter->second.modelGeneration != modelGeneration || (includeOwnerMap && !iter->second.includeOwnerMap))
+    return false;
+
+  buf.resultReady.reset();
+  buf.nextCoalesced = iter->second.waiting;
+  iter->second.waiting = &buf;
+  return true;
+}
+
+void NNInFlightTable::finish(Hash128 nnHash, const shared_ptr<NNOutput>& result) {
+  uint32_t shardIdx = (uint32_t)nnHash.hash0 & shardMask;
+  std::map<Hash128,Pending>& shard = shards[shardIdx];
+  std::mutex& mutex = mutexPool->getMutex(shardIdx);
+
+  NNResultBuf* waiting;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = shard.find(nnHash);
+    assert(iter != shard.end());
+    waiting = iter->second.waiting;
+    shard.erase(iter);
+  }
+
+  //Wake them without the lock held
+  while(waiting != NULL) {
+    //Once set, the waiting thread may immediately reuse its buf
+    NNResultBuf* next = waiting->nextCoalesced;
+    waiting->nextCoalesced = NULL;
+    waiting->result = result;
+    waiting->resultReady.set();
+    waiting = next;
   }
 }
@@ -1,59 +1,150 @@
 #ifndef NEURALNET_NNEVAL_H_
 #define NEURALNET_NNEVAL_H_
 
+#include <map>
 #include <memory>
 
 #include "../core/global.h"
+#include "../core/lockfreequeue.h"
 #include "../core/logger.h"
 #include "../core/multithread.h"
+#include "../core/waitflag.h"
 #include "../game/board.h"
 #include "../game/boardhistory.h"
 #include "../neuralnet/nninputs.h"
 #include "../neuralnet/nninterface.h"
+#include "../neuralnet/nnbatching.h"
+#include "../neuralnet/laddercache.h"
+#include "../neuralnet/nndiskcache.h"
+#include "../neuralnet/syntheticnn.h"
 #include "../search/mutexpool.h"
 
 class NNEvaluator;
-
+struct NNResultBuf;
+
+//Fixed-size cache of postprocessed neural net outputs. All memory is allocated up front in flat arrays, with
+//policies and ownermaps stored as fp16 and values as full floats, so an entry takes about half the memory of
+//an NNOutput, with no per-entry allocations or refcounts.
+//
+//Entries are grouped in buckets of a few slots, any of which can hold a given hash, and when a bucket is full,
+//the slot to evict is picked by the clock algorithm, which spares entries that were looked up since the last sweep.
+//Ownermaps live in a smaller separate array of slots shared by several entries, where the most recent one stored wins.
+//
+//Each entry is tagged with the generation of the model that produced it, see NNEvaluator::swapModel, and lookups
+//only find entries of the generation asked for, so that entries from a replaced model simply age out.
 class NNCacheTable {
-  struct Entry {
-    std::shared_ptr<NNOutput> ptr;
-    Entry();
-    ~Entry();
-  };
-
-  Entry* entries;
-  MutexPool* mutexPool;
-  uint64_t tableSize;
-  uint64_t tableMask;
-  uint32_t mutexPoolMask;
-
  public:
-  NNCacheTable(int sizePowerOfTwo, int mutexPoolSizePowerOfTwo);
+  static const int NUM_WAYS = 4;
+
+  //ownerMapFraction is the number of ownermap slots per entry, in (0,1].
+  NNCacheTable(int64_t numEntries, int nnXLen, int nnYLen, double ownerMapFraction, int mutexPoolSizePowerOfTwo);
   ~NNCacheTable();
 
   NNCacheTable(const NNCacheTable& other) = delete;
   NNCacheTable& operator=(const NNCacheTable& other) = delete;
 
+  //The number of entries that fit in approximately the given number of bytes
+  static int64_t getNumEntriesForBytes(int64_t bytes, int nnXLen, int nnYLen, double ownerMapFraction);
+
   //These are thread-safe. For get, ret will be set to nullptr upon a failure to find.
-  bool get(Hash128 nnHash, std::shared_ptr<NNOutput>& ret);
-  void set(const std::shared_ptr<NNOutput>& p);
+  //Outputs must have the nnXLen and nnYLen of the table.
+  //set also rounds the policy and ownermap of p in place to what is stored, so that p matches what get returns.
+  bool get(Hash128 nnHash, uint32_t modelGeneration, std::shared_ptr<NNOutput>& ret);
+  void set(const std::shared_ptr<NNOutput>& p, uint32_t modelGeneration);
   void clear();
+
+  int64_t getNumEntries() const;
+  int64_t getNumBytes() const;
+  uint64_t numHits() const;
+  uint64_t numMisses() const;
+  uint64_t numEvictions() const;
+  void clearStats();
+
+ private:
+  int nnXLen;
+  int nnYLen;
+  int policySize;
+  int ownerMapSize;
+
+  uint64_t numBuckets;
+  uint64_t numOwnerBuckets;
+  uint32_t numMutexes;
+
+  //Indexed by slot, NUM_WAYS consecutive slots per bucket
+  Hash128* slotHashes;
+  uint32_t* slotGenerations;
+  uint8_t* slotFlags;
+  float* slotValues;
+  uint16_t* slotPolicies;
+  //Indexed by bucket
+  uint8_t* clockHands;
+  //Indexed by ownermap slot, NUM_WAYS consecutive slots per ownermap bucket
+  Hash128* ownerHashes;
+  uint32_t* ownerGenerations;
+  bool* ownerValid;
+  uint16_t* ownerMaps;
+
+  MutexPool* mutexPool;
+
+  std::atomic<uint64_t> m_numHits;
+  std::atomic<uint64_t> m_numMisses;
+  std::atomic<uint64_t> m_numEvictions;
+};
+
+//Evaluations that have been submitted but not returned yet, so that identical requests made in the meantime
+//can wait on the same result instead of taking up rows of their own.
+class NNInFlightTable {
+  struct Pending {
+    uint32_t modelGeneration;
+    bool includeOwnerMap;
+    //Linked through NNResultBuf::nextCoalesced
+    NNResultBuf* waiting;
+  };
+
+  std::map<Hash128,Pending>* shards;
+  MutexPool* mutexPool;
+  uint32_t shardMask;
+
+ public:
+  NNInFlightTable(int numShardsPowerOfTwo);
+  ~NNInFlightTable();
+
+  NNInFlightTable(const NNInFlightTable& other) = delete;
+  NNInFlightTable& operator=(const NNInFlightTable& other) = delete;
+
+  //These are thread-safe.
+  //If canJoin and an evaluation of nnHash is in flight for the same model generation that includes the ownermap if needed,
+  //attaches buf to it and returns true, buf.result and buf.resultReady will be set once it is finished. Otherwise returns
+  //false, and if nothing was in flight for nnHash, records that the caller is now evaluating it and sets isLeader, after
+  //which it must call finish.
+  bool joinOrLead(Hash128 nnHash, uint32_t modelGeneration, bool includeOwnerMap, bool canJoin, NNResultBuf& buf, bool& isLeader);
+  //Hand result to every request attached to nnHash and stop tracking it. Pass nullptr if the evaluation failed.
+  void finish(Hash128 nnHash, const std::shared_ptr<NNOutput>& result);
 };
 
 //Each thread should allocate and re-use one of these
 struct NNResultBuf {
-  std::condition_variable clientWaitingForResult;
-  std::mutex resultMutex;
-  bool hasResult;
+  WaitFlag resultReady;
   bool includeOwnerMap;
+  int symmetry;
   int boardXSizeForServer;
   int boardYSizeForServer;
+  Hash128 nnHashForServer;
   int rowSpatialSize;
   int rowGlobalSize;
   float* rowSpatial;
   float* rowGlobal;
   std::shared_ptr<NNOutput> result;
   bool errorLogLockout; //error flag to restrict log to 1 error to prevent spam
+  NNResultBuf* nextCoalesced; //Used by NNInFlightTable while waiting on another request's evaluation
+  //If not NULL, the server featurizes this position straight into its input buffers instead of copying rowSpatial
+  //and rowGlobal, see evaluateBatch. The board and history must not change until resultReady is set.
+  const Board* boardForServer;
+  const BoardHistory* historyForServer;
+  Player nextPlayerForServer;
+  double drawEquivalentWinsForWhiteForServer;
+  //Generation of the model to evaluate this row with, stamped upon submitting it
+  uint32_t modelGenerationForServer;
 
   NNResultBuf();
   ~NNResultBuf();
@@ -61,6 +152,18 @@ struct NNResultBuf {
   NNResultBuf& operator=(const NNResultBuf& other) = delete;
 };
 
+//One position to evaluate for NNEvaluator::evaluateBatch, the board and history are only pointed to, not copied.
+struct NNBatchQuery {
+  const Board* board;
+  const BoardHistory* history;
+  Player nextPlayer;
+  double drawEquivalentWinsForWhite;
+  bool includeOwnerMap;
+
+  NNBatchQuery();
+  NNBatchQuery(const Board& board, const BoardHistory& history, Player nextPlayer, double drawEquivalentWinsForWhite, bool includeOwnerMap);
+};
+
 //Each server thread should allocate and re-use one of these
 struct NNServerBuf {
   InputBuffers* inputBuffers;
@@ -101,16 +204,36 @@ class NNEvaluator {
   int getNNXLen() const;
   int getNNYLen() const;
 
+  //Incremented by every swapModel
+  uint32_t getModelGeneration() const;
+
+  //Load another model and switch to it without restarting the server threads or their compute context, such as when
+  //selfplay finds a newer net. The new model must have the same model version, so that it takes the same inputs.
+  //Rows submitted before the switch are still evaluated on the old model, which is freed once they are done, and cached
+  //evaluations from the old model are no longer used. Blocks until then, logging how long it took.
+  //Threadsafe with evaluations, but not with itself, spawnServerThreads, or killServerThreads.
+  void swapModel(const std::string& newModelName, const std::string& newModelFileName, int modelFileIdx, Logger* logger);
+
   //Return the "nearest" supported ruleset to desiredRules by this model.
   //Fills supported with true if desiredRules itself was exactly supported, false if some modifications had to be made.
   Rules getSupportedRules(const Rules& desiredRules, bool& supported);
 
   //Clear all entires cached in the table
   void clearCache();
+  //Replace the cache with an empty one sized to use approximately this many megabytes, overriding nnCacheSizePowerOfTwo.
+  //Enables the cache even if nnCacheSizePowerOfTwo was negative. Must be called before spawnServerThreads.
+  void setCacheSizeMB(double megabytes);
+  //Bytes preallocated by the cache, or 0 if there is no cache
+  int64_t getCacheSizeBytes() const;
+  //Also keep evaluations in a file that persists across runs, see nndiskcache.h, consulted upon missing the cache in RAM.
+  //Requires the cache to be enabled, and must be called before spawnServerThreads. The file is for the current model,
+  //and is no longer used after swapModel.
+  void setDiskCache(const std::string& fileName, int64_t maxFileBytes, Logger* logger);
 
   //Queue a position for the next neural net batch evaluation and wait for it. Upon evaluation, result
   //will be supplied in NNResultBuf& buf, the shared_ptr there can grabbed via std::move if desired.
   //logStream is for some error logging, can be NULL.
+  //If the same position is already being evaluated for another caller, waits for and shares that result instead.
   //This function is threadsafe.
   void evaluate(
     Board& board,
@@ -122,10 +245,36 @@ class NNEvaluator {
     bool skipCache,
     bool includeOwnerMap
   );
+  //Same, but evaluate in a specific symmetry in [0,NNInputs::NUM_SYMMETRY_COMBINATIONS) rather than whichever one
+  //the server thread picks, or pass NNInputs::SYMMETRY_NOTSPECIFIED for the same behavior as above.
+  //Since the cache does not distinguish symmetries, evaluations with a specific symmetry neither use nor fill it.
+  void evaluate(
+    Board& board,
+    const BoardHistory& history,
+    Player nextPlayer,
+    double drawEquivalentWinsForWhite,
+    NNResultBuf& buf,
+    Logger* logger,
+    bool skipCache,
+    bool includeOwnerMap,
+    int symmetry
+  );
+
+  //Evaluate many positions from one thread, keeping up to a full batch of them submitted at once, so that a single
+  //caller can keep the backend busy. Blocks until all are done and fills results in the same order as queries.
+  //Uses the cache and coalesces with identical evaluations in flight the same way as evaluate. Unlike evaluate, the
+  //server threads featurize these positions straight into their input buffers, so they must not change meanwhile.
+  //This function is threadsafe.
+  void evaluateBatch(
+    const std::vector<NNBatchQuery>& queries,
+    std::vector<std::shared_ptr<NNOutput>>& results,
+    Logger* logger,
+    bool skipCache
+  );
 
   //Actually spawn threads and return the results.
-  //If doRandomize, uses randSeed as a seed, further randomized per-thread
-  //If not doRandomize, uses defaultSymmetry for all nn evaluations.
+  //If doRandomize, uses randSeed as a seed, further randomized per-thread, and picks a random symmetry for each row.
+  //If not doRandomize, uses defaultSymmetry for all nn evaluations that do not request a specific symmetry.
   //This function itself is not threadsafe.
   void spawnServerThreads(
     int numThreads,
@@ -138,18 +287,44 @@ class NNEvaluator {
     bool useNHWC
   );
 
+  //Instead of a real net, serve evaluations from SyntheticNN with a simulated batch latency.
+  //Requires debugSkipNeuralNet, and must be called before spawnServerThreads. Unlike plain debugSkipNeuralNet,
+  //input rows are still filled so that the cost of featurization is included in benchmarks.
+  void setSyntheticNN(const SyntheticNNParams& params);
+
+  //Set how long server threads hold back partially filled batches waiting for more rows, see nnbatching.h.
+  //Defaults to launching immediately. Must be called before spawnServerThreads.
+  void setBatchingParams(const NNBatchingParams& params);
+
   //Kill spawned server threads and join and free them. This function is not threadsafe, and along with spawnServerThreads
   //should have calls to it and spawnServerThreads singlethreaded.
   void killServerThreads();
 
   //Some stats
   uint64_t numRowsProcessed() const;
+  //Requests that waited on an identical evaluation already in flight instead of being given a row
+  uint64_t numCoalescedRequests() const;
   uint64_t numBatchesProcessed() const;
   double averageProcessedBatchSize() const;
+  //Element i is the number of batches processed with exactly i rows, for i in [0,maxBatchSize]
+  std::vector<uint64_t> getBatchSizeHistogram() const;
+  //Total time server threads spent holding back partial batches for more rows
+  double totalBatchFillWaitSeconds() const;
+  //Current estimate of the backend's latency as fixedSeconds + perRowSeconds * numRows
+  void getBatchLatencyModel(double& fixedSeconds, double& perRowSeconds) const;
+  //Time from submitting a row that missed the cache to getting its result back, at the given fraction in [0,1]
+  //of all such rows, for example 0.5 for the median or 0.99 for the 99th percentile.
+  double submitLatencyPercentileSeconds(double fraction) const;
+  //Cache lookups that found or did not find an entry, and entries replaced to make room. All zero if there is no cache.
+  void getCacheStats(uint64_t& hits, uint64_t& misses, uint64_t& evictions) const;
+  //Lookups in the disk cache after missing the cache in RAM, and entries appended to it. All zero if there is none.
+  void getDiskCacheStats(uint64_t& hits, uint64_t& misses, uint64_t& writes) const;
 
   void clearStats();
 
  private:
+  //Guards modelName, modelFileName, and loadedModel against swapModel, for everything other than server threads
+  mutable std::mutex modelMutex;
   std::string modelName;
   std::string modelFileName;
   int nnXLen;
@@ -161,8 +336,15 @@ class NNEvaluator {
   ComputeContext* computeContext;
   LoadedModel* loadedModel;
   NNCacheTable* nnCacheTable;
+  NNInFlightTable* nnInFlightTable; //Non-NULL whenever nnCacheTable is
+  int cacheMutexPoolSizePowerOfTwo;
+  NNDiskCache* nnDiskCache;
+  //Non-NULL if the inputs have ladder features, shared by everything filling rows for this evaluator
+  LadderCache* ladderCache;
+  uint32_t diskCacheModelGeneration;
 
   bool debugSkipNeuralNet;
+  SyntheticNNParams* syntheticNNParams;
   bool alwaysIncludeOwnerMap;
   float nnPolicyInvTemperature;
 
@@ -171,29 +353,83 @@ class NNEvaluator {
 
   std::vector<std::thread*> serverThreads;
 
-  std::condition_variable serverWaitingForBatchStart;
-  std::mutex bufferMutex;
-  bool isKilled;
+  //Server threads switch to loadedModel once they see this change, which swapModel does only after updating loadedModel
+  std::atomic<uint32_t> modelGeneration;
+  //Rows submitted and not yet finished, indexed by the parity of their model generation, of which there are at most two
+  std::atomic<int64_t> m_numRowsOfGeneration[2];
+  //Model generation at the last spawnServerThreads
+  uint32_t serverSpawnGeneration;
+  //Server threads that have a compute handle, or will upon starting up, guarded by modelMutex
+  int numServersWithHandle;
+  //Server threads still holding a compute handle for the model being replaced
+  std::atomic<int> m_numServersOnOldModel;
+  std::condition_variable oldModelReleased;
+
+  //Only used by server threads to sleep when there are not enough rows, clients touch these only to wake them.
+  std::condition_variable serverWaitingForRows;
+  std::mutex serverSleepMutex;
+  std::atomic<bool> isKilled;
+  std::atomic<int> m_numServersSleeping;
+
+  NNBatchingPolicy* batchingPolicy;
 
   int maxNumRows;
-  int numResultBufss;
-  int numResultBufssMask;
 
   std::atomic<uint64_t> m_numRowsProcessed;
+  std::atomic<uint64_t> m_numCoalescedRequests;
   std::atomic<uint64_t> m_numBatchesProcessed;
+  std::atomic<uint64_t>* m_batchSizeCounts; //Length maxNumRows+1
+  std::atomic<uint64_t> m_batchFillWaitNanos;
+  LatencyHistogram m_submitLatency;
+
+  //Rows submitted by clients and not yet taken by a server thread, sized to hold maxConcurrentEvals of them.
+  LockFreeQueue<NNResultBuf*>* m_queue;
+  //Number of rows in m_queue not yet claimed by a server thread. Clients increment it after pushing, and server threads
+  //claim rows by decrementing it before popping, so every claimed row is in the queue or about to be.
+  std::atomic<int> m_numQueuedRows;
+
+  void recordBatchProcessed(int numRows, double seconds);
+  double getCacheOwnerMapFraction() const;
+  void wakeServers();
+  //Returns false if killed. If deadline is not NULL, also returns upon reaching it. Also returns if a server thread
+  //with the given compute handle state has to switch models, see serverNeedsModelSwitch.
+  bool waitForQueuedRows(
+    int minRows, const std::chrono::steady_clock::time_point* deadline, uint32_t handleGeneration, bool hasOldHandle
+  );
+  int claimQueuedRows();
+  bool serverNeedsModelSwitch(uint32_t handleGeneration, bool hasOldHandle) const;
+  void releaseRowGeneration(uint32_t generation);
+
+  void checkBoardSize(const Board& board) const;
+  Hash128 computeNNHash(const Board& board, const BoardHistory& history, Player nextPlayer, double drawEquivalentWinsForWhite) const;
+  void fillRow(
+    const Board& board, const BoardHistory& history, Player nextPlayer, double drawEquivalentWinsForWhite,
+    float* rowSpatial, float* rowGlobal
+  ) const;
+  void allocateRowBuffers(NNResultBuf& buf) const;
+  //Returns true and sets result upon finding a usable evaluation in the cache in RAM or on disk. Upon finding one
+  //that lacks only the ownermap, returns false and sets resultWithoutOwnerMap.
+  bool lookupCache(
+    Hash128 nnHash, uint32_t generation, bool includeOwnerMap,
+    std::shared_ptr<NNOutput>& result, std::shared_ptr<NNOutput>& resultWithoutOwnerMap
+  );
+  //Stamps buf with the current model generation and queues it
+  void pushQueuedRow(NNResultBuf& buf);
 
-  //An array of NNResultBuf** of length numResultBufss, each NNResultBuf** is an array of NNResultBuf* of length maxNumRows.
-  //If a full resultBufs array fills up, client threads can move on to fill up more without waiting. Implemented basically
-  //as a circular buffer.
-  NNResultBuf*** m_resultBufss;
-  int m_currentResultBufsLen; //Number of rows used in in the latest (not yet full) resultBufss.
-  int m_currentResultBufsIdx; //Index of the current resultBufs being filled.
-  int m_oldestResultBufsIdx; //Index of the oldest resultBufs that still needs to be processed by a server thread
+  void postprocessResult(
+    const Board& board,
+    const BoardHistory& history,
+    Player nextPlayer,
+    NNResultBuf& buf,
+    Logger* logger,
+    bool hadResultWithoutOwnerMap,
+    const std::shared_ptr<NNOutput>& resultWithoutOwnerMap
+  );
 
  public:
   //Helper, for internal use only
   void serve(
-    NNServerBuf& buf, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
+    NNServerBuf& buf, const LoadedModel* model, Rand& rand, Logger* logger, bool doRandomize, int defaultSymmetry,
     int gpuIdxForThisThread, bool useFP16, bool useNHWC
   );
 };
@@ -1,4 +1,7 @@
 #include "../neuralnet/nninputs.h"
+#include "../neuralnet/laddercache.h"
+
+#include <cstring>
 
 using namespace std;
 
@@ -294,6 +297,83 @@ void NNOutput::debugPrint(ostream& out, const Board& board) {
 }
 
 
+//-------------------------------------------------------------------------------------------------------------
+
+//IEEE half precision conversions, rounding to nearest even. See Fabian Giesen's "float->half variants".
+uint16_t NNCompress::floatToHalf(float f) {
+  uint32_t x;
+  std::memcpy(&x,&f,sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  x &= 0x7FFFFFFF;
+
+  uint16_t h;
+  //Too large for a half, infinity or nan
+  if(x >= (uint32_t)(127 + 16) << 23)
+    h = x > (uint32_t)255 << 23 ? 0x7E00 : 0x7C00;
+  //Subnormal half or zero, let float addition do the rounding
+  else if(x < (uint32_t)(127 - 14) << 23) {
+    float denormMagic;
+    uint32_t denormMagicBits = (uint32_t)((127 - 15) + (23 - 10) + 1) << 23;
+    std::memcpy(&denormMagic,&denormMagicBits,sizeof(denormMagic));
+    float g;
+    std::memcpy(&g,&x,sizeof(g));
+    g += denormMagic;
+    uint32_t gBits;
+    std::memcpy(&gBits,&g,sizeof(gBits));
+    h = (uint16_t)(gBits - denormMagicBits);
+  }
+  else {
+    uint32_t mantOdd = (x >> 13) & 1;
+    x += ((uint32_t)(15 - 127) << 23) + 0xFFF;
+    x += mantOdd;
+    h = (uint16_t)(x >> 13);
+  }
+  return (uint16_t)(h | sign);
+}
+
+float NNCompress::halfToFloat(uint16_t h) {
+  const uint32_t shiftedExp = (uint32_t)0x7C00 << 13;
+  uint32_t x = (uint32_t)(h & 0x7FFF) << 13;
+  uint32_t exp = shiftedExp & x;
+  x += (uint32_t)(127 - 15) << 23;
+  float f;
+  //Infinity or nan
+  if(exp == shiftedExp) {
+    x += (uint32_t)(128 - 16) << 23;
+    std::memcpy(&f,&x,sizeof(f));
+  }
+  //Zero or subnormal, renormalize with float subtraction
+  else if(exp == 0) {
+    x += (uint32_t)1 << 23;
+    uint32_t magicBits = (uint32_t)113 << 23;
+    float magic;
+    std::memcpy(&magic,&magicBits,sizeof(magic));
+    std::memcpy(&f,&x,sizeof(f));
+    f -= magic;
+  }
+  else
+    std::memcpy(&f,&x,sizeof(f));
+  return (h & 0x8000) ? -f : f;
+}
+
+void NNCompress::decompressPolicy(const uint16_t* compressed, int policySize, float* policyProbs) {
+  float policySum = 0.0f;
+  for(int i = 0; i<policySize; i++) {
+    policyProbs[i] = halfToFloat(compressed[i]);
+    if(policyProbs[i] > 0.0f)
+      policySum += policyProbs[i];
+  }
+  if(policySum > 0.0f) {
+    float policyScale = 1.0f / policySum;
+    for(int i = 0; i<policySize; i++) {
+      if(policyProbs[i] > 0.0f)
+        policyProbs[i] *= policyScale;
+    }
+  }
+  for(int i = policySize; i<NNPos::MAX_NN_POLICY_SIZE; i++)
+    policyProbs[i] = -1.0f;
+}
+
 //-------------------------------------------------------------------------------------------------------------
 
 
@@ -309,16 +389,21 @@ static void setRowBinV5(float* rowBin, int pos, int feature, float value, int po
 
 
 //Calls f on each location that is part of an inescapable atari, or a group that can be put into inescapable atari
-static void iterLadders(const Board& board, int nnXLen, std::function<void(Loc,int,const vector<Loc>&)> f) {
+//If ladderCache is not NULL, looks up and stores the status of each chain there.
+static void iterLadders(
+  const Board& board, int nnXLen, LadderCache* ladderCache, std::function<void(Loc,int,const vector<Loc>&)> f
+) {
   int xSize = board.x_size;
   int ySize = board.y_size;
 
   Loc chainHeadsSolved[Board::MAX_PLAY_SIZE];
   bool chainHeadsSolvedValue[Board::MAX_PLAY_SIZE];
   int numChainHeadsSolved = 0;
-  Board copy(board);
+  //Only copied once a search is needed
+  std::unique_ptr<Board> copy;
   vector<Loc> buf;
   vector<Loc> workingMoves;
+  Hash128 boardHash = ladderCache != NULL ? LadderCache::getBoardHash(board) : Hash128();
 
   for(int y = 0; y<ySize; y++) {
     for(int x = 0; x<xSize; x++) {
@@ -341,13 +426,19 @@ static void iterLadders(const Board& board, int nnXLen, std::function<void(Loc,i
             }
           }
           if(!alreadySolved) {
-            //Perform search on copy so as not to mess up tracking of solved heads
+            //Since we scan in order, loc is the first stone of the chain, which unlike the head, depends only on the position
             bool laddered;
-            if(libs == 1)
-              laddered = copy.searchIsLadderCaptured(loc,true,buf);
-            else {
+            if(ladderCache == NULL || !ladderCache->get(boardHash,loc,laddered,workingMoves)) {
+              //Perform search on copy so as not to mess up tracking of solved heads
+              if(copy == nullptr)
+                copy.reset(new Board(board));
               workingMoves.clear();
-              laddered = copy.searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+              if(libs == 1)
+                laddered = copy->searchIsLadderCaptured(loc,true,buf);
+              else
+                laddered = copy->searchIsLadderCapturedAttackerFirst2Libs(loc,buf,workingMoves);
+              if(ladderCache != NULL)
+                ladderCache->set(boardHash,loc,laddered,workingMoves);
             }
 
             chainHeadsSolved[numChainHeadsSolved] = head;
@@ -431,7 +522,8 @@ Hash128 NNInputs::getHashV3(
 
 void NNInputs::fillRowV3(
   const Board& board, const BoardHistory& hist, Player nextPlayer,
-  double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, float* rowBin, float* rowGlobal
+  double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, LadderCache* ladderCache,
+  float* rowBin, float* rowGlobal
 ) {
   assert(nnXLen <= NNPos::MAX_BOARD_LEN);
   assert(nnYLen <= NNPos::MAX_BOARD_LEN);
@@ -576,7 +668,7 @@ void NNInputs::fillRowV3(
     }
   };
 
-  iterLadders(board, nnXLen, addLadderFeature);
+  iterLadders(board, nnXLen, ladderCache, addLadderFeature);
 
   const Board& prevBoard = hist.getRecentBoard(1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
@@ -586,7 +678,7 @@ void NNInputs::fillRowV3(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV3(rowBin,pos,15, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevBoard, nnXLen, addPrevLadderFeature);
+  iterLadders(prevBoard, nnXLen, ladderCache, addPrevLadderFeature);
 
   const Board& prevPrevBoard = hist.getRecentBoard(2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
@@ -596,7 +688,7 @@ void NNInputs::fillRowV3(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV3(rowBin,pos,16, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevPrevBoard, nnXLen, addPrevPrevLadderFeature);
+  iterLadders(prevPrevBoard, nnXLen, ladderCache, addPrevPrevLadderFeature);
 
   //Features 18,19 - current territory
   Color area[Board::MAX_ARR_SIZE];
@@ -823,7 +915,8 @@ Hash128 NNInputs::getHashV4(
 
 void NNInputs::fillRowV4(
   const Board& board, const BoardHistory& hist, Player nextPlayer,
-  double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, float* rowBin, float* rowGlobal
+  double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, LadderCache* ladderCache,
+  float* rowBin, float* rowGlobal
 ) {
   assert(nnXLen <= NNPos::MAX_BOARD_LEN);
   assert(nnYLen <= NNPos::MAX_BOARD_LEN);
@@ -968,7 +1061,7 @@ void NNInputs::fillRowV4(
     }
   };
 
-  iterLadders(board, nnXLen, addLadderFeature);
+  iterLadders(board, nnXLen, ladderCache, addLadderFeature);
 
   const Board& prevBoard = hist.getRecentBoard(1);
   auto addPrevLadderFeature = [&prevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
@@ -978,7 +1071,7 @@ void NNInputs::fillRowV4(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV4(rowBin,pos,15, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevBoard, nnXLen, addPrevLadderFeature);
+  iterLadders(prevBoard, nnXLen, ladderCache, addPrevLadderFeature);
 
   const Board& prevPrevBoard = hist.getRecentBoard(2);
   auto addPrevPrevLadderFeature = [&prevPrevBoard,posStride,featureStride,rowBin](Loc loc, int pos, const vector<Loc>& workingMoves){
@@ -988,7 +1081,7 @@ void NNInputs::fillRowV4(
     assert(pos >= 0 && pos < NNPos::MAX_BOARD_AREA);
     setRowBinV4(rowBin,pos,16, 1.0f, posStride, featureStride);
   };
-  iterLadders(prevPrevBoard, nnXLen, addPrevPrevLadderFeature);
+  iterLadders(prevPrevBoard, nnXLen, ladderCache, addPrevPrevLadderFeature);
 
   //Features 18,19 - pass alive territory and stones
   Color area[Board::MAX_ARR_SIZE];
@@ -8,6 +8,8 @@
 #include "../game/boardhistory.h"
 #include "../game/rules.h"
 
+class LadderCache;
+
 namespace NNPos {
   constexpr int MAX_BOARD_LEN = Board::MAX_LEN;
   constexpr int MAX_BOARD_AREA = MAX_BOARD_LEN * MAX_BOARD_LEN;
@@ -24,8 +26,9 @@ namespace NNPos {
 }
 
 namespace NNInputs {
-  const int NUM_SYMMETRY_BOOLS = 3;
   const int NUM_SYMMETRY_COMBINATIONS = 8;
+  //For requesting an evaluation without caring which symmetry it uses
+  const int SYMMETRY_NOTSPECIFIED = -1;
 
   const int NUM_FEATURES_SPATIAL_V3 = 22;
   const int NUM_FEATURES_GLOBAL_V3 = 14;
@@ -41,18 +44,22 @@ namespace NNInputs {
     const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
     double drawEquivalentWinsForWhite
   );
+  //ladderCache may be NULL, or else is used to skip ladder searches already done for an earlier row
   void fillRowV3(
     const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
-    double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, float* rowBin, float* rowGlobal
+    double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, LadderCache* ladderCache,
+    float* rowBin, float* rowGlobal
   );
 
   Hash128 getHashV4(
     const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
     double drawEquivalentWinsForWhite
   );
+  //ladderCache may be NULL, or else is used to skip ladder searches already done for an earlier row
   void fillRowV4(
     const Board& board, const BoardHistory& boardHistory, Player nextPlayer,
-    double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, float* rowBin, float* rowGlobal
+    double drawEquivalentWinsForWhite, int nnXLen, int nnYLen, bool useNHWC, LadderCache* ladderCache,
+    float* rowBin, float* rowGlobal
   );
 
   Hash128 getHashV5(
@@ -98,6 +105,17 @@ struct NNOutput {
   void debugPrint(std::ostream& out, const Board& board);
 };
 
+//Half precision storage for the policy and ownership of NNOutputs kept in the caches
+namespace NNCompress {
+  uint16_t floatToHalf(float f);
+  float halfToFloat(uint16_t h);
+
+  //Decompress policySize entries into policyProbs and fill the rest up to MAX_NN_POLICY_SIZE with -1.
+  //Legal moves are renormalized to sum to 1 again, since the rounding errors could otherwise add up to more
+  //than search tolerates.
+  void decompressPolicy(const uint16_t* compressed, int policySize, float* policyProbs);
+}
+
 //Utility functions for computing the "scoreValue", the unscaled utility of various numbers of points, prior to multiplication by
 //staticScoreUtilityFactor or dynamicScoreUtilityFactor (see searchparams.h)
 namespace ScoreValue {
@@ -98,9 +98,11 @@ namespace NeuralNet {
   // filled with the global input features.
   float* getBatchEltGlobalInplace(InputBuffers* buffers, int nIdx);
 
-  // Returns a pointer to bool array of length 3 to input the board symmetries that should
-  // be used to rotate/reflect the board for the neural net.
-  bool* getSymmetriesInplace(InputBuffers* buffers);
+  // Returns a pointer to an int array of length maxBatchSize, to input for each batch element the board symmetry
+  // in [0,NNInputs::NUM_SYMMETRY_COMBINATIONS) that should be used to rotate/reflect it for the neural net.
+  // Bit 0 of a symmetry flips y, bit 1 flips x, and bit 2 transposes, in that order (transposing is ignored
+  // for non-square nnXLen and nnYLen). Outputs are returned in the original orientation.
+  int* getSymmetriesInplace(InputBuffers* buffers);
 
   // The total number of spatial features ("C"), times nnYLen ("H"), times nnXLen ("W")
   int getBatchEltSpatialLen(const InputBuffers* buffers);
@@ -182,7 +184,8 @@ namespace NeuralNet {
     int nnYLen,
     bool useFP16,
     bool useNHWC,
-    const bool* symmetries,
+    //Of length batchSize, see getSymmetriesInplace
+    const int* symmetries,
     const std::vector<float>& inputBuffer,
     std::vector<float>& outputBuffer
   );
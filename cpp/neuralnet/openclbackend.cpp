@@ -114,6 +114,7 @@ struct CompiledPrograms {
   cl_program addCBiasesNCReluProgram;
   cl_program transposeNCHWProgram;
   cl_program mirrorProgram;
+  cl_program applySymmetriesNCHWProgram;
   cl_program extractChannel0NCHWProgram;
   cl_program xgemmDirectProgram;
 
@@ -149,6 +150,7 @@ struct CompiledPrograms {
       tuneParams.transpose.compileOptions()
     );
     mirrorProgram = compileProgram("mirrorProgram", context, deviceIdsToUse, OpenCLKernels::mirror, "");
+    applySymmetriesNCHWProgram = compileProgram("applySymmetriesNCHWProgram", context, deviceIdsToUse, OpenCLKernels::applySymmetriesNCHW, "");
     extractChannel0NCHWProgram = compileProgram("extractChannel0NCHWProgram", context, deviceIdsToUse, OpenCLKernels::extractChannel0NCHW, "");
     xgemmDirectProgram = compileProgram("xgemmDirectProgram", context, deviceIdsToUse, OpenCLKernels::xgemmDirect, tuneParams.xGemmDirect.compileOptions());
   }
@@ -167,6 +169,7 @@ struct CompiledPrograms {
     clReleaseProgram(addCBiasesNCReluProgram);
     clReleaseProgram(transposeNCHWProgram);
     clReleaseProgram(mirrorProgram);
+    clReleaseProgram(applySymmetriesNCHWProgram);
     clReleaseProgram(extractChannel0NCHWProgram);
     clReleaseProgram(xgemmDirectProgram);
   }
@@ -282,6 +285,7 @@ struct ComputeHandleInternal {
   cl_kernel addCBiasesNCReluKernel;
   cl_kernel transposeNCHWKernel;
   cl_kernel mirrorKernel;
+  cl_kernel applySymmetriesNCHWKernel;
   cl_kernel extractChannel0NCHWKernel;
   cl_kernel xgemmDirectBatchedNNKernel;
   cl_kernel xgemmDirectBatchedTTKernel;
@@ -337,6 +341,8 @@ struct ComputeHandleInternal {
     CHECK_ERR(err);
     mirrorKernel = clCreateKernel(progs->mirrorProgram, "mirror", &err);
     CHECK_ERR(err);
+    applySymmetriesNCHWKernel = clCreateKernel(progs->applySymmetriesNCHWProgram, "applySymmetriesNCHW", &err);
+    CHECK_ERR(err);
     extractChannel0NCHWKernel = clCreateKernel(progs->extractChannel0NCHWProgram, "extractChannel0NCHW", &err);
     CHECK_ERR(err);
     xgemmDirectBatchedNNKernel = clCreateKernel(progs->xgemmDirectProgram, "XgemmDirectBatchedNN", &err);
@@ -367,6 +373,7 @@ struct ComputeHandleInternal {
     clReleaseKernel(addCBiasesNCReluKernel);
     clReleaseKernel(transposeNCHWKernel);
     clReleaseKernel(mirrorKernel);
+    clReleaseKernel(applySymmetriesNCHWKernel);
     clReleaseKernel(extractChannel0NCHWKernel);
     clReleaseKernel(xgemmDirectBatchedNNKernel);
     clReleaseKernel(xgemmDirectBatchedTTKernel);
@@ -513,28 +520,77 @@ static void doMirrorNCHW(ComputeHandleInternal* handle, int batchSize, int cSize
   }
 }
 
+static void doApplySymmetriesNCHW(
+  ComputeHandleInternal* handle, int batchSize, int cSize, int nnXLen, int nnYLen, bool inverse,
+  cl_mem symmetries, cl_mem input, cl_mem output
+) {
+  cl_int err;
+  static constexpr int nKernelDims = 3;
+  size_t globalSizes[nKernelDims] = {powerOf2ify(nnXLen*nnYLen),powerOf2ify(cSize),powerOf2ify(batchSize)};
+  size_t* localSizes = NULL;
+
+  int inverseInt = inverse ? 1 : 0;
+  cl_kernel kernel = handle->applySymmetriesNCHWKernel;
+  clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&input);
+  clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&output);
+  clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&symmetries);
+  clSetKernelArg(kernel, 3, sizeof(int), (void *)&batchSize);
+  clSetKernelArg(kernel, 4, sizeof(int), (void *)&cSize);
+  clSetKernelArg(kernel, 5, sizeof(int), (void *)&nnYLen);
+  clSetKernelArg(kernel, 6, sizeof(int), (void *)&nnXLen);
+  clSetKernelArg(kernel, 7, sizeof(int), (void *)&inverseInt);
+
+  MAYBE_EVENT;
+  err = clEnqueueNDRangeKernel(
+    handle->commandQueue, kernel, nKernelDims, NULL, globalSizes, localSizes, 0, NULL, MAYBE_EVENTREF
+  );
+  CHECK_ERR(err);
+  MAYBE_PROFILE("ApplySymmetriesNCHW",30);
+  MAYBE_FREE_EVENT;
+}
+
+//symmetriesBuffer is the host copy of the per-row symmetries, deviceSymmetries the same values on the device.
+//When every row shares a symmetry, mirror and transpose the whole batch at once, else gather each row separately.
 static void applySymmetriesNCHW(
   ComputeHandleInternal* handle,
-  const bool* symmetriesBuffer, bool inverse, int batchSize, int cSize, int nnXLen, int nnYLen,
+  const int* symmetriesBuffer, cl_mem deviceSymmetries, bool inverse, int batchSize, int cSize, int nnXLen, int nnYLen,
   cl_mem input, cl_mem inputScratch
 ) {
-  if(!symmetriesBuffer[0] && !symmetriesBuffer[1] && !symmetriesBuffer[2])
-    return;
+  int symmetry = symmetriesBuffer[0];
+  bool allSame = true;
+  for(int i = 1; i<batchSize; i++) {
+    if(symmetriesBuffer[i] != symmetry) {
+      allSame = false;
+      break;
+    }
+  }
 
   cl_int err;
+  if(!allSame) {
+    doApplySymmetriesNCHW(handle, batchSize, cSize, nnXLen, nnYLen, inverse, deviceSymmetries, input, inputScratch);
+    err = clEnqueueCopyBuffer(handle->commandQueue, inputScratch, input, 0, 0, sizeof(float)*batchSize*cSize*nnYLen*nnXLen, 0, NULL, NULL);
+    CHECK_ERR(err);
+    return;
+  }
+  if(symmetry == 0)
+    return;
+  bool flipY = (symmetry & 0x1) != 0;
+  bool flipX = (symmetry & 0x2) != 0;
+  bool transpose = (symmetry & 0x4) != 0 && nnXLen == nnYLen;
+
   if(inverse) {
-    if(symmetriesBuffer[2] && nnXLen == nnYLen)
+    if(transpose)
       transposeNCHW(handle, batchSize, cSize, nnXLen, nnYLen, input, inputScratch);
     else {
       err = clEnqueueCopyBuffer(handle->commandQueue, input, inputScratch, 0, 0, sizeof(float)*batchSize*cSize*nnYLen*nnXLen, 0, NULL, NULL);
       CHECK_ERR(err);
     }
-    doMirrorNCHW(handle, batchSize, cSize, nnYLen, nnXLen, symmetriesBuffer[0], symmetriesBuffer[1], inputScratch, input);
+    doMirrorNCHW(handle, batchSize, cSize, nnYLen, nnXLen, flipY, flipX, inputScratch, input);
   }
   else {
-    doMirrorNCHW(handle, batchSize, cSize, nnYLen, nnXLen, symmetriesBuffer[0], symmetriesBuffer[1], input, inputScratch);
+    doMirrorNCHW(handle, batchSize, cSize, nnYLen, nnXLen, flipY, flipX, input, inputScratch);
 
-    if(symmetriesBuffer[2] && nnXLen == nnYLen)
+    if(transpose)
       transposeNCHW(handle, batchSize, cSize, nnXLen, nnYLen, inputScratch, input);
     else {
       err = clEnqueueCopyBuffer(handle->commandQueue, inputScratch, input, 0, 0, sizeof(float)*batchSize*cSize*nnYLen*nnXLen, 0, NULL, NULL);
@@ -1513,7 +1569,8 @@ struct PolicyHead {
 
   void apply(
     ComputeHandleInternal* handle,
-    const bool* symmetriesBuffer,
+    const int* symmetriesBuffer,
+    cl_mem deviceSymmetries,
     int batchSize,
     cl_mem mask,
     cl_mem maskSum,
@@ -1559,7 +1616,7 @@ struct PolicyHead {
     p2Conv->apply(handle,batchSize,p1OutB,policy,convWorkspace,convWorkspace2);
 
     bool inverse = true;
-    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, p2Channels, nnXLen, nnYLen, policy, p2Out);
+    applySymmetriesNCHW(handle, symmetriesBuffer, deviceSymmetries, inverse, batchSize, p2Channels, nnXLen, nnYLen, policy, p2Out);
 
     gpoolToPassMul->apply(handle,batchSize,gpoolConcat,policyPass);
 
@@ -1654,7 +1711,8 @@ struct ValueHead {
 
   void apply(
     ComputeHandleInternal* handle,
-    const bool* symmetriesBuffer,
+    const int* symmetriesBuffer,
+    cl_mem deviceSymmetries,
     int batchSize,
     cl_mem mask,
     cl_mem maskSum,
@@ -1695,7 +1753,7 @@ struct ValueHead {
     vOwnershipConv->apply(handle,batchSize,v1Out2,ownership,convWorkspace,convWorkspace2);
 
     bool inverse = true;
-    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, ownershipChannels, nnXLen, nnYLen, ownership, ownershipScratch);
+    applySymmetriesNCHW(handle, symmetriesBuffer, deviceSymmetries, inverse, batchSize, ownershipChannels, nnXLen, nnYLen, ownership, ownershipScratch);
   }
 
 };
@@ -1821,7 +1879,8 @@ struct Model {
   void apply(
     ComputeHandleInternal* handle,
     int batchSize,
-    bool* symmetriesBuffer,
+    const int* symmetriesBuffer,
+    cl_mem deviceSymmetries,
 
     cl_mem input,
     cl_mem inputScratch,
@@ -1857,7 +1916,7 @@ struct Model {
   ) {
 
     bool inverse = false;
-    applySymmetriesNCHW(handle, symmetriesBuffer, inverse, batchSize, numInputChannels, nnXLen, nnYLen, input, inputScratch);
+    applySymmetriesNCHW(handle, symmetriesBuffer, deviceSymmetries, inverse, batchSize, numInputChannels, nnXLen, nnYLen, input, inputScratch);
 
     {
       cl_kernel kernel = handle->extractChannel0NCHWKernel;
@@ -1904,6 +1963,7 @@ struct Model {
     policyHead->apply(
       handle,
       symmetriesBuffer,
+      deviceSymmetries,
       batchSize,
       mask,
       maskSum,
@@ -1923,6 +1983,7 @@ struct Model {
     valueHead->apply(
       handle,
       symmetriesBuffer,
+      deviceSymmetries,
       batchSize,
       mask,
       maskSum,
@@ -1954,6 +2015,9 @@ struct Buffers {
   cl_mem mask;
   cl_mem maskSum;
 
+  //Per-row symmetries, ints stored in a buffer sized in floats
+  cl_mem symmetries;
+
   cl_mem trunk;
   cl_mem trunkScratch;
   cl_mem mid;
@@ -2004,6 +2068,9 @@ struct Buffers {
     mask = createReadWriteBuffer(handle, batchXYElts);
     maskSum = createReadWriteBuffer(handle, batchElts);
 
+    static_assert(sizeof(int) == sizeof(float), "");
+    symmetries = createReadWriteBuffer(handle, batchElts);
+
     trunk = createReadWriteBuffer(handle, m.trunk->trunkNumChannels * batchXYElts);
     trunkScratch = createReadWriteBuffer(handle, m.trunk->trunkNumChannels * batchXYElts);
     size_t maxMidChannels = std::max(m.trunk->regularNumChannels + m.trunk->dilatedNumChannels, m.trunk->midNumChannels);
@@ -2051,6 +2118,7 @@ struct Buffers {
 
     clReleaseMemObject(mask);
     clReleaseMemObject(maskSum);
+    clReleaseMemObject(symmetries);
 
     clReleaseMemObject(trunk);
     clReleaseMemObject(trunkScratch);
@@ -2173,7 +2241,7 @@ struct InputBuffers {
 
   float* userInputBuffer; //Host pointer
   float* userInputGlobalBuffer; //Host pointer
-  bool* symmetriesBuffer; //Host pointer
+  int* symmetriesBuffer; //Host pointer
 
   float* policyPassResults; //Host pointer
   float* policyResults; //Host pointer
@@ -2216,7 +2284,8 @@ struct InputBuffers {
 
     userInputBuffer = new float[(size_t)m.numInputChannels * maxBatchSize * xSize * ySize];
     userInputGlobalBuffer = new float[(size_t)m.numInputGlobalChannels * maxBatchSize];
-    symmetriesBuffer = new bool[NNInputs::NUM_SYMMETRY_BOOLS];
+    symmetriesBuffer = new int[maxBatchSize];
+    std::fill(symmetriesBuffer,symmetriesBuffer+maxBatchSize,0);
 
     policyPassResults = new float[(size_t)maxBatchSize * 1];
     policyResults = new float[(size_t)maxBatchSize * xSize * ySize];
@@ -2268,7 +2337,7 @@ int NeuralNet::getBatchEltGlobalLen(const InputBuffers* inputBuffers) {
   return inputBuffers->singleInputGlobalElts;
 }
 
-bool* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
+int* NeuralNet::getSymmetriesInplace(InputBuffers* inputBuffers) {
   return inputBuffers->symmetriesBuffer;
 }
 
@@ -2327,11 +2396,24 @@ void NeuralNet::getOutput(
     NULL
   );
   CHECK_ERR(err);
+  err = clEnqueueWriteBuffer(
+    handle->commandQueue,
+    buffers->symmetries,
+    CL_FALSE,
+    0,
+    sizeof(int)*batchSize,
+    inputBuffers->symmetriesBuffer,
+    0,
+    NULL,
+    NULL
+  );
+  CHECK_ERR(err);
 
   gpuHandle->model->apply(
     handle,
     batchSize,
     inputBuffers->symmetriesBuffer,
+    buffers->symmetries,
 
     buffers->input,
     buffers->inputScratch,
@@ -2739,7 +2821,7 @@ bool NeuralNet::testEvaluateSymmetry(
   int nnYLen,
   bool useFP16,
   bool useNHWC,
-  const bool* symmetries,
+  const int* symmetries,
   const std::vector<float>& inputBuffer,
   std::vector<float>& outputBuffer
 ) {
@@ -2762,13 +2844,17 @@ bool NeuralNet::testEvaluateSymmetry(
   vector<float> inputTmp = inputBuffer;
   cl_mem input = createReadWriteBuffer(handle,inputTmp);
   cl_mem inputScratch = createReadWriteBuffer(handle,numFloats);
+  cl_mem deviceSymmetries = createReadWriteBuffer(handle,(size_t)batchSize);
+  cl_int err = clEnqueueWriteBuffer(handle->commandQueue, deviceSymmetries, CL_TRUE, 0, sizeof(int)*batchSize, symmetries, 0, NULL, NULL);
+  CHECK_ERR(err);
 
-  applySymmetriesNCHW(handle, symmetries, false, batchSize, numChannels, nnXLen, nnYLen, input, inputScratch);
+  applySymmetriesNCHW(handle, symmetries, deviceSymmetries, false, batchSize, numChannels, nnXLen, nnYLen, input, inputScratch);
 
   blockingReadBuffer(handle->commandQueue, input, numFloats, outputBuffer);
 
   clReleaseMemObject(input);
   clReleaseMemObject(inputScratch);
+  clReleaseMemObject(deviceSymmetries);
   delete handle;
   freeComputeContext(context);
 
@@ -668,6 +668,46 @@ __kernel void mirror(__global float* in, __global float* out, int batchSize, int
 )%%";
 
 
+string OpenCLKernels::applySymmetriesNCHW = R"%%(
+//Transforms each batch element by its own symmetry (bit 0 = flip y, bit 1 = flip x, bit 2 = transpose if square),
+//or undoes that transformation if inverse is nonzero.
+__kernel void applySymmetriesNCHW(
+  __global float* in, __global float* out, __global int* symmetries,
+  int batchSize, int cSize, int ySize, int xSize, int inverse
+)
+{
+  const int xyIdx = get_global_id(0);
+  const int cIdx = get_global_id(1);
+  const int nIdx = get_global_id(2);
+  const int xySize = xSize * ySize;
+  if(xyIdx < xySize && cIdx < cSize && nIdx < batchSize) {
+    int symmetry = symmetries[nIdx];
+    bool flipY = (symmetry & 0x1) != 0;
+    bool flipX = (symmetry & 0x2) != 0;
+    bool transpose = (symmetry & 0x4) != 0 && xSize == ySize;
+    int y = xyIdx / xSize;
+    int x = xyIdx % xSize;
+    int srcY;
+    int srcX;
+    if(!transpose) {
+      srcY = flipY ? ySize-1-y : y;
+      srcX = flipX ? xSize-1-x : x;
+    }
+    else if(inverse == 0) {
+      srcY = flipY ? ySize-1-x : x;
+      srcX = flipX ? xSize-1-y : y;
+    }
+    else {
+      srcY = flipX ? xSize-1-x : x;
+      srcX = flipY ? ySize-1-y : y;
+    }
+    int base = (nIdx * cSize + cIdx) * xySize;
+    out[base + xyIdx] = in[base + srcY * xSize + srcX];
+  }
+}
+)%%";
+
+
 string OpenCLKernels::extractChannel0NCHW = R"%%(
 __kernel void extractChannel0NCHW(__global float* in, __global float* out, int nSize, int cSize, int xySize)
 {
@@ -19,6 +19,7 @@ namespace OpenCLKernels {
   extern std::string addCBiasesNCRelu;
   extern std::string transposeNCHW;
   extern std::string mirror;
+  extern std::string applySymmetriesNCHW;
   extern std::string extractChannel0NCHW;
 
   extern std::string xgemmDirect;
@@ -0,0 +1,82 @@
+#include "../neuralnet/syntheticnn.h"
+
+#include <cmath>
+
+using namespace std;
+
+SyntheticNNParams::SyntheticNNParams()
+  :batchLatencyMs(2.0),
+   rowLatencyMs(0.1),
+   batchSizeExponent(0.7)
+{}
+
+double SyntheticNN::getBatchLatencySeconds(const SyntheticNNParams& params, int numRows) {
+  double ms = params.batchLatencyMs + params.rowLatencyMs * pow((double)numRows, params.batchSizeExponent);
+  return std::max(ms, 0.0) * 0.001;
+}
+
+namespace {
+  //Cheap deterministic stream of random numbers keyed by a position hash.
+  //Rand is much too expensive to seed once per evaluation.
+  struct HashStream {
+    uint64_t state;
+    HashStream(Hash128 hash)
+      :state(hash.hash0 ^ Hash::murmurMix(hash.hash1))
+    {}
+    uint64_t next() {
+      state += 0x9E3779B97F4A7C15ULL;
+      return Hash::murmurMix(state);
+    }
+    double nextDouble() {
+      //53 bits, in (0,1)
+      return ((double)(next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+    double nextGaussian() {
+      const double twoPi = 6.283185307179586476925;
+      return sqrt(-2.0 * log(nextDouble())) * cos(twoPi * nextDouble());
+    }
+  };
+}
+
+void SyntheticNN::fillOutput(
+  Hash128 nnHash, int boardXSize, int boardYSize, int nnXLen, int nnYLen, bool includeOwnerMap, NNOutput& out
+) {
+  HashStream stream(nnHash);
+
+  float* policyProbs = out.policyProbs;
+  for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++)
+    policyProbs[i] = 0;
+
+  //Logits by distance from the nearest edge, so the search favors the third and fourth lines like a real net does
+  static const float lineLogits[5] = {-2.0f, -0.8f, 0.5f, 0.6f, 0.0f};
+  for(int y = 0; y<boardYSize; y++) {
+    for(int x = 0; x<boardXSize; x++) {
+      int line = std::min(std::min(x, boardXSize-1-x), std::min(y, boardYSize-1-y));
+      int pos = NNPos::xyToPos(x,y,nnXLen);
+      policyProbs[pos] = lineLogits[std::min(line,4)] + (float)(stream.nextGaussian() * 1.2);
+    }
+  }
+  policyProbs[NNPos::locToPos(Board::PASS_LOC,boardXSize,nnXLen,nnYLen)] = -3.0f;
+
+  out.nnXLen = nnXLen;
+  out.nnYLen = nnYLen;
+  if(includeOwnerMap) {
+    assert(out.whiteOwnerMap != NULL);
+    for(int i = 0; i<nnXLen*nnYLen; i++)
+      out.whiteOwnerMap[i] = 0.0f;
+    for(int y = 0; y<boardYSize; y++) {
+      for(int x = 0; x<boardXSize; x++) {
+        int pos = NNPos::xyToPos(x,y,nnXLen);
+        out.whiteOwnerMap[pos] = (float)(stream.nextGaussian() * 0.5);
+      }
+    }
+  }
+
+  //Raw logits from the perspective of the player to move, postprocessing converts these
+  double winLogit = stream.nextGaussian() * 0.5;
+  out.whiteWinProb = winLogit;
+  out.whiteLossProb = -winLogit;
+  out.whiteNoResultProb = -4.0;
+  out.whiteScoreMean = winLogit * 0.25;
+  out.whiteScoreMeanSq = 0.5 + stream.nextGaussian() * 0.1;
+}
@@ -0,0 +1,35 @@
+#ifndef NEURALNET_SYNTHETICNN_H_
+#define NEURALNET_SYNTHETICNN_H_
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../neuralnet/nninputs.h"
+
+//A fake neural net for benchmarking the search without a model file or a real backend.
+//Outputs are a deterministic function of the nnHash of the position, and are shaped roughly like a real net's
+//(policy concentrated on the third and fourth lines, small value and score logits), so that the search builds
+//trees of a realistic shape. Each batch takes a simulated amount of wall-clock time to evaluate.
+struct SyntheticNNParams {
+  //Fixed cost of evaluating a batch, in milliseconds
+  double batchLatencyMs;
+  //Additional cost per row, scaled by numRows^batchSizeExponent, in milliseconds
+  double rowLatencyMs;
+  //Less than 1 models a device that gets more efficient as the batch grows
+  double batchSizeExponent;
+
+  SyntheticNNParams();
+};
+
+namespace SyntheticNN {
+  //Simulated wall-clock time to evaluate a batch of numRows rows
+  double getBatchLatencySeconds(const SyntheticNNParams& params, int numRows);
+
+  //Fill out with raw pre-postprocessing outputs (unnormalized policy logits, value logits, pre-scaled score),
+  //in the same form that NeuralNet::getOutput produces them.
+  //If includeOwnerMap, out.whiteOwnerMap must already be allocated with nnXLen*nnYLen floats.
+  void fillOutput(
+    Hash128 nnHash, int boardXSize, int boardYSize, int nnXLen, int nnYLen, bool includeOwnerMap, NNOutput& out
+  );
+}
+
+#endif  // NEURALNET_SYNTHETICNN_H_
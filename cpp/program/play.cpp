@@ -285,6 +285,13 @@ bool MatchPairer::getMatchup(
       if(nnEvals[i] != NULL) {
         logger.write(nnEvals[i]->getModelFileName());
         logger.write("NN rows: " + Global::int64ToString(nnEvals[i]->numRowsProcessed()));
+        logger.write("NN coalesced requests: " + Global::int64ToString(nnEvals[i]->numCoalescedRequests()));
+        uint64_t cacheHits, cacheMisses, cacheEvictions;
+        nnEvals[i]->getCacheStats(cacheHits,cacheMisses,cacheEvictions);
+        logger.write(
+          "NN cache hits/misses/evictions: " + Global::uint64ToString(cacheHits) + " " +
+          Global::uint64ToString(cacheMisses) + " " + Global::uint64ToString(cacheEvictions)
+        );
         logger.write("NN batches: " + Global::int64ToString(nnEvals[i]->numBatchesProcessed()));
         logger.write("NN avg batch size: " + Global::doubleToString(nnEvals[i]->averageProcessedBatchSize()));
       }
@@ -398,6 +405,8 @@ static void logSearch(Search* bot, Logger& logger, Loc loc) {
   Board::printBoard(sout, bot->getRootBoard(), loc, &(bot->getRootHist().moveHistory));
   sout << "\n";
   sout << "Root visits: " << bot->numRootVisits() << "\n";
+  sout << "Search threads spawned: " << bot->numSearchThreadsSpawned
+       << " startup ms: " << Global::strprintf("%.3f", bot->lastSearchStartupSeconds * 1000.0) << "\n";
   sout << "PV: ";
   bot->printPV(sout, bot->rootNode, 25);
   sout << "\n";
@@ -708,10 +717,8 @@ static void recordTreePositionsRec(
   int bestChildIdx = 0;
   int64_t bestChildVisits = 0;
   for(int i = 1; i<node->numChildren; i++) {
-    const SearchNode* child = node->children[i];
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t numVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    const SearchNode* child = node->children[i].node;
+    int64_t numVisits = child->getStats().visits;
     if(numVisits > bestChildVisits) {
       bestChildVisits = numVisits;
       bestChildIdx = i;
@@ -725,20 +732,19 @@ static void recordTreePositionsRec(
     if(!newPlaAlwaysBest && !newOppAlwaysBest)
       continue;
 
-    const SearchNode* child = node->children[i];
-    if(child->prevMoveLoc == excludeLoc0 || child->prevMoveLoc == excludeLoc1)
+    const SearchNode* child = node->children[i].node;
+    Loc moveLoc = node->children[i].moveLoc;
+    if(moveLoc == excludeLoc0 || moveLoc == excludeLoc1)
       continue;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t numVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    int64_t numVisits = child->getStats().visits;
 
     if(numVisits < minVisitsAtNode)
       continue;
 
     Board copy = board;
     BoardHistory histCopy = hist;
-    histCopy.makeBoardMoveAssumeLegal(copy, child->prevMoveLoc, pla, NULL);
+    histCopy.makeBoardMoveAssumeLegal(copy, moveLoc, pla, NULL);
     Player nextPla = getOpp(pla);
     recordTreePositionsRec(
       gameData,
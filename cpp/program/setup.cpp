@@ -29,6 +29,8 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
   string backendPrefix = "cuda";
   #elif defined(USE_OPENCL_BACKEND)
   string backendPrefix = "opencl";
+  #elif defined(USE_CPU_BACKEND)
+  string backendPrefix = "cpu";
   #else
   string backendPrefix = "dummybackend";
   #endif
@@ -39,6 +41,8 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     cfg.markAllKeysUsedWithPrefix("cuda");
   if(backendPrefix != "opencl")
     cfg.markAllKeysUsedWithPrefix("opencl");
+  if(backendPrefix != "cpu")
+    cfg.markAllKeysUsedWithPrefix("cpu");
   if(backendPrefix != "dummybackend")
     cfg.markAllKeysUsedWithPrefix("dummybackend");
 
@@ -76,7 +80,7 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
     else if(cfg.contains("requireMaxBoardSize"))
       requireExactNNLen = cfg.getBool("requireMaxBoardSize");
 
-    bool inputsUseNHWC = backendPrefix == "opencl" ? false : true;
+    bool inputsUseNHWC = (backendPrefix == "opencl" || backendPrefix == "cpu") ? false : true;
     if(cfg.contains(backendPrefix+"InputsUseNHWC"+idxStr))
       inputsUseNHWC = cfg.getBool(backendPrefix+"InputsUseNHWC"+idxStr);
     else if(cfg.contains("inputsUseNHWC"+idxStr))
@@ -162,6 +166,13 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
       + " useNHWC " + Global::boolToString(useNHWC)
     );
 
+    //If provided, a memory budget for the cache takes precedence over nnCacheSizePowerOfTwo
+    double cacheSizeMB = 0.0;
+    if(cfg.contains("nnCacheSizeMB"+idxStr))
+      cacheSizeMB = cfg.getDouble("nnCacheSizeMB"+idxStr, 1.0, 1048576.0);
+    else if(cfg.contains("nnCacheSizeMB"))
+      cacheSizeMB = cfg.getDouble("nnCacheSizeMB", 1.0, 1048576.0);
+
     NNEvaluator* nnEval = new NNEvaluator(
       nnModelName,
       nnModelFile,
@@ -174,7 +185,7 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
       nnYLen,
       requireExactNNLen,
       inputsUseNHWC,
-      cfg.getInt("nnCacheSizePowerOfTwo", -1, 48),
+      cacheSizeMB > 0.0 ? -1 : cfg.getInt("nnCacheSizePowerOfTwo", -1, 48),
       cfg.getInt("nnMutexPoolSizePowerOfTwo", -1, 24),
       debugSkipNeuralNet,
       alwaysIncludeOwnerMap,
@@ -182,6 +193,48 @@ vector<NNEvaluator*> Setup::initializeNNEvaluators(
       openCLTunerFile
     );
 
+    if(cacheSizeMB > 0.0)
+      nnEval->setCacheSizeMB(cacheSizeMB);
+    logger.write("NN cache size for nnModelFile" + idxStr + ": " + Global::doubleToString(nnEval->getCacheSizeBytes() / 1048576.0) + " MB");
+
+    string diskCacheFile;
+    if(cfg.contains("nnDiskCacheFile"+idxStr))
+      diskCacheFile = cfg.getString("nnDiskCacheFile"+idxStr);
+    else if(cfg.contains("nnDiskCacheFile")) {
+      if(nnModelFiles.size() > 1)
+        throw StringError("nnDiskCacheFile cannot be shared between multiple models, specify nnDiskCacheFile0, nnDiskCacheFile1, etc instead");
+      diskCacheFile = cfg.getString("nnDiskCacheFile");
+    }
+    if(diskCacheFile != "") {
+      double diskCacheMaxSizeMB = 1024.0;
+      if(cfg.contains("nnDiskCacheMaxSizeMB"+idxStr))
+        diskCacheMaxSizeMB = cfg.getDouble("nnDiskCacheMaxSizeMB"+idxStr, 1.0, 1048576.0);
+      else if(cfg.contains("nnDiskCacheMaxSizeMB"))
+        diskCacheMaxSizeMB = cfg.getDouble("nnDiskCacheMaxSizeMB", 1.0, 1048576.0);
+      nnEval->setDiskCache(diskCacheFile, (int64_t)(diskCacheMaxSizeMB * 1024.0 * 1024.0), &logger);
+    }
+
+    string nnBatchingMode = "immediate";
+    if(cfg.contains("nnBatchingMode"+idxStr))
+      nnBatchingMode = cfg.getString("nnBatchingMode"+idxStr, {"immediate","latency","throughput"});
+    else if(cfg.contains("nnBatchingMode"))
+      nnBatchingMode = cfg.getString("nnBatchingMode", {"immediate","latency","throughput"});
+    NNBatchingParams batchingParams = NNBatchingParams::getDefaults(nnBatchingMode);
+    if(cfg.contains("nnBatchMaxWaitMicros"+idxStr))
+      batchingParams.maxWaitMicros = cfg.getInt64("nnBatchMaxWaitMicros"+idxStr, 0, 1000000);
+    else if(cfg.contains("nnBatchMaxWaitMicros"))
+      batchingParams.maxWaitMicros = cfg.getInt64("nnBatchMaxWaitMicros", 0, 1000000);
+    if(cfg.contains("nnBatchTargetFill"+idxStr))
+      batchingParams.targetFill = cfg.getDouble("nnBatchTargetFill"+idxStr, 0.01, 1.0);
+    else if(cfg.contains("nnBatchTargetFill"))
+      batchingParams.targetFill = cfg.getDouble("nnBatchTargetFill", 0.01, 1.0);
+    logger.write(
+      "nnBatchingMode" + idxStr + " = " + nnBatchingMode
+      + " maxWaitMicros " + Global::int64ToString(batchingParams.maxWaitMicros)
+      + " targetFill " + Global::doubleToString(batchingParams.targetFill)
+    );
+    nnEval->setBatchingParams(batchingParams);
+
     int defaultSymmetry = forcedSymmetry >= 0 ? forcedSymmetry : 0;
     nnEval->spawnServerThreads(
       numNNServerThreadsPerModel,
@@ -281,6 +334,15 @@ vector<SearchParams> Setup::loadParams(
     else if(cfg.contains("scaleParentWeight")) params.scaleParentWeight = cfg.getBool("scaleParentWeight");
     else params.scaleParentWeight = true;
 
+    if(cfg.contains("useIncrementalBackup"+idxStr)) params.useIncrementalBackup = cfg.getBool("useIncrementalBackup"+idxStr);
+    else if(cfg.contains("useIncrementalBackup")) params.useIncrementalBackup = cfg.getBool("useIncrementalBackup");
+    else params.useIncrementalBackup = false;
+    if(cfg.contains("incrementalBackupFullRecomputeVisits"+idxStr))
+      params.incrementalBackupFullRecomputeVisits = cfg.getInt64("incrementalBackupFullRecomputeVisits"+idxStr, (int64_t)0, (int64_t)1 << 50);
+    else if(cfg.contains("incrementalBackupFullRecomputeVisits"))
+      params.incrementalBackupFullRecomputeVisits = cfg.getInt64("incrementalBackupFullRecomputeVisits", (int64_t)0, (int64_t)1 << 50);
+    else params.incrementalBackupFullRecomputeVisits = 1000;
+
     if(cfg.contains("rootNoiseEnabled"+idxStr)) params.rootNoiseEnabled = cfg.getBool("rootNoiseEnabled"+idxStr);
     else                                        params.rootNoiseEnabled = cfg.getBool("rootNoiseEnabled");
     if(cfg.contains("rootDirichletNoiseTotalConcentration"+idxStr))
@@ -336,10 +398,24 @@ vector<SearchParams> Setup::loadParams(
     else if(cfg.contains("rootPruneUselessMoves"))   params.rootPruneUselessMoves = cfg.getBool("rootPruneUselessMoves");
     else                                             params.rootPruneUselessMoves = false;
 
+    if(cfg.contains("useGraphSearch"+idxStr)) params.useGraphSearch = cfg.getBool("useGraphSearch"+idxStr);
+    else if(cfg.contains("useGraphSearch"))   params.useGraphSearch = cfg.getBool("useGraphSearch");
+    else                                      params.useGraphSearch = false;
+
+    if(cfg.contains("maxNodeArenaSizeFactor"+idxStr)) params.maxNodeArenaSizeFactor = cfg.getDouble("maxNodeArenaSizeFactor"+idxStr, 1.0, 100.0);
+    else if(cfg.contains("maxNodeArenaSizeFactor"))   params.maxNodeArenaSizeFactor = cfg.getDouble("maxNodeArenaSizeFactor",        1.0, 100.0);
+    else                                              params.maxNodeArenaSizeFactor = 1.5;
+
     if(cfg.contains("mutexPoolSize"+idxStr)) params.mutexPoolSize = (uint32_t)cfg.getInt("mutexPoolSize"+idxStr, 1, 1 << 24);
     else                                     params.mutexPoolSize = (uint32_t)cfg.getInt("mutexPoolSize",        1, 1 << 24);
     if(cfg.contains("numVirtualLossesPerThread"+idxStr)) params.numVirtualLossesPerThread = (int32_t)cfg.getInt("numVirtualLossesPerThread"+idxStr, 1, 1000);
     else                                                 params.numVirtualLossesPerThread = (int32_t)cfg.getInt("numVirtualLossesPerThread",        1, 1000);
+    if(cfg.contains("useUndoForPlayoutReset"+idxStr)) params.useUndoForPlayoutReset = cfg.getBool("useUndoForPlayoutReset"+idxStr);
+    else if(cfg.contains("useUndoForPlayoutReset"))   params.useUndoForPlayoutReset = cfg.getBool("useUndoForPlayoutReset");
+    else                                              params.useUndoForPlayoutReset = true;
+    if(cfg.contains("numLeavesPerThread"+idxStr)) params.numLeavesPerThread = cfg.getInt("numLeavesPerThread"+idxStr, 1, 4096);
+    else if(cfg.contains("numLeavesPerThread"))   params.numLeavesPerThread = cfg.getInt("numLeavesPerThread",        1, 4096);
+    else                                          params.numLeavesPerThread = 1;
 
     paramss.push_back(params);
   }
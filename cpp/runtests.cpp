@@ -30,12 +30,21 @@ int MainCmds::runtests(int argc, const char* const* argv) {
   Tests::runBoardAreaTests();
 
   Tests::runRulesTests();
+  Tests::runBoardHistoryRecentBoardsTests();
+  Tests::runKoHashTableTests();
 
   Tests::runBoardUndoTest();
   Tests::runBoardStressTest();
 
   Tests::runSgfTests();
 
+  Tests::runLadderCacheTests();
+
+  Tests::runChildSelectionTests();
+
+  Tests::runNNCacheTests();
+  Tests::runModelDescBinaryTests();
+
   ScoreValue::freeTables();
 
   cout << "All tests passed" << endl;
@@ -147,3 +156,25 @@ int MainCmds::runnnontinyboardtest(int argc, const char* const* argv) {
 
   return 0;
 }
+
+int MainCmds::runsearchstresstests(int argc, const char* const* argv) {
+  (void)argc;
+  (void)argv;
+  Board::initHash();
+  ScoreValue::initTables();
+
+  Tests::runSearchStressTests();
+
+  ScoreValue::freeTables();
+
+  return 0;
+}
+
+int MainCmds::runselectionbenchmark(int argc, const char* const* argv) {
+  (void)argc;
+  (void)argv;
+
+  Tests::runChildSelectionBenchmark();
+
+  return 0;
+}
@@ -0,0 +1,400 @@
+#include "../search/childselection.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+using ChildSelection::ExistingChildParams;
+using ChildSelection::ILLEGAL_SELECTION_VALUE;
+using ChildSelection::FORCED_SELECTION_VALUE;
+
+//All implementations must evaluate exactly these expressions in this order, so that they agree to the last bit.
+static inline double getSelectionValue(
+  double cpuctExploration, float nnPolicyProb, double totalChildVisits, double childVisits, double childUtility, bool plaIsWhite
+) {
+  if(nnPolicyProb < 0)
+    return ILLEGAL_SELECTION_VALUE;
+  double exploreComponent = cpuctExploration * nnPolicyProb * sqrt(totalChildVisits + 0.01) / (1.0 + childVisits);
+  //Adjust value to be from the player's perspective, so that players prefer values in their favor rather than in white's favor
+  double valueComponent = plaIsWhite ? childUtility : -childUtility;
+  return exploreComponent + valueComponent;
+}
+
+static inline double getExistingSelectionValue(
+  const ExistingChildParams& params, float nnPolicyProb, double childVisits, double childUtility, double childVirtualLosses
+) {
+  //When multithreading, totalChildVisits could be out of sync with childVisits, so if they provably are, then fix that up
+  double totalChildVisits = (double)params.totalChildVisits;
+  if(totalChildVisits < childVisits)
+    totalChildVisits = childVisits;
+
+  //Virtual losses to direct threads down different paths
+  if(childVirtualLosses > 0) {
+    childVisits += childVirtualLosses;
+    double virtualLossVisitFrac = childVirtualLosses / childVisits;
+    childUtility = childUtility + (params.virtualLossUtility - childUtility) * virtualLossVisitFrac;
+  }
+
+  //Hack to get the root to funnel more visits down child branches
+  if(params.rootDesiredPerChildVisitsCoeff > 0.0) {
+    if(childVisits < sqrt(nnPolicyProb * (float)totalChildVisits * params.rootDesiredPerChildVisitsCoeff))
+      return FORCED_SELECTION_VALUE;
+  }
+
+  return getSelectionValue(params.cpuctExploration,nnPolicyProb,totalChildVisits,childVisits,childUtility,params.plaIsWhite);
+}
+
+int ChildSelection::selectBestExistingScalar(
+  const ExistingChildParams& params, int numChildren,
+  const float* policyProbs, const double* visits, const double* utilities, const double* virtualLosses,
+  double& maxValue
+) {
+  int bestIdx = -1;
+  maxValue = ILLEGAL_SELECTION_VALUE;
+  for(int i = 0; i<numChildren; i++) {
+    double value = getExistingSelectionValue(params,policyProbs[i],visits[i],utilities[i],virtualLosses[i]);
+    if(value > maxValue) {
+      maxValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+int ChildSelection::selectBestNewScalar(
+  double cpuctExploration, int64_t totalChildVisits, double fpuValue, bool plaIsWhite,
+  int policySize, const float* policyProbs, const bool* excluded,
+  double& maxValue
+) {
+  int bestIdx = -1;
+  maxValue = ILLEGAL_SELECTION_VALUE;
+  for(int i = 0; i<policySize; i++) {
+    if(excluded[i])
+      continue;
+    double value = getSelectionValue(cpuctExploration,policyProbs[i],(double)totalChildVisits,0.0,fpuValue,plaIsWhite);
+    if(value > maxValue) {
+      maxValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+//Combine per-lane maximums, each of which is the first occurrence within its lane, into the overall first maximum
+static inline void mergeLanes(const double* laneValues, const double* laneIdxs, int numLanes, double& maxValue, int& bestIdx) {
+  for(int lane = 0; lane<numLanes; lane++) {
+    int idx = (int)laneIdxs[lane];
+    if(idx < 0)
+      continue;
+    if(laneValues[lane] > maxValue || (laneValues[lane] == maxValue && idx < bestIdx)) {
+      maxValue = laneValues[lane];
+      bestIdx = idx;
+    }
+  }
+}
+
+#if defined(__AVX2__)
+
+int ChildSelection::selectBestExisting(
+  const ExistingChildParams& params, int numChildren,
+  const float* policyProbs, const double* visits, const double* utilities, const double* virtualLosses,
+  double& maxValue
+) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d tiny = _mm256_set1_pd(0.01);
+  const __m256d cpuct = _mm256_set1_pd(params.cpuctExploration);
+  const __m256d baseTotal = _mm256_set1_pd((double)params.totalChildVisits);
+  const __m256d virtualLossUtility = _mm256_set1_pd(params.virtualLossUtility);
+  const __m256d illegal = _mm256_set1_pd(ILLEGAL_SELECTION_VALUE);
+  const __m256d forced = _mm256_set1_pd(FORCED_SELECTION_VALUE);
+  const __m256d coeff = _mm256_set1_pd(params.rootDesiredPerChildVisitsCoeff);
+  const __m256d signFlip = params.plaIsWhite ? zero : _mm256_set1_pd(-0.0);
+  const bool useForced = params.rootDesiredPerChildVisitsCoeff > 0.0;
+
+  __m256d bestValues = illegal;
+  __m256d bestIdxs = _mm256_set1_pd(-1.0);
+  __m256d idxs = _mm256_setr_pd(0.0,1.0,2.0,3.0);
+  const __m256d idxStep = _mm256_set1_pd(4.0);
+
+  int i = 0;
+  for(; i+4 <= numChildren; i += 4) {
+    __m128 probsF = _mm_loadu_ps(policyProbs+i);
+    __m256d probs = _mm256_cvtps_pd(probsF);
+    __m256d childVisits = _mm256_loadu_pd(visits+i);
+    __m256d childUtility = _mm256_loadu_pd(utilities+i);
+    __m256d childVirtualLosses = _mm256_loadu_pd(virtualLosses+i);
+
+    __m256d total = _mm256_max_pd(baseTotal,childVisits);
+
+    __m256d hasVirtualLosses = _mm256_cmp_pd(childVirtualLosses,zero,_CMP_GT_OQ);
+    __m256d adjVisits = _mm256_add_pd(childVisits,childVirtualLosses);
+    __m256d frac = _mm256_div_pd(childVirtualLosses,adjVisits);
+    __m256d adjUtility = _mm256_add_pd(childUtility,_mm256_mul_pd(_mm256_sub_pd(virtualLossUtility,childUtility),frac));
+    childVisits = _mm256_blendv_pd(childVisits,adjVisits,hasVirtualLosses);
+    childUtility = _mm256_blendv_pd(childUtility,adjUtility,hasVirtualLosses);
+
+    __m256d explore = _mm256_div_pd(
+      _mm256_mul_pd(_mm256_mul_pd(cpuct,probs),_mm256_sqrt_pd(_mm256_add_pd(total,tiny))),
+      _mm256_add_pd(one,childVisits)
+    );
+    __m256d values = _mm256_add_pd(explore,_mm256_xor_pd(childUtility,signFlip));
+    values = _mm256_blendv_pd(values,illegal,_mm256_cmp_pd(probs,zero,_CMP_LT_OQ));
+
+    if(useForced) {
+      //The threshold is computed in single precision up to the coeff, just as in the scalar code
+      __m128 probTimesTotal = _mm_mul_ps(probsF,_mm256_cvtpd_ps(total));
+      __m256d threshold = _mm256_sqrt_pd(_mm256_mul_pd(_mm256_cvtps_pd(probTimesTotal),coeff));
+      values = _mm256_blendv_pd(values,forced,_mm256_cmp_pd(childVisits,threshold,_CMP_LT_OQ));
+    }
+
+    __m256d isBetter = _mm256_cmp_pd(values,bestValues,_CMP_GT_OQ);
+    bestValues = _mm256_blendv_pd(bestValues,values,isBetter);
+    bestIdxs = _mm256_blendv_pd(bestIdxs,idxs,isBetter);
+    idxs = _mm256_add_pd(idxs,idxStep);
+  }
+
+  double laneValues[4];
+  double laneIdxs[4];
+  _mm256_storeu_pd(laneValues,bestValues);
+  _mm256_storeu_pd(laneIdxs,bestIdxs);
+  int bestIdx = -1;
+  maxValue = ILLEGAL_SELECTION_VALUE;
+  mergeLanes(laneValues,laneIdxs,4,maxValue,bestIdx);
+
+  for(; i<numChildren; i++) {
+    double value = getExistingSelectionValue(params,policyProbs[i],visits[i],utilities[i],virtualLosses[i]);
+    if(value > maxValue) {
+      maxValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+int ChildSelection::selectBestNew(
+  double cpuctExploration, int64_t totalChildVisits, double fpuValue, bool plaIsWhite,
+  int policySize, const float* policyProbs, const bool* excluded,
+  double& maxValue
+) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d cpuct = _mm256_set1_pd(cpuctExploration);
+  const __m256d sqrtTotal = _mm256_set1_pd(sqrt((double)totalChildVisits + 0.01));
+  const __m256d valueComponent = _mm256_set1_pd(plaIsWhite ? fpuValue : -fpuValue);
+  const __m256d illegal = _mm256_set1_pd(ILLEGAL_SELECTION_VALUE);
+
+  __m256d bestValues = illegal;
+  __m256d bestIdxs = _mm256_set1_pd(-1.0);
+  __m256d idxs = _mm256_setr_pd(0.0,1.0,2.0,3.0);
+  const __m256d idxStep = _mm256_set1_pd(4.0);
+
+  int i = 0;
+  for(; i+4 <= policySize; i += 4) {
+    __m256d probs = _mm256_cvtps_pd(_mm_loadu_ps(policyProbs+i));
+    int32_t excludedBytes;
+    std::memcpy(&excludedBytes,excluded+i,sizeof(int32_t));
+    __m256i excludedWide = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(excludedBytes));
+    __m256d isExcluded = _mm256_castsi256_pd(_mm256_cmpgt_epi64(excludedWide,_mm256_setzero_si256()));
+
+    //Dividing by 1.0 + 0 visits is exact, so it's left out
+    __m256d values = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(cpuct,probs),sqrtTotal),valueComponent);
+    values = _mm256_blendv_pd(values,illegal,_mm256_or_pd(isExcluded,_mm256_cmp_pd(probs,zero,_CMP_LT_OQ)));
+
+    __m256d isBetter = _mm256_cmp_pd(values,bestValues,_CMP_GT_OQ);
+    bestValues = _mm256_blendv_pd(bestValues,values,isBetter);
+    bestIdxs = _mm256_blendv_pd(bestIdxs,idxs,isBetter);
+    idxs = _mm256_add_pd(idxs,idxStep);
+  }
+
+  double laneValues[4];
+  double laneIdxs[4];
+  _mm256_storeu_pd(laneValues,bestValues);
+  _mm256_storeu_pd(laneIdxs,bestIdxs);
+  int bestIdx = -1;
+  maxValue = ILLEGAL_SELECTION_VALUE;
+  mergeLanes(laneValues,laneIdxs,4,maxValue,bestIdx);
+
+  for(; i<policySize; i++) {
+    if(excluded[i])
+      continue;
+    double value = getSelectionValue(cpuctExploration,policyProbs[i],(double)totalChildVisits,0.0,fpuValue,plaIsWhite);
+    if(value > maxValue) {
+      maxValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+const char* ChildSelection::getImplementationName() {
+  return "AVX2";
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+int ChildSelection::selectBestExisting(
+  const ExistingChildParams& params, int numChildren,
+  const float* policyProbs, const double* visits, const double* utilities, const double* virtualLosses,
+  double& maxValue
+) {
+  const float64x2_t zero = vdupq_n_f64(0.0);
+  const float64x2_t one = vdupq_n_f64(1.0);
+  const float64x2_t tiny = vdupq_n_f64(0.01);
+  const float64x2_t cpuct = vdupq_n_f64(params.cpuctExploration);
+  const float64x2_t baseTotal = vdupq_n_f64((double)params.totalChildVisits);
+  const float64x2_t virtualLossUtility = vdupq_n_f64(params.virtualLossUtility);
+  const float64x2_t illegal = vdupq_n_f64(ILLEGAL_SELECTION_VALUE);
+  const float64x2_t forced = vdupq_n_f64(FORCED_SELECTION_VALUE);
+  const float64x2_t coeff = vdupq_n_f64(params.rootDesiredPerChildVisitsCoeff);
+  const bool useForced = params.rootDesiredPerChildVisitsCoeff > 0.0;
+
+  float64x2_t bestValues = illegal;
+  float64x2_t bestIdxs = vdupq_n_f64(-1.0);
+  const double initialIdxs[2] = {0.0,1.0};
+  float64x2_t idxs = vld1q_f64(initialIdxs);
+  const float64x2_t idxStep = vdupq_n_f64(2.0);
+
+  int i = 0;
+  for(; i+2 <= numChildren; i += 2) {
+    float32x2_t probsF = vld1_f32(policyProbs+i);
+    float64x2_t probs = vcvt_f64_f32(probsF);
+    float64x2_t childVisits = vld1q_f64(visits+i);
+    float64x2_t childUtility = vld1q_f64(utilities+i);
+    float64x2_t childVirtualLosses = vld1q_f64(virtualLosses+i);
+
+    float64x2_t total = vmaxq_f64(baseTotal,childVisits);
+
+    uint64x2_t hasVirtualLosses = vcgtq_f64(childVirtualLosses,zero);
+    float64x2_t adjVisits = vaddq_f64(childVisits,childVirtualLosses);
+    float64x2_t frac = vdivq_f64(childVirtualLosses,adjVisits);
+    float64x2_t adjUtility = vaddq_f64(childUtility,vmulq_f64(vsubq_f64(virtualLossUtility,childUtility),frac));
+    childVisits = vbslq_f64(hasVirtualLosses,adjVisits,childVisits);
+    childUtility = vbslq_f64(hasVirtualLosses,adjUtility,childUtility);
+
+    float64x2_t explore = vdivq_f64(
+      vmulq_f64(vmulq_f64(cpuct,probs),vsqrtq_f64(vaddq_f64(total,tiny))),
+      vaddq_f64(one,childVisits)
+    );
+    float64x2_t values = vaddq_f64(explore,params.plaIsWhite ? childUtility : vnegq_f64(childUtility));
+    values = vbslq_f64(vcltq_f64(probs,zero),illegal,values);
+
+    if(useForced) {
+      //The threshold is computed in single precision up to the coeff, just as in the scalar code
+      float32x2_t probTimesTotal = vmul_f32(probsF,vcvt_f32_f64(total));
+      float64x2_t threshold = vsqrtq_f64(vmulq_f64(vcvt_f64_f32(probTimesTotal),coeff));
+      values = vbslq_f64(vcltq_f64(childVisits,threshold),forced,values);
+    }
+
+    uint64x2_t isBetter = vcgtq_f64(values,bestValues);
+    bestValues = vbslq_f64(isBetter,values,bestValues);
+    bestIdxs = vbslq_f64(isBetter,idxs,bestIdxs);
+    idxs = vaddq_f64(idxs,idxStep);
+  }
+
+  double laneValues[2];
+  double laneIdxs[2];
+  vst1q_f64(laneValues,bestValues);
+  vst1q_f64(laneIdxs,bestIdxs);
+  int bestIdx = -1;
+  maxValue = ILLEGAL_SELECTION_VALUE;
+  mergeLanes(laneValues,laneIdxs,2,maxValue,bestIdx);
+
+  for(; i<numChildren; i++) {
+    double value = getExistingSelectionValue(params,policyProbs[i],visits[i],utilities[i],virtualLosses[i]);
+    if(value > maxValue) {
+      maxValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+int ChildSelection::selectBestNew(
+  double cpuctExploration, int64_t totalChildVisits, double fpuValue, bool plaIsWhite,
+  int policySize, const float* policyProbs, const bool* excluded,
+  double& maxValue
+) {
+  const float64x2_t zero = vdupq_n_f64(0.0);
+  const float64x2_t cpuct = vdupq_n_f64(cpuctExploration);
+  const float64x2_t sqrtTotal = vdupq_n_f64(sqrt((double)totalChildVisits + 0.01));
+  const float64x2_t valueComponent = vdupq_n_f64(plaIsWhite ? fpuValue : -fpuValue);
+  const float64x2_t illegal = vdupq_n_f64(ILLEGAL_SELECTION_VALUE);
+
+  float64x2_t bestValues = illegal;
+  float64x2_t bestIdxs = vdupq_n_f64(-1.0);
+  const double initialIdxs[2] = {0.0,1.0};
+  float64x2_t idxs = vld1q_f64(initialIdxs);
+  const float64x2_t idxStep = vdupq_n_f64(2.0);
+
+  int i = 0;
+  for(; i+2 <= policySize; i += 2) {
+    float64x2_t probs = vcvt_f64_f32(vld1_f32(policyProbs+i));
+    uint64x2_t isExcluded = vcombine_u64(
+      vcreate_u64(excluded[i] ? ~((uint64_t)0) : 0),
+      vcreate_u64(excluded[i+1] ? ~((uint64_t)0) : 0)
+    );
+
+    //Dividing by 1.0 + 0 visits is exact, so it's left out
+    float64x2_t values = vaddq_f64(vmulq_f64(vmulq_f64(cpuct,probs),sqrtTotal),valueComponent);
+    values = vbslq_f64(vorrq_u64(isExcluded,vcltq_f64(probs,zero)),illegal,values);
+
+    uint64x2_t isBetter = vcgtq_f64(values,bestValues);
+    bestValues = vbslq_f64(isBetter,values,bestValues);
+    bestIdxs = vbslq_f64(isBetter,idxs,bestIdxs);
+    idxs = vaddq_f64(idxs,idxStep);
+  }
+
+  double laneValues[2];
+  double laneIdxs[2];
+  vst1q_f64(laneValues,bestValues);
+  vst1q_f64(laneIdxs,bestIdxs);
+  int bestIdx = -1;
+  maxValue = ILLEGAL_SELECTION_VALUE;
+  mergeLanes(laneValues,laneIdxs,2,maxValue,bestIdx);
+
+  for(; i<policySize; i++) {
+    if(excluded[i])
+      continue;
+    double value = getSelectionValue(cpuctExploration,policyProbs[i],(double)totalChildVisits,0.0,fpuValue,plaIsWhite);
+    if(value > maxValue) {
+      maxValue = value;
+      bestIdx = i;
+    }
+  }
+  return bestIdx;
+}
+
+const char* ChildSelection::getImplementationName() {
+  return "NEON";
+}
+
+#else
+
+int ChildSelection::selectBestExisting(
+  const ExistingChildParams& params, int numChildren,
+  const float* policyProbs, const double* visits, const double* utilities, const double* virtualLosses,
+  double& maxValue
+) {
+  return selectBestExistingScalar(params,numChildren,policyProbs,visits,utilities,virtualLosses,maxValue);
+}
+
+int ChildSelection::selectBestNew(
+  double cpuctExploration, int64_t totalChildVisits, double fpuValue, bool plaIsWhite,
+  int policySize, const float* policyProbs, const bool* excluded,
+  double& maxValue
+) {
+  return selectBestNewScalar(cpuctExploration,totalChildVisits,fpuValue,plaIsWhite,policySize,policyProbs,excluded,maxValue);
+}
+
+const char* ChildSelection::getImplementationName() {
+  return "scalar";
+}
+
+#endif
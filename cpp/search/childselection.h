@@ -0,0 +1,56 @@
+#ifndef SEARCH_CHILDSELECTION_H_
+#define SEARCH_CHILDSELECTION_H_
+
+#include "../core/global.h"
+
+//PUCT selection over all the children of a node at once.
+//The caller gathers the stats of the children into contiguous arrays (structure of arrays) so that the selection
+//values and their argmax can be computed with SIMD - AVX2 when compiled with USE_AVX2, NEON on aarch64, and plain
+//scalar code otherwise. Every implementation computes exactly the same values as Search did one child at a time,
+//and ties always go to the lowest index.
+namespace ChildSelection {
+  //Selection value for moves that may not be chosen. Any selectable move has a strictly larger value.
+  const double ILLEGAL_SELECTION_VALUE = -1e50;
+  //Selection value for root children that are forced to get more visits
+  const double FORCED_SELECTION_VALUE = 1e20;
+
+  struct ExistingChildParams {
+    double cpuctExploration;
+    int64_t totalChildVisits;
+    double virtualLossUtility; //Utility that a virtual loss counts as, white-positive
+    bool plaIsWhite;
+    double rootDesiredPerChildVisitsCoeff; //Zero unless this is the root during search and the coeff is enabled
+  };
+
+  //Returns the index of the child with the greatest selection value, or -1 if no child beats ILLEGAL_SELECTION_VALUE.
+  //utilities are white-positive, and should already include the fpu value for children with 0 visits.
+  int selectBestExisting(
+    const ExistingChildParams& params, int numChildren,
+    const float* policyProbs, const double* visits, const double* utilities, const double* virtualLosses,
+    double& maxValue
+  );
+  //Same, for moves that do not have a child yet, which all count as having 0 visits and fpuValue as their utility.
+  //Moves where excluded is true are skipped.
+  int selectBestNew(
+    double cpuctExploration, int64_t totalChildVisits, double fpuValue, bool plaIsWhite,
+    int policySize, const float* policyProbs, const bool* excluded,
+    double& maxValue
+  );
+
+  //One move at a time, regardless of what SIMD is available. For testing and benchmarking.
+  int selectBestExistingScalar(
+    const ExistingChildParams& params, int numChildren,
+    const float* policyProbs, const double* visits, const double* utilities, const double* virtualLosses,
+    double& maxValue
+  );
+  int selectBestNewScalar(
+    double cpuctExploration, int64_t totalChildVisits, double fpuValue, bool plaIsWhite,
+    int policySize, const float* policyProbs, const bool* excluded,
+    double& maxValue
+  );
+
+  //"AVX2", "NEON", or "scalar"
+  const char* getImplementationName();
+}
+
+#endif  // SEARCH_CHILDSELECTION_H_
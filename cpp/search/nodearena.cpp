@@ -0,0 +1,257 @@
+#include "../search/nodearena.h"
+
+#include "../core/os.h"
+#include "../search/search.h"
+
+#ifdef OS_IS_WINDOWS
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#endif
+#ifdef OS_IS_UNIX_OR_APPLE
+  #include <sys/resource.h>
+#endif
+#ifdef __APPLE__
+  #include <pthread.h>
+#endif
+
+using namespace std;
+
+SearchNodeArenaStats::SearchNodeArenaStats()
+  :numNodes(0),numChildrenArrays(0),numSlabs(0),bytesReserved(0)
+{}
+
+static std::atomic<uint64_t> nextArenaGeneration(1);
+
+SearchNodeArena::SearchNodeArena()
+  :generation(nextArenaGeneration.fetch_add(1,std::memory_order_relaxed)),
+   mutex(),nodeSlabs(),arraySlabs(),retiredNNOutputs()
+{}
+
+SearchNodeArena::~SearchNodeArena() {
+  releaseAll();
+}
+
+SearchNodeArena::NodeSlab* SearchNodeArena::newNodeSlab() {
+  NodeSlab* slab = new NodeSlab();
+  slab->nodes = (SearchNode*)::operator new(sizeof(SearchNode) * NODES_PER_SLAB);
+  slab->numUsed = 0;
+  slab->capacity = NODES_PER_SLAB;
+  std::lock_guard<std::mutex> lock(mutex);
+  nodeSlabs.push_back(slab);
+  return slab;
+}
+
+SearchNodeArena::ArraySlab* SearchNodeArena::newArraySlab(int minCapacity) {
+  ArraySlab* slab = new ArraySlab();
+  slab->capacity = std::max(minCapacity,(int)EDGES_PER_SLAB);
+  slab->edges = new SearchChild[slab->capacity];
+  slab->numUsed = 0;
+  slab->numArrays = 0;
+  std::lock_guard<std::mutex> lock(mutex);
+  arraySlabs.push_back(slab);
+  return slab;
+}
+
+void SearchNodeArena::retireNNOutput(std::shared_ptr<NNOutput>&& nnOutput) {
+  std::lock_guard<std::mutex> lock(mutex);
+  retiredNNOutputs.push_back(std::move(nnOutput));
+}
+
+int64_t SearchNodeArena::releaseAll() {
+  int64_t numReleased = 0;
+  for(size_t i = 0; i<nodeSlabs.size(); i++) {
+    NodeSlab* slab = nodeSlabs[i];
+    //Nodes hold references to their nnOutputs, so they still need to be destroyed, but unlike deleting the tree
+    //this is a linear pass over contiguous memory.
+    for(int j = 0; j<slab->numUsed; j++)
+      slab->nodes[j].~SearchNode();
+    numReleased += slab->numUsed;
+    ::operator delete(slab->nodes);
+    delete slab;
+  }
+  for(size_t i = 0; i<arraySlabs.size(); i++) {
+    delete[] arraySlabs[i]->edges;
+    delete arraySlabs[i];
+  }
+  nodeSlabs.clear();
+  arraySlabs.clear();
+  retiredNNOutputs.clear();
+  generation = nextArenaGeneration.fetch_add(1,std::memory_order_relaxed);
+  return numReleased;
+}
+
+uint64_t SearchNodeArena::getGeneration() const {
+  return generation;
+}
+
+SearchNodeArenaStats SearchNodeArena::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  SearchNodeArenaStats stats;
+  for(size_t i = 0; i<nodeSlabs.size(); i++) {
+    stats.numNodes += nodeSlabs[i]->numUsed;
+    stats.bytesReserved += (int64_t)sizeof(SearchNode) * nodeSlabs[i]->capacity;
+  }
+  for(size_t i = 0; i<arraySlabs.size(); i++) {
+    stats.numChildrenArrays += arraySlabs[i]->numArrays;
+    stats.bytesReserved += (int64_t)sizeof(SearchChild) * arraySlabs[i]->capacity;
+  }
+  stats.numSlabs = (int64_t)(nodeSlabs.size() + arraySlabs.size());
+  return stats;
+}
+
+//-----------------------------------------------------------------------------------------
+
+SearchNodeAllocator::SearchNodeAllocator(SearchNodeArena* a)
+  :arena(a),arenaGeneration(a->getGeneration()),nodeSlab(NULL),arraySlab(NULL)
+{}
+
+SearchNodeAllocator::~SearchNodeAllocator()
+{}
+
+void SearchNodeAllocator::reset(SearchNodeArena* a) {
+  if(a == arena && a->getGeneration() == arenaGeneration)
+    return;
+  arena = a;
+  arenaGeneration = a->getGeneration();
+  nodeSlab = NULL;
+  arraySlab = NULL;
+}
+
+void* SearchNodeAllocator::allocNode() {
+  if(nodeSlab == NULL || nodeSlab->numUsed >= nodeSlab->capacity)
+    nodeSlab = arena->newNodeSlab();
+  void* ret = nodeSlab->nodes + nodeSlab->numUsed;
+  nodeSlab->numUsed++;
+  return ret;
+}
+
+SearchChild* SearchNodeAllocator::allocChildren(int capacity) {
+  assert(capacity > 0);
+  //Arrays too large for a normal slab just get a dedicated slab of their own
+  if(capacity > SearchNodeArena::EDGES_PER_SLAB) {
+    SearchNodeArena::ArraySlab* slab = arena->newArraySlab(capacity);
+    slab->numUsed = capacity;
+    slab->numArrays = 1;
+    return slab->edges;
+  }
+  if(arraySlab == NULL || arraySlab->numUsed + capacity > arraySlab->capacity)
+    arraySlab = arena->newArraySlab(SearchNodeArena::EDGES_PER_SLAB);
+  SearchChild* arr = arraySlab->edges + arraySlab->numUsed;
+  arraySlab->numUsed += capacity;
+  arraySlab->numArrays++;
+  return arr;
+}
+
+void SearchNodeAllocator::retireNNOutput(std::shared_ptr<NNOutput>&& nnOutput) {
+  arena->retireNNOutput(std::move(nnOutput));
+}
+
+//-----------------------------------------------------------------------------------------
+
+static std::mutex sharedReclaimerMutex;
+static SearchNodeReclaimer* sharedReclaimer = NULL;
+static int sharedReclaimerNumUsers = 0;
+
+SearchNodeReclaimer* SearchNodeReclaimer::acquire() {
+  std::lock_guard<std::mutex> lock(sharedReclaimerMutex);
+  if(sharedReclaimer == NULL)
+    sharedReclaimer = new SearchNodeReclaimer();
+  sharedReclaimerNumUsers++;
+  return sharedReclaimer;
+}
+void SearchNodeReclaimer::release() {
+  std::lock_guard<std::mutex> lock(sharedReclaimerMutex);
+  sharedReclaimerNumUsers--;
+  if(sharedReclaimerNumUsers == 0) {
+    delete sharedReclaimer;
+    sharedReclaimer = NULL;
+  }
+}
+
+SearchNodeReclaimer::SearchNodeReclaimer()
+  :mutex(),condVar(),entries(),shouldStop(false),thread()
+{}
+
+SearchNodeReclaimer::~SearchNodeReclaimer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    shouldStop = true;
+  }
+  condVar.notify_all();
+  if(thread.joinable())
+    thread.join();
+  //Every user waits for its own arenas before releasing the reclaimer
+  assert(entries.size() == 0);
+}
+
+void SearchNodeReclaimer::deferRelease(SearchNodeArena* arena, Account* account) {
+  Entry entry;
+  entry.arena = arena;
+  entry.account = account;
+  entry.bytes = arena->getStats().bytesReserved;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!thread.joinable())
+      thread = std::thread(&SearchNodeReclaimer::loop, this);
+    entries.push_back(entry);
+    account->bytesPending += entry.bytes;
+    account->numPending += 1;
+  }
+  condVar.notify_all();
+}
+
+//Called and returns with lock held, releases it while actually releasing the arena
+void SearchNodeReclaimer::releaseEntry(std::unique_lock<std::mutex>& lock, const Entry& entry) {
+  lock.unlock();
+  *(entry.account->numNodesReleased) += entry.arena->releaseAll();
+  delete entry.arena;
+  lock.lock();
+  entry.account->bytesPending -= entry.bytes;
+  entry.account->numPending -= 1;
+  //Wake anyone waiting in releaseUntilAtMost
+  condVar.notify_all();
+}
+
+void SearchNodeReclaimer::releaseUntilAtMost(Account* account, int64_t maxBytes) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while(account->bytesPending > maxBytes || (maxBytes <= 0 && account->numPending > 0)) {
+    //Help out with the most recent arena of this account not yet taken by the background thread, if any
+    size_t i = entries.size();
+    while(i > 0 && entries[i-1].account != account)
+      i--;
+    if(i <= 0) {
+      condVar.wait(lock);
+      continue;
+    }
+    Entry entry = entries[i-1];
+    entries.erase(entries.begin() + (i-1));
+    releaseEntry(lock,entry);
+  }
+}
+
+static void lowerCurrentThreadPriority() {
+#if defined(OS_IS_WINDOWS)
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__APPLE__)
+  pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#elif defined(__linux__)
+  //On linux, the nice value is per thread, and 0 means the calling thread
+  setpriority(PRIO_PROCESS, 0, 10);
+#endif
+}
+
+void SearchNodeReclaimer::loop() {
+  lowerCurrentThreadPriority();
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    while(entries.size() <= 0 && !shouldStop)
+      condVar.wait(lock);
+    if(entries.size() <= 0)
+      break;
+    Entry entry = entries.back();
+    entries.pop_back();
+    releaseEntry(lock,entry);
+  }
+}
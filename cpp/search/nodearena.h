@@ -0,0 +1,138 @@
+#ifndef SEARCH_NODEARENA_H_
+#define SEARCH_NODEARENA_H_
+
+#include "../core/global.h"
+#include "../core/multithread.h"
+
+struct SearchNode;
+struct SearchChild;
+struct NNOutput;
+
+struct SearchNodeArenaStats {
+  int64_t numNodes; //Nodes allocated, including ones no longer reachable from the root
+  int64_t numChildrenArrays; //Children arrays allocated, including ones since replaced by a larger array
+  int64_t numSlabs;
+  int64_t bytesReserved;
+
+  SearchNodeArenaStats();
+};
+
+//Owns the memory for all the SearchNodes of a search tree and their children arrays.
+//Memory is handed out in large slabs to SearchNodeAllocators, each owned by a single thread, so that allocating
+//a node only needs to lock when a thread has filled its slab. Nodes and children arrays are never freed individually,
+//instead the whole arena is released at once, which is what allows other threads to keep reading them without locking.
+class SearchNodeArena {
+ public:
+  struct NodeSlab {
+    SearchNode* nodes;
+    int numUsed;
+    int capacity;
+  };
+  struct ArraySlab {
+    SearchChild* edges;
+    int numUsed;
+    int capacity;
+    int numArrays;
+  };
+
+  static const int NODES_PER_SLAB = 512;
+  static const int EDGES_PER_SLAB = 8192;
+
+  SearchNodeArena();
+  ~SearchNodeArena();
+
+  SearchNodeArena(const SearchNodeArena&) = delete;
+  SearchNodeArena& operator=(const SearchNodeArena&) = delete;
+
+  //Threadsafe
+  NodeSlab* newNodeSlab();
+  ArraySlab* newArraySlab(int minCapacity);
+  //Keep alive an nnOutput that was replaced on a node, since other threads may still be reading it
+  void retireNNOutput(std::shared_ptr<NNOutput>&& nnOutput);
+
+  //NOT threadsafe, no allocators may be in use on this arena.
+  //Destroys every node in the arena, returns the number destroyed.
+  int64_t releaseAll();
+  SearchNodeArenaStats getStats() const;
+  //Unique across all arenas ever created in the process, and changed by releaseAll, so that an allocator can tell
+  //whether its slabs are still valid even if a new arena reuses the address of a deleted one
+  uint64_t getGeneration() const;
+
+ private:
+  uint64_t generation;
+  mutable std::mutex mutex;
+  std::vector<NodeSlab*> nodeSlabs;
+  std::vector<ArraySlab*> arraySlabs;
+  std::vector<std::shared_ptr<NNOutput>> retiredNNOutputs;
+};
+
+//Per-thread handle for allocating from a SearchNodeArena. Not threadsafe.
+class SearchNodeAllocator {
+ public:
+  SearchNodeAllocator(SearchNodeArena* arena);
+  ~SearchNodeAllocator();
+
+  SearchNodeAllocator(const SearchNodeAllocator&) = delete;
+  SearchNodeAllocator& operator=(const SearchNodeAllocator&) = delete;
+
+  //Switch to allocating from arena. Keeps the partly used slabs if arena is the one already in use and hasn't been
+  //released since, otherwise starts fresh ones.
+  void reset(SearchNodeArena* arena);
+
+  //Returns uninitialized memory for a single SearchNode, the caller must construct the node into it immediately
+  void* allocNode();
+  //Returns an array of uninitialized edges, the caller must fill in every edge before publishing it
+  SearchChild* allocChildren(int capacity);
+  void retireNNOutput(std::shared_ptr<NNOutput>&& nnOutput);
+
+ private:
+  SearchNodeArena* arena;
+  uint64_t arenaGeneration;
+  SearchNodeArena::NodeSlab* nodeSlab;
+  SearchNodeArena::ArraySlab* arraySlab;
+};
+
+//Releases the arenas of discarded search trees in the background, on a single thread shared by every Search in the
+//process that runs at lowered priority where the OS supports it, so that the threads discarding trees don't wait on it.
+class SearchNodeReclaimer {
+ public:
+  //The arenas handed off by one user of the reclaimer, such as one Search, so that it can wait for its own.
+  struct Account {
+    std::atomic<int64_t>* numNodesReleased; //Incremented by the number of nodes destroyed
+    int64_t bytesPending; //Including any arena being released right now
+    int64_t numPending;
+  };
+
+  //The reclaimer exists while anything has acquired it
+  static SearchNodeReclaimer* acquire();
+  static void release();
+
+  //Hand off an arena to be released and deleted
+  void deferRelease(SearchNodeArena* arena, Account* account);
+  //Release arenas of account on this thread, or wait for the background thread to finish with them,
+  //until at most maxBytes remain pending, or none at all if maxBytes is 0
+  void releaseUntilAtMost(Account* account, int64_t maxBytes);
+
+ private:
+  struct Entry {
+    SearchNodeArena* arena;
+    Account* account;
+    int64_t bytes;
+  };
+
+  std::mutex mutex;
+  std::condition_variable condVar;
+  std::vector<Entry> entries;
+  bool shouldStop;
+  std::thread thread; //Started the first time something is handed off
+
+  SearchNodeReclaimer();
+  ~SearchNodeReclaimer();
+  SearchNodeReclaimer(const SearchNodeReclaimer&) = delete;
+  SearchNodeReclaimer& operator=(const SearchNodeReclaimer&) = delete;
+
+  void releaseEntry(std::unique_lock<std::mutex>& lock, const Entry& entry);
+  void loop();
+};
+
+#endif  // SEARCH_NODEARENA_H_
@@ -0,0 +1,55 @@
+#include "../search/nodetable.h"
+
+using namespace std;
+
+SearchNodeTable::SearchNodeTable(int numShardsPowerOfTwo) {
+  assert(numShardsPowerOfTwo >= 0 && numShardsPowerOfTwo <= 16);
+  uint64_t numShards = ((uint64_t)1) << numShardsPowerOfTwo;
+  shards = new Shard[numShards];
+  shardMask = numShards-1;
+}
+
+SearchNodeTable::~SearchNodeTable() {
+  delete[] shards;
+}
+
+SearchNode* SearchNodeTable::find(Hash128 graphHash) const {
+  Shard& shard = getShard(graphHash);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto iter = shard.nodes.find(graphHash);
+  if(iter == shard.nodes.end())
+    return NULL;
+  return iter->second;
+}
+
+SearchNode* SearchNodeTable::findOrCreate(Hash128 graphHash, const std::function<SearchNode*()>& create, bool& created) {
+  Shard& shard = getShard(graphHash);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto iter = shard.nodes.find(graphHash);
+  if(iter != shard.nodes.end()) {
+    created = false;
+    return iter->second;
+  }
+  SearchNode* node = create();
+  shard.nodes[graphHash] = node;
+  created = true;
+  return node;
+}
+
+void SearchNodeTable::insert(Hash128 graphHash, SearchNode* node) {
+  Shard& shard = getShard(graphHash);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  shard.nodes[graphHash] = node;
+}
+
+void SearchNodeTable::clear() {
+  for(uint64_t i = 0; i<=shardMask; i++)
+    shards[i].nodes.clear();
+}
+
+size_t SearchNodeTable::size() const {
+  size_t total = 0;
+  for(uint64_t i = 0; i<=shardMask; i++)
+    total += shards[i].nodes.size();
+  return total;
+}
@@ -0,0 +1,55 @@
+#ifndef SEARCH_NODETABLE_H_
+#define SEARCH_NODETABLE_H_
+
+#include <functional>
+#include <unordered_map>
+
+#include "../core/global.h"
+#include "../core/hash.h"
+#include "../core/multithread.h"
+
+struct SearchNode;
+
+//Maps graph hashes to the SearchNode for that position, so that positions reached by different move orders
+//can share a single node. Threadsafe, sharded by hash so that concurrent lookups rarely contend.
+//Does not own the nodes, they belong to the search's SearchNodeArena.
+class SearchNodeTable {
+ public:
+  SearchNodeTable(int numShardsPowerOfTwo);
+  ~SearchNodeTable();
+
+  SearchNodeTable(const SearchNodeTable&) = delete;
+  SearchNodeTable& operator=(const SearchNodeTable&) = delete;
+
+  //Returns the node for graphHash, or NULL if there is none
+  SearchNode* find(Hash128 graphHash) const;
+  //Returns the node for graphHash if there is one, otherwise calls create and inserts the node it returns.
+  //Sets created accordingly. create is called while holding the lock for the shard.
+  SearchNode* findOrCreate(Hash128 graphHash, const std::function<SearchNode*()>& create, bool& created);
+  //Insert or overwrite
+  void insert(Hash128 graphHash, SearchNode* node);
+
+  //NOT threadsafe
+  void clear();
+  size_t size() const;
+
+ private:
+  struct HashFn {
+    size_t operator()(const Hash128& hash) const {
+      return (size_t)hash.hash1;
+    }
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Hash128,SearchNode*,HashFn> nodes;
+  };
+
+  Shard* shards;
+  uint64_t shardMask;
+
+  Shard& getShard(Hash128 graphHash) const {
+    return shards[graphHash.hash0 & shardMask];
+  }
+};
+
+#endif  // SEARCH_NODETABLE_H_
@@ -5,6 +5,7 @@
 
 #include "../core/fancymath.h"
 #include "../core/timer.h"
+#include "../search/childselection.h"
 #include "../search/distributiontable.h"
 
 using namespace std;
@@ -51,6 +52,52 @@ double NodeStats::getResultUtilitySum(const SearchParams& searchParams) const {
   );
 }
 
+AtomicNodeStats::AtomicNodeStats()
+  :visits(0),winValueSum(0.0),noResultValueSum(0.0),scoreMeanSum(0.0),scoreMeanSqSum(0.0),utilitySum(0.0),utilitySqSum(0.0),weightSum(0.0),weightSqSum(0.0)
+{}
+AtomicNodeStats::~AtomicNodeStats()
+{}
+
+NodeStats AtomicNodeStats::load() const {
+  NodeStats ret;
+  ret.visits = visits.load(std::memory_order_relaxed);
+  ret.winValueSum = winValueSum.load(std::memory_order_relaxed);
+  ret.noResultValueSum = noResultValueSum.load(std::memory_order_relaxed);
+  ret.scoreMeanSum = scoreMeanSum.load(std::memory_order_relaxed);
+  ret.scoreMeanSqSum = scoreMeanSqSum.load(std::memory_order_relaxed);
+  ret.utilitySum = utilitySum.load(std::memory_order_relaxed);
+  ret.utilitySqSum = utilitySqSum.load(std::memory_order_relaxed);
+  ret.weightSum = weightSum.load(std::memory_order_relaxed);
+  ret.weightSqSum = weightSqSum.load(std::memory_order_relaxed);
+  return ret;
+}
+
+void AtomicNodeStats::store(const NodeStats& stats) {
+  visits.store(stats.visits,std::memory_order_relaxed);
+  winValueSum.store(stats.winValueSum,std::memory_order_relaxed);
+  noResultValueSum.store(stats.noResultValueSum,std::memory_order_relaxed);
+  scoreMeanSum.store(stats.scoreMeanSum,std::memory_order_relaxed);
+  scoreMeanSqSum.store(stats.scoreMeanSqSum,std::memory_order_relaxed);
+  utilitySum.store(stats.utilitySum,std::memory_order_relaxed);
+  utilitySqSum.store(stats.utilitySqSum,std::memory_order_relaxed);
+  weightSum.store(stats.weightSum,std::memory_order_relaxed);
+  weightSqSum.store(stats.weightSqSum,std::memory_order_relaxed);
+}
+
+void AtomicNodeStats::add(const NodeStats& delta) {
+  NodeStats stats = load();
+  stats.visits += delta.visits;
+  stats.winValueSum += delta.winValueSum;
+  stats.noResultValueSum += delta.noResultValueSum;
+  stats.scoreMeanSum += delta.scoreMeanSum;
+  stats.scoreMeanSqSum += delta.scoreMeanSqSum;
+  stats.utilitySum += delta.utilitySum;
+  stats.utilitySqSum += delta.utilitySqSum;
+  stats.weightSum += delta.weightSum;
+  stats.weightSqSum += delta.weightSqSum;
+  store(stats);
+}
+
 static double getResultUtility(double winValue, double noResultValue, const SearchParams& searchParams) {
   return (
     (2.0*winValue - 1.0 + noResultValue) * searchParams.winLossUtilityFactor +
@@ -74,47 +121,90 @@ static double getScoreStdev(double scoreMean, double scoreMeanSq) {
 
 //-----------------------------------------------------------------------------------------
 
-SearchNode::SearchNode(Search& search, SearchThread& thread, Loc moveLoc)
-  :lockIdx(),nextPla(thread.pla),prevMoveLoc(moveLoc),
-   nnOutput(),
+SearchNode::SearchNode(Search& search, SearchThread& thread)
+  :lockIdx(),statsVersion(0),nextPla(thread.pla),
+   graphHash(),graphHashIsPathDependent(false),
+   nnOutput(),nnOutputPtr(NULL),
    children(NULL),numChildren(0),childrenCapacity(0),
    stats(),virtualLosses(0)
 {
   lockIdx = thread.rand.nextUInt(search.mutexPool->getNumMutexes());
 }
 SearchNode::~SearchNode() {
-  if(children != NULL) {
-    for(int i = 0; i<numChildren; i++)
-      delete children[i];
-  }
-  delete[] children;
+  //Children are not freed here, they belong to the SearchNodeArena
 }
 
 SearchNode::SearchNode(SearchNode&& other) noexcept
-:lockIdx(other.lockIdx),
-  nextPla(other.nextPla),prevMoveLoc(other.prevMoveLoc),
-  nnOutput(std::move(other.nnOutput)),
-  stats(other.stats),virtualLosses(other.virtualLosses)
+:lockIdx(other.lockIdx),statsVersion(0),
+  nextPla(other.nextPla),
+  graphHash(other.graphHash),graphHashIsPathDependent(other.graphHashIsPathDependent),
+  nnOutput(std::move(other.nnOutput)),nnOutputPtr(other.nnOutputPtr.load()),
+  children(other.children.load()),numChildren(other.numChildren.load()),childrenCapacity(other.childrenCapacity),
+  stats(),virtualLosses(other.virtualLosses.load())
 {
-  children = other.children;
+  stats.store(other.stats.load());
+  other.nnOutputPtr = NULL;
   other.children = NULL;
-  numChildren = other.numChildren;
-  childrenCapacity = other.childrenCapacity;
 }
 SearchNode& SearchNode::operator=(SearchNode&& other) noexcept {
   lockIdx = other.lockIdx;
+  statsVersion = 0;
   nextPla = other.nextPla;
-  prevMoveLoc = other.prevMoveLoc;
+  graphHash = other.graphHash;
+  graphHashIsPathDependent = other.graphHashIsPathDependent;
   nnOutput = std::move(other.nnOutput);
-  children = other.children;
+  nnOutputPtr = other.nnOutputPtr.load();
+  other.nnOutputPtr = NULL;
+  children = other.children.load();
   other.children = NULL;
-  numChildren = other.numChildren;
+  numChildren = other.numChildren.load();
   childrenCapacity = other.childrenCapacity;
-  stats = other.stats;
-  virtualLosses = other.virtualLosses;
+  stats.store(other.stats.load());
+  virtualLosses = other.virtualLosses.load();
   return *this;
 }
 
+NodeStats SearchNode::getStats() const {
+#ifdef NODE_STATS_LOCKED_READS
+  lockStats();
+  NodeStats ret = stats.load();
+  unlockStats();
+  return ret;
+#else
+  while(true) {
+    uint32_t versionBefore = statsVersion.load(std::memory_order_acquire);
+    if((versionBefore & 1) != 0)
+      continue;
+    NodeStats ret = stats.load();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t versionAfter = statsVersion.load(std::memory_order_relaxed);
+    if(versionBefore == versionAfter)
+      return ret;
+  }
+#endif
+}
+
+void SearchNode::lockStats() const {
+  while(true) {
+    uint32_t version = statsVersion.load(std::memory_order_relaxed);
+    if((version & 1) == 0 && statsVersion.compare_exchange_weak(version,version+1,std::memory_order_acquire,std::memory_order_relaxed))
+      break;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void SearchNode::unlockStats() const {
+  statsVersion.fetch_add(1,std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------------------
+
+SearchPendingLeaf::SearchPendingLeaf()
+  :node(NULL),virtualLossesToSubtract(0),isRoot(false),moves(),path()
+{}
+SearchPendingLeaf::~SearchPendingLeaf()
+{}
+
 //-----------------------------------------------------------------------------------------
 
 static string makeSeed(const Search& search, int threadIdx) {
@@ -149,7 +239,23 @@ SearchThread::SearchThread(int tIdx, const Search& search, Logger* lg)
    utilityBuf(),
    utilitySqBuf(),
    selfUtilityBuf(),
-   visitsBuf()
+   visitsBuf(),
+   selectionPolicyBuf(),
+   selectionVisitsBuf(),
+   selectionUtilityBuf(),
+   selectionVirtualLossBuf(),
+   playoutLeafStats(),
+   moveRecords(),
+   playoutMoves(),
+   koHashTable(),
+   nodeAlloc(search.nodeArena),
+   deferLeafEvals(false),
+   pendingLeaves(),
+   numPendingLeaves(0),
+   leafBoards(),
+   leafHistories(),
+   nnBatchQueries(),
+   nnBatchResults()
 {
   if(logger != NULL)
     logStream = logger->createOStream();
@@ -166,8 +272,33 @@ SearchThread::SearchThread(int tIdx, const Search& search, Logger* lg)
   utilitySqBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
   selfUtilityBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
   visitsBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
-
+  selectionPolicyBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
+  selectionVisitsBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
+  selectionUtilityBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
+  selectionVirtualLossBuf.resize(NNPos::MAX_NN_POLICY_SIZE);
+
+  koHashTable.recompute(history);
+}
+void SearchThread::reset(const Search& search, Logger* lg) {
+  pla = search.rootPla;
+  board = search.rootBoard;
+  history = search.rootHistory;
+  rand.init(makeSeed(search,threadIdx));
+  //The logger might be different or even a new one at the same address, so always recreate the stream
+  if(logStream != NULL)
+    delete logStream;
+  logStream = NULL;
+  logger = lg;
+  if(logger != NULL)
+    logStream = logger->createOStream();
+  moveRecords.clear();
+  playoutMoves.clear();
+  koHashTable.recompute(history);
+  nodeAlloc.reset(search.nodeArena);
+  deferLeafEvals = false;
+  numPendingLeaves = 0;
 }
+
 SearchThread::~SearchThread() {
   if(logStream != NULL)
     delete logStream;
@@ -181,9 +312,13 @@ static const double VALUE_WEIGHT_DEGREES_OF_FREEDOM = 3.0;
 
 static const int64_t MIN_VISITS_FOR_LCB = 3;
 
+static const int64_t MAX_BYTES_PENDING_RECLAIM = (int64_t)1 << 28;
+
 Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   :rootPla(P_BLACK),rootBoard(),rootHistory(),rootPassLegal(true),
    rootSafeArea(NULL),
+   rootExcludedNewMoves(NULL),
+   nonRootExcludedNewMoves(NULL),
    recentScoreCenter(0.0),
    alwaysIncludeOwnerMap(false),
    searchParams(params),numSearchesBegun(0),randSeed(rSeed),
@@ -199,6 +334,8 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   rootKoHashTable = new KoHashTable();
 
   rootSafeArea = new Color[Board::MAX_ARR_SIZE];
+  rootExcludedNewMoves = new bool[NNPos::MAX_NN_POLICY_SIZE];
+  nonRootExcludedNewMoves = new bool[NNPos::MAX_NN_POLICY_SIZE];
 
   valueWeightDistribution = new DistributionTable(
     [](double z) { return FancyMath::tdistpdf(z,VALUE_WEIGHT_DEGREES_OF_FREEDOM); },
@@ -209,6 +346,23 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
   );
 
   rootNode = NULL;
+  nodeArena = new SearchNodeArena();
+  numNodesReleased = 0;
+  numNodesCompacted = 0;
+  nodeTable = new SearchNodeTable(8);
+  numGraphNodesShared = 0;
+  nodeLockWaitNanos = 0;
+  reclaimer = SearchNodeReclaimer::acquire();
+  reclaimAccount.numNodesReleased = &numNodesReleased;
+  reclaimAccount.bytesPending = 0;
+  reclaimAccount.numPending = 0;
+  workerTaskGeneration = 0;
+  numWorkersForTask = 0;
+  numWorkersRunning = 0;
+  workersShouldTerminate = false;
+  workerException = nullptr;
+  numSearchThreadsSpawned = 0;
+  lastSearchStartupSeconds = 0.0;
   mutexPool = new MutexPool(params.mutexPoolSize);
 
   rootHistory.clear(rootBoard,rootPla,Rules(),0);
@@ -216,10 +370,26 @@ Search::Search(SearchParams params, NNEvaluator* nnEval, const string& rSeed)
 }
 
 Search::~Search() {
+  {
+    std::lock_guard<std::mutex> lock(workerMutex);
+    workersShouldTerminate = true;
+  }
+  workerCondVar.notify_all();
+  for(size_t i = 0; i<workerThreads.size(); i++)
+    workerThreads[i].join();
+  for(size_t i = 0; i<searchThreads.size(); i++)
+    delete searchThreads[i];
+
   delete[] rootSafeArea;
+  delete[] rootExcludedNewMoves;
+  delete[] nonRootExcludedNewMoves;
   delete rootKoHashTable;
   delete valueWeightDistribution;
-  delete rootNode;
+  rootNode = NULL;
+  reclaimer->releaseUntilAtMost(&reclaimAccount,0);
+  SearchNodeReclaimer::release();
+  delete nodeTable;
+  delete nodeArena;
   delete mutexPool;
 }
 
@@ -295,8 +465,20 @@ void Search::setNNEval(NNEvaluator* nnEval) {
 }
 
 void Search::clearSearch() {
-  delete rootNode;
   rootNode = NULL;
+  nodeTable->clear();
+  if(nodeArena->getStats().numSlabs > 0) {
+    deferReleaseArena(nodeArena);
+    nodeArena = new SearchNodeArena();
+  }
+}
+
+void Search::finishPendingReclaim() {
+  reclaimer->releaseUntilAtMost(&reclaimAccount,0);
+}
+
+void Search::deferReleaseArena(SearchNodeArena* arena) {
+  reclaimer->deferRelease(arena,&reclaimAccount);
 }
 
 bool Search::isLegal(Loc moveLoc, Player movePla) const {
@@ -329,14 +511,43 @@ bool Search::makeMove(Loc moveLoc, Player movePla) {
   if(rootNode != NULL) {
     bool foundChild = false;
     for(int i = 0; i<rootNode->numChildren; i++) {
-      SearchNode* child = rootNode->children[i];
-      if(child->prevMoveLoc == moveLoc) {
-        //Grab out the node to prevent its deletion along with the root
-        SearchNode* node = new SearchNode(std::move(*child));
-        //Delete the root and replace it with the child
-        delete rootNode;
-        rootNode = node;
-        rootNode->prevMoveLoc = Board::NULL_LOC;
+      SearchNode* child = rootNode->children[i].node;
+      if(rootNode->children[i].moveLoc == moveLoc) {
+        //Copying the subtree of the child takes time proportional to its size, so only do so when the rest of the
+        //tree makes up enough of the arena, per maxNodeArenaSizeFactor. Otherwise keep searching in the same arena, the
+        //rest of the tree staying allocated until later moves leave little enough of the arena in use to be worth
+        //compacting. Counting stops as soon as the subtree is known to be big enough to keep the arena.
+        nodeTable->clear();
+        int64_t numArenaNodes = nodeArena->getStats().numNodes;
+        int64_t minNodesToKeepArena = (int64_t)ceil(numArenaNodes / searchParams.maxNodeArenaSizeFactor);
+        int64_t numSubtreeNodes;
+        if(searchParams.useGraphSearch) {
+          std::unordered_set<const SearchNode*> seen;
+          seen.insert(child);
+          numSubtreeNodes = countSubtreeNodesUpTo(*child,minNodesToKeepArena,&seen);
+        }
+        else
+          numSubtreeNodes = countSubtreeNodesUpTo(*child,minNodesToKeepArena,NULL);
+        if(numSubtreeNodes < minNodesToKeepArena) {
+          //Move the subtree of the child into a fresh arena and release everything else all at once
+          SearchNodeArena* newArena = new SearchNodeArena();
+          {
+            SearchNodeAllocator alloc(newArena);
+            if(searchParams.useGraphSearch) {
+              std::unordered_map<const SearchNode*,SearchNode*> copies;
+              rootNode = compactSubtree(*child,alloc,&copies);
+            }
+            else
+              rootNode = compactSubtree(*child,alloc,NULL);
+          }
+          deferReleaseArena(nodeArena);
+          nodeArena = newArena;
+        }
+        else {
+          //Nodes reached from the old root by a different history are not safe to share from the new one, so without
+          //a compaction to add back the ones of the subtree, none are found by transpositions, which only costs sharing.
+          rootNode = child;
+        }
         foundChild = true;
         break;
       }
@@ -348,10 +559,84 @@ bool Search::makeMove(Loc moveLoc, Player movePla) {
   rootHistory.makeBoardMoveAssumeLegal(rootBoard,moveLoc,rootPla,rootKoHashTable);
   rootPla = getOpp(rootPla);
   rootKoHashTable->recompute(rootHistory);
+  if(rootNode != NULL)
+    setRootGraphHash();
   return true;
 }
 
-static const double POLICY_ILLEGAL_SELECTION_VALUE = -1e50;
+int64_t Search::countSubtreeNodesUpTo(const SearchNode& node, int64_t maxCount, std::unordered_set<const SearchNode*>* seen) const {
+  int64_t count = 1;
+  for(int i = 0; i<node.numChildren && count < maxCount; i++) {
+    const SearchNode* child = node.children[i].node;
+    if(seen != NULL && !seen->insert(child).second)
+      continue;
+    count += countSubtreeNodesUpTo(*child,maxCount-count,seen);
+  }
+  return count;
+}
+
+SearchNode* Search::compactSubtree(SearchNode& node, SearchNodeAllocator& alloc, std::unordered_map<const SearchNode*,SearchNode*>* copies) {
+  const SearchChild* oldChildren = node.children;
+  SearchNode* copy = new (alloc.allocNode()) SearchNode(std::move(node));
+  numNodesCompacted++;
+  if(copies != NULL)
+    (*copies)[&node] = copy;
+  copy->children = NULL;
+  copy->childrenCapacity = 0;
+  if(copy->numChildren > 0) {
+    copy->children = alloc.allocChildren(copy->numChildren);
+    copy->childrenCapacity = copy->numChildren;
+    for(int i = 0; i<copy->numChildren; i++) {
+      SearchChild& edge = copy->children[i];
+      edge.moveLoc = oldChildren[i].moveLoc;
+      edge.edgeVisits.store(oldChildren[i].edgeVisits.load(std::memory_order_relaxed),std::memory_order_relaxed);
+      //A node shared with another parent may already have been moved
+      if(copies != NULL) {
+        auto iter = copies->find(oldChildren[i].node);
+        if(iter != copies->end()) {
+          edge.node = iter->second;
+          continue;
+        }
+      }
+      edge.node = compactSubtree(*(oldChildren[i].node),alloc,copies);
+      if(copies != NULL)
+        nodeTable->insert(edge.node->graphHash,edge.node);
+    }
+  }
+  return copy;
+}
+
+//The root is never in the nodeTable, since nothing below it can repeat its position with the same history.
+//Its graph hash only serves as the starting point for the hashes of its children.
+void Search::setRootGraphHash() {
+  assert(rootNode != NULL);
+  rootNode->graphHash = NNInputs::getHashV5(rootBoard,rootHistory,rootPla,searchParams.drawEquivalentWinsForWhite);
+  rootNode->graphHashIsPathDependent = false;
+}
+
+//Until there has been a capture or a pass since the root, every move strictly adds a stone, so no position can repeat
+//and the legal moves below it can't depend on the order of the moves that reached it. Such positions are keyed by
+//the position and ko situation as in NNInputs::getHashV5, the move that reached them being recorded on the edge.
+//After that, to stay conservative about superko and other history-dependent rules, the parent's hash is chained in,
+//so the node is only ever reached through that same parent.
+Hash128 Search::getChildGraphHash(const SearchNode& parent, const SearchThread& thread, Loc moveLoc, bool moveCaptured, bool& isPathDependent) const {
+  Hash128 hash = NNInputs::getHashV5(thread.board,thread.history,thread.pla,searchParams.drawEquivalentWinsForWhite);
+
+  isPathDependent = parent.graphHashIsPathDependent || moveCaptured || moveLoc == Board::PASS_LOC || thread.history.encorePhase > 0;
+  if(isPathDependent) {
+    uint64_t chain0 = Hash::murmurMix(parent.graphHash.hash0 ^ Hash::basicLCong(parent.graphHash.hash1));
+    uint64_t chain1 = Hash::murmurMix(parent.graphHash.hash1 + chain0);
+    hash.hash0 ^= chain0;
+    hash.hash1 ^= chain1;
+  }
+  return hash;
+}
+
+SearchNodeArenaStats Search::getNodeArenaStats() const {
+  return nodeArena->getStats();
+}
+
+static const double POLICY_ILLEGAL_SELECTION_VALUE = ChildSelection::ILLEGAL_SELECTION_VALUE;
 
 bool Search::getPlaySelectionValues(
   vector<Loc>& locs, vector<double>& playSelectionValues, double scaleMaxToAtLeast
@@ -397,12 +682,11 @@ bool Search::getPlaySelectionValuesAlreadyLocked(
 
   //Store up basic visit counts
   for(int i = 0; i<numChildren; i++) {
-    SearchNode* child = node.children[i];
-    Loc moveLoc = child->prevMoveLoc;
+    const SearchChild& edge = node.children[i];
+    Loc moveLoc = edge.moveLoc;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    NodeStats childStats = edge.node->getStats();
+    int64_t childVisits = getEdgeVisits(edge,childStats.visits);
 
     locs.push_back(moveLoc);
     playSelectionValues.push_back(childVisits);
@@ -423,7 +707,7 @@ bool Search::getPlaySelectionValuesAlreadyLocked(
   //Possibly reduce visits on children that we spend too many visits on in retrospect
   if(&node == rootNode && searchParams.rootDesiredPerChildVisitsCoeff > 0 && numChildren > 0) {
 
-    const SearchNode* bestChild = node.children[mostVisitedIdx];
+    const SearchChild& bestChild = node.children[mostVisitedIdx];
     double fpuValue = -10.0; //dummy, not actually used since these childs all should actually have visits
     bool isRootDuringSearch = false;
     double bestChildExploreSelectionValue = getExploreSelectionValue(node,bestChild,totalChildVisits,fpuValue,isRootDuringSearch);
@@ -554,13 +838,12 @@ bool Search::getNodeValues(const SearchNode& node, ReportedSearchValues& values)
   if(nnOutput == nullptr)
     return false;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  double winValueSum = node.stats.winValueSum;
-  double noResultValueSum = node.stats.noResultValueSum;
-  double scoreMeanSum = node.stats.scoreMeanSum;
-  double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-  double weightSum = node.stats.weightSum;
-  node.statsLock.clear(std::memory_order_release);
+  NodeStats nodeStats = node.getStats();
+  double winValueSum = nodeStats.winValueSum;
+  double noResultValueSum = nodeStats.noResultValueSum;
+  double scoreMeanSum = nodeStats.scoreMeanSum;
+  double scoreMeanSqSum = nodeStats.scoreMeanSqSum;
+  double weightSum = nodeStats.weightSum;
 
   assert(weightSum > 0.0);
 
@@ -626,10 +909,9 @@ double Search::getRootUtility() const {
   assert(rootNode != NULL);
   const SearchNode& node = *rootNode;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  double utilitySum = node.stats.utilitySum;
-  double weightSum = node.stats.weightSum;
-  node.statsLock.clear(std::memory_order_release);
+  NodeStats nodeStats = node.getStats();
+  double utilitySum = nodeStats.utilitySum;
+  double weightSum = nodeStats.weightSum;
 
   assert(weightSum > 0.0);
   return utilitySum / weightSum;
@@ -639,9 +921,8 @@ int64_t Search::getRootVisits() const {
   assert(rootNode != NULL);
   const SearchNode& node = *rootNode;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  int64_t numVisits = node.stats.visits;
-  node.statsLock.clear(std::memory_order_release);
+  NodeStats nodeStats = node.getStats();
+  int64_t numVisits = nodeStats.visits;
 
   return numVisits;
 }
@@ -787,8 +1068,12 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
       (*recordUtilities)[i] = NAN;
   }
 
+  int numThreads = std::max(searchParams.numThreads,1);
+  prepareSearchThreads(numThreads,logger);
+
   auto searchLoop = [this,&timer,&numPlayoutsShared,numNonPlayoutVisits,&logger,&shouldStopNow,&recordUtilities,maxVisits,maxPlayouts,maxTime](int threadIdx) {
-    SearchThread* stbuf = new SearchThread(threadIdx,*this,&logger);
+    SearchThread* stbuf = searchThreads[threadIdx];
+    threadStartSeconds[threadIdx] = timer.getSeconds();
 
     int64_t numPlayouts = numPlayoutsShared.load(std::memory_order_relaxed);
     try {
@@ -803,16 +1088,24 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
           break;
         }
 
-        runSinglePlayout(*stbuf);
+        int64_t numNewPlayouts = 1;
+        if(searchParams.numLeavesPerThread <= 1)
+          runSinglePlayout(*stbuf);
+        else {
+          //Don't overshoot the caps by more than necessary
+          int64_t numToRun = std::min((int64_t)searchParams.numLeavesPerThread, maxPlayouts - numPlayouts);
+          numToRun = std::min(numToRun, maxVisits - numPlayouts - numNonPlayoutVisits);
+          numNewPlayouts = runLeafBatch(*stbuf, (int)std::max(numToRun,(int64_t)1));
+        }
 
-        numPlayouts = numPlayoutsShared.fetch_add((int64_t)1, std::memory_order_relaxed);
-        numPlayouts += 1;
+        int64_t numPlayoutsBefore = numPlayoutsShared.fetch_add(numNewPlayouts, std::memory_order_relaxed);
+        numPlayouts = numPlayoutsBefore + numNewPlayouts;
 
         //Test and see if the altered training target has an effect in a real training run.
         if(searchParams.numThreads == 1 && recordUtilities != NULL) {
-          if(numPlayouts <= recordUtilities->size()) {
-            assert(numPlayouts >= 1);
-            (*recordUtilities)[numPlayouts-1] = getRootUtility();
+          for(int64_t n = numPlayoutsBefore+1; n <= numPlayouts; n++) {
+            if(n <= recordUtilities->size())
+              (*recordUtilities)[n-1] = getRootUtility();
           }
         }
 
@@ -820,33 +1113,110 @@ void Search::runWholeSearch(Logger& logger, std::atomic<bool>& shouldStopNow, ve
     }
     catch(const exception& e) {
       logger.write(string("ERROR: Search thread failed: ") + e.what());
-      delete stbuf;
+      shouldStopNow.store(true,std::memory_order_relaxed);
       throw;
     }
     catch(const string& e) {
       logger.write("ERROR: Search thread failed: " + e);
-      delete stbuf;
+      shouldStopNow.store(true,std::memory_order_relaxed);
       throw;
     }
     catch(...) {
       logger.write("ERROR: Search thread failed with unexpected throw");
-      delete stbuf;
+      shouldStopNow.store(true,std::memory_order_relaxed);
       throw;
     }
-
-    delete stbuf;
   };
 
-  if(searchParams.numThreads <= 1)
+  if(numThreads <= 1)
     searchLoop(0);
   else {
-    std::thread* threads = new std::thread[searchParams.numThreads-1];
-    for(int i = 0; i<searchParams.numThreads-1; i++)
-      threads[i] = std::thread(searchLoop,i+1);
-    searchLoop(0);
-    for(int i = 0; i<searchParams.numThreads-1; i++)
-      threads[i].join();
-    delete[] threads;
+    //Wake up the parked workers for threadIdx 1 and up, and participate as threadIdx 0
+    {
+      std::lock_guard<std::mutex> lock(workerMutex);
+      workerTask = searchLoop;
+      numWorkersForTask = numThreads-1;
+      numWorkersRunning = numThreads-1;
+      workerException = nullptr;
+      workerTaskGeneration++;
+    }
+    workerCondVar.notify_all();
+
+    std::exception_ptr mainException = nullptr;
+    try {
+      searchLoop(0);
+    }
+    catch(...) {
+      mainException = std::current_exception();
+    }
+
+    //The search loop refers to locals of this function, so wait for all workers even if we failed
+    std::exception_ptr exception;
+    {
+      std::unique_lock<std::mutex> lock(workerMutex);
+      while(numWorkersRunning > 0)
+        workerDoneCondVar.wait(lock);
+      workerTask = nullptr;
+      exception = mainException != nullptr ? mainException : workerException;
+      workerException = nullptr;
+    }
+    if(exception != nullptr)
+      std::rethrow_exception(exception);
+  }
+
+  lastSearchStartupSeconds = 0.0;
+  for(int i = 0; i<numThreads; i++)
+    lastSearchStartupSeconds = std::max(lastSearchStartupSeconds,threadStartSeconds[i]);
+}
+
+void Search::prepareSearchThreads(int numThreads, Logger& logger) {
+  while(searchThreads.size() < (size_t)numThreads)
+    searchThreads.push_back(new SearchThread((int)searchThreads.size(),*this,&logger));
+  for(int i = 0; i<numThreads; i++)
+    searchThreads[i]->reset(*this,&logger);
+  threadStartSeconds.assign(numThreads,0.0);
+
+  if(workerThreads.size() < (size_t)(numThreads-1)) {
+    int64_t generation;
+    {
+      std::lock_guard<std::mutex> lock(workerMutex);
+      generation = workerTaskGeneration;
+    }
+    while(workerThreads.size() < (size_t)(numThreads-1)) {
+      int threadIdx = (int)workerThreads.size() + 1;
+      workerThreads.push_back(std::thread(&Search::workerLoop, this, threadIdx, generation));
+      numSearchThreadsSpawned++;
+    }
+  }
+}
+
+void Search::workerLoop(int threadIdx, int64_t seenGeneration) {
+  std::unique_lock<std::mutex> lock(workerMutex);
+  while(true) {
+    while(!workersShouldTerminate && workerTaskGeneration == seenGeneration)
+      workerCondVar.wait(lock);
+    if(workersShouldTerminate)
+      return;
+    seenGeneration = workerTaskGeneration;
+    //Searches using fewer threads than the pool has leave the extra workers parked
+    if(threadIdx > numWorkersForTask)
+      continue;
+
+    lock.unlock();
+    std::exception_ptr exception = nullptr;
+    try {
+      workerTask(threadIdx);
+    }
+    catch(...) {
+      exception = std::current_exception();
+    }
+    lock.lock();
+
+    if(exception != nullptr && workerException == nullptr)
+      workerException = exception;
+    numWorkersRunning--;
+    if(numWorkersRunning <= 0)
+      workerDoneCondVar.notify_all();
   }
 }
 
@@ -857,6 +1227,9 @@ void Search::beginSearch(Logger& logger) {
                       " nnYLen = " + Global::intToString(nnYLen) + " but was asked to search board with larger x or y size");
   rootBoard.checkConsistency();
 
+  //If the reclaimer is falling too far behind, help it out so that memory stays bounded
+  reclaimer->releaseUntilAtMost(&reclaimAccount,MAX_BYTES_PENDING_RECLAIM);
+
   numSearchesBegun++;
   computeRootValues(logger);
 
@@ -869,7 +1242,8 @@ void Search::beginSearch(Logger& logger) {
   SearchThread dummyThread(-1, *this, NULL);
 
   if(rootNode == NULL) {
-    rootNode = new SearchNode(*this, dummyThread, Board::NULL_LOC);
+    rootNode = new (dummyThread.nodeAlloc.allocNode()) SearchNode(*this, dummyThread);
+    setRootGraphHash();
   }
   else {
     //If the root node has any existing children, then prune things down if there are moves that should not be allowed at the root.
@@ -881,12 +1255,13 @@ void Search::beginSearch(Logger& logger) {
       //Perform the filtering
       int numGoodChildren = 0;
       for(int i = 0; i<numChildren; i++) {
-        SearchNode* child = node.children[i];
-        node.children[i] = NULL;
-        if(isAllowedRootMove(child->prevMoveLoc))
-          node.children[numGoodChildren++] = child;
-        else {
-          delete child;
+        SearchChild& edge = node.children[i];
+        //Filtered children are simply dropped, their memory is reclaimed along with the rest of the arena
+        if(isAllowedRootMove(edge.moveLoc)) {
+          SearchChild& goodEdge = node.children[numGoodChildren++];
+          goodEdge.node = edge.node;
+          goodEdge.moveLoc = edge.moveLoc;
+          goodEdge.edgeVisits.store(edge.edgeVisits.load(std::memory_order_relaxed),std::memory_order_relaxed);
         }
       }
       bool anyFiltered = numChildren != numGoodChildren;
@@ -897,19 +1272,18 @@ void Search::beginSearch(Logger& logger) {
         //Fix up the number of visits of the root node after doing this filtering
         int64_t newNumVisits = 0;
         for(int i = 0; i<numChildren; i++) {
-          const SearchNode* child = node.children[i];
-          while(child->statsLock.test_and_set(std::memory_order_acquire));
-          int64_t childVisits = child->stats.visits;
-          child->statsLock.clear(std::memory_order_release);
+          const SearchChild& edge = node.children[i];
+          NodeStats childStats = edge.node->getStats();
+          int64_t childVisits = getEdgeVisits(edge,childStats.visits);
           newNumVisits += childVisits;
         }
         //For the node's own visit itself
         newNumVisits += 1;
 
         //Set the visits in place
-        while(node.statsLock.test_and_set(std::memory_order_acquire));
-        node.stats.visits = newNumVisits;
-        node.statsLock.clear(std::memory_order_release);
+        node.lockStats();
+        node.stats.visits.store(newNumVisits,std::memory_order_relaxed);
+        node.unlockStats();
 
         //Update all other stats
         recomputeNodeStats(node, dummyThread, 0, 0, true);
@@ -918,7 +1292,12 @@ void Search::beginSearch(Logger& logger) {
 
     //Recursively update all stats in the tree if we have dynamic score values
     if(searchParams.dynamicScoreUtilityFactor != 0) {
-      recursivelyRecomputeStats(node,dummyThread,true);
+      if(searchParams.useGraphSearch) {
+        std::unordered_set<const SearchNode*> visited;
+        recursivelyRecomputeStats(node,dummyThread,true,&visited);
+      }
+      else
+        recursivelyRecomputeStats(node,dummyThread,true,NULL);
     }
 
   }
@@ -941,7 +1320,10 @@ double Search::getNormToTApproxForLCB(int64_t numVisits) const {
   return normToTApproxTable[idx];
 }
 
-void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot) {
+void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot, std::unordered_set<const SearchNode*>* visited) {
+  if(visited != NULL && !visited->insert(&node).second)
+    return;
+
   //First, recompute all children.
   vector<SearchNode*> children;
   children.reserve(rootBoard.x_size * rootBoard.y_size + 1);
@@ -953,13 +1335,13 @@ void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, b
     lock_guard<std::mutex> lock(mutex);
     numChildren = node.numChildren;
     for(int i = 0; i<numChildren; i++)
-      children.push_back(node.children[i]);
+      children.push_back(node.children[i].node);
 
     noNNOutput = node.nnOutput == nullptr;
   }
 
   for(int i = 0; i<numChildren; i++) {
-    recursivelyRecomputeStats(*(children[i]),thread,false);
+    recursivelyRecomputeStats(*(children[i]),thread,false,visited);
   }
 
   //If this node has no nnOutput, then it must also have no children, because it's
@@ -969,13 +1351,12 @@ void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, b
 
   //If the node has no children, then just update its utility directly
   if(numChildren <= 0) {
-    while(node.statsLock.test_and_set(std::memory_order_acquire));
-    double resultUtilitySum = node.stats.getResultUtilitySum(searchParams);
-    double scoreMeanSum = node.stats.scoreMeanSum;
-    double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-    double weightSum = node.stats.weightSum;
-    int64_t numVisits = node.stats.visits;
-    node.statsLock.clear(std::memory_order_release);
+    NodeStats nodeStats = node.getStats();
+    double resultUtilitySum = nodeStats.getResultUtilitySum(searchParams);
+    double scoreMeanSum = nodeStats.scoreMeanSum;
+    double scoreMeanSqSum = nodeStats.scoreMeanSqSum;
+    double weightSum = nodeStats.weightSum;
+    int64_t numVisits = nodeStats.visits;
 
     //It's possible that this node has 0 weight in the case where it's the root node
     //and has 0 visits because we began a search and then stopped it before any playouts happened.
@@ -991,10 +1372,10 @@ void Search::recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, b
       double newUtilitySum = newUtility * weightSum;
       double newUtilitySqSum = newUtility * newUtility * weightSum;
 
-      while(node.statsLock.test_and_set(std::memory_order_acquire));
-      node.stats.utilitySum = newUtilitySum;
-      node.stats.utilitySqSum = newUtilitySqSum;
-      node.statsLock.clear(std::memory_order_release);
+      node.lockStats();
+      node.stats.utilitySum.store(newUtilitySum,std::memory_order_relaxed);
+      node.stats.utilitySqSum.store(newUtilitySqSum,std::memory_order_relaxed);
+      node.unlockStats();
     }
   }
   else {
@@ -1018,6 +1399,12 @@ void Search::computeRootValues(Logger& logger) {
     isMultiStoneSuicideLegal
   );
 
+  for(int movePos = 0; movePos<NNPos::MAX_NN_POLICY_SIZE; movePos++) {
+    Loc moveLoc = movePos < policySize ? NNPos::posToLoc(movePos,rootBoard.x_size,rootBoard.y_size,nnXLen,nnYLen) : Board::NULL_LOC;
+    nonRootExcludedNewMoves[movePos] = moveLoc == Board::NULL_LOC;
+    rootExcludedNewMoves[movePos] = moveLoc == Board::NULL_LOC || !isAllowedRootMove(moveLoc);
+  }
+
   //Grab a neural net evaluation for the current position and use that as the center
   Board board = rootBoard;
   const BoardHistory& hist = rootHistory;
@@ -1041,9 +1428,8 @@ void Search::computeRootValues(Logger& logger) {
 int64_t Search::numRootVisits() const {
   if(rootNode == NULL)
     return 0;
-  while(rootNode->statsLock.test_and_set(std::memory_order_acquire));
-  int64_t n = rootNode->stats.visits;
-  rootNode->statsLock.clear(std::memory_order_release);
+  NodeStats rootStats = rootNode->getStats();
+  int64_t n = rootStats.visits;
   return n;
 }
 
@@ -1084,22 +1470,20 @@ void Search::addDirichletNoise(const SearchParams& searchParams, Rand& rand, int
 }
 
 
-//Assumes node is locked
-void Search::maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool isRoot) const {
+void Search::maybeAddPolicyNoise(SearchThread& thread, shared_ptr<NNOutput>& nnOutput, bool isRoot) const {
   if(!isRoot)
     return;
   if(!searchParams.rootNoiseEnabled && searchParams.rootPolicyTemperature == 1.0)
     return;
 
   //Copy nnOutput as we're about to modify its policy to add noise or temperature
-  shared_ptr<NNOutput> newNNOutput = std::make_shared<NNOutput>(*(node.nnOutput));
-  //Replace the old pointer
-  node.nnOutput = newNNOutput;
+  shared_ptr<NNOutput> newNNOutput = std::make_shared<NNOutput>(*nnOutput);
+  float* policyProbs = newNNOutput->policyProbs;
 
   if(searchParams.rootPolicyTemperature != 1.0) {
     double maxValue = 0.0;
     for(int i = 0; i<policySize; i++) {
-      double prob = node.nnOutput->policyProbs[i];
+      double prob = policyProbs[i];
       if(prob > maxValue)
         maxValue = prob;
     }
@@ -1110,25 +1494,36 @@ void Search::maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool is
     double sum = 0.0;
 
     for(int i = 0; i<policySize; i++) {
-      if(node.nnOutput->policyProbs[i] > 0) {
+      if(policyProbs[i] > 0) {
         //Numerically stable way to raise to power and normalize
-        double p = exp((log((double)node.nnOutput->policyProbs[i]) - logMaxValue) * invTemp);
-        node.nnOutput->policyProbs[i] = p;
+        double p = exp((log((double)policyProbs[i]) - logMaxValue) * invTemp);
+        policyProbs[i] = p;
         sum += p;
       }
     }
     assert(sum > 0.0);
     for(int i = 0; i<policySize; i++) {
-      if(node.nnOutput->policyProbs[i] >= 0) {
-        node.nnOutput->policyProbs[i] = (double)node.nnOutput->policyProbs[i] / sum;
+      if(policyProbs[i] >= 0) {
+        policyProbs[i] = (double)policyProbs[i] / sum;
       }
     }
   }
 
   if(searchParams.rootNoiseEnabled) {
-    addDirichletNoise(searchParams, thread.rand, policySize, node.nnOutput->policyProbs);
+    addDirichletNoise(searchParams, thread.rand, policySize, policyProbs);
   }
 
+  //Replace the old pointer
+  nnOutput = std::move(newNNOutput);
+}
+
+//Assumes node is locked. Other threads may still be reading the old output without the lock,
+//so it's kept alive by the arena rather than freed here.
+void Search::setNodeNNOutput(SearchThread& thread, SearchNode& node, shared_ptr<NNOutput>&& newNNOutput) const {
+  node.nnOutputPtr.store(newNNOutput.get(),std::memory_order_release);
+  if(node.nnOutput != nullptr)
+    thread.nodeAlloc.retireNNOutput(std::move(node.nnOutput));
+  node.nnOutput = std::move(newNNOutput);
 }
 
 bool Search::isAllowedRootMove(Loc moveLoc) const {
@@ -1237,15 +1632,14 @@ void Search::getValueChildWeights(
 }
 
 //Parent must be locked
-void Search::getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchNode* child, double& lcbBuf, double& radiusBuf) const {
-  while(child->statsLock.test_and_set(std::memory_order_acquire));
-  double utilitySum = child->stats.utilitySum;
-  double utilitySqSum = child->stats.utilitySqSum;
-  double scoreMeanSum = child->stats.scoreMeanSum;
-  double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-  double weightSum = child->stats.weightSum;
-  double weightSqSum = child->stats.weightSqSum;
-  child->statsLock.clear(std::memory_order_release);
+void Search::getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchChild& edge, double& lcbBuf, double& radiusBuf) const {
+  NodeStats childStats = edge.node->getStats();
+  double utilitySum = childStats.utilitySum;
+  double utilitySqSum = childStats.utilitySqSum;
+  double scoreMeanSum = childStats.scoreMeanSum;
+  double scoreMeanSqSum = childStats.scoreMeanSqSum;
+  double weightSum = childStats.weightSum;
+  double weightSqSum = childStats.weightSqSum;
 
   radiusBuf = 2.0 * (searchParams.winLossUtilityFactor + searchParams.staticScoreUtilityFactor + searchParams.dynamicScoreUtilityFactor);
   lcbBuf = -radiusBuf;
@@ -1259,7 +1653,7 @@ void Search::getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchNo
     return;
 
   double utilityNoBonus = utilitySum / weightSum;
-  double endingScoreBonus = getEndingWhiteScoreBonus(parent,child);
+  double endingScoreBonus = getEndingWhiteScoreBonus(parent,edge.moveLoc);
   double utilityDiff = getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
   double utilityWithBonus = utilityNoBonus + utilityDiff;
   double selfUtility = parent.nextPla == P_WHITE ? utilityWithBonus : -utilityWithBonus;
@@ -1291,19 +1685,19 @@ double Search::getExploreSelectionValue(
   return exploreComponent + valueComponent;
 }
 
-//Parent must be locked
-double Search::getEndingWhiteScoreBonus(const SearchNode& parent, const SearchNode* child) const {
-  if(&parent != rootNode || child->prevMoveLoc == Board::NULL_LOC)
+//Parent does not need to be locked
+double Search::getEndingWhiteScoreBonus(const SearchNode& parent, Loc moveLoc) const {
+  if(&parent != rootNode || moveLoc == Board::NULL_LOC)
     return 0.0;
-  if(parent.nnOutput == nullptr || parent.nnOutput->whiteOwnerMap == NULL)
+  const NNOutput* nnOutput = parent.getNNOutput();
+  if(nnOutput == NULL || nnOutput->whiteOwnerMap == NULL)
     return 0.0;
 
   bool isAreaIsh = rootHistory.rules.scoringRule == Rules::SCORING_AREA
     || (rootHistory.rules.scoringRule == Rules::SCORING_TERRITORY && rootHistory.encorePhase >= 2);
-  assert(parent.nnOutput->nnXLen == nnXLen);
-  assert(parent.nnOutput->nnYLen == nnYLen);
-  float* whiteOwnerMap = parent.nnOutput->whiteOwnerMap;
-  Loc moveLoc = child->prevMoveLoc;
+  assert(nnOutput->nnXLen == nnXLen);
+  assert(nnOutput->nnYLen == nnYLen);
+  float* whiteOwnerMap = nnOutput->whiteOwnerMap;
 
   //Extra points from the perspective of the root player
   double extraRootPoints = 0.0;
@@ -1360,32 +1754,38 @@ int Search::getPos(Loc moveLoc) const {
   return NNPos::locToPos(moveLoc,rootBoard.x_size,nnXLen,nnYLen);
 }
 
-//Parent must be locked
-double Search::getExploreSelectionValue(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const {
-  Loc moveLoc = child->prevMoveLoc;
-  int movePos = getPos(moveLoc);
-  float nnPolicyProb = parent.nnOutput->policyProbs[movePos];
-
-  while(child->statsLock.test_and_set(std::memory_order_acquire));
-  int64_t childVisits = child->stats.visits;
-  double utilitySum = child->stats.utilitySum;
-  double scoreMeanSum = child->stats.scoreMeanSum;
-  double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-  double weightSum = child->stats.weightSum;
-  int32_t childVirtualLosses = child->virtualLosses;
-  child->statsLock.clear(std::memory_order_release);
+int64_t Search::getEdgeVisits(const SearchChild& edge, int64_t childVisits) const {
+  if(searchParams.useGraphSearch)
+    return edge.edgeVisits.load(std::memory_order_relaxed);
+  return childVisits;
+}
+
+//Parent does not need to be locked
+double Search::getExploreSelectionValue(const SearchNode& parent, const SearchChild& edge, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const {
+  const SearchNode* child = edge.node;
+  int movePos = getPos(edge.moveLoc);
+  float nnPolicyProb = parent.getNNOutput()->policyProbs[movePos];
+
+  NodeStats childStats = child->getStats();
+  int64_t childVisits = getEdgeVisits(edge,childStats.visits);
+  double utilitySum = childStats.utilitySum;
+  double scoreMeanSum = childStats.scoreMeanSum;
+  double scoreMeanSqSum = childStats.scoreMeanSqSum;
+  double weightSum = childStats.weightSum;
+  int32_t childVirtualLosses = child->virtualLosses.load(std::memory_order_relaxed);
 
   //It's possible that childVisits is actually 0 here with multithreading because we're visiting this node while a child has
-  //been expanded but its thread not yet finished its first visit
+  //been expanded but its thread not yet finished its first visit.
+  //With graph search the child may have no visits through this edge yet but already have a value from other parents.
   double childUtility;
-  if(childVisits <= 0)
+  if(childStats.visits <= 0)
     childUtility = fpuValue;
   else {
     assert(weightSum > 0.0);
     childUtility = utilitySum / weightSum;
 
     //Tiny adjustment for passing
-    double endingScoreBonus = getEndingWhiteScoreBonus(parent,child);
+    double endingScoreBonus = getEndingWhiteScoreBonus(parent,edge.moveLoc);
     if(endingScoreBonus != 0)
       childUtility += getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
   }
@@ -1413,35 +1813,33 @@ double Search::getExploreSelectionValue(const SearchNode& parent, const SearchNo
 
   return getExploreSelectionValue(nnPolicyProb,totalChildVisits,childVisits,childUtility,parent.nextPla);
 }
-//Parent must be locked
+//Parent does not need to be locked
 double Search::getNewExploreSelectionValue(const SearchNode& parent, int movePos, int64_t totalChildVisits, double fpuValue) const {
-  float nnPolicyProb = parent.nnOutput->policyProbs[movePos];
+  float nnPolicyProb = parent.getNNOutput()->policyProbs[movePos];
   int64_t childVisits = 0;
   double childUtility = fpuValue;
   return getExploreSelectionValue(nnPolicyProb,totalChildVisits,childVisits,childUtility,parent.nextPla);
 }
 
 //Parent must be locked
-int64_t Search::getReducedPlaySelectionVisits(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double bestChildExploreSelectionValue) const {
+int64_t Search::getReducedPlaySelectionVisits(const SearchNode& parent, const SearchChild& edge, int64_t totalChildVisits, double bestChildExploreSelectionValue) const {
   assert(&parent == rootNode);
-  Loc moveLoc = child->prevMoveLoc;
-  int movePos = getPos(moveLoc);
-  float nnPolicyProb = parent.nnOutput->policyProbs[movePos];
-
-  while(child->statsLock.test_and_set(std::memory_order_acquire));
-  int64_t childVisits = child->stats.visits;
-  double utilitySum = child->stats.utilitySum;
-  double scoreMeanSum = child->stats.scoreMeanSum;
-  double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-  double weightSum = child->stats.weightSum;
-  child->statsLock.clear(std::memory_order_release);
+  int movePos = getPos(edge.moveLoc);
+  float nnPolicyProb = parent.getNNOutput()->policyProbs[movePos];
+
+  NodeStats childStats = edge.node->getStats();
+  int64_t childVisits = getEdgeVisits(edge,childStats.visits);
+  double utilitySum = childStats.utilitySum;
+  double scoreMeanSum = childStats.scoreMeanSum;
+  double scoreMeanSqSum = childStats.scoreMeanSqSum;
+  double weightSum = childStats.weightSum;
 
   //getReducedPlaySelectionValue only happens after the search, so there should be no multithreading shenanigans that give us a 0-visit child.
-  assert(childVisits > 0);
+  assert(childStats.visits > 0);
   assert(weightSum > 0.0);
 
   //Tiny adjustment for passing
-  double endingScoreBonus = getEndingWhiteScoreBonus(parent,child);
+  double endingScoreBonus = getEndingWhiteScoreBonus(parent,edge.moveLoc);
   double childUtility = utilitySum / weightSum;
   if(endingScoreBonus != 0)
     childUtility += getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
@@ -1464,16 +1862,15 @@ int64_t Search::getReducedPlaySelectionVisits(const SearchNode& parent, const Se
 
 double Search::getFpuValueForChildrenAssumeVisited(const SearchNode& node, Player pla, bool isRoot, double policyProbMassVisited, double& parentUtility) const {
   if(searchParams.fpuUseParentAverage) {
-    while(node.statsLock.test_and_set(std::memory_order_acquire));
-    double utilitySum = node.stats.utilitySum;
-    double weightSum = node.stats.weightSum;
-    node.statsLock.clear(std::memory_order_release);
+    NodeStats nodeStats = node.getStats();
+    double utilitySum = nodeStats.utilitySum;
+    double weightSum = nodeStats.weightSum;
 
     assert(weightSum > 0.0);
     parentUtility = utilitySum / weightSum;
   }
   else {
-    parentUtility = getUtilityFromNN(*node.nnOutput);
+    parentUtility = getUtilityFromNN(*node.getNNOutput());
   }
 
   double fpuValue;
@@ -1492,34 +1889,59 @@ double Search::getFpuValueForChildrenAssumeVisited(const SearchNode& node, Playe
 }
 
 
-//Assumes node is locked
+//Does not require node to be locked, but the node must already have an nnOutput
 void Search::selectBestChildToDescend(
-  const SearchThread& thread, const SearchNode& node, int& bestChildIdx, Loc& bestChildMoveLoc,
+  SearchThread& thread, const SearchNode& node, int& bestChildIdx, Loc& bestChildMoveLoc,
   bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE],
   bool isRoot) const
 {
   assert(thread.pla == node.nextPla);
 
-  double maxSelectionValue = POLICY_ILLEGAL_SELECTION_VALUE;
   bestChildIdx = -1;
   bestChildMoveLoc = Board::NULL_LOC;
 
-  int numChildren = node.numChildren;
+  //Load numChildren before children, so that children is guaranteed to hold at least that many
+  int numChildren = node.numChildren.load(std::memory_order_acquire);
+  const SearchChild* children = node.children.load(std::memory_order_acquire);
+  const NNOutput* nnOutput = node.getNNOutput();
 
+  float* childPolicyProbs = thread.selectionPolicyBuf.data();
+  double* childVisits = thread.selectionVisitsBuf.data();
+  double* childUtilities = thread.selectionUtilityBuf.data();
+  double* childVirtualLosses = thread.selectionVirtualLossBuf.data();
+  bool childHasUtility[NNPos::MAX_NN_POLICY_SIZE];
+
+  //Gather the stats of all existing children, snapshotting each child once.
+  //Utilities are filled in below for any child without visits, once the fpu value is known.
+  //Visits are those through the edge from this node, which with graph search may be fewer than the child's own.
   double policyProbMassVisited = 0.0;
   int64_t totalChildVisits = 0;
   for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = node.children[i];
-    Loc moveLoc = child->prevMoveLoc;
-    int movePos = getPos(moveLoc);
-    float nnPolicyProb = node.nnOutput->policyProbs[movePos];
+    const SearchChild& edge = children[i];
+    const SearchNode* child = edge.node;
+    int movePos = getPos(edge.moveLoc);
+    float nnPolicyProb = nnOutput->policyProbs[movePos];
     policyProbMassVisited += nnPolicyProb;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
+    NodeStats childStats = child->getStats();
+    int64_t edgeVisits = getEdgeVisits(edge,childStats.visits);
+    //It's possible that visits is actually 0 here with multithreading because we're visiting this node while a child has
+    //been expanded but its thread not yet finished its first visit
+    childHasUtility[i] = childStats.visits > 0;
+    if(childHasUtility[i]) {
+      assert(childStats.weightSum > 0.0);
+      double childUtility = childStats.utilitySum / childStats.weightSum;
+      //Tiny adjustment for passing
+      double endingScoreBonus = getEndingWhiteScoreBonus(node,edge.moveLoc);
+      if(endingScoreBonus != 0)
+        childUtility += getScoreUtilityDiff(childStats.scoreMeanSum, childStats.scoreMeanSqSum, childStats.weightSum, endingScoreBonus);
+      childUtilities[i] = childUtility;
+    }
+    childPolicyProbs[i] = nnPolicyProb;
+    childVisits[i] = (double)edgeVisits;
+    childVirtualLosses[i] = (double)child->virtualLosses.load(std::memory_order_relaxed);
 
-    totalChildVisits += childVisits;
+    totalChildVisits += edgeVisits;
   }
   //Probability mass should not sum to more than 1, giving a generous allowance
   //for floating point error.
@@ -1529,54 +1951,92 @@ void Search::selectBestChildToDescend(
   double parentUtility;
   double fpuValue = getFpuValueForChildrenAssumeVisited(node, thread.pla, isRoot, policyProbMassVisited, parentUtility);
 
-  std::fill(posesWithChildBuf,posesWithChildBuf+NNPos::MAX_NN_POLICY_SIZE,false);
-
   //Try all existing children
-  for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = node.children[i];
-    Loc moveLoc = child->prevMoveLoc;
-    bool isRootDuringSearch = isRoot;
-    double selectionValue = getExploreSelectionValue(node,child,totalChildVisits,fpuValue,isRootDuringSearch);
-    if(selectionValue > maxSelectionValue) {
-      maxSelectionValue = selectionValue;
-      bestChildIdx = i;
-      bestChildMoveLoc = moveLoc;
+  double maxSelectionValue = POLICY_ILLEGAL_SELECTION_VALUE;
+  if(numChildren > 0) {
+    for(int i = 0; i<numChildren; i++) {
+      if(!childHasUtility[i])
+        childUtilities[i] = fpuValue;
+    }
+    double utilityRadius = searchParams.winLossUtilityFactor + searchParams.staticScoreUtilityFactor + searchParams.dynamicScoreUtilityFactor;
+    ChildSelection::ExistingChildParams params;
+    params.cpuctExploration = searchParams.cpuctExploration;
+    params.totalChildVisits = totalChildVisits;
+    params.virtualLossUtility = (node.nextPla == P_WHITE ? -utilityRadius : utilityRadius);
+    params.plaIsWhite = node.nextPla == P_WHITE;
+    params.rootDesiredPerChildVisitsCoeff = isRoot ? searchParams.rootDesiredPerChildVisitsCoeff : 0.0;
+    int idx = ChildSelection::selectBestExisting(
+      params, numChildren, childPolicyProbs, childVisits, childUtilities, childVirtualLosses, maxSelectionValue
+    );
+    if(idx >= 0) {
+      bestChildIdx = idx;
+      bestChildMoveLoc = children[idx].moveLoc;
     }
-
-    posesWithChildBuf[getPos(moveLoc)] = true;
   }
 
   //Try all new children
-  for(int movePos = 0; movePos<policySize; movePos++) {
-    bool alreadyTried = posesWithChildBuf[movePos];
-    if(alreadyTried)
-      continue;
-
-    Loc moveLoc = NNPos::posToLoc(movePos,thread.board.x_size,thread.board.y_size,nnXLen,nnYLen);
-    if(moveLoc == Board::NULL_LOC)
-      continue;
-
-    //Special logic for the root
-    if(isRoot) {
-      assert(thread.board.pos_hash == rootBoard.pos_hash);
-      assert(thread.pla == rootPla);
-      if(!isAllowedRootMove(moveLoc))
-        continue;
-    }
+  if(isRoot) {
+    assert(thread.board.pos_hash == rootBoard.pos_hash);
+    assert(thread.pla == rootPla);
+  }
+  const bool* excludedNewMoves = isRoot ? rootExcludedNewMoves : nonRootExcludedNewMoves;
+  std::copy(excludedNewMoves,excludedNewMoves+policySize,posesWithChildBuf);
+  for(int i = 0; i<numChildren; i++)
+    posesWithChildBuf[getPos(children[i].moveLoc)] = true;
 
-    double selectionValue = getNewExploreSelectionValue(node,movePos,totalChildVisits,fpuValue);
-    if(selectionValue > maxSelectionValue) {
-      maxSelectionValue = selectionValue;
-      bestChildIdx = numChildren;
-      bestChildMoveLoc = moveLoc;
+  double maxNewSelectionValue;
+  int newMovePos = ChildSelection::selectBestNew(
+    searchParams.cpuctExploration, totalChildVisits, fpuValue, node.nextPla == P_WHITE,
+    policySize, nnOutput->policyProbs, posesWithChildBuf, maxNewSelectionValue
+  );
+  if(newMovePos >= 0 && maxNewSelectionValue > maxSelectionValue) {
+    bestChildIdx = numChildren;
+    bestChildMoveLoc = NNPos::posToLoc(newMovePos,thread.board.x_size,thread.board.y_size,nnXLen,nnYLen);
+  }
+
+}
+void Search::updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int childIdx, int32_t virtualLossesToSubtract, bool isRoot) {
+  if(searchParams.useGraphSearch) {
+    //The children array is only replaced under the stats lock, so the edge incremented is the current one
+    node.lockStats();
+    node.children.load(std::memory_order_acquire)[childIdx].edgeVisits.fetch_add(1,std::memory_order_relaxed);
+    node.unlockStats();
+  }
+  if(canBackupIncrementally(isRoot)) {
+    const NodeStats& leafStats = thread.playoutLeafStats;
+    const int64_t fullRecomputeVisits = searchParams.incrementalBackupFullRecomputeVisits;
+    node.lockStats();
+    int64_t newVisits = node.stats.visits.load(std::memory_order_relaxed) + leafStats.visits;
+    if(fullRecomputeVisits <= 0 || newVisits % fullRecomputeVisits != 0) {
+      node.stats.add(leafStats);
+      node.unlockStats();
+      if(virtualLossesToSubtract != 0)
+        node.virtualLosses.fetch_sub(virtualLossesToSubtract,std::memory_order_release);
+      return;
     }
+    node.unlockStats();
   }
-
-}
-void Search::updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int32_t virtualLossesToSubtract, bool isRoot) {
   recomputeNodeStats(node,thread,1,virtualLossesToSubtract,isRoot);
 }
 
+//Without value weighting or a visits exponent, every child has weight equal to its visits and recomputeNodeStats is
+//just the sum of the leaf values of all the playouts through the node, so adding each playout's leaf value gives the
+//same stats up to floating point error. At the root with noise, visits are subtracted from children based on the max
+//child visits, and with graph search the values of children also change with playouts through their other parents,
+//so those need the full recompute.
+//Dynamic score utilities only change between searches, where beginSearch fully recomputes the whole tree anyways.
+//
+//If a full recompute on another thread races with an incremental one, the node may be off by a playout until its next
+//full recompute, similar to the races that recomputeNodeStats itself accepts.
+bool Search::canBackupIncrementally(bool isRoot) const {
+  return
+    searchParams.useIncrementalBackup &&
+    searchParams.valueWeightExponent <= 0 &&
+    searchParams.visitsExponent == 1.0 &&
+    !searchParams.useGraphSearch &&
+    !(isRoot && searchParams.rootNoiseEnabled);
+}
+
 //Recompute all the stats of this node based on its children, except its visits and virtual losses, which are not child-dependent and
 //are updated in the manner specified.
 void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numVisitsToAdd, int32_t virtualLossesToSubtract, bool isRoot) {
@@ -1596,27 +2056,27 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
   int64_t totalChildVisits = 0;
   int64_t maxChildVisits = 0;
 
-  std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
-  unique_lock<std::mutex> lock(mutex);
-
-  int numChildren = node.numChildren;
+  //No need to lock the node, load numChildren before children so that children holds at least that many
+  int numChildren = node.numChildren.load(std::memory_order_acquire);
+  const SearchChild* children = node.children.load(std::memory_order_acquire);
   int numGoodChildren = 0;
   for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = node.children[i];
-
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    double winValueSum = child->stats.winValueSum;
-    double noResultValueSum = child->stats.noResultValueSum;
-    double scoreMeanSum = child->stats.scoreMeanSum;
-    double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-    double weightSum = child->stats.weightSum;
-    double weightSqSum = child->stats.weightSqSum;
-    double utilitySum = child->stats.utilitySum;
-    double utilitySqSum = child->stats.utilitySqSum;
-    child->statsLock.clear(std::memory_order_release);
-
-    if(childVisits <= 0)
+    const SearchNode* child = children[i].node;
+
+    NodeStats childStats = child->getStats();
+    //Each child is weighted by the playouts from this node into it, averaging its value over all of its own visits.
+    //With graph search, a child reached mostly through other parents must not outweigh the rest of this node's children.
+    int64_t childVisits = getEdgeVisits(children[i],childStats.visits);
+    double winValueSum = childStats.winValueSum;
+    double noResultValueSum = childStats.noResultValueSum;
+    double scoreMeanSum = childStats.scoreMeanSum;
+    double scoreMeanSqSum = childStats.scoreMeanSqSum;
+    double weightSum = childStats.weightSum;
+    double weightSqSum = childStats.weightSqSum;
+    double utilitySum = childStats.utilitySum;
+    double utilitySqSum = childStats.utilitySqSum;
+
+    if(childVisits <= 0 || childStats.visits <= 0)
       continue;
     assert(weightSum > 0.0);
 
@@ -1638,7 +2098,6 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
       maxChildVisits = childVisits;
     numGoodChildren++;
   }
-  lock.unlock();
 
   if(searchParams.valueWeightExponent > 0)
     getValueChildWeights(numGoodChildren,selfUtilities,visits,weightFactors);
@@ -1705,10 +2164,11 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
       desiredWeight = 1.0;
     }
 
-    double winProb = (double)node.nnOutput->whiteWinProb;
-    double noResultProb = (double)node.nnOutput->whiteNoResultProb;
-    double scoreMean = (double)node.nnOutput->whiteScoreMean;
-    double scoreMeanSq = (double)node.nnOutput->whiteScoreMeanSq;
+    const NNOutput* nnOutput = node.getNNOutput();
+    double winProb = (double)nnOutput->whiteWinProb;
+    double noResultProb = (double)nnOutput->whiteNoResultProb;
+    double scoreMean = (double)nnOutput->whiteScoreMean;
+    double scoreMeanSq = (double)nnOutput->whiteScoreMeanSq;
     double utility =
       getResultUtility(winProb, noResultProb, searchParams)
       + getScoreUtility(scoreMean, scoreMeanSq, 1.0);
@@ -1723,53 +2183,176 @@ void Search::recomputeNodeStats(SearchNode& node, SearchThread& thread, int numV
     weightSqSum += desiredWeight * desiredWeight;
   }
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  node.stats.visits += numVisitsToAdd;
+  NodeStats newStats;
+  newStats.winValueSum = winValueSum;
+  newStats.noResultValueSum = noResultValueSum;
+  newStats.scoreMeanSum = scoreMeanSum;
+  newStats.scoreMeanSqSum = scoreMeanSqSum;
+  newStats.utilitySum = utilitySum;
+  newStats.utilitySqSum = utilitySqSum;
+  newStats.weightSum = weightSum;
+  newStats.weightSqSum = weightSqSum;
+
+  node.lockStats();
+  newStats.visits = node.stats.visits.load(std::memory_order_relaxed) + numVisitsToAdd;
   //It's possible that these values are a bit wrong if there's a race and two threads each try to update this
   //each of them only having some of the latest updates for all the children. We just accept this and let the
   //error persist, it will get fixed the next time a visit comes through here and the values will at least
-  //be consistent with each other within this node, since statsLock at least ensures these three are set atomically.
-  node.stats.winValueSum = winValueSum;
-  node.stats.noResultValueSum = noResultValueSum;
-  node.stats.scoreMeanSum = scoreMeanSum;
-  node.stats.scoreMeanSqSum = scoreMeanSqSum;
-  node.stats.utilitySum = utilitySum;
-  node.stats.utilitySqSum = utilitySqSum;
-  node.stats.weightSum = weightSum;
-  node.stats.weightSqSum = weightSqSum;
-  node.virtualLosses -= virtualLossesToSubtract;
-  node.statsLock.clear(std::memory_order_release);
+  //be consistent with each other within this node, since readers only ever see all of them published together.
+  node.stats.store(newStats);
+  node.unlockStats();
+  if(virtualLossesToSubtract != 0)
+    node.virtualLosses.fetch_sub(virtualLossesToSubtract,std::memory_order_release);
 }
 
 void Search::runSinglePlayout(SearchThread& thread) {
   bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE];
   playoutDescend(thread,*rootNode,posesWithChildBuf,true,0);
+  resetThreadToRoot(thread);
+}
 
-  //Restore thread state back to the root state
+int Search::runLeafBatch(SearchThread& thread, int numPlayouts) {
+  bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE];
+  int numVisitsAdded = 0;
+
+  //Descend all the playouts first. Each leaf keeps the virtual losses along its path until its value is backed up,
+  //steering the later playouts elsewhere. Playouts ending at terminal positions are finished immediately.
+  thread.numPendingLeaves = 0;
+  thread.deferLeafEvals = true;
+  for(int i = 0; i<numPlayouts; i++) {
+    if(playoutDescend(thread,*rootNode,posesWithChildBuf,true,0))
+      numVisitsAdded++;
+    resetThreadToRoot(thread);
+  }
+  thread.deferLeafEvals = false;
+
+  int numPending = thread.numPendingLeaves;
+  thread.numPendingLeaves = 0;
+  if(numPending <= 0)
+    return numVisitsAdded;
+
+  //Leaves are replayed from the thread's state at the root a chunk at a time, each chunk evaluated before the next,
+  //so that the copies of the board and history in use stay bounded by the evaluator's batch size.
+  assert(thread.board.pos_hash == rootBoard.pos_hash);
+  int maxInChunk = std::max(nnEvaluator->getMaxBatchSize(),1);
+  if((int)thread.leafBoards.size() < std::min(maxInChunk,numPending)) {
+    thread.leafBoards.resize(std::min(maxInChunk,numPending));
+    thread.leafHistories.resize(std::min(maxInChunk,numPending));
+  }
+  for(int chunkStart = 0; chunkStart < numPending; chunkStart += maxInChunk) {
+    int numInChunk = std::min(maxInChunk, numPending - chunkStart);
+    thread.nnBatchQueries.resize(numInChunk);
+    for(int i = 0; i<numInChunk; i++) {
+      const SearchPendingLeaf& leaf = thread.pendingLeaves[chunkStart+i];
+      Board& board = thread.leafBoards[i];
+      BoardHistory& history = thread.leafHistories[i];
+      board = thread.board;
+      history = thread.history;
+      Player pla = thread.pla;
+      for(Loc moveLoc: leaf.moves) {
+        history.makeBoardMoveAssumeLegal(board,moveLoc,pla,NULL);
+        pla = getOpp(pla);
+      }
+      thread.nnBatchQueries[i] = NNBatchQuery(
+        board, history, pla, searchParams.drawEquivalentWinsForWhite, leaf.isRoot || alwaysIncludeOwnerMap
+      );
+    }
+    nnEvaluator->evaluateBatch(thread.nnBatchQueries, thread.nnBatchResults, thread.logger, false);
+
+    for(int i = 0; i<numInChunk; i++) {
+      SearchPendingLeaf& leaf = thread.pendingLeaves[chunkStart+i];
+      SearchNode& node = *(leaf.node);
+      //Several playouts, from this thread or others, may have reached the same leaf, only the first to get here counts
+      bool initialized = false;
+      {
+        std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
+        lockNodeMutexForPlayout(mutex);
+        lock_guard<std::mutex> lock(mutex,std::adopt_lock);
+        if(node.nnOutput == nullptr) {
+          shared_ptr<NNOutput> newNNOutput = std::move(thread.nnBatchResults[i]);
+          maybeAddPolicyNoise(thread,newNNOutput,leaf.isRoot);
+          setNodeNNOutput(thread,node,std::move(newNNOutput));
+          initialized = true;
+        }
+      }
+
+      if(initialized) {
+        const NNOutput* nnOutput = node.getNNOutput();
+        addLeafValue(
+          thread,node,nnOutput->whiteWinProb,nnOutput->whiteNoResultProb,nnOutput->whiteScoreMean,nnOutput->whiteScoreMeanSq,
+          leaf.virtualLossesToSubtract,false
+        );
+        for(const SearchPendingLeaf::PathEntry& entry: leaf.path)
+          updateStatsAfterPlayout(*(entry.node),thread,entry.childIdx,entry.virtualLossesToSubtract,entry.isRoot);
+        numVisitsAdded++;
+      }
+      else {
+        //Drop the playout, just taking back its virtual losses
+        if(leaf.virtualLossesToSubtract != 0)
+          node.virtualLosses.fetch_sub(leaf.virtualLossesToSubtract,std::memory_order_release);
+        for(const SearchPendingLeaf::PathEntry& entry: leaf.path) {
+          if(entry.virtualLossesToSubtract != 0)
+            entry.node->virtualLosses.fetch_sub(entry.virtualLossesToSubtract,std::memory_order_release);
+        }
+      }
+    }
+    //Don't hold onto the outputs, the nodes have them now
+    for(int i = 0; i<numInChunk; i++)
+      thread.nnBatchResults[i] = nullptr;
+  }
+  return numVisitsAdded;
+}
+
+void Search::resetThreadToRoot(SearchThread& thread) const {
   thread.pla = rootPla;
-  thread.board = rootBoard;
-  thread.history = rootHistory;
+  if(searchParams.useUndoForPlayoutReset) {
+    thread.history.undoRecordedMoves(thread.board,thread.moveRecords,rootBoard,rootHistory);
+    thread.moveRecords.clear();
+  }
+  else {
+    thread.board = rootBoard;
+    thread.history = rootHistory;
+  }
+  thread.playoutMoves.clear();
+  thread.koHashTable.update(thread.history);
 }
 
-void Search::addLeafValue(SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, int32_t virtualLossesToSubtract, bool isCertain) {
+void Search::makeThreadMove(SearchThread& thread, Loc moveLoc) const {
+  if(searchParams.useUndoForPlayoutReset)
+    thread.moveRecords.push_back(thread.history.makeBoardMoveRecorded(thread.board,moveLoc,thread.pla,&thread.koHashTable));
+  else
+    thread.history.makeBoardMoveAssumeLegal(thread.board,moveLoc,thread.pla,&thread.koHashTable);
+  thread.koHashTable.update(thread.history);
+  thread.playoutMoves.push_back(moveLoc);
+  thread.pla = getOpp(thread.pla);
+}
+
+void Search::addLeafValue(
+  SearchThread& thread, SearchNode& node,
+  double winValue, double noResultValue, double scoreMean, double scoreMeanSq, int32_t virtualLossesToSubtract, bool isCertain
+) {
   double utility =
     getResultUtility(winValue, noResultValue, searchParams)
     + getScoreUtility(scoreMean, scoreMeanSq, 1.0);
 
   double newWeightSq = isCertain ? 0.001 : 1.0;
 
-  while(node.statsLock.test_and_set(std::memory_order_acquire));
-  node.stats.visits += 1;
-  node.stats.winValueSum += winValue;
-  node.stats.noResultValueSum += noResultValue;
-  node.stats.scoreMeanSum += scoreMean;
-  node.stats.scoreMeanSqSum += scoreMeanSq;
-  node.stats.utilitySum += utility;
-  node.stats.utilitySqSum += utility * utility;
-  node.stats.weightSum += 1.0;
-  node.stats.weightSqSum += newWeightSq;
-  node.virtualLosses -= virtualLossesToSubtract;
-  node.statsLock.clear(std::memory_order_release);
+  NodeStats& leafStats = thread.playoutLeafStats;
+  leafStats.visits = 1;
+  leafStats.winValueSum = winValue;
+  leafStats.noResultValueSum = noResultValue;
+  leafStats.scoreMeanSum = scoreMean;
+  leafStats.scoreMeanSqSum = scoreMeanSq;
+  leafStats.utilitySum = utility;
+  leafStats.utilitySqSum = utility * utility;
+  leafStats.weightSum = 1.0;
+  leafStats.weightSqSum = newWeightSq;
+
+  node.lockStats();
+  node.stats.add(leafStats);
+  node.unlockStats();
+  if(virtualLossesToSubtract != 0)
+    node.virtualLosses.fetch_sub(virtualLossesToSubtract,std::memory_order_release);
 }
 
 void Search::initNodeNNOutput(
@@ -1783,8 +2366,10 @@ void Search::initNodeNNOutput(
     thread.nnResultBuf, thread.logger, skipCache, includeOwnerMap
   );
 
-  node.nnOutput = std::move(thread.nnResultBuf.result);
-  maybeAddPolicyNoise(thread,node,isRoot);
+  //Fully build the output before publishing it, since other threads read it without the lock
+  shared_ptr<NNOutput> newNNOutput = std::move(thread.nnResultBuf.result);
+  maybeAddPolicyNoise(thread,newNNOutput,isRoot);
+  setNodeNNOutput(thread,node,std::move(newNNOutput));
 
   //If this is a re-initialization of the nnOutput, we don't want to add any visits or anything.
   //Also don't bother updating any of the stats. Technically we should do so because winValueSum
@@ -1795,15 +2380,26 @@ void Search::initNodeNNOutput(
     return;
 
   //Values in the search are from the perspective of white positive always
-  double winProb = (double)node.nnOutput->whiteWinProb;
-  double noResultProb = (double)node.nnOutput->whiteNoResultProb;
-  double scoreMean = (double)node.nnOutput->whiteScoreMean;
-  double scoreMeanSq = (double)node.nnOutput->whiteScoreMeanSq;
+  const NNOutput* nnOutput = node.getNNOutput();
+  double winProb = (double)nnOutput->whiteWinProb;
+  double noResultProb = (double)nnOutput->whiteNoResultProb;
+  double scoreMean = (double)nnOutput->whiteScoreMean;
+  double scoreMeanSq = (double)nnOutput->whiteScoreMeanSq;
 
-  addLeafValue(node,winProb,noResultProb,scoreMean,scoreMeanSq,virtualLossesToSubtract,false);
+  addLeafValue(thread,node,winProb,noResultProb,scoreMean,scoreMeanSq,virtualLossesToSubtract,false);
 }
 
-void Search::playoutDescend(
+void Search::lockNodeMutexForPlayout(std::mutex& mutex) {
+  //Only pay for reading the clock when there is actually contention
+  if(mutex.try_lock())
+    return;
+  auto start = std::chrono::steady_clock::now();
+  mutex.lock();
+  auto waited = std::chrono::steady_clock::now() - start;
+  nodeLockWaitNanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(),std::memory_order_relaxed);
+}
+
+bool Search::playoutDescend(
   SearchThread& thread, SearchNode& node,
   bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE],
   bool isRoot, int32_t virtualLossesToSubtract
@@ -1816,32 +2412,54 @@ void Search::playoutDescend(
       double noResultValue = 1.0;
       double scoreMean = 0.0;
       double scoreMeanSq = 0.0;
-      addLeafValue(node, winValue, noResultValue, scoreMean, scoreMeanSq, virtualLossesToSubtract,true);
-      return;
+      addLeafValue(thread, node, winValue, noResultValue, scoreMean, scoreMeanSq, virtualLossesToSubtract,true);
+      return true;
     }
     else {
       double winValue = ScoreValue::whiteWinsOfWinner(thread.history.winner, searchParams.drawEquivalentWinsForWhite);
       double noResultValue = 0.0;
       double scoreMean = ScoreValue::whiteScoreDrawAdjust(thread.history.finalWhiteMinusBlackScore,searchParams.drawEquivalentWinsForWhite,thread.history);
       double scoreMeanSq = ScoreValue::whiteScoreMeanSqOfScoreGridded(thread.history.finalWhiteMinusBlackScore,searchParams.drawEquivalentWinsForWhite,thread.history);
-      addLeafValue(node, winValue, noResultValue, scoreMean, scoreMeanSq, virtualLossesToSubtract,true);
-      return;
+      addLeafValue(thread, node, winValue, noResultValue, scoreMean, scoreMeanSq, virtualLossesToSubtract,true);
+      return true;
     }
   }
 
+  //Reading the nnOutput and selecting a child don't require the lock, it's only needed to initialize
+  //this node or to add a child to it.
   std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
-  unique_lock<std::mutex> lock(mutex);
 
   //Hit leaf node, finish
-  if(node.nnOutput == nullptr) {
-    initNodeNNOutput(thread,node,isRoot,false,virtualLossesToSubtract,false);
-    return;
+  if(node.getNNOutput() == NULL) {
+    //No need for the lock, whichever playout reaching this leaf gets its evaluation back first initializes it
+    if(thread.deferLeafEvals) {
+      if(thread.numPendingLeaves >= (int)thread.pendingLeaves.size())
+        thread.pendingLeaves.resize(thread.numPendingLeaves+1);
+      SearchPendingLeaf& leaf = thread.pendingLeaves[thread.numPendingLeaves++];
+      leaf.node = &node;
+      leaf.virtualLossesToSubtract = virtualLossesToSubtract;
+      leaf.isRoot = isRoot;
+      leaf.moves = thread.playoutMoves;
+      leaf.path.clear();
+      return false;
+    }
+    lockNodeMutexForPlayout(mutex);
+    lock_guard<std::mutex> lock(mutex,std::adopt_lock);
+    //Another thread may have initialized this node while we waited for the lock, in which case we just descend
+    if(node.nnOutput == nullptr) {
+      initNodeNNOutput(thread,node,isRoot,false,virtualLossesToSubtract,false);
+      return true;
+    }
   }
   //For the root node, make sure we have a whiteOwnerMap
-  if(isRoot && node.nnOutput->whiteOwnerMap == NULL) {
-    bool isReInit = true;
-    initNodeNNOutput(thread,node,isRoot,false,0,isReInit);
-    assert(node.nnOutput->whiteOwnerMap != NULL);
+  if(isRoot && node.getNNOutput()->whiteOwnerMap == NULL) {
+    lockNodeMutexForPlayout(mutex);
+    lock_guard<std::mutex> lock(mutex,std::adopt_lock);
+    if(node.nnOutput->whiteOwnerMap == NULL) {
+      bool isReInit = true;
+      initNodeNNOutput(thread,node,isRoot,false,0,isReInit);
+      assert(node.nnOutput->whiteOwnerMap != NULL);
+    }
     //As isReInit is true, we don't return, just keep going, since we didn't count this as a true visit in the node stats
   }
 
@@ -1856,11 +2474,25 @@ void Search::playoutDescend(
   //(this should only happen either on a bug or where the nnHash doesn't have full legality information or when there's an actual hash collision).
   //Regenerate the neural net call and continue
   if(!thread.history.isLegal(thread.board,bestChildMoveLoc,thread.pla)) {
-    bool isReInit = true;
-    initNodeNNOutput(thread,node,isRoot,true,0,isReInit);
+    //With graph search, a node shared between move orders may rarely have a child that is illegal by superko for this
+    //particular history. Regenerating won't help, so end the playout here, counting the node's own evaluation again.
+    if(searchParams.useGraphSearch && bestChildIdx < node.numChildren.load(std::memory_order_acquire)) {
+      const NNOutput* nnOutput = node.getNNOutput();
+      addLeafValue(
+        thread,node,nnOutput->whiteWinProb,nnOutput->whiteNoResultProb,nnOutput->whiteScoreMean,nnOutput->whiteScoreMeanSq,
+        virtualLossesToSubtract,false
+      );
+      return true;
+    }
+    {
+      lockNodeMutexForPlayout(mutex);
+      lock_guard<std::mutex> lock(mutex,std::adopt_lock);
+      bool isReInit = true;
+      initNodeNNOutput(thread,node,isRoot,true,0,isReInit);
 
-    if(thread.logStream != NULL)
-      (*thread.logStream) << "WARNING: Chosen move not legal so regenerated nn output, nnhash=" << node.nnOutput->nnHash << endl;
+      if(thread.logStream != NULL)
+        (*thread.logStream) << "WARNING: Chosen move not legal so regenerated nn output, nnhash=" << node.nnOutput->nnHash << endl;
+    }
 
     //As isReInit is true, we don't return, just keep going, since we didn't count this as a true visit in the node stats
     selectBestChildToDescend(thread,node,bestChildIdx,bestChildMoveLoc,posesWithChildBuf,isRoot);
@@ -1869,64 +2501,116 @@ void Search::playoutDescend(
   }
 
   if(bestChildIdx < -1) {
-    lock.unlock();
     throw StringError("Search error: No move with sane selection value - can't even pass?");
   }
 
-  //Reallocate the children array to increase capacity if necessary
-  if(bestChildIdx >= node.childrenCapacity) {
-    int newCapacity = node.childrenCapacity + (node.childrenCapacity / 4) + 1;
-    assert(newCapacity < 0x3FFF);
-    SearchNode** newArr = new SearchNode*[newCapacity];
-    for(int i = 0; i<node.numChildren; i++) {
-      newArr[i] = node.children[i];
-      node.children[i] = NULL;
-    }
-    SearchNode** oldArr = node.children;
-    node.children = newArr;
-    node.childrenCapacity = (uint16_t)newCapacity;
-    delete[] oldArr;
-  }
-
   Loc moveLoc = bestChildMoveLoc;
 
-  //Allocate a new child node if necessary
-  SearchNode* child;
-  if(bestChildIdx == node.numChildren) {
-    assert(thread.history.isLegal(thread.board,moveLoc,thread.pla));
-    thread.history.makeBoardMoveAssumeLegal(thread.board,moveLoc,thread.pla,rootKoHashTable);
-    thread.pla = getOpp(thread.pla);
+  //Children are only ever appended, so if the selected child existed it's still at the same index
+  SearchNode* child = NULL;
+  int childIdx = bestChildIdx;
+  {
+    int numChildren = node.numChildren.load(std::memory_order_acquire);
+    const SearchChild* children = node.children.load(std::memory_order_acquire);
+    if(bestChildIdx < numChildren && children[bestChildIdx].moveLoc == moveLoc)
+      child = children[bestChildIdx].node;
+  }
 
-    node.numChildren++;
-    child = new SearchNode(*this,thread,moveLoc);
-    node.children[bestChildIdx] = child;
+  //Allocate a new child node if necessary
+  bool createdChild = false;
+  if(child == NULL) {
+    lockNodeMutexForPlayout(mutex);
+    lock_guard<std::mutex> lock(mutex,std::adopt_lock);
+    int numChildren = node.numChildren.load(std::memory_order_relaxed);
+    SearchChild* children = node.children.load(std::memory_order_relaxed);
+    //Another thread may have added this same move since we selected it
+    for(int i = bestChildIdx; i<numChildren; i++) {
+      if(children[i].moveLoc == moveLoc) {
+        child = children[i].node;
+        childIdx = i;
+        break;
+      }
+    }
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    child->virtualLosses += searchParams.numVirtualLossesPerThread;
-    child->statsLock.clear(std::memory_order_release);
+    if(child == NULL) {
+      //Reallocate the children array to increase capacity if necessary.
+      //The old array may still be being read by other threads, so it is abandoned rather than reused.
+      //Edge visits are copied under the stats lock so that no concurrent increment lands in the old array.
+      if(numChildren >= node.childrenCapacity) {
+        int newCapacity = node.childrenCapacity + (node.childrenCapacity / 4) + 1;
+        assert(newCapacity < 0x3FFF);
+        SearchChild* newArr = thread.nodeAlloc.allocChildren(newCapacity);
+        node.lockStats();
+        for(int i = 0; i<numChildren; i++) {
+          newArr[i].node = children[i].node;
+          newArr[i].moveLoc = children[i].moveLoc;
+          newArr[i].edgeVisits.store(children[i].edgeVisits.load(std::memory_order_relaxed),std::memory_order_relaxed);
+        }
+        children = newArr;
+        node.children.store(newArr,std::memory_order_release);
+        node.unlockStats();
+        node.childrenCapacity = (uint16_t)newCapacity;
+      }
 
-    lock.unlock();
+      assert(thread.history.isLegal(thread.board,moveLoc,thread.pla));
+      int numCapturesBefore = thread.board.numBlackCaptures + thread.board.numWhiteCaptures;
+      makeThreadMove(thread,moveLoc);
+
+      if(searchParams.useGraphSearch) {
+        bool moveCaptured = thread.board.numBlackCaptures + thread.board.numWhiteCaptures != numCapturesBefore;
+        bool isPathDependent;
+        Hash128 graphHash = getChildGraphHash(node,thread,moveLoc,moveCaptured,isPathDependent);
+        bool created;
+        child = nodeTable->findOrCreate(
+          graphHash,
+          [&]() {
+            SearchNode* newChild = new (thread.nodeAlloc.allocNode()) SearchNode(*this,thread);
+            newChild->graphHash = graphHash;
+            newChild->graphHashIsPathDependent = isPathDependent;
+            return newChild;
+          },
+          created
+        );
+        if(!created)
+          numGraphNodesShared.fetch_add(1,std::memory_order_relaxed);
+      }
+      else {
+        child = new (thread.nodeAlloc.allocNode()) SearchNode(*this,thread);
+      }
+      //A shared node may already be in use by other threads through another parent
+      child->virtualLosses.fetch_add(searchParams.numVirtualLossesPerThread,std::memory_order_relaxed);
+      //Publish the child only once its slot is filled
+      children[numChildren].node = child;
+      children[numChildren].moveLoc = moveLoc;
+      children[numChildren].edgeVisits.store(0,std::memory_order_relaxed);
+      childIdx = numChildren;
+      node.numChildren.store((uint16_t)(numChildren+1),std::memory_order_release);
+      createdChild = true;
+    }
   }
-  else {
-    child = node.children[bestChildIdx];
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    child->virtualLosses += searchParams.numVirtualLossesPerThread;
-    child->statsLock.clear(std::memory_order_release);
-
-    //Unlock before making moves if the child already exists since we don't depend on it at this point
-    lock.unlock();
+  if(!createdChild) {
+    child->virtualLosses.fetch_add(searchParams.numVirtualLossesPerThread,std::memory_order_relaxed);
 
     assert(thread.history.isLegal(thread.board,moveLoc,thread.pla));
-    thread.history.makeBoardMoveAssumeLegal(thread.board,moveLoc,thread.pla,rootKoHashTable);
-    thread.pla = getOpp(thread.pla);
+    makeThreadMove(thread,moveLoc);
   }
 
   //Recurse!
-  playoutDescend(thread,*child,posesWithChildBuf,false,searchParams.numVirtualLossesPerThread);
+  if(!playoutDescend(thread,*child,posesWithChildBuf,false,searchParams.numVirtualLossesPerThread)) {
+    //Stats are updated later, once the leaf is evaluated
+    SearchPendingLeaf::PathEntry entry;
+    entry.node = &node;
+    entry.childIdx = childIdx;
+    entry.virtualLossesToSubtract = virtualLossesToSubtract;
+    entry.isRoot = isRoot;
+    thread.pendingLeaves[thread.numPendingLeaves-1].path.push_back(entry);
+    return false;
+  }
 
   //Update this node stats
-  updateStatsAfterPlayout(node,thread,virtualLossesToSubtract,isRoot);
+  updateStatsAfterPlayout(node,thread,childIdx,virtualLossesToSubtract,isRoot);
+  return true;
 }
 
 
@@ -1976,22 +2660,22 @@ void Search::printRootEndingScoreValueBonus(ostream& out) const {
     return;
 
   for(int i = 0; i<rootNode->numChildren; i++) {
-    const SearchNode* child = rootNode->children[i];
+    const SearchNode* child = rootNode->children[i].node;
+    Loc moveLoc = rootNode->children[i].moveLoc;
 
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    double utilitySum = child->stats.utilitySum;
-    double scoreMeanSum = child->stats.scoreMeanSum;
-    double scoreMeanSqSum = child->stats.scoreMeanSqSum;
-    double weightSum = child->stats.weightSum;
-    child->statsLock.clear(std::memory_order_release);
+    NodeStats childStats = child->getStats();
+    int64_t childVisits = childStats.visits;
+    double utilitySum = childStats.utilitySum;
+    double scoreMeanSum = childStats.scoreMeanSum;
+    double scoreMeanSqSum = childStats.scoreMeanSqSum;
+    double weightSum = childStats.weightSum;
 
     double utilityNoBonus = utilitySum / weightSum;
-    double endingScoreBonus = getEndingWhiteScoreBonus(*rootNode,child);
+    double endingScoreBonus = getEndingWhiteScoreBonus(*rootNode,moveLoc);
     double utilityDiff = getScoreUtilityDiff(scoreMeanSum, scoreMeanSqSum, weightSum, endingScoreBonus);
     double utilityWithBonus = utilityNoBonus + utilityDiff;
 
-    out << Location::toString(child->prevMoveLoc,rootBoard) << " " << Global::strprintf(
+    out << Location::toString(moveLoc,rootBoard) << " " << Global::strprintf(
       "visits %d utilityNoBonus %.2fc utilityWithBonus %.2fc endingScoreBonus %.2f",
       childVisits, utilityNoBonus*100, utilityWithBonus*100, endingScoreBonus
     );
@@ -2045,7 +2729,7 @@ void Search::appendPVForMove(vector<Loc>& buf, vector<Loc>& scratchLocs, vector<
     assert(node.numChildren >= scratchValues.size());
     //We rely on the fact that children are never reordered - we can access this safely
     //despite dropping the lock in between computing play selection values and now
-    n = node.children[bestChildIdx];
+    n = node.children[bestChildIdx].node;
     lock.unlock();
 
     buf.push_back(bestChildMoveLoc);
@@ -2089,16 +2773,15 @@ AnalysisData Search::getAnalysisDataOfSingleChild(
   double utilitySum = 0.0;
 
   if(child != NULL) {
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    numVisits = child->stats.visits;
-    winValueSum = child->stats.winValueSum;
-    noResultValueSum = child->stats.noResultValueSum;
-    scoreMeanSum = child->stats.scoreMeanSum;
-    scoreMeanSqSum = child->stats.scoreMeanSqSum;
-    weightSum = child->stats.weightSum;
-    weightSqSum = child->stats.weightSqSum;
-    utilitySum = child->stats.utilitySum;
-    child->statsLock.clear(std::memory_order_release);
+    NodeStats childStats = child->getStats();
+    numVisits = childStats.visits;
+    winValueSum = childStats.winValueSum;
+    noResultValueSum = childStats.noResultValueSum;
+    scoreMeanSum = childStats.scoreMeanSum;
+    scoreMeanSqSum = childStats.scoreMeanSqSum;
+    weightSum = childStats.weightSum;
+    weightSqSum = childStats.weightSqSum;
+    utilitySum = childStats.utilitySum;
   }
 
   AnalysisData data;
@@ -2155,7 +2838,9 @@ void Search::getAnalysisData(
 ) const {
   buf.clear();
   vector<SearchNode*> children;
+  vector<Loc> moveLocs;
   children.reserve(rootBoard.x_size * rootBoard.y_size + 1);
+  moveLocs.reserve(rootBoard.x_size * rootBoard.y_size + 1);
 
   int numChildren;
   vector<Loc> scratchLocs;
@@ -2166,8 +2851,10 @@ void Search::getAnalysisData(
     std::mutex& mutex = mutexPool->getMutex(node.lockIdx);
     lock_guard<std::mutex> lock(mutex);
     numChildren = node.numChildren;
-    for(int i = 0; i<numChildren; i++)
-      children.push_back(node.children[i]);
+    for(int i = 0; i<numChildren; i++) {
+      children.push_back(node.children[i].node);
+      moveLocs.push_back(node.children[i].moveLoc);
+    }
 
     if(numChildren <= 0)
       return;
@@ -2189,10 +2876,8 @@ void Search::getAnalysisData(
     for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++)
       policyProbs[i] = nnOutput.policyProbs[i];
 
-    for(int i = 0; i<numChildren; i++) {
-      const SearchNode* child = children[i];
-      policyProbMassVisited += policyProbs[getPos(child->prevMoveLoc)];
-    }
+    for(int i = 0; i<numChildren; i++)
+      policyProbMassVisited += policyProbs[getPos(moveLocs[i])];
     //Probability mass should not sum to more than 1, giving a generous allowance
     //for floating point error.
     assert(policyProbMassVisited <= 1.0001);
@@ -2202,13 +2887,12 @@ void Search::getAnalysisData(
   double parentScoreMean;
   double parentScoreStdev;
   {
-    while(node.statsLock.test_and_set(std::memory_order_acquire));
-    double winValueSum = node.stats.winValueSum;
-    double noResultValueSum = node.stats.noResultValueSum;
-    double scoreMeanSum = node.stats.scoreMeanSum;
-    double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-    double weightSum = node.stats.weightSum;
-    node.statsLock.clear(std::memory_order_release);
+    NodeStats nodeStats = node.getStats();
+    double winValueSum = nodeStats.winValueSum;
+    double noResultValueSum = nodeStats.noResultValueSum;
+    double scoreMeanSum = nodeStats.scoreMeanSum;
+    double scoreMeanSqSum = nodeStats.scoreMeanSqSum;
+    double weightSum = nodeStats.weightSum;
     assert(weightSum > 0.0);
 
     double winValue = winValueSum / weightSum;
@@ -2225,9 +2909,9 @@ void Search::getAnalysisData(
 
   for(int i = 0; i<numChildren; i++) {
     SearchNode* child = children[i];
-    double policyProb = policyProbs[getPos(child->prevMoveLoc)];
+    double policyProb = policyProbs[getPos(moveLocs[i])];
     AnalysisData data = getAnalysisDataOfSingleChild(
-      child, scratchLocs, scratchValues, child->prevMoveLoc, policyProb, fpuValue, parentUtility, parentWinLossValue,
+      child, scratchLocs, scratchValues, moveLocs[i], policyProb, fpuValue, parentUtility, parentWinLossValue,
       parentScoreMean, parentScoreStdev, maxPVDepth
     );
     data.playSelectionValue = playSelectionValues[i];
@@ -2312,7 +2996,7 @@ void Search::printTree(ostream& out, const SearchNode* node, PrintTreeOptions op
   {
     vector<Loc> scratchLocs;
     vector<double> scratchValues;
-    //Use dummy values for parent
+    //Use dummy values for parent, including the move, which is recorded on the edge from the parent
     double policyProb = NAN;
     double fpuValue = 0;
     double parentUtility = 0;
@@ -2321,7 +3005,7 @@ void Search::printTree(ostream& out, const SearchNode* node, PrintTreeOptions op
     double parentScoreStdev = 0;
     data = getAnalysisDataOfSingleChild(
       node, scratchLocs, scratchValues,
-      node->prevMoveLoc, policyProb, fpuValue, parentUtility, parentWinLossValue,
+      Board::NULL_LOC, policyProb, fpuValue, parentUtility, parentWinLossValue,
       parentScoreMean, parentScoreStdev, options.maxPVDepth_
     );
     data.weightFactor = NAN;
@@ -2402,12 +3086,11 @@ void Search::printTreeHelper(
     }
 
     if(options.printSqs_) {
-      while(node.statsLock.test_and_set(std::memory_order_acquire));
-      double scoreMeanSqSum = node.stats.scoreMeanSqSum;
-      double utilitySqSum = node.stats.utilitySqSum;
-      double weightSum = node.stats.weightSum;
-      double weightSqSum = node.stats.weightSqSum;
-      node.statsLock.clear(std::memory_order_release);
+      NodeStats nodeStats = node.getStats();
+      double scoreMeanSqSum = nodeStats.scoreMeanSqSum;
+      double utilitySqSum = nodeStats.utilitySqSum;
+      double weightSum = nodeStats.weightSum;
+      double weightSqSum = nodeStats.weightSqSum;
       sprintf(buf,"SMSQ %5.1f USQ %7.5f W %6.2f WSQ %8.2f ", scoreMeanSqSum/weightSum, utilitySqSum/weightSum, weightSum, weightSqSum);
       out << buf;
     }
@@ -2461,7 +3144,7 @@ void Search::printTreeHelper(
 
   for(int i = 0; i<numChildren; i++) {
     const SearchNode* child = analysisData[i].node;
-    Loc moveLoc = child->prevMoveLoc;
+    Loc moveLoc = analysisData[i].move;
 
     if((depth >= options.branch_.size() && i < numChildrenToRecurseOn) ||
        (depth < options.branch_.size() && moveLoc == options.branch_[depth]))
@@ -2504,21 +3187,17 @@ double Search::getAverageTreeOwnershipHelper(vector<double>& accum, int64_t minV
 
   int numChildren = node->numChildren;
   vector<const SearchNode*> children(numChildren);
-  for(int i = 0; i<numChildren; i++)
-    children[i] = node->children[i];
-
-  //We can unlock now - during a search, children are never deallocated
-  lock.unlock();
-
   vector<int64_t> visitsBuf(numChildren);
   for(int i = 0; i<numChildren; i++) {
-    const SearchNode* child = children[i];
-    while(child->statsLock.test_and_set(std::memory_order_acquire));
-    int64_t childVisits = child->stats.visits;
-    child->statsLock.clear(std::memory_order_release);
-    visitsBuf[i] = childVisits;
+    const SearchChild& edge = node->children[i];
+    children[i] = edge.node;
+    NodeStats childStats = edge.node->getStats();
+    visitsBuf[i] = getEdgeVisits(edge,childStats.visits);
   }
 
+  //We can unlock now - during a search, children are never deallocated
+  lock.unlock();
+
   double relativeChildrenWeightSum = 0.0;
   int64_t usedChildrenVisitSum = 0;
   for(int i = 0; i<numChildren; i++) {
@@ -1,7 +1,9 @@
 #ifndef SEARCH_SEARCH_H_
 #define SEARCH_SEARCH_H_
 
+#include <functional>
 #include <memory>
+#include <unordered_set>
 
 #include "../core/global.h"
 #include "../core/hash.h"
@@ -13,6 +15,8 @@
 #include "../neuralnet/nneval.h"
 #include "../search/analysisdata.h"
 #include "../search/mutexpool.h"
+#include "../search/nodearena.h"
+#include "../search/nodetable.h"
 #include "../search/searchparams.h"
 #include "../search/searchprint.h"
 #include "../search/timecontrols.h"
@@ -56,31 +60,81 @@ struct NodeStats {
   double getResultUtilitySum(const SearchParams& searchParams) const;
 };
 
+//The stats stored in a SearchNode. Every field is atomic so that readers can copy them while a writer is updating them
+//without that being a data race, relying on the node's seqlock rather than on the atomics to get a consistent copy.
+//So all accesses are relaxed, and writes must be made while holding the seqlock.
+struct AtomicNodeStats {
+  std::atomic<int64_t> visits;
+  std::atomic<double> winValueSum;
+  std::atomic<double> noResultValueSum;
+  std::atomic<double> scoreMeanSum;
+  std::atomic<double> scoreMeanSqSum;
+  std::atomic<double> utilitySum;
+  std::atomic<double> utilitySqSum;
+  std::atomic<double> weightSum;
+  std::atomic<double> weightSqSum;
+
+  AtomicNodeStats();
+  ~AtomicNodeStats();
+
+  AtomicNodeStats(const AtomicNodeStats&) = delete;
+  AtomicNodeStats& operator=(const AtomicNodeStats&) = delete;
+
+  NodeStats load() const;
+  void store(const NodeStats& stats);
+  //Add every field of delta
+  void add(const NodeStats& delta);
+};
+
+//An edge from a node to one of its children. Under searchParams.useGraphSearch a child may be reached through edges
+//of several parents, so the move and the number of playouts through the edge live here rather than on the child.
+struct SearchChild {
+  SearchNode* node;
+  Loc moveLoc;
+  //Playouts that went from the parent to the child through this edge. Only maintained under useGraphSearch, where
+  //it weights the child in its parent's stats and selection instead of the child's own visits, which may include
+  //playouts that reached it through other parents. Protected under the parent's statsVersion.
+  std::atomic<int64_t> edgeVisits;
+};
+
 struct SearchNode {
   //Locks------------------------------------------------------------------------------
   uint32_t lockIdx;
-  mutable std::atomic_flag statsLock = ATOMIC_FLAG_INIT;
+  //Seqlock for stats: odd while a writer is updating stats, incremented once at the start and once at the end
+  //of every write. Readers never block writers, they simply retry if the version changed under them.
+  mutable std::atomic<uint32_t> statsVersion;
 
   //Constant during search--------------------------------------------------------------
   Player nextPla;
-  Loc prevMoveLoc;
+  //Only used with searchParams.useGraphSearch, set before the node is published to other threads
+  Hash128 graphHash;
+  bool graphHashIsPathDependent; //If true, graphHash depends on the moves that led here, not just the position
 
   //Mutable---------------------------------------------------------------------------
   //All of these values are protected under the mutex indicated by lockIdx
-  std::shared_ptr<NNOutput> nnOutput; //Once set, constant thereafter
-
-  SearchNode** children;
-  uint16_t numChildren;
+  std::shared_ptr<NNOutput> nnOutput; //Owning reference, only ever replaced as a whole, under the mutex
+
+  //Same output as nnOutput, published for reading without the mutex. Replaced outputs are retired into the
+  //SearchNodeArena rather than freed, so a reader holding an old pointer still sees valid memory.
+  std::atomic<NNOutput*> nnOutputPtr;
+
+  //Children and the array itself are owned by the search's SearchNodeArena.
+  //Only modified under the mutex, but may be read without it: a child is written into its slot before numChildren
+  //is incremented, and a grown array is fully copied before being published, so a reader that loads numChildren
+  //and then children always sees at least that many valid entries. Arrays are never reused once replaced.
+  //A grown array is also copied and published under statsVersion, so that no edgeVisits increment is lost.
+  std::atomic<SearchChild*> children;
+  std::atomic<uint16_t> numChildren;
   uint16_t childrenCapacity;
 
   //Lightweight mutable---------------------------------------------------------------
-  //Protected under statsLock
-  NodeStats stats;
-  //Also protected under statsLock
-  int32_t virtualLosses;
+  //Protected under statsVersion
+  AtomicNodeStats stats;
+  //Updated atomically on its own, independent of stats
+  std::atomic<int32_t> virtualLosses;
 
   //--------------------------------------------------------------------------------
-  SearchNode(Search& search, SearchThread& thread, Loc prevMoveLoc);
+  SearchNode(Search& search, SearchThread& thread);
   ~SearchNode();
 
   SearchNode(const SearchNode&) = delete;
@@ -88,6 +142,40 @@ struct SearchNode {
 
   SearchNode(SearchNode&& other) noexcept;
   SearchNode& operator=(SearchNode&& other) noexcept;
+
+  //Consistent snapshot of stats, safe to call concurrently with writers.
+  //Built with NODE_STATS_LOCKED_READS, takes the seqlock as a writer would instead, to measure what optimistic reads save.
+  NodeStats getStats() const;
+  //Bracket any modification of stats. Writers still exclude each other, but only briefly.
+  void lockStats() const;
+  void unlockStats() const;
+
+  NNOutput* getNNOutput() const {
+    return nnOutputPtr.load(std::memory_order_acquire);
+  }
+};
+
+//A leaf reached by a playout whose neural net evaluation was deferred so that it could be evaluated in a batch
+//along with the leaves of other playouts, see Search::runLeafBatch.
+struct SearchPendingLeaf {
+  struct PathEntry {
+    SearchNode* node;
+    int childIdx;
+    int32_t virtualLossesToSubtract;
+    bool isRoot;
+  };
+
+  SearchNode* node;
+  int32_t virtualLossesToSubtract;
+  bool isRoot;
+  //The moves from the root to the leaf, replayed from the root to evaluate it, rather than keeping a copy of the
+  //board and history, which would be large for each of many leaves
+  std::vector<Loc> moves;
+  //The nodes the playout passed through to reach the leaf, from its parent up to the root
+  std::vector<PathEntry> path;
+
+  SearchPendingLeaf();
+  ~SearchPendingLeaf();
 };
 
 //Per-thread state
@@ -116,9 +204,41 @@ struct SearchThread {
   std::vector<double> selfUtilityBuf;
   std::vector<int64_t> visitsBuf;
 
+  //Stats of the children of a node gathered into contiguous arrays, for ChildSelection
+  std::vector<float> selectionPolicyBuf;
+  std::vector<double> selectionVisitsBuf;
+  std::vector<double> selectionUtilityBuf;
+  std::vector<double> selectionVirtualLossBuf;
+
+  //The values that the current playout added at its leaf, for searchParams.useIncrementalBackup
+  NodeStats playoutLeafStats;
+
+  //Moves made so far in the current playout, if searchParams.useUndoForPlayoutReset
+  std::vector<BoardHistory::MoveRecord> moveRecords;
+  //Moves made so far in the current playout
+  std::vector<Loc> playoutMoves;
+  //Kept covering all of history as moves are made and the playout is reset, for superko checks during descent
+  KoHashTable koHashTable;
+
+  SearchNodeAllocator nodeAlloc;
+
+  //While true, playouts that reach a leaf needing a neural net evaluation defer it into pendingLeaves.
+  //Only the first numPendingLeaves entries are in use, the rest are kept to reuse their buffers.
+  bool deferLeafEvals;
+  std::vector<SearchPendingLeaf> pendingLeaves;
+  int numPendingLeaves;
+  //Pending leaves replayed for evaluation, at most the evaluator's max batch size of them at a time
+  std::vector<Board> leafBoards;
+  std::vector<BoardHistory> leafHistories;
+  std::vector<NNBatchQuery> nnBatchQueries;
+  std::vector<std::shared_ptr<NNOutput>> nnBatchResults;
+
   SearchThread(int threadIdx, const Search& search, Logger* logger);
   ~SearchThread();
 
+  //Reinitialize for a new search from the current root of search, reusing all buffers
+  void reset(const Search& search, Logger* logger);
+
   SearchThread(const SearchThread&) = delete;
   SearchThread& operator=(const SearchThread&) = delete;
 };
@@ -132,6 +252,9 @@ struct Search {
 
   //Precomputed values at the root
   Color* rootSafeArea;
+  //Moves that selectBestChildToDescend never considers as new children, by policy pos, at the root and elsewhere
+  bool* rootExcludedNewMoves;
+  bool* nonRootExcludedNewMoves;
   //Used to center for dynamic scorevalue
   double recentScoreCenter;
 
@@ -155,6 +278,41 @@ struct Search {
   //Mutable---------------------------------------------------------------
   SearchNode* rootNode;
 
+  //All nodes of the tree are allocated from this arena
+  SearchNodeArena* nodeArena;
+  //Node allocation counters, cumulative over the lifetime of the search
+  std::atomic<int64_t> numNodesReleased; //Destroyed by clearing the search or discarding the rest of the tree on makeMove
+  int64_t numNodesCompacted; //Moved into a fresh arena on makeMove, when that would free enough of the old one
+
+  //Nodes of the tree by graph hash, only used with searchParams.useGraphSearch
+  SearchNodeTable* nodeTable;
+  std::atomic<int64_t> numGraphNodesShared; //Children linked to an existing node for a transposition, cumulative
+
+  //Time playouts spent blocked waiting for node locks, summed over threads, cumulative
+  std::atomic<int64_t> nodeLockWaitNanos;
+
+  //Arenas of discarded trees, released in the background by the reclaimer shared with other searches
+  SearchNodeReclaimer* reclaimer;
+  SearchNodeReclaimer::Account reclaimAccount; //Guarded by the reclaimer
+
+  //Persistent pool of search threads, reused across searches----------------
+  std::vector<SearchThread*> searchThreads; //Indexed by threadIdx, reset at the start of each search
+  std::vector<std::thread> workerThreads; //Run threadIdx 1 and up, parked between searches
+  std::mutex workerMutex;
+  std::condition_variable workerCondVar;
+  std::condition_variable workerDoneCondVar;
+  std::function<void(int)> workerTask; //Search loop for the current search
+  int64_t workerTaskGeneration; //Incremented each time workers are woken for a new search
+  int numWorkersForTask;
+  int numWorkersRunning;
+  bool workersShouldTerminate;
+  std::exception_ptr workerException;
+  std::vector<double> threadStartSeconds;
+
+  //Stats for the thread pool
+  int64_t numSearchThreadsSpawned; //Total over the lifetime of this search
+  double lastSearchStartupSeconds; //For the most recent runWholeSearch, the time until every thread was running playouts
+
   //Services--------------------------------------------------------------
   MutexPool* mutexPool;
   NNEvaluator* nnEvaluator; //externally owned
@@ -190,7 +348,10 @@ struct Search {
   void setNNEval(NNEvaluator* nnEval);
 
   //Just directly clear search without changing anything
+  //The old tree is released in the background, see finishPendingReclaim.
   void clearSearch();
+  //Block until all trees discarded by clearSearch or makeMove have actually been released
+  void finishPendingReclaim();
 
   //Updates position and preserves the relevant subtree of search
   //If the move is not legal for the specified player, returns false and does nothing, else returns true
@@ -229,6 +390,9 @@ struct Search {
   //Get the number of visits recorded for the root node
   int64_t getRootVisits() const;
 
+  //Get allocation stats for the nodes in the current tree, including ones pruned but not yet released
+  SearchNodeArenaStats getNodeArenaStats() const;
+
   //Run an entire search from start to finish
   //If recordUtilities is provided, and we're doing a singlethreaded search, will fill recordUtilities
   //with the root utility as of the end of each playout performed, up to the length of recordUtilities.
@@ -249,6 +413,10 @@ struct Search {
 
   //Within-search functions, threadsafe-------------------------------------------
   void runSinglePlayout(SearchThread& thread);
+  //Run up to numPlayouts playouts, descending each of them with virtual losses before evaluating all the leaves they
+  //reach together in one batch, see searchParams.numLeavesPerThread. Returns the number of playouts that added a visit,
+  //which can be fewer if several of them reached the same unevaluated leaf.
+  int runLeafBatch(SearchThread& thread, int numPlayouts);
 
   //Tree-inspection functions---------------------------------------------------------------
   void printPV(std::ostream& out, const SearchNode* node, int maxDepth) const;
@@ -277,7 +445,8 @@ struct Search {
 
   //Helpers-----------------------------------------------------------------------
 private:
-  void maybeAddPolicyNoise(SearchThread& thread, SearchNode& node, bool isRoot) const;
+  void maybeAddPolicyNoise(SearchThread& thread, std::shared_ptr<NNOutput>& nnOutput, bool isRoot) const;
+  void setNodeNNOutput(SearchThread& thread, SearchNode& node, std::shared_ptr<NNOutput>&& newNNOutput) const;
   int getPos(Loc moveLoc) const;
 
   bool isAllowedRootMove(Loc moveLoc) const;
@@ -289,7 +458,11 @@ private:
   double getUtilityFromNN(const NNOutput& nnOutput) const;
 
   //Parent must be locked
-  double getEndingWhiteScoreBonus(const SearchNode& parent, const SearchNode* child) const;
+  double getEndingWhiteScoreBonus(const SearchNode& parent, Loc moveLoc) const;
+
+  //Visits by which the child of edge counts within its parent, given the child's own visits.
+  //With graph search, only the playouts through this edge, since the child may also be reached through other parents.
+  int64_t getEdgeVisits(const SearchChild& edge, int64_t childVisits) const;
 
   void getValueChildWeights(
     int numChildren,
@@ -299,7 +472,7 @@ private:
   ) const;
 
   //Parent must be locked
-  void getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchNode* child, double& lcbBuf, double& radiusBuf) const;
+  void getSelfUtilityLCBAndRadius(const SearchNode& parent, const SearchChild& edge, double& lcbBuf, double& radiusBuf) const;
 
   double getExploreSelectionValue(
     double nnPolicyProb, int64_t totalChildVisits, int64_t childVisits,
@@ -315,35 +488,65 @@ private:
   ) const;
 
   //Parent must be locked
-  double getExploreSelectionValue(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const;
+  double getExploreSelectionValue(const SearchNode& parent, const SearchChild& edge, int64_t totalChildVisits, double fpuValue, bool isRootDuringSearch) const;
   double getNewExploreSelectionValue(const SearchNode& parent, int movePos, int64_t totalChildVisits, double fpuValue) const;
 
   //Parent must be locked
-  int64_t getReducedPlaySelectionVisits(const SearchNode& parent, const SearchNode* child, int64_t totalChildVisits, double bestChildExploreSelectionValue) const;
+  int64_t getReducedPlaySelectionVisits(const SearchNode& parent, const SearchChild& edge, int64_t totalChildVisits, double bestChildExploreSelectionValue) const;
 
   double getFpuValueForChildrenAssumeVisited(const SearchNode& node, Player pla, bool isRoot, double policyProbMassVisited, double& parentUtility) const;
 
-  void updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int32_t virtualLossesToSubtract, bool isRoot);
+  //childIdx is the child of node that the playout went through
+  void updateStatsAfterPlayout(SearchNode& node, SearchThread& thread, int childIdx, int32_t virtualLossesToSubtract, bool isRoot);
+  bool canBackupIncrementally(bool isRoot) const;
   void recomputeNodeStats(SearchNode& node, SearchThread& thread, int numVisitsToAdd, int32_t virtualLossesToSubtract, bool isRoot);
-  void recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot);
+  //With graph search, visited tracks nodes already recomputed so that shared nodes are only done once
+  void recursivelyRecomputeStats(SearchNode& node, SearchThread& thread, bool isRoot, std::unordered_set<const SearchNode*>* visited);
 
   void maybeRecomputeNormToTApproxTable();
   double getNormToTApproxForLCB(int64_t numVisits) const;
 
   void selectBestChildToDescend(
-    const SearchThread& thread, const SearchNode& node, int& bestChildIdx, Loc& bestChildMoveLoc,
+    SearchThread& thread, const SearchNode& node, int& bestChildIdx, Loc& bestChildMoveLoc,
     bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE],
     bool isRoot
   ) const;
 
-  void addLeafValue(SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, int32_t virtualLossesToSubtract, bool isCertain);
+  //Lock a node mutex during a playout, accumulating into nodeLockWaitNanos if it had to wait
+  void lockNodeMutexForPlayout(std::mutex& mutex);
+  void addLeafValue(SearchThread& thread, SearchNode& node, double winValue, double noResultValue, double scoreMean, double scoreMeanSq, int32_t virtualLossesToSubtract, bool isCertain);
 
   void initNodeNNOutput(
     SearchThread& thread, SearchNode& node,
     bool isRoot, bool skipCache, int32_t virtualLossesToSubtract, bool isReInit
   );
 
-  void playoutDescend(
+  //Hand off an arena to the reclaimer to be released
+  void deferReleaseArena(SearchNodeArena* arena);
+
+  //Make sure there are searchThreads for numThreads, reset for this search, with workers for all but the first
+  void prepareSearchThreads(int numThreads, Logger& logger);
+  void workerLoop(int threadIdx, int64_t seenGeneration);
+
+  //Move node and its subtree into the arena of alloc, returning the new copy of node.
+  //With graph search, nodes shared between parents are copied only once, tracked by copies, and added to nodeTable.
+  SearchNode* compactSubtree(SearchNode& node, SearchNodeAllocator& alloc, std::unordered_map<const SearchNode*,SearchNode*>* copies);
+  //Count node and the nodes of its subtree, stopping early once at least maxCount are found.
+  //With graph search, seen tracks the nodes already counted so that shared ones are counted once.
+  int64_t countSubtreeNodesUpTo(const SearchNode& node, int64_t maxCount, std::unordered_set<const SearchNode*>* seen) const;
+
+  //Graph hash for the position the thread is at, having just made moveLoc from parent
+  Hash128 getChildGraphHash(const SearchNode& parent, const SearchThread& thread, Loc moveLoc, bool moveCaptured, bool& isPathDependent) const;
+  void setRootGraphHash();
+
+  //Make a move on the thread's board and history, recording it for undo if necessary
+  void makeThreadMove(SearchThread& thread, Loc moveLoc) const;
+  //Restore the thread's board and history back to the root after a playout
+  void resetThreadToRoot(SearchThread& thread) const;
+
+  //Returns false if the playout stopped at a leaf whose evaluation was deferred, in which case nothing was backed up
+  //and node was appended to the path of the last of thread.pendingLeaves.
+  bool playoutDescend(
     SearchThread& thread, SearchNode& node,
     bool posesWithChildBuf[NNPos::MAX_NN_POLICY_SIZE],
     bool isRoot, int32_t virtualLossesToSubtract
@@ -18,6 +18,8 @@ SearchParams::SearchParams()
    valueWeightExponent(0.5),
    visitsExponent(1.0),
    scaleParentWeight(true),
+   useIncrementalBackup(false),
+   incrementalBackupFullRecomputeVisits(1000),
    rootNoiseEnabled(false),
    rootDirichletNoiseTotalConcentration(10.83),
    rootDirichletNoiseWeight(0.25),
@@ -35,8 +37,12 @@ SearchParams::SearchParams()
    minVisitPropForLCB(0.05),
    rootEndingBonusPoints(0.0),
    rootPruneUselessMoves(false),
+   useGraphSearch(false),
+   maxNodeArenaSizeFactor(1.5),
    mutexPoolSize(8192),
    numVirtualLossesPerThread(3),
+   useUndoForPlayoutReset(true),
+   numLeavesPerThread(1),
    numThreads(1),
    maxVisits(((int64_t)1) << 50),
    maxPlayouts(((int64_t)1) << 50),
@@ -22,6 +22,10 @@ struct SearchParams {
 
   bool scaleParentWeight; //Also scale parent weight when applying valueWeightExponent?
 
+  //Backup parameters
+  bool useIncrementalBackup; //Add each playout's leaf value to the nodes along its path rather than recomputing them from all their children
+  int64_t incrementalBackupFullRecomputeVisits; //With incremental backup, still recompute a node from its children every this many visits, 0 = never
+
   //Root parameters
   bool rootNoiseEnabled;
   double rootDirichletNoiseTotalConcentration; //Same as alpha * board size, to match alphazero this might be 0.03 * 361, total number of balls in the urn
@@ -49,9 +53,21 @@ struct SearchParams {
   double rootEndingBonusPoints; //Extra bonus (or penalty) to encourage good passing behavior at the end of the game.
   bool rootPruneUselessMoves; //Prune moves that are entirely useless moves that prolong the game.
 
+  //Graph search
+  bool useGraphSearch; //Share nodes between positions reached by different move orders, rather than searching each separately
+
+  //Tree reuse
+  double maxNodeArenaSizeFactor; //On makeMove, keep searching in the same node arena only if it holds at most this many times
+                                 //the nodes of the kept subtree, otherwise compact the subtree into a fresh arena.
+                                 //Discarded nodes and their nnOutputs stay allocated until compacted away, so this bounds
+                                 //their memory to (this - 1) times that of the tree in use.
+
   //Threading-related
   uint32_t mutexPoolSize; //Size of mutex pool for synchronizing access to all search nodes
   int32_t numVirtualLossesPerThread; //Number of virtual losses for one thread to add
+  bool useUndoForPlayoutReset; //After each playout, undo the moves made rather than copying the root board and history back
+  int numLeavesPerThread; //Number of playouts each thread descends before evaluating all of their leaves together in one batch
+                          //Each waiting leaf keeps only its moves, at most the nn max batch size are replayed at a time
 
   //Asyncbot
   int numThreads; //Number of threads
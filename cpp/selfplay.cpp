@@ -35,11 +35,11 @@ static void signalHandler(int signal)
 //Wraps together a neural net and handles for outputting training data for it.
 //There should be one of these active per currently-loaded neural net, and one active thread
 //looping and actually performing the data output
-//DOES take ownership of the NNEvaluators
+//Shares ownership of the NNEvaluator, which with switchNetsMidGame, successive nets reuse by swapping models
 namespace {
   struct NetAndStuff {
     string modelName;
-    NNEvaluator* nnEval;
+    std::shared_ptr<NNEvaluator> nnEval;
     MatchPairer* matchPairer;
     double validationProp;
 
@@ -55,7 +55,7 @@ namespace {
 
   public:
     NetAndStuff(
-      ConfigParser& cfg, const string& name, NNEvaluator* neval, int maxDQueueSize,
+      ConfigParser& cfg, const string& name, const std::shared_ptr<NNEvaluator>& neval, int maxDQueueSize,
       TrainingDataWriter* tdWriter, TrainingDataWriter* vdWriter, ofstream* sOut, double vProp
     )
       :modelName(name),
@@ -79,12 +79,11 @@ namespace {
       //ever gives is the trivial self-pairing, but we use it also for keeping the game count and some logging.
       bool forSelfPlay = true;
       bool forGateKeeper = false;
-      matchPairer = new MatchPairer(cfg, 1, {modelName}, {nnEval}, {baseParams}, forSelfPlay, forGateKeeper);
+      matchPairer = new MatchPairer(cfg, 1, {modelName}, {nnEval.get()}, {baseParams}, forSelfPlay, forGateKeeper);
     }
 
     ~NetAndStuff() {
       delete matchPairer;
-      delete nnEval;
       delete tdataWriter;
       delete vdataWriter;
       if(sgfOut != NULL)
@@ -291,6 +290,13 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
     //block anyone else
     logger.write(netAndStuff->nnEval->getModelFileName());
     logger.write("NN rows: " + Global::int64ToString(netAndStuff->nnEval->numRowsProcessed()));
+    logger.write("NN coalesced requests: " + Global::int64ToString(netAndStuff->nnEval->numCoalescedRequests()));
+    uint64_t cacheHits, cacheMisses, cacheEvictions;
+    netAndStuff->nnEval->getCacheStats(cacheHits,cacheMisses,cacheEvictions);
+    logger.write(
+      "NN cache hits/misses/evictions: " + Global::uint64ToString(cacheHits) + " " +
+      Global::uint64ToString(cacheMisses) + " " + Global::uint64ToString(cacheEvictions)
+    );
     logger.write("NN batches: " + Global::int64ToString(netAndStuff->nnEval->numBatchesProcessed()));
     logger.write("NN avg batch size: " + Global::doubleToString(netAndStuff->nnEval->averageProcessedBatchSize()));
 
@@ -313,7 +319,8 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
 
   auto loadLatestNeuralNet =
     [inputsVersion,maxDataQueueSize,maxRowsPerTrainFile,maxRowsPerValFile,firstFileRandMinProp,dataBoardLen,
-     &modelsDir,&outputDir,&logger,&cfg,validationProp,numGameThreads](const string* lastNetName) -> NetAndStuff* {
+     &modelsDir,&outputDir,&logger,&cfg,validationProp,numGameThreads,switchNetsMidGame,
+     &netAndStuffsMutex,&netAndStuffs](const string* lastNetName) -> NetAndStuff* {
 
     string modelName;
     string modelFile;
@@ -332,13 +339,6 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
     int maxConcurrentEvals = cfg.getInt("numSearchThreads") * numGameThreads * 2 + 16;
 
     Rand rand;
-    vector<NNEvaluator*> nnEvals =
-      Setup::initializeNNEvaluators(
-        {modelName},{modelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefault,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1
-      );
-    assert(nnEvals.size() == 1);
-    NNEvaluator* nnEval = nnEvals[0];
-    logger.write("Loaded latest neural net " + modelName + " from: " + modelFile);
 
     string modelOutputDir = outputDir + "/" + modelName;
     string sgfOutputDir = modelOutputDir + "/sgfs";
@@ -382,6 +382,36 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
       out.close();
     }
 
+    std::shared_ptr<NNEvaluator> nnEval;
+    //Since games switch to the newest net anyways, swap it into the current evaluator rather than standing up
+    //another one, which saves the time and memory to set up the backend and have both running at once
+    if(switchNetsMidGame) {
+      std::shared_ptr<NNEvaluator> currentNNEval;
+      {
+        std::lock_guard<std::mutex> lock(netAndStuffsMutex);
+        if(netAndStuffs.size() > 0)
+          currentNNEval = netAndStuffs[netAndStuffs.size()-1]->nnEval;
+      }
+      if(currentNNEval != nullptr) {
+        try {
+          currentNNEval->swapModel(modelName,modelFile,0,&logger);
+          nnEval = currentNNEval;
+        }
+        catch(const StringError& e) {
+          logger.write(string("Could not swap in new neural net, loading it separately instead: ") + e.what());
+        }
+      }
+    }
+    if(nnEval == nullptr) {
+      vector<NNEvaluator*> nnEvals =
+        Setup::initializeNNEvaluators(
+          {modelName},{modelFile},cfg,logger,rand,maxConcurrentEvals,debugSkipNeuralNetDefault,false,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,-1
+        );
+      assert(nnEvals.size() == 1);
+      nnEval = std::shared_ptr<NNEvaluator>(nnEvals[0]);
+    }
+    logger.write("Loaded latest neural net " + modelName + " from: " + modelFile);
+
     //Note that this inputsVersion passed here is NOT necessarily the same as the one used in the neural net self play, it
     //simply controls the input feature version for the written data
     TrainingDataWriter* tdataWriter = new TrainingDataWriter(
@@ -451,7 +481,7 @@ int MainCmds::selfplay(int argc, const char* const* argv) {
         netAndStuff = newNetAndStuff;
         prevModelName = netAndStuff->modelName;
         logger.write("Game loop thread " + Global::intToString(threadIdx) + " changing midgame to new neural net: " + prevModelName);
-        return netAndStuff->nnEval;
+        return netAndStuff->nnEval.get();
       };
 
       FinishedGameData* gameData = NULL;
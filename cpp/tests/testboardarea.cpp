@@ -16,6 +16,10 @@ void Tests::runBoardAreaTests() {
       bool unsafeBigTerritories = (mode >= 4);
       Board copy(board);
       copy.calculateArea(result,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+      Color referenceResult[Board::MAX_ARR_SIZE];
+      copy.calculateAreaReference(referenceResult,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+      for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+        testAssert(result[i] == referenceResult[i]);
       out << "Safe big territories " << safeBigTerritories << " "
       << "Unsafe big territories " << unsafeBigTerritories << " "
       << "Non pass alive stones " << nonPassAliveStones << " "
@@ -1347,6 +1351,86 @@ NonPassAliveSelfConn white
 ----0-1-0
 -0-0-----
 
+)%%";
+    expect(name,out,expected);
+  }
+
+  //============================================================================
+  {
+    const char* name = "Bitboard area matches reference on random boards";
+    Rand rand("runBoardAreaTests random boards");
+
+    int numPositions = 0;
+    int numMarkedStones = 0;
+    int numMarkedEmpty = 0;
+    auto checkAgainstReference = [&](const Board& board) {
+      for(int mode = 0; mode < 16; mode++) {
+        bool multiStoneSuicideLegal = (mode & 1) != 0;
+        bool nonPassAliveStones = (mode & 2) != 0;
+        bool safeBigTerritories = (mode & 4) != 0;
+        bool unsafeBigTerritories = (mode & 8) != 0;
+        Color result[Board::MAX_ARR_SIZE];
+        Color referenceResult[Board::MAX_ARR_SIZE];
+        board.calculateArea(result,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+        board.calculateAreaReference(referenceResult,nonPassAliveStones,safeBigTerritories,unsafeBigTerritories,multiStoneSuicideLegal);
+        for(int i = 0; i<Board::MAX_ARR_SIZE; i++)
+          testAssert(result[i] == referenceResult[i]);
+        if(mode == 0) {
+          for(int y = 0; y<board.y_size; y++) {
+            for(int x = 0; x<board.x_size; x++) {
+              Loc loc = Location::getLoc(x,y,board.x_size);
+              if(result[loc] != C_EMPTY) {
+                if(board.colors[loc] == C_EMPTY)
+                  numMarkedEmpty++;
+                else
+                  numMarkedStones++;
+              }
+            }
+          }
+        }
+      }
+      numPositions++;
+    };
+
+    //Random play that avoids filling its own eyes, so that boards end up with plenty of pass-alive groups
+    const int sizes[8][2] = {{19,19},{19,19},{13,13},{9,9},{7,5},{19,3},{2,17},{1,1}};
+    for(int game = 0; game < 40; game++) {
+      int xSize = sizes[game % 8][0];
+      int ySize = sizes[game % 8][1];
+      bool multiStoneSuicideLegal = rand.nextBool(0.5);
+      Board board(xSize,ySize);
+      Player pla = P_BLACK;
+      int numPassesInARow = 0;
+      for(int turn = 0; turn < xSize * ySize * 3 && numPassesInARow < 2; turn++) {
+        vector<Loc> moves;
+        for(int y = 0; y<ySize; y++) {
+          for(int x = 0; x<xSize; x++) {
+            Loc loc = Location::getLoc(x,y,xSize);
+            if(board.isLegal(loc,pla,multiStoneSuicideLegal) && !board.isSimpleEye(loc,pla))
+              moves.push_back(loc);
+          }
+        }
+        if(moves.size() == 0) {
+          numPassesInARow++;
+        }
+        else {
+          numPassesInARow = 0;
+          board.playMoveAssumeLegal(moves[rand.nextUInt((uint32_t)moves.size())],pla);
+        }
+        pla = getOpp(pla);
+        if(rand.nextBool(0.1))
+          checkAgainstReference(board);
+      }
+      checkAgainstReference(board);
+    }
+
+    out << "numPositions " << numPositions << endl;
+    out << "numMarkedStones " << numMarkedStones << endl;
+    out << "numMarkedEmpty " << numMarkedEmpty << endl;
+    string expected = R"%%(
+numPositions 755
+numMarkedStones 45437
+numMarkedEmpty 7097
 )%%";
     expect(name,out,expected);
   }
@@ -0,0 +1,153 @@
+#include "../tests/tests.h"
+
+#include "../core/timer.h"
+#include "../neuralnet/nninputs.h"
+#include "../search/childselection.h"
+
+using namespace std;
+using namespace TestCommon;
+
+namespace {
+  struct RandomChildren {
+    ChildSelection::ExistingChildParams params;
+    double fpuValue;
+    int numChildren;
+    int policySize;
+    vector<float> policyProbs;
+    vector<double> visits;
+    vector<double> utilities;
+    vector<double> virtualLosses;
+    vector<float> newPolicyProbs;
+    bool excluded[NNPos::MAX_NN_POLICY_SIZE];
+
+    RandomChildren(Rand& rand, int nChildren, int pSize)
+      :params(),fpuValue(0.0),numChildren(nChildren),policySize(pSize),
+       policyProbs(nChildren),visits(nChildren),utilities(nChildren),virtualLosses(nChildren),
+       newPolicyProbs(pSize)
+    {
+      params.cpuctExploration = rand.nextDouble(0.2,3.0);
+      params.plaIsWhite = rand.nextBool(0.5);
+      params.virtualLossUtility = params.plaIsWhite ? -1.3 : 1.3;
+      params.rootDesiredPerChildVisitsCoeff = rand.nextBool(0.3) ? rand.nextDouble(0.5,4.0) : 0.0;
+      fpuValue = rand.nextDouble(-1.0,1.0);
+
+      int64_t totalChildVisits = 0;
+      for(int i = 0; i<numChildren; i++) {
+        //Illegal moves, and repeated values to check that ties go to the lowest index
+        if(rand.nextBool(0.05))
+          policyProbs[i] = -1.0f;
+        else
+          policyProbs[i] = (float)rand.nextDouble(0.0,0.3);
+        visits[i] = rand.nextBool(0.1) ? 0.0 : (double)rand.nextUInt(2000);
+        utilities[i] = visits[i] <= 0 ? fpuValue : rand.nextDouble(-1.2,1.2);
+        virtualLosses[i] = rand.nextBool(0.2) ? (double)rand.nextUInt(4) : 0.0;
+        if(i > 0 && rand.nextBool(0.1)) {
+          int j = rand.nextUInt(i);
+          policyProbs[i] = policyProbs[j];
+          visits[i] = visits[j];
+          utilities[i] = utilities[j];
+          virtualLosses[i] = virtualLosses[j];
+        }
+        totalChildVisits += (int64_t)visits[i];
+      }
+      //With multithreading the total may lag behind individual children
+      if(rand.nextBool(0.2))
+        totalChildVisits = totalChildVisits / 2;
+      params.totalChildVisits = totalChildVisits;
+
+      for(int i = 0; i<policySize; i++) {
+        if(rand.nextBool(0.05))
+          newPolicyProbs[i] = -1.0f;
+        else if(rand.nextBool(0.1) && i > 0)
+          newPolicyProbs[i] = newPolicyProbs[rand.nextUInt(i)];
+        else
+          newPolicyProbs[i] = (float)rand.nextDouble(0.0,0.05);
+        excluded[i] = rand.nextBool(0.3);
+      }
+    }
+  };
+}
+
+void Tests::runChildSelectionTests() {
+  Rand rand("runChildSelectionTests");
+  for(int rep = 0; rep<2000; rep++) {
+    int numChildren = rand.nextBool(0.5) ? rand.nextUInt(12) : rand.nextUInt(NNPos::MAX_NN_POLICY_SIZE+1);
+    int policySize = rand.nextUInt(NNPos::MAX_NN_POLICY_SIZE+1);
+    RandomChildren c(rand,numChildren,policySize);
+
+    double maxValue;
+    double maxValueScalar;
+    int idx = ChildSelection::selectBestExisting(
+      c.params, c.numChildren, c.policyProbs.data(), c.visits.data(), c.utilities.data(), c.virtualLosses.data(), maxValue
+    );
+    int idxScalar = ChildSelection::selectBestExistingScalar(
+      c.params, c.numChildren, c.policyProbs.data(), c.visits.data(), c.utilities.data(), c.virtualLosses.data(), maxValueScalar
+    );
+    testAssert(idx == idxScalar);
+    testAssert(maxValue == maxValueScalar);
+    testAssert(idx >= -1 && idx < c.numChildren);
+    if(idx < 0)
+      testAssert(maxValue == ChildSelection::ILLEGAL_SELECTION_VALUE);
+
+    idx = ChildSelection::selectBestNew(
+      c.params.cpuctExploration, c.params.totalChildVisits, c.fpuValue, c.params.plaIsWhite,
+      c.policySize, c.newPolicyProbs.data(), c.excluded, maxValue
+    );
+    idxScalar = ChildSelection::selectBestNewScalar(
+      c.params.cpuctExploration, c.params.totalChildVisits, c.fpuValue, c.params.plaIsWhite,
+      c.policySize, c.newPolicyProbs.data(), c.excluded, maxValueScalar
+    );
+    testAssert(idx == idxScalar);
+    testAssert(maxValue == maxValueScalar);
+    if(idx >= 0)
+      testAssert(!c.excluded[idx] && c.newPolicyProbs[idx] >= 0);
+  }
+}
+
+void Tests::runChildSelectionBenchmark() {
+  cout << "Child selection implementation: " << ChildSelection::getImplementationName() << endl;
+
+  Rand rand("runChildSelectionBenchmark");
+  const int numChildrenToTest[5] = {4, 16, 64, 200, NNPos::MAX_NN_POLICY_SIZE};
+  for(int n = 0; n<5; n++) {
+    int numChildren = numChildrenToTest[n];
+    RandomChildren c(rand,numChildren,NNPos::MAX_NN_POLICY_SIZE);
+    const int numReps = 4000000 / (numChildren + NNPos::MAX_NN_POLICY_SIZE);
+
+    double sink = 0.0;
+    double maxValue;
+    ClockTimer timer;
+    for(int rep = 0; rep<numReps; rep++) {
+      sink += ChildSelection::selectBestExistingScalar(
+        c.params, c.numChildren, c.policyProbs.data(), c.visits.data(), c.utilities.data(), c.virtualLosses.data(), maxValue
+      );
+      sink += maxValue;
+      sink += ChildSelection::selectBestNewScalar(
+        c.params.cpuctExploration, c.params.totalChildVisits, c.fpuValue, c.params.plaIsWhite,
+        c.policySize, c.newPolicyProbs.data(), c.excluded, maxValue
+      );
+      sink += maxValue;
+    }
+    double scalarSeconds = timer.getSeconds();
+
+    timer.reset();
+    for(int rep = 0; rep<numReps; rep++) {
+      sink += ChildSelection::selectBestExisting(
+        c.params, c.numChildren, c.policyProbs.data(), c.visits.data(), c.utilities.data(), c.virtualLosses.data(), maxValue
+      );
+      sink += maxValue;
+      sink += ChildSelection::selectBestNew(
+        c.params.cpuctExploration, c.params.totalChildVisits, c.fpuValue, c.params.plaIsWhite,
+        c.policySize, c.newPolicyProbs.data(), c.excluded, maxValue
+      );
+      sink += maxValue;
+    }
+    double vectorSeconds = timer.getSeconds();
+
+    cout << "numChildren " << numChildren
+         << " scalar " << Global::strprintf("%.1f", scalarSeconds / numReps * 1e9) << " ns/selection"
+         << " vectorized " << Global::strprintf("%.1f", vectorSeconds / numReps * 1e9) << " ns/selection"
+         << " speedup " << Global::strprintf("%.2f", scalarSeconds / vectorSeconds)
+         << (sink == 12345.678 ? " " : "") << endl;
+  }
+}
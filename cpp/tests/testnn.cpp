@@ -1,5 +1,10 @@
 #include "../tests/tests.h"
 #include "../neuralnet/nninterface.h"
+#include "../neuralnet/nneval.h"
+#include "../neuralnet/nndiskcache.h"
+#include "../core/os.h"
+
+#include <fstream>
 
 #include <cmath>
 
@@ -846,7 +851,7 @@ static void testSymmetries(int64_t& numTestsRun) {
   auto testConfigurations = [&](
     const string& label,
     int batchSize, int numChannels, int nnXLen, int nnYLen,
-    const bool* symmetries,
+    const vector<int>& symmetries,
     const vector<float>& input, const vector<float>& expected
   ) {
     for(int useNHWC = 0; useNHWC <= 1; useNHWC++) {
@@ -856,7 +861,7 @@ static void testSymmetries(int64_t& numTestsRun) {
 
         vector<float> outputThisLoop;
         bool supported = NeuralNet::testEvaluateSymmetry(
-          batchSize,numChannels,nnXLen,nnYLen,useFP16,useNHWC,symmetries,inputThisLoop,outputThisLoop
+          batchSize,numChannels,nnXLen,nnYLen,useFP16,useNHWC,symmetries.data(),inputThisLoop,outputThisLoop
         );
 
         if(supported) {
@@ -892,7 +897,7 @@ static void testSymmetries(int64_t& numTestsRun) {
 
     {
       string label("Symmetry 0");
-      bool symmetries[3] = {false,false,false};
+      int symmetry = 0;
       //NCHW
       vector<float> expected({
         0,1,2,
@@ -907,13 +912,13 @@ static void testSymmetries(int64_t& numTestsRun) {
         1,1,1,
         1,0,1,
       });
-      testConfigurations(label,3,1,nnXLen,nnYLen,symmetries,input,expected);
-      testConfigurations(label,1,3,nnXLen,nnYLen,symmetries,input,expected);
+      testConfigurations(label,3,1,nnXLen,nnYLen,vector<int>(3,symmetry),input,expected);
+      testConfigurations(label,1,3,nnXLen,nnYLen,vector<int>(1,symmetry),input,expected);
     }
 
     {
       string label("Symmetry 1");
-      bool symmetries[3] = {true,false,false};
+      int symmetry = 1;
       //NCHW
       vector<float> expected({
         6,7,8,
@@ -928,13 +933,13 @@ static void testSymmetries(int64_t& numTestsRun) {
         1,1,1,
         1,0,0,
       });
-      testConfigurations(label,3,1,nnXLen,nnYLen,symmetries,input,expected);
-      testConfigurations(label,1,3,nnXLen,nnYLen,symmetries,input,expected);
+      testConfigurations(label,3,1,nnXLen,nnYLen,vector<int>(3,symmetry),input,expected);
+      testConfigurations(label,1,3,nnXLen,nnYLen,vector<int>(1,symmetry),input,expected);
     }
 
     {
       string label("Symmetry 2");
-      bool symmetries[3] = {false,true,false};
+      int symmetry = 2;
       //NCHW
       vector<float> expected({
         2,1,0,
@@ -949,13 +954,13 @@ static void testSymmetries(int64_t& numTestsRun) {
         1,1,1,
         1,0,1,
       });
-      testConfigurations(label,3,1,nnXLen,nnYLen,symmetries,input,expected);
-      testConfigurations(label,1,3,nnXLen,nnYLen,symmetries,input,expected);
+      testConfigurations(label,3,1,nnXLen,nnYLen,vector<int>(3,symmetry),input,expected);
+      testConfigurations(label,1,3,nnXLen,nnYLen,vector<int>(1,symmetry),input,expected);
     }
 
     {
       string label("Symmetry 3");
-      bool symmetries[3] = {true,true,false};
+      int symmetry = 3;
       //NCHW
       vector<float> expected({
         8,7,6,
@@ -970,13 +975,13 @@ static void testSymmetries(int64_t& numTestsRun) {
         1,1,1,
         0,0,1,
       });
-      testConfigurations(label,3,1,nnXLen,nnYLen,symmetries,input,expected);
-      testConfigurations(label,1,3,nnXLen,nnYLen,symmetries,input,expected);
+      testConfigurations(label,3,1,nnXLen,nnYLen,vector<int>(3,symmetry),input,expected);
+      testConfigurations(label,1,3,nnXLen,nnYLen,vector<int>(1,symmetry),input,expected);
     }
 
     {
       string label("Symmetry 4");
-      bool symmetries[3] = {false,false,true};
+      int symmetry = 4;
       //NCHW
       vector<float> expected({
         0,3,6,
@@ -991,13 +996,13 @@ static void testSymmetries(int64_t& numTestsRun) {
         0,1,0,
         0,1,1,
       });
-      testConfigurations(label,3,1,nnXLen,nnYLen,symmetries,input,expected);
-      testConfigurations(label,1,3,nnXLen,nnYLen,symmetries,input,expected);
+      testConfigurations(label,3,1,nnXLen,nnYLen,vector<int>(3,symmetry),input,expected);
+      testConfigurations(label,1,3,nnXLen,nnYLen,vector<int>(1,symmetry),input,expected);
     }
 
     {
       string label("Symmetry 6");
-      bool symmetries[3] = {false,true,true};
+      int symmetry = 6;
       //NCHW
       vector<float> expected({
         2,5,8,
@@ -1012,8 +1017,28 @@ static void testSymmetries(int64_t& numTestsRun) {
         0,1,0,
         1,1,1,
       });
+      testConfigurations(label,3,1,nnXLen,nnYLen,vector<int>(3,symmetry),input,expected);
+      testConfigurations(label,1,3,nnXLen,nnYLen,vector<int>(1,symmetry),input,expected);
+    }
+
+    {
+      string label("Different symmetry per row");
+      vector<int> symmetries({2,4,3});
+      //NCHW
+      vector<float> expected({
+        2,1,0,
+        5,4,3,
+        8,7,6,
+
+        3,0,0,
+        0,5,6,
+        4,0,0,
+
+        1,0,1,
+        1,1,1,
+        0,0,1,
+      });
       testConfigurations(label,3,1,nnXLen,nnYLen,symmetries,input,expected);
-      testConfigurations(label,1,3,nnXLen,nnYLen,symmetries,input,expected);
     }
 
   }
@@ -1034,3 +1059,463 @@ void Tests::runNNLayerTests() {
   cout << "Tested " << numTestsRun << " configurations" << endl;
   cout << "Done" << endl;
 }
+
+static shared_ptr<NNOutput> makeCacheTestOutput(Rand& rand, int nnXLen, int nnYLen, bool withOwnerMap) {
+  shared_ptr<NNOutput> output = std::make_shared<NNOutput>();
+  output->nnHash = Hash128(rand.nextUInt64(),rand.nextUInt64());
+  output->whiteWinProb = (float)rand.nextDouble();
+  output->whiteLossProb = (float)rand.nextDouble();
+  output->whiteNoResultProb = (float)rand.nextDouble();
+  output->whiteScoreMean = (float)rand.nextGaussian() * 20.0f;
+  output->whiteScoreMeanSq = (float)rand.nextDouble() * 400.0f;
+  int policySize = NNPos::getPolicySize(nnXLen,nnYLen);
+  double policySum = 0.0;
+  for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++) {
+    output->policyProbs[i] = i >= policySize || rand.nextBool(0.2) ? -1.0f : (float)(rand.nextDouble() * rand.nextDouble());
+    if(output->policyProbs[i] >= 0.0f)
+      policySum += output->policyProbs[i];
+  }
+  for(int i = 0; i<policySize; i++) {
+    if(output->policyProbs[i] >= 0.0f)
+      output->policyProbs[i] = (float)(output->policyProbs[i] / policySum);
+  }
+  output->nnXLen = nnXLen;
+  output->nnYLen = nnYLen;
+  if(withOwnerMap) {
+    output->whiteOwnerMap = new float[nnXLen*nnYLen];
+    for(int i = 0; i<nnXLen*nnYLen; i++)
+      output->whiteOwnerMap[i] = (float)(rand.nextDouble() * 2.0 - 1.0);
+  }
+  return output;
+}
+
+static bool cachedOutputMatches(const NNOutput& cached, const NNOutput& expected) {
+  //Values are stored exactly, policy and ownership as half precision, with policy renormalized after
+  if(cached.nnHash != expected.nnHash ||
+     cached.whiteWinProb != expected.whiteWinProb ||
+     cached.whiteLossProb != expected.whiteLossProb ||
+     cached.whiteNoResultProb != expected.whiteNoResultProb ||
+     cached.whiteScoreMean != expected.whiteScoreMean ||
+     cached.whiteScoreMeanSq != expected.whiteScoreMeanSq ||
+     cached.nnXLen != expected.nnXLen ||
+     cached.nnYLen != expected.nnYLen)
+    return false;
+  double policySum = 0.0;
+  for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++) {
+    if(std::abs(cached.policyProbs[i] - expected.policyProbs[i]) > 0.001f * std::max(1e-4f,std::abs(expected.policyProbs[i])))
+      return false;
+    if(cached.policyProbs[i] > 0.0f)
+      policySum += cached.policyProbs[i];
+  }
+  if(std::abs(policySum - 1.0) > 1e-5)
+    return false;
+  if((cached.whiteOwnerMap == NULL) != (expected.whiteOwnerMap == NULL))
+    return false;
+  if(expected.whiteOwnerMap != NULL) {
+    for(int i = 0; i<expected.nnXLen*expected.nnYLen; i++) {
+      if(std::abs(cached.whiteOwnerMap[i] - expected.whiteOwnerMap[i]) > 0.001f)
+        return false;
+    }
+  }
+  return true;
+}
+
+void Tests::runNNCacheTests() {
+  cout << "Running nn cache tests" << endl;
+  Rand rand("runNNCacheTests");
+
+  //Roundtrip and stats
+  {
+    int nnXLen = 19;
+    int nnYLen = 17;
+    NNCacheTable table(1 << 12, nnXLen, nnYLen, 1.0, 4);
+    testAssert(table.getNumEntries() == (1 << 12));
+    vector<shared_ptr<NNOutput>> outputs;
+    vector<shared_ptr<NNOutput>> originals;
+    for(int i = 0; i<200; i++) {
+      outputs.push_back(makeCacheTestOutput(rand,nnXLen,nnYLen,i % 2 == 0));
+      originals.push_back(std::make_shared<NNOutput>(*outputs.back()));
+      table.set(outputs.back(),0);
+      testAssert(cachedOutputMatches(*outputs.back(),*originals.back()));
+    }
+    shared_ptr<NNOutput> result;
+    int numFound = 0;
+    for(int i = 0; i<(int)outputs.size(); i++) {
+      if(table.get(outputs[i]->nnHash,0,result)) {
+        testAssert(cachedOutputMatches(*result,*originals[i]));
+        //Exactly what the evaluation that stored it was given
+        for(int j = 0; j<NNPos::MAX_NN_POLICY_SIZE; j++)
+          testAssert(result->policyProbs[j] == outputs[i]->policyProbs[j]);
+        if(result->whiteOwnerMap != NULL) {
+          for(int j = 0; j<nnXLen*nnYLen; j++)
+            testAssert(result->whiteOwnerMap[j] == outputs[i]->whiteOwnerMap[j]);
+        }
+        numFound++;
+      }
+    }
+    //Each bucket has 4 ways, so a few entries might have been evicted
+    testAssert(numFound >= 190);
+    testAssert(numFound + table.numEvictions() == outputs.size());
+    testAssert(!table.get(Hash128(rand.nextUInt64(),rand.nextUInt64()),0,result));
+    testAssert(result == nullptr);
+    testAssert(table.numHits() == (uint64_t)numFound);
+    testAssert(table.numMisses() == (uint64_t)(outputs.size() - numFound + 1));
+
+    table.clear();
+    table.clearStats();
+    testAssert(!table.get(outputs[0]->nnHash,0,result));
+    testAssert(table.numHits() == 0 && table.numMisses() == 1 && table.numEvictions() == 0);
+  }
+
+  //Clock eviction within a single bucket, and ownermaps only kept for some entries
+  {
+    int nnXLen = 9;
+    int nnYLen = 9;
+    NNCacheTable table(NNCacheTable::NUM_WAYS, nnXLen, nnYLen, 1.0, 0);
+    vector<shared_ptr<NNOutput>> outputs;
+    for(int i = 0; i<NNCacheTable::NUM_WAYS; i++) {
+      outputs.push_back(makeCacheTestOutput(rand,nnXLen,nnYLen,true));
+      table.set(outputs.back(),0);
+    }
+    testAssert(table.numEvictions() == 0);
+
+    //Looking up entry 0 gives it a second chance, so the next insert evicts entry 1
+    shared_ptr<NNOutput> result;
+    testAssert(table.get(outputs[0]->nnHash,0,result));
+    shared_ptr<NNOutput> extra = makeCacheTestOutput(rand,nnXLen,nnYLen,false);
+    table.set(extra,0);
+    testAssert(table.numEvictions() == 1);
+    testAssert(table.get(outputs[0]->nnHash,0,result));
+    testAssert(cachedOutputMatches(*result,*outputs[0]));
+    testAssert(!table.get(outputs[1]->nnHash,0,result));
+    testAssert(table.get(extra->nnHash,0,result));
+    testAssert(result->whiteOwnerMap == NULL);
+    for(int i = 2; i<NNCacheTable::NUM_WAYS; i++)
+      testAssert(table.get(outputs[i]->nnHash,0,result));
+
+    //Setting the same hash again replaces it in place
+    table.set(outputs[2],0);
+    testAssert(table.numEvictions() == 1);
+  }
+
+  //Entries from another model generation are never found, nor are their ownermaps, and are free to replace
+  {
+    int nnXLen = 9;
+    int nnYLen = 9;
+    NNCacheTable table(NNCacheTable::NUM_WAYS, nnXLen, nnYLen, 1.0, 0);
+    shared_ptr<NNOutput> oldOutput = makeCacheTestOutput(rand,nnXLen,nnYLen,true);
+    table.set(oldOutput,0);
+    shared_ptr<NNOutput> result;
+    testAssert(!table.get(oldOutput->nnHash,1,result));
+    testAssert(result == nullptr);
+
+    shared_ptr<NNOutput> newOutput = makeCacheTestOutput(rand,nnXLen,nnYLen,false);
+    newOutput->nnHash = oldOutput->nnHash;
+    table.set(newOutput,1);
+    testAssert(table.get(newOutput->nnHash,1,result));
+    testAssert(cachedOutputMatches(*result,*newOutput));
+    testAssert(result->whiteOwnerMap == NULL);
+    testAssert(!table.get(oldOutput->nnHash,0,result));
+
+    //The old entry was replaced rather than taking up a way
+    for(int i = 0; i<NNCacheTable::NUM_WAYS-1; i++)
+      table.set(makeCacheTestOutput(rand,nnXLen,nnYLen,false),1);
+    testAssert(table.numEvictions() == 0);
+    testAssert(table.get(newOutput->nnHash,1,result));
+  }
+
+  //Budget in bytes
+  {
+    int64_t bytes = (int64_t)64 << 20;
+    int64_t numEntries = NNCacheTable::getNumEntriesForBytes(bytes,19,19,0.25);
+    NNCacheTable table(numEntries, 19, 19, 0.25, 8);
+    testAssert(table.getNumBytes() <= bytes);
+    testAssert(table.getNumBytes() >= bytes * 0.98);
+    cout << "64MB cache entries: " << table.getNumEntries() << endl;
+  }
+
+#ifdef OS_IS_UNIX_OR_APPLE
+  //Disk cache persistence, corruption, and model mismatch
+  {
+    const string fileName = "tmp_test_nndiskcache.bin";
+    std::remove(fileName.c_str());
+    int nnXLen = 13;
+    int nnYLen = 13;
+    int64_t maxBytes = (int64_t)1 << 20;
+    vector<shared_ptr<NNOutput>> outputs;
+    for(int i = 0; i<50; i++)
+      outputs.push_back(makeCacheTestOutput(rand,nnXLen,nnYLen,i % 3 == 0));
+
+    shared_ptr<NNOutput> result;
+    {
+      NNDiskCache cache(fileName, "model A", nnXLen, nnYLen, maxBytes, NULL);
+      testAssert(cache.getNumEntries() == 0);
+      for(int i = 0; i<(int)outputs.size(); i++)
+        cache.set(outputs[i]);
+      cache.set(outputs[0]);
+      testAssert(cache.getNumEntries() == (int64_t)outputs.size());
+      //Records are found before and after they reach the file
+      testAssert(cache.get(outputs[7]->nnHash,result));
+      testAssert(cachedOutputMatches(*result,*outputs[7]));
+      cache.flush();
+      testAssert(cache.numWrites() == outputs.size());
+      testAssert(cache.get(outputs[8]->nnHash,result));
+      testAssert(cachedOutputMatches(*result,*outputs[8]));
+    }
+    int64_t fileBytes;
+    {
+      NNDiskCache cache(fileName, "model A", nnXLen, nnYLen, maxBytes, NULL);
+      testAssert(cache.getNumEntries() == (int64_t)outputs.size());
+      for(int i = 0; i<(int)outputs.size(); i++) {
+        testAssert(cache.get(outputs[i]->nnHash,result));
+        testAssert(cachedOutputMatches(*result,*outputs[i]));
+      }
+      testAssert(!cache.get(Hash128(rand.nextUInt64(),rand.nextUInt64()),result));
+      testAssert(result == nullptr);
+      testAssert(cache.numHits() == outputs.size() && cache.numMisses() == 1 && cache.numCorrupt() == 0);
+      fileBytes = cache.getFileBytes();
+    }
+
+    //Damage one record and leave a partial record at the end, as an interrupted write would
+    {
+      std::fstream file(fileName, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(fileBytes - 40);
+      file.put('x');
+      file.seekp(fileBytes);
+      file.write("partial record", 14);
+    }
+    {
+      NNDiskCache cache(fileName, "model A", nnXLen, nnYLen, maxBytes, NULL);
+      testAssert(cache.numCorrupt() == 1);
+      testAssert(cache.getNumEntries() == (int64_t)outputs.size() - 1);
+      testAssert(!cache.get(outputs.back()->nnHash,result));
+      cache.set(outputs.back());
+      cache.flush();
+      testAssert(cache.getFileBytes() == fileBytes + (fileBytes - 64) / (int64_t)outputs.size());
+      testAssert(cache.get(outputs.back()->nnHash,result));
+      testAssert(cachedOutputMatches(*result,*outputs.back()));
+    }
+
+    //A different model or board size starts over
+    {
+      NNDiskCache cache(fileName, "model B", nnXLen, nnYLen, maxBytes, NULL);
+      testAssert(cache.getNumEntries() == 0);
+      testAssert(!cache.get(outputs[0]->nnHash,result));
+    }
+    {
+      NNDiskCache cache(fileName, "model B", nnXLen, nnYLen+1, maxBytes, NULL);
+      testAssert(cache.getNumEntries() == 0);
+    }
+
+    //Stops appending at the size limit
+    {
+      std::remove(fileName.c_str());
+      NNDiskCache cache(fileName, "model A", nnXLen, nnYLen, 10000, NULL);
+      for(int i = 0; i<(int)outputs.size(); i++)
+        cache.set(outputs[i]);
+      cache.flush();
+      testAssert(cache.numWrites() > 0 && cache.numWrites() < outputs.size());
+      testAssert(cache.getFileBytes() <= 10000);
+    }
+    std::remove(fileName.c_str());
+  }
+#endif
+}
+
+//Text format of a small model with random weights, with one block of each kind that the trunk supports
+static string makeTestModelText(Rand& rand) {
+  ostringstream out;
+  auto weights = [&](int n) {
+    for(int i = 0; i<n; i++)
+      out << rand.nextGaussian() << " ";
+    out << "\n";
+  };
+  auto conv = [&](const string& name, int size, int ic, int oc) {
+    out << name << " " << size << " " << size << " " << ic << " " << oc << " 1 1\n";
+    weights(size * size * ic * oc);
+  };
+  auto bn = [&](const string& name, int c, bool hasScale) {
+    out << name << " " << c << " 0.001 " << hasScale << " 1\n";
+    weights(c);
+    for(int i = 0; i<c; i++)
+      out << 0.5 + rand.nextDouble() << " ";
+    out << "\n";
+    if(hasScale)
+      weights(c);
+    weights(c);
+  };
+  auto act = [&](const string& name) {
+    out << name << "\n";
+  };
+  auto matmul = [&](const string& name, int ic, int oc) {
+    out << name << " " << ic << " " << oc << "\n";
+    weights(ic * oc);
+  };
+  auto matbias = [&](const string& name, int c) {
+    out << name << " " << c << "\n";
+    weights(c);
+  };
+
+  out << "testmodel 5 3 2\n";
+  out << "trunk 3 4 3 2 1 2\n";
+  conv("conv1", 5, 3, 4);
+  matmul("ginputlayer", 2, 4);
+  out << "ordinary_block\n" << "rconv1\n";
+  bn("rconv1/norm1", 4, true);
+  act("rconv1/actv1");
+  conv("rconv1/w1", 3, 4, 3);
+  bn("rconv1/norm2", 3, false);
+  act("rconv1/actv2");
+  conv("rconv1/w2", 3, 3, 4);
+  out << "dilated_block\n" << "rconv2\n";
+  bn("rconv2/norm1", 4, false);
+  act("rconv2/actv1");
+  conv("rconv2/w1a", 3, 4, 2);
+  out << "rconv2/w1b 3 3 4 1 2 2\n";
+  weights(3 * 3 * 4 * 1);
+  bn("rconv2/norm2", 3, true);
+  act("rconv2/actv2");
+  conv("rconv2/w2", 3, 3, 4);
+  out << "gpool_block\n" << "rconv3\n";
+  bn("rconv3/norm1", 4, false);
+  act("rconv3/actv1");
+  conv("rconv3/w1a", 3, 4, 2);
+  conv("rconv3/w1b", 3, 4, 2);
+  bn("rconv3/norm1b", 2, false);
+  act("rconv3/actv1b");
+  matmul("rconv3/w1r", 6, 2);
+  bn("rconv3/norm2", 2, false);
+  act("rconv3/actv2");
+  conv("rconv3/w2", 3, 2, 4);
+  bn("trunk/norm", 4, true);
+  act("trunk/actv");
+
+  out << "policyhead\n";
+  conv("p1/intermediate_conv", 1, 4, 2);
+  conv("g1/conv", 1, 4, 2);
+  bn("g1/norm", 2, false);
+  act("g1/actv");
+  matmul("matmulg2w", 6, 2);
+  bn("p1/norm", 2, false);
+  act("p1/actv");
+  conv("p2/w", 1, 2, 1);
+  matmul("matmulpass", 6, 1);
+
+  out << "valuehead\n";
+  conv("v1/w", 1, 4, 2);
+  bn("v1/norm", 2, false);
+  act("v1/actv");
+  matmul("v2/w", 6, 3);
+  matbias("v2/b", 3);
+  act("v2/actv");
+  matmul("v3/w", 3, 3);
+  matbias("v3/b", 3);
+  matmul("sv3/w", 3, 2);
+  matbias("sv3/b", 2);
+  conv("vownership/w", 1, 2, 1);
+  return out.str();
+}
+
+static string readFileBytes(const string& fileName) {
+  ifstream in(fileName, ios::in | ios::binary);
+  return string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void Tests::runModelDescBinaryTests() {
+  cout << "Running model desc binary format tests" << endl;
+  Rand rand("runModelDescBinaryTests");
+
+  const string textFileName = "tmp_test_model.txt";
+  const string binFileName = "tmp_test_model.kgb";
+  const string binFileName2 = "tmp_test_model2.kgb";
+  {
+    ofstream out(textFileName);
+    out << makeTestModelText(rand);
+  }
+
+  ModelDesc fromText;
+  ModelDesc::loadFromFileMaybeGZipped(textFileName,fromText);
+  fromText.saveToBinaryFile(binFileName);
+  ModelDesc fromBinary;
+  ModelDesc::loadFromFileMaybeGZipped(binFileName,fromBinary);
+
+  //Everything comes back exactly, such that writing it again gives the same file
+  fromBinary.saveToBinaryFile(binFileName2);
+  string binBytes = readFileBytes(binFileName);
+  testAssert(binBytes.size() > 0 && binBytes.size() % 64 == 0);
+  testAssert(binBytes == readFileBytes(binFileName2));
+
+  testAssert(fromBinary.name == "testmodel");
+  testAssert(fromBinary.version == 5);
+  testAssert(fromBinary.numInputChannels == 3);
+  testAssert(fromBinary.numInputGlobalChannels == 2);
+  testAssert(fromBinary.numValueChannels == 3);
+  testAssert(fromBinary.numScoreValueChannels == 2);
+  testAssert(fromBinary.numOwnershipChannels == 1);
+  testAssert(fromBinary.trunk.blocks.size() == 3);
+  testAssert(fromBinary.trunk.blocks[0].first == ORDINARY_BLOCK_KIND);
+  testAssert(fromBinary.trunk.blocks[1].first == DILATED_BLOCK_KIND);
+  testAssert(fromBinary.trunk.blocks[2].first == GLOBAL_POOLING_BLOCK_KIND);
+  testAssert(((GlobalPoolingResidualBlockDesc*)fromBinary.trunk.blocks[2].second)->version == 5);
+  testAssert(((DilatedResidualBlockDesc*)fromBinary.trunk.blocks[1].second)->dilatedConv.dilationX == 2);
+  testAssert(fromBinary.trunk.trunkTipBN.hasScale && !fromBinary.valueHead.v1BN.hasScale);
+  testAssert(fromBinary.maxConvChannels(3,3) == fromText.maxConvChannels(3,3));
+  vector<const ConvLayerDesc*> textConvs;
+  vector<const ConvLayerDesc*> binaryConvs;
+  fromText.iterConvLayers([&](const ConvLayerDesc& desc) { textConvs.push_back(&desc); });
+  fromBinary.iterConvLayers([&](const ConvLayerDesc& desc) { binaryConvs.push_back(&desc); });
+  testAssert(textConvs.size() == binaryConvs.size());
+  for(size_t i = 0; i<textConvs.size(); i++) {
+    testAssert(textConvs[i]->name == binaryConvs[i]->name);
+    testAssert(textConvs[i]->weights == binaryConvs[i]->weights);
+  }
+  testAssert(fromText.valueHead.v2Mul.weights == fromBinary.valueHead.v2Mul.weights);
+  testAssert(fromText.trunk.trunkTipBN.variance == fromBinary.trunk.trunkTipBN.variance);
+
+  //Damage and truncation are both caught
+  auto loadFails = [&](const string& bytes) {
+    {
+      ofstream out(binFileName2, ios::out | ios::binary | ios::trunc);
+      out.write(bytes.data(), bytes.size());
+    }
+    ModelDesc desc;
+    try {
+      ModelDesc::loadFromFileMaybeGZipped(binFileName2,desc);
+    }
+    catch(const StringError&) {
+      return true;
+    }
+    return false;
+  };
+  testAssert(!loadFails(binBytes));
+  for(int i = 0; i<20; i++) {
+    string damaged = binBytes;
+    size_t pos = 8 + (size_t)rand.nextUInt((uint32_t)(damaged.size() - 8));
+    damaged[pos] = (char)(damaged[pos] ^ (1 << rand.nextUInt(8)));
+    testAssert(loadFails(damaged));
+  }
+  testAssert(loadFails(binBytes.substr(0, binBytes.size() - 64)));
+  testAssert(loadFails(binBytes.substr(0, 40)));
+
+  //A file whose tensors all have the sizes it claims, but whose layers do not fit together
+  {
+    ModelDesc mismatched;
+    ModelDesc::loadFromFileMaybeGZipped(binFileName,mismatched);
+    ConvLayerDesc& p1Conv = mismatched.policyHead.p1Conv;
+    p1Conv.inChannels += 1;
+    p1Conv.weights.resize((size_t)p1Conv.convYSize * p1Conv.convXSize * p1Conv.inChannels * p1Conv.outChannels);
+    mismatched.saveToBinaryFile(binFileName2);
+    testAssert(loadFails(readFileBytes(binFileName2)));
+  }
+  {
+    ModelDesc mismatched;
+    ModelDesc::loadFromFileMaybeGZipped(binFileName,mismatched);
+    mismatched.numValueChannels = 1;
+    mismatched.saveToBinaryFile(binFileName2);
+    testAssert(loadFails(readFileBytes(binFileName2)));
+  }
+
+  std::remove(textFileName.c_str());
+  std::remove(binFileName.c_str());
+  std::remove(binFileName2.c_str());
+}
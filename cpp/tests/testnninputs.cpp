@@ -3,6 +3,7 @@
 #include <iomanip>
 
 #include "../neuralnet/nninputs.h"
+#include "../neuralnet/laddercache.h"
 #include "../neuralnet/modelversion.h"
 #include "../dataio/sgf.h"
 
@@ -128,11 +129,11 @@ void Tests::runNNInputsV3V4Tests() {
     static_assert(NNModelVersion::latestInputsVersionImplemented == 5, "");
     if(version == 3) {
       hash = NNInputs::getHashV3(board,hist,nextPla,drawEquivalentWinsForWhite);
-      NNInputs::fillRowV3(board,hist,nextPla,drawEquivalentWinsForWhite,nnXLen,nnYLen,inputsUseNHWC,rowBin,rowGlobal);
+      NNInputs::fillRowV3(board,hist,nextPla,drawEquivalentWinsForWhite,nnXLen,nnYLen,inputsUseNHWC,NULL,rowBin,rowGlobal);
     }
     else if(version == 4) {
       hash = NNInputs::getHashV4(board,hist,nextPla,drawEquivalentWinsForWhite);
-      NNInputs::fillRowV4(board,hist,nextPla,drawEquivalentWinsForWhite,nnXLen,nnYLen,inputsUseNHWC,rowBin,rowGlobal);
+      NNInputs::fillRowV4(board,hist,nextPla,drawEquivalentWinsForWhite,nnXLen,nnYLen,inputsUseNHWC,NULL,rowBin,rowGlobal);
     }
     else if(version == 5) {
       hash = NNInputs::getHashV5(board,hist,nextPla,drawEquivalentWinsForWhite);
@@ -643,3 +644,96 @@ xxx..xx
 
   }
 }
+
+void Tests::runLadderCacheTests() {
+  cout << "Running ladder cache tests" << endl;
+  Rand rand("runLadderCacheTests");
+
+  //Lookups
+  {
+    LadderCache ladderCache(8,2);
+    Board board(9,9);
+    Hash128 boardHash = LadderCache::getBoardHash(board);
+    Loc loc = Location::getLoc(2,3,board.x_size);
+    Loc other = Location::getLoc(3,3,board.x_size);
+    bool laddered = false;
+    vector<Loc> workingMoves;
+    testAssert(!ladderCache.get(boardHash,loc,laddered,workingMoves));
+    ladderCache.set(boardHash,loc,true,{other,Location::getLoc(4,4,board.x_size)});
+    testAssert(ladderCache.get(boardHash,loc,laddered,workingMoves));
+    testAssert(laddered && workingMoves.size() == 2 && workingMoves[0] == other);
+    testAssert(!ladderCache.get(boardHash,other,laddered,workingMoves));
+
+    //The ko is part of the key
+    board.ko_loc = other;
+    testAssert(LadderCache::getBoardHash(board) != boardHash);
+    testAssert(!ladderCache.get(LadderCache::getBoardHash(board),loc,laddered,workingMoves));
+
+    ladderCache.set(boardHash,loc,false,{});
+    testAssert(ladderCache.get(boardHash,loc,laddered,workingMoves));
+    testAssert(!laddered && workingMoves.size() == 0);
+    ladderCache.clear();
+    testAssert(!ladderCache.get(boardHash,loc,laddered,workingMoves));
+    testAssert(ladderCache.numHits() == 2);
+    testAssert(ladderCache.numMisses() == 4);
+  }
+
+  //Rows filled with the cache match rows filled without it, along random games and their children, including when
+  //the cache is too small to hold much
+  for(int version = 3; version <= 4; version++) {
+    for(int sizePowerOfTwo = 4; sizePowerOfTwo <= 16; sizePowerOfTwo += 12) {
+      LadderCache ladderCache(sizePowerOfTwo,2);
+      int boardLen = sizePowerOfTwo == 4 ? 9 : 19;
+      int nnXLen = 19;
+      int nnYLen = 19;
+      bool inputsUseNHWC = rand.nextBool(0.5);
+      int rowLen = NNInputs::NUM_FEATURES_SPATIAL_V4 * nnXLen * nnYLen;
+      int globalLen = NNInputs::NUM_FEATURES_GLOBAL_V4;
+      static_assert(NNInputs::NUM_FEATURES_SPATIAL_V3 == NNInputs::NUM_FEATURES_SPATIAL_V4, "");
+      static_assert(NNInputs::NUM_FEATURES_GLOBAL_V3 == NNInputs::NUM_FEATURES_GLOBAL_V4, "");
+      vector<float> rowBin(rowLen), rowGlobal(globalLen), cachedRowBin(rowLen), cachedRowGlobal(globalLen);
+
+      auto checkRows = [&](const Board& board, const BoardHistory& hist, Player pla) {
+        if(version == 3) {
+          NNInputs::fillRowV3(board,hist,pla,0.5,nnXLen,nnYLen,inputsUseNHWC,NULL,rowBin.data(),rowGlobal.data());
+          NNInputs::fillRowV3(board,hist,pla,0.5,nnXLen,nnYLen,inputsUseNHWC,&ladderCache,cachedRowBin.data(),cachedRowGlobal.data());
+        }
+        else {
+          NNInputs::fillRowV4(board,hist,pla,0.5,nnXLen,nnYLen,inputsUseNHWC,NULL,rowBin.data(),rowGlobal.data());
+          NNInputs::fillRowV4(board,hist,pla,0.5,nnXLen,nnYLen,inputsUseNHWC,&ladderCache,cachedRowBin.data(),cachedRowGlobal.data());
+        }
+        testAssert(rowBin == cachedRowBin);
+        testAssert(rowGlobal == cachedRowGlobal);
+      };
+
+      for(int game = 0; game<3; game++) {
+        Board board(boardLen,boardLen);
+        Player pla = P_BLACK;
+        BoardHistory hist(board,pla,Rules::getTrompTaylorish(),0);
+        for(int move = 0; move<200; move++) {
+          checkRows(board,hist,pla);
+          Loc loc = Board::NULL_LOC;
+          for(int tries = 0; tries<100; tries++) {
+            Loc candidate = Location::getLoc((int)rand.nextUInt(boardLen),(int)rand.nextUInt(boardLen),boardLen);
+            if(!hist.isLegal(board,candidate,pla) || board.isSimpleEye(candidate,pla))
+              continue;
+            if(loc == Board::NULL_LOC)
+              loc = candidate;
+            else {
+              Board childBoard = board;
+              BoardHistory childHist = hist;
+              childHist.makeBoardMoveAssumeLegal(childBoard,candidate,pla,NULL);
+              checkRows(childBoard,childHist,getOpp(pla));
+              break;
+            }
+          }
+          if(loc == Board::NULL_LOC)
+            break;
+          hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+          pla = getOpp(pla);
+        }
+      }
+      testAssert(ladderCache.numHits() > 0);
+    }
+  }
+}
@@ -2351,3 +2351,274 @@ HASH: C377EB251DBAB5E2F6C1BABE18EEE392
 
        
 }
+
+void Tests::runBoardHistoryRecentBoardsTests() {
+  cout << "Running board history recent boards tests" << endl;
+  Rand rand("runBoardHistoryRecentBoardsTests");
+  ostringstream out;
+
+  int numChecks = 0;
+  int numChecksInEncore = 0;
+  int numUndos = 0;
+
+  //boards[i] is the board after i moves since the history was cleared
+  auto checkRecentBoards = [&](const BoardHistory& hist, const vector<Board>& boards) {
+    for(int k = 0; k<BoardHistory::NUM_RECENT_BOARDS; k++) {
+      const Board& expected = boards[std::max(0, (int)boards.size() - 1 - k)];
+      Board recent = hist.getRecentBoard(k);
+      recent.checkConsistency();
+      testAssert(boardsSeemEqual(recent,expected));
+      testAssert(recent.pos_hash == expected.pos_hash);
+      testAssert(recent.ko_loc == expected.ko_loc);
+    }
+    numChecks++;
+    if(hist.encorePhase > 0)
+      numChecksInEncore++;
+  };
+
+  auto chooseMove = [&](const Board& board, const BoardHistory& hist, Player pla) {
+    if(rand.nextBool(0.1))
+      return Board::PASS_LOC;
+    for(int tries = 0; tries<50; tries++) {
+      Loc loc = Location::getLoc((int)rand.nextUInt(board.x_size),(int)rand.nextUInt(board.y_size),board.x_size);
+      if(hist.isLegal(board,loc,pla) && !board.isSimpleEye(loc,pla))
+        return loc;
+    }
+    return Board::PASS_LOC;
+  };
+
+  for(int game = 0; game<60; game++) {
+    Rules rules = game % 3 == 0 ? Rules::getTrompTaylorish() : Rules::getSimpleTerritory();
+    if(game % 3 == 2)
+      rules.koRule = Rules::KO_SIMPLE;
+    rules.multiStoneSuicideLegal = rand.nextBool(0.5);
+    int xSize = 4 + (int)rand.nextUInt(6);
+    int ySize = 4 + (int)rand.nextUInt(6);
+
+    Board board(xSize,ySize);
+    Player pla = P_BLACK;
+    BoardHistory hist(board,pla,rules,0);
+    vector<Board> boards;
+    boards.push_back(board);
+    checkRecentBoards(hist,boards);
+
+    for(int turn = 0; turn<200 && !hist.isGameFinished; turn++) {
+      //Sometimes make a few recorded moves as a search would, check along the way, and then undo them all
+      if(rand.nextBool(0.2)) {
+        Board refBoard = board;
+        BoardHistory refHist = hist;
+        vector<Board> refBoards = boards;
+        vector<BoardHistory::MoveRecord> records;
+        Player searchPla = pla;
+        int numSearchMoves = 1 + (int)rand.nextUInt(8);
+        for(int i = 0; i<numSearchMoves && !hist.isGameFinished; i++) {
+          Loc loc = chooseMove(board,hist,searchPla);
+          records.push_back(hist.makeBoardMoveRecorded(board,loc,searchPla,NULL));
+          boards.push_back(board);
+          checkRecentBoards(hist,boards);
+          searchPla = getOpp(searchPla);
+        }
+        hist.undoRecordedMoves(board,records,refBoard,refHist);
+        boards = refBoards;
+        testAssert(boardsSeemEqual(board,refBoard));
+        testAssert(hist.moveHistory.size() == refHist.moveHistory.size());
+        checkRecentBoards(hist,boards);
+        numUndos++;
+      }
+
+      Loc loc = chooseMove(board,hist,pla);
+      hist.makeBoardMoveAssumeLegal(board,loc,pla,NULL);
+      boards.push_back(board);
+      checkRecentBoards(hist,boards);
+      pla = getOpp(pla);
+
+      if(rand.nextBool(0.05)) {
+        BoardHistory copy(hist);
+        checkRecentBoards(copy,boards);
+      }
+    }
+  }
+
+  out << "numChecks " << numChecks << endl;
+  out << "numChecksInEncore " << numChecksInEncore << endl;
+  out << "numUndos " << numUndos << endl;
+  string expected = R"%%(
+numChecks 8326
+numChecksInEncore 1976
+numUndos 794
+)%%";
+  expect("Board history recent boards",out,expected);
+}
+
+void Tests::runKoHashTableTests() {
+  cout << "Running ko hash table tests" << endl;
+  Rand rand("runKoHashTableTests");
+  ostringstream out;
+
+  //Compare against counting directly in the history
+  auto checkTable = [](const KoHashTable& table, const BoardHistory& hist, const vector<Hash128>& queries) {
+    testAssert(table.size() == hist.koHashHistory.size());
+    testAssert(table.koHistoryLastClearedBeginningMoveIdx == hist.koHistoryLastClearedBeginningMoveIdx);
+    for(size_t i = 0; i<queries.size(); i++) {
+      int count = 0;
+      for(size_t j = 0; j<hist.koHashHistory.size(); j++)
+        if(hist.koHashHistory[j] == queries[i])
+          count++;
+      testAssert(table.numberOfOccurrencesOfHash(queries[i]) == count);
+      testAssert(table.containsHash(queries[i]) == (count > 0));
+    }
+  };
+
+  {
+    //Arbitrary histories of hashes from a small pool, many sharing the same low bits, so that there are
+    //plenty of repeats, long probe sequences, and removals from the middle of them
+    vector<Hash128> pool;
+    for(int i = 0; i<300; i++)
+      pool.push_back(Hash128(rand.nextUInt64(8) * 1024 + rand.nextUInt64(4) + (rand.nextBool(0.3) ? 1023 : 0), rand.nextUInt64()));
+    vector<Hash128> queries = pool;
+    for(int i = 0; i<20; i++)
+      queries.push_back(Hash128(rand.nextUInt64(8) * 1024, rand.nextUInt64()));
+
+    KoHashTable table;
+    BoardHistory hist;
+    hist.koHashHistory.clear();
+    for(int step = 0; step<3000; step++) {
+      int kind = (int)rand.nextUInt(5);
+      if(kind == 0) {
+        int n = (int)rand.nextUInt(40);
+        for(int i = 0; i<n; i++)
+          hist.koHashHistory.push_back(pool[rand.nextUInt((uint32_t)pool.size())]);
+        table.update(hist);
+      }
+      else if(kind == 1) {
+        hist.koHashHistory.resize(hist.koHashHistory.size() - rand.nextUInt((uint32_t)hist.koHashHistory.size()+1));
+        table.update(hist);
+      }
+      else if(kind == 2) {
+        //Change some of the end, which update does not support but recompute does
+        size_t numKept = hist.koHashHistory.size() - rand.nextUInt((uint32_t)hist.koHashHistory.size()+1);
+        hist.koHashHistory.resize(numKept);
+        int n = (int)rand.nextUInt(40);
+        for(int i = 0; i<n; i++)
+          hist.koHashHistory.push_back(pool[rand.nextUInt((uint32_t)pool.size())]);
+        table.recompute(hist);
+      }
+      else if(kind == 3) {
+        vector<Hash128> koHashesBefore = hist.koHashHistory;
+        int clearedIdxBefore = hist.koHistoryLastClearedBeginningMoveIdx;
+        hist.koHistoryLastClearedBeginningMoveIdx += 1;
+        hist.koHashHistory.resize(rand.nextUInt(3));
+        if(rand.nextBool(0.5)) {
+          //Clearing leaves the table covering the history from before, until that is returned to
+          table.update(hist);
+          testAssert(table.size() == koHashesBefore.size());
+          testAssert(table.koHistoryLastClearedBeginningMoveIdx == clearedIdxBefore);
+          hist.koHashHistory = koHashesBefore;
+          hist.koHistoryLastClearedBeginningMoveIdx = clearedIdxBefore;
+          table.update(hist);
+        }
+        else
+          table.recompute(hist);
+      }
+      else {
+        KoHashTable fresh;
+        fresh.recompute(hist);
+        checkTable(fresh,hist,queries);
+      }
+      checkTable(table,hist,queries);
+    }
+  }
+
+  {
+    //Games with superko and repetition checks, made the way a search does from a root, compared to
+    //histories given no table, which check everything linearly
+    int numMoves = 0;
+    int numSuperKoBans = 0;
+    int numNoResults = 0;
+    for(int game = 0; game<40; game++) {
+      Rules rules = Rules::getTrompTaylorish();
+      if(game % 4 == 1)
+        rules.koRule = Rules::KO_SITUATIONAL;
+      else if(game % 4 == 2)
+        rules.koRule = Rules::KO_SPIGHT;
+      else if(game % 4 == 3)
+        rules = Rules::getSimpleTerritory();
+      rules.multiStoneSuicideLegal = rand.nextBool(0.5);
+      Board rootBoard(4 + (int)rand.nextUInt(2), 4 + (int)rand.nextUInt(2));
+      Player rootPla = P_BLACK;
+      BoardHistory rootHist(rootBoard,rootPla,rules,0);
+      KoHashTable rootTable;
+      rootTable.recompute(rootHist);
+
+      auto chooseMove = [&](const Board& board, const BoardHistory& hist, Player pla) {
+        if(rand.nextBool(0.1))
+          return Board::PASS_LOC;
+        for(int tries = 0; tries<30; tries++) {
+          Loc loc = Location::getLoc((int)rand.nextUInt(board.x_size),(int)rand.nextUInt(board.y_size),board.x_size);
+          if(hist.isLegal(board,loc,pla))
+            return loc;
+        }
+        return Board::PASS_LOC;
+      };
+      auto checkSame = [&](const BoardHistory& hist, const BoardHistory& refHist) {
+        for(int i = 0; i<Board::MAX_ARR_SIZE; i++) {
+          testAssert(hist.superKoBanned[i] == refHist.superKoBanned[i]);
+          if(hist.superKoBanned[i])
+            numSuperKoBans++;
+        }
+        testAssert(hist.isGameFinished == refHist.isGameFinished);
+        testAssert(hist.isNoResult == refHist.isNoResult);
+        testAssert(hist.encorePhase == refHist.encorePhase);
+        numMoves++;
+      };
+
+      KoHashTable threadTable;
+      threadTable.recompute(rootHist);
+      for(int rootMove = 0; rootMove<60 && !rootHist.isGameFinished; rootMove++) {
+        for(int playout = 0; playout<4; playout++) {
+          Board board = rootBoard;
+          BoardHistory hist = rootHist;
+          Board refBoard = rootBoard;
+          BoardHistory refHist = rootHist;
+          vector<BoardHistory::MoveRecord> records;
+          Player pla = rootPla;
+          int depth = (int)rand.nextUInt(12);
+          for(int i = 0; i<depth && !hist.isGameFinished; i++) {
+            Loc loc = chooseMove(board,hist,pla);
+            records.push_back(hist.makeBoardMoveRecorded(board,loc,pla,&threadTable));
+            threadTable.update(hist);
+            refHist.makeBoardMoveAssumeLegal(refBoard,loc,pla,NULL);
+            checkSame(hist,refHist);
+            if(hist.isNoResult)
+              numNoResults++;
+            pla = getOpp(pla);
+          }
+          hist.undoRecordedMoves(board,records,rootBoard,rootHist);
+          threadTable.update(hist);
+          checkTable(threadTable,hist,hist.koHashHistory);
+        }
+
+        Loc loc = chooseMove(rootBoard,rootHist,rootPla);
+        BoardHistory refHist = rootHist;
+        Board refBoard = rootBoard;
+        rootHist.makeBoardMoveAssumeLegal(rootBoard,loc,rootPla,&rootTable);
+        rootTable.recompute(rootHist);
+        refHist.makeBoardMoveAssumeLegal(refBoard,loc,rootPla,NULL);
+        checkSame(rootHist,refHist);
+        checkTable(rootTable,rootHist,rootHist.koHashHistory);
+        rootPla = getOpp(rootPla);
+        //The search thread's table only follows a new root upon being recomputed
+        threadTable.recompute(rootHist);
+      }
+    }
+    out << "numMoves " << numMoves << endl;
+    out << "numSuperKoBans " << numSuperKoBans << endl;
+    out << "numNoResults " << numNoResults << endl;
+    string expected = R"%%(
+numMoves 43533
+numSuperKoBans 71
+numNoResults 0
+)%%";
+    expect("Ko hash table games",out,expected);
+  }
+}
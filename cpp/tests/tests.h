@@ -22,6 +22,8 @@ namespace Tests {
 
   //testrules.cpp
   void runRulesTests();
+  void runBoardHistoryRecentBoardsTests();
+  void runKoHashTableTests();
 
   //testscore.cpp
   void runScoreTests();
@@ -31,12 +33,18 @@ namespace Tests {
 
   //testnninputs.cpp
   void runNNInputsV3V4Tests();
+  void runLadderCacheTests();
 
   //testsearch.cpp
   void runNNLessSearchTests();
   void runSearchTests(const std::string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
   void runSearchTestsV3(const std::string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
   void runNNOnTinyBoard(const std::string& modelFile, bool inputsNHWC, bool cudaNHWC, int symmetry, bool useFP16);
+  void runSearchStressTests();
+
+  //testchildselection.cpp
+  void runChildSelectionTests();
+  void runChildSelectionBenchmark();
 
   //testtime.cpp
   void runTimeControlsTests();
@@ -47,6 +55,8 @@ namespace Tests {
 
   //testnn.cpp
   void runNNLayerTests();
+  void runNNCacheTests();
+  void runModelDescBinaryTests();
 }
 
 namespace TestCommon {
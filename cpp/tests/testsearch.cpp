@@ -3,6 +3,9 @@
 #include <algorithm>
 #include <iterator>
 
+#include "../core/lockfreequeue.h"
+#include "../core/timer.h"
+#include "../core/waitflag.h"
 #include "../dataio/sgf.h"
 #include "../neuralnet/nninputs.h"
 #include "../search/asyncbot.h"
@@ -163,6 +166,212 @@ static NNEvaluator* startNNEval(
   return nnEval;
 }
 
+static int64_t countTreeNodes(const SearchNode* node) {
+  if(node == NULL)
+    return 0;
+  int64_t count = 1;
+  for(int i = 0; i<node->numChildren; i++)
+    count += countTreeNodes(node->children[i].node);
+  return count;
+}
+
+//Count distinct nodes reachable from node in a search graph, checking that no virtual losses are left behind
+static void collectGraphNodes(const SearchNode* node, std::set<const SearchNode*>& nodes) {
+  if(node == NULL || !nodes.insert(node).second)
+    return;
+  testAssert(node->virtualLosses.load() == 0);
+  for(int i = 0; i<node->numChildren; i++)
+    collectGraphNodes(node->children[i].node,nodes);
+}
+
+//Check that undoing the moves of each playout produces exactly the same search as copying the root state back
+static void runUndoVsCopyPlayoutReset(
+  const string& modelFile, Logger& logger, int symmetry, bool inputsNHWC, bool cudaNHWC, bool useFP16, bool debugSkipNeuralNet
+) {
+  auto searchTreeStr = [&](bool useUndo, const Board& board, Player nextPla, const BoardHistory& hist, int64_t maxVisits) {
+    //Fresh evaluator each time, so that with debugSkipNeuralNet the random outputs are the same
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,symmetry,inputsNHWC,cudaNHWC,useFP16,debugSkipNeuralNet,1.0);
+    SearchParams params;
+    params.maxVisits = maxVisits;
+    params.useUndoForPlayoutReset = useUndo;
+    Search* search = new Search(params, nnEval, "undoVsCopySeed");
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+
+    ostringstream out;
+    PrintTreeOptions options;
+    options = options.maxDepth(20);
+    search->printTree(out, search->rootNode, options, P_WHITE);
+    delete search;
+    delete nnEval;
+    return out.str();
+  };
+
+  auto check = [&](const string& name, const Board& board, Player nextPla, const BoardHistory& hist, int64_t maxVisits) {
+    string copied = searchTreeStr(false,board,nextPla,hist,maxVisits);
+    string undone = searchTreeStr(true,board,nextPla,hist,maxVisits);
+    testAssert(copied.size() > 0);
+    testAssert(copied == undone);
+    cout << "Undo matches copy playout reset: " << name << endl;
+  };
+
+  Board board = Board::parseBoard(9,9,R"%%(
+.........
+.........
+..x..o...
+.........
+..x...o..
+...o.....
+..o.x.x..
+.........
+.........
+)%%");
+
+  {
+    Rules rules = Rules::getTrompTaylorish();
+    BoardHistory hist(board,P_BLACK,rules,0);
+    check("tromp-taylor",board,P_BLACK,hist,300);
+  }
+  {
+    Rules rules = Rules::getSimpleTerritory();
+    BoardHistory hist(board,P_BLACK,rules,0);
+    check("territory",board,P_BLACK,hist,300);
+  }
+
+  //Kos, captures, and passes ending the game or phases
+  Board koBoard = Board::parseBoard(7,7,R"%%(
+.xo.o..
+xo.o...
+.xo....
+xxooooo
+..xxxxx
+.......
+.......
+)%%");
+  {
+    Rules rules = Rules::getTrompTaylorish();
+    BoardHistory hist(koBoard,P_BLACK,rules,0);
+    check("tromp-taylor ko",koBoard,P_BLACK,hist,500);
+  }
+  {
+    Rules rules = Rules::getSimpleTerritory();
+    BoardHistory hist(koBoard,P_BLACK,rules,0);
+    check("territory ko",koBoard,P_BLACK,hist,500);
+    BoardHistory encoreHist(koBoard,P_BLACK,rules,1);
+    check("territory ko encore",koBoard,P_BLACK,encoreHist,500);
+  }
+}
+
+//Check that incrementally backing up playouts gives the same search as recomputing nodes from all their children,
+//and compare how long each takes.
+static void runIncrementalVsFullBackup(
+  const string& modelFile, Logger& logger, int symmetry, bool inputsNHWC, bool cudaNHWC, bool useFP16, bool debugSkipNeuralNet
+) {
+  auto runSearch = [&](
+    bool useIncremental, int64_t fullRecomputeVisits, const Board& board, Player nextPla, const BoardHistory& hist, int64_t maxVisits,
+    vector<AnalysisData>& buf, double& seconds
+  ) {
+    //Fresh evaluator each time, so that with debugSkipNeuralNet the random outputs are the same
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,symmetry,inputsNHWC,cudaNHWC,useFP16,debugSkipNeuralNet,1.0);
+    SearchParams params;
+    params.maxVisits = maxVisits;
+    //Incremental backup only applies without value weighting
+    params.valueWeightExponent = 0.0;
+    params.useIncrementalBackup = useIncremental;
+    params.incrementalBackupFullRecomputeVisits = fullRecomputeVisits;
+    Search* search = new Search(params, nnEval, "incrementalVsFullSeed");
+    search->setPosition(nextPla,board,hist);
+    ClockTimer timer;
+    search->runWholeSearch(nextPla,logger,NULL);
+    seconds = timer.getSeconds();
+    search->getAnalysisData(buf,1,false,1);
+    delete search;
+    delete nnEval;
+  };
+
+  auto check = [&](const string& name, const Board& board, Player nextPla, const BoardHistory& hist, int64_t maxVisits, int64_t fullRecomputeVisits) {
+    vector<AnalysisData> fullBuf;
+    vector<AnalysisData> incrementalBuf;
+    double fullSeconds;
+    double incrementalSeconds;
+    runSearch(false,0,board,nextPla,hist,maxVisits,fullBuf,fullSeconds);
+    runSearch(true,fullRecomputeVisits,board,nextPla,hist,maxVisits,incrementalBuf,incrementalSeconds);
+
+    auto byMove = [](const AnalysisData& a, const AnalysisData& b) { return a.move < b.move; };
+    std::sort(fullBuf.begin(),fullBuf.end(),byMove);
+    std::sort(incrementalBuf.begin(),incrementalBuf.end(),byMove);
+    testAssert(fullBuf.size() > 1);
+    testAssert(fullBuf.size() == incrementalBuf.size());
+    double maxUtilityDiff = 0.0;
+    double maxScoreDiff = 0.0;
+    for(size_t i = 0; i<fullBuf.size(); i++) {
+      testAssert(fullBuf[i].move == incrementalBuf[i].move);
+      testAssert(fullBuf[i].numVisits == incrementalBuf[i].numVisits);
+      maxUtilityDiff = std::max(maxUtilityDiff, std::fabs(fullBuf[i].utility - incrementalBuf[i].utility));
+      maxScoreDiff = std::max(maxScoreDiff, std::fabs(fullBuf[i].scoreMean - incrementalBuf[i].scoreMean));
+    }
+    testAssert(maxUtilityDiff < 1e-8);
+    testAssert(maxScoreDiff < 1e-6);
+    cout << "Incremental backup matches full recompute: " << name << endl;
+    //Timings vary from run to run, so they're only reported with a real neural net
+    if(!debugSkipNeuralNet) {
+      cout << "Full recompute " << Global::strprintf("%.3f", fullSeconds) << "s, incremental "
+           << Global::strprintf("%.3f", incrementalSeconds) << "s, max root child utility diff "
+           << Global::strprintf("%.3g", maxUtilityDiff) << endl;
+    }
+  };
+
+  Board board = Board::parseBoard(9,9,R"%%(
+.........
+.........
+..x..o...
+.........
+..x...o..
+...o.....
+..o.x.x..
+.........
+.........
+)%%");
+  {
+    Rules rules = Rules::getTrompTaylorish();
+    BoardHistory hist(board,P_BLACK,rules,0);
+    check("9x9 tromp-taylor",board,P_BLACK,hist,500,0);
+    check("9x9 tromp-taylor periodic full recompute",board,P_BLACK,hist,500,50);
+  }
+  {
+    Rules rules = Rules::getSimpleTerritory();
+    BoardHistory hist(board,P_WHITE,rules,0);
+    check("9x9 territory",board,P_WHITE,hist,500,0);
+  }
+
+  Board board19 = Board::parseBoard(19,19,R"%%(
+...................
+...................
+...................
+...x...........o...
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...................
+...o...........x...
+...................
+...................
+...................
+)%%");
+  {
+    Rules rules = Rules::getTrompTaylorish();
+    BoardHistory hist(board19,P_BLACK,rules,0);
+    check("19x19 opening",board19,P_BLACK,hist,1000,0);
+  }
+}
+
 static void runBasicPositions(NNEvaluator* nnEval, Logger& logger)
 {
   {
@@ -607,6 +816,9 @@ void Tests::runSearchTests(const string& modelFile, bool inputsNHWC, bool cudaNH
   runBasicPositions(nnEval, logger);
   delete nnEval;
 
+  runUndoVsCopyPlayoutReset(modelFile,logger,symmetry,inputsNHWC,cudaNHWC,useFP16,false);
+  runIncrementalVsFullBackup(modelFile,logger,symmetry,inputsNHWC,cudaNHWC,useFP16,false);
+
   NeuralNet::globalCleanup();
 }
 
@@ -759,7 +971,7 @@ ooooooo
 
       //In theory nothing requires this, but it would be kind of crazy if this were false
       testAssert(search->rootNode->numChildren > 1);
-      Loc locToDescend = search->rootNode->children[1]->prevMoveLoc;
+      Loc locToDescend = search->rootNode->children[1].moveLoc;
 
       PrintTreeOptions options;
       options = options.maxDepth(1);
@@ -830,14 +1042,14 @@ o..oo.x
 
     auto hasSuicideRootMoves = [](const Search* search) {
       for(int i = 0; i<search->rootNode->numChildren; i++) {
-        if(search->rootBoard.isSuicide(search->rootNode->children[i]->prevMoveLoc,search->rootPla))
+        if(search->rootBoard.isSuicide(search->rootNode->children[i].moveLoc,search->rootPla))
           return true;
       }
       return false;
     };
     auto hasPassAliveRootMoves = [](const Search* search) {
       for(int i = 0; i<search->rootNode->numChildren; i++) {
-        if(search->rootSafeArea[search->rootNode->children[i]->prevMoveLoc] != C_EMPTY)
+        if(search->rootSafeArea[search->rootNode->children[i].moveLoc] != C_EMPTY)
           return true;
       }
       return false;
@@ -1115,6 +1327,275 @@ o..o.oo
     run(11,7);
   }
 
+  {
+    cout << "===================================================================" << endl;
+    cout << "Undoing playout moves vs copying the root board and history" << endl;
+    cout << "===================================================================" << endl;
+
+    runUndoVsCopyPlayoutReset(modelFile,logger,0,true,false,false,true);
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Incremental backup vs full recompute of node stats" << endl;
+    cout << "===================================================================" << endl;
+
+    runIncrementalVsFullBackup(modelFile,logger,0,true,false,false,true);
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Search node arena compaction and release" << endl;
+    cout << "===================================================================" << endl;
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    SearchParams params;
+    params.maxVisits = 1000;
+    params.numThreads = 4;
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(9,9);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    int64_t numTreeNodes = countTreeNodes(search->rootNode);
+    testAssert(numTreeNodes > 1);
+    testAssert(search->getNodeArenaStats().numNodes == numTreeNodes);
+    cout << "Arena nodes match tree after search" << endl;
+
+    //Continuing in the same arena, threads keep allocating from their partly used slabs rather than starting new ones
+    int64_t numSlabsBefore = search->getNodeArenaStats().numSlabs;
+    search->searchParams.maxVisits = 1010;
+    search->runWholeSearch(nextPla,logger,NULL);
+    search->searchParams.maxVisits = 1000;
+    numTreeNodes = countTreeNodes(search->rootNode);
+    testAssert(search->getNodeArenaStats().numNodes == numTreeNodes);
+    testAssert(search->getNodeArenaStats().numSlabs == numSlabsBefore);
+    cout << "Threads keep their slabs across searches in the same arena" << endl;
+
+    Loc moveLoc = search->getChosenMoveLoc();
+    int64_t numSubtreeNodes = -1;
+    for(int i = 0; i<search->rootNode->numChildren; i++) {
+      if(search->rootNode->children[i].moveLoc == moveLoc)
+        numSubtreeNodes = countTreeNodes(search->rootNode->children[i].node);
+    }
+    testAssert(numSubtreeNodes > 0);
+    search->makeMove(moveLoc,nextPla);
+    search->finishPendingReclaim();
+    testAssert(countTreeNodes(search->rootNode) == numSubtreeNodes);
+    if(numSubtreeNodes * search->searchParams.maxNodeArenaSizeFactor < numTreeNodes) {
+      testAssert(search->getNodeArenaStats().numNodes == numSubtreeNodes);
+      testAssert(search->numNodesCompacted == numSubtreeNodes);
+      testAssert(search->numNodesReleased == numTreeNodes);
+    }
+    else {
+      testAssert(search->getNodeArenaStats().numNodes == numTreeNodes);
+      testAssert(search->getNodeArenaStats().numNodes <= numSubtreeNodes * search->searchParams.maxNodeArenaSizeFactor);
+      testAssert(search->numNodesCompacted == 0);
+      testAssert(search->numNodesReleased == 0);
+    }
+    cout << "Arena holds only the subtree after makeMove, unless the subtree is most of it" << endl;
+
+    search->runWholeSearch(getOpp(nextPla),logger,NULL);
+    testAssert(search->getNodeArenaStats().numNodes >= countTreeNodes(search->rootNode));
+    cout << "Arena nodes cover tree after continuing search" << endl;
+
+    //Moving to a small subtree always compacts it
+    {
+      const SearchNode* smallChild = NULL;
+      Loc smallChildMoveLoc = Board::NULL_LOC;
+      for(int i = 0; i<search->rootNode->numChildren; i++) {
+        const SearchNode* child = search->rootNode->children[i].node;
+        if(child->numChildren > 0 && (smallChild == NULL || child->getStats().visits < smallChild->getStats().visits)) {
+          smallChild = child;
+          smallChildMoveLoc = search->rootNode->children[i].moveLoc;
+        }
+      }
+      testAssert(smallChild != NULL);
+      int64_t numArenaNodes = search->getNodeArenaStats().numNodes;
+      numSubtreeNodes = countTreeNodes(smallChild);
+      testAssert(numSubtreeNodes * search->searchParams.maxNodeArenaSizeFactor < numArenaNodes);
+      int64_t numCompactedBefore = search->numNodesCompacted;
+      int64_t numReleasedBefore = search->numNodesReleased;
+      search->makeMove(smallChildMoveLoc,getOpp(nextPla));
+      search->finishPendingReclaim();
+      testAssert(countTreeNodes(search->rootNode) == numSubtreeNodes);
+      testAssert(search->getNodeArenaStats().numNodes == numSubtreeNodes);
+      testAssert(search->numNodesCompacted - numCompactedBefore == numSubtreeNodes);
+      testAssert(search->numNodesReleased - numReleasedBefore == numArenaNodes);
+      cout << "Arena holds only a small subtree after makeMove" << endl;
+    }
+
+    search->clearSearch();
+    testAssert(search->getNodeArenaStats().numNodes == 0);
+    testAssert(search->getNodeArenaStats().numSlabs == 0);
+    cout << "Arena empty after clearSearch" << endl;
+
+    //Searching while the discarded tree is being released in the background
+    search->finishPendingReclaim();
+    int64_t numReleasedBefore = search->numNodesReleased;
+    int64_t numDiscarded = 0;
+    for(int i = 0; i<4; i++) {
+      search->setPosition(nextPla,board,hist);
+      search->runWholeSearch(nextPla,logger,NULL);
+      numDiscarded += countTreeNodes(search->rootNode);
+    }
+    search->clearSearch();
+    search->finishPendingReclaim();
+    testAssert(search->numNodesReleased - numReleasedBefore == numDiscarded);
+    cout << "Discarded trees all released after finishPendingReclaim" << endl;
+
+    //Worker threads persist across searches, and only grow when more threads are requested
+    testAssert(search->numSearchThreadsSpawned == 3);
+    search->searchParams.numThreads = 2;
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    testAssert(search->numSearchThreadsSpawned == 3);
+    search->searchParams.numThreads = 6;
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    testAssert(search->numSearchThreadsSpawned == 5);
+    testAssert(search->getRootVisits() >= 1000);
+    cout << "Search threads reused across searches" << endl;
+
+    delete search;
+    delete nnEval;
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Graph search sharing transpositions" << endl;
+    cout << "===================================================================" << endl;
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    SearchParams params;
+    params.maxVisits = 3000;
+    params.useGraphSearch = true;
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(7,7);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    std::set<const SearchNode*> graphNodes;
+    collectGraphNodes(search->rootNode,graphNodes);
+    testAssert(search->numGraphNodesShared > 0);
+    //Sharing means the graph has fewer nodes than it has parent-child links, counting the root
+    int64_t numLinks = 1;
+    for(const SearchNode* node: graphNodes)
+      numLinks += node->numChildren;
+    testAssert((int64_t)graphNodes.size() < numLinks);
+    testAssert(search->getNodeArenaStats().numNodes == (int64_t)graphNodes.size());
+    testAssert(search->nodeTable->size() == graphNodes.size()-1);
+    cout << "Transpositions share nodes" << endl;
+
+    //Shared nodes must stay shared when the graph is compacted on makeMove, which a small subtree always is
+    const SearchNode* smallChild = NULL;
+    Loc smallChildMoveLoc = Board::NULL_LOC;
+    for(int i = 0; i<search->rootNode->numChildren; i++) {
+      const SearchNode* child = search->rootNode->children[i].node;
+      if(child->numChildren > 0 && (smallChild == NULL || child->getStats().visits < smallChild->getStats().visits)) {
+        smallChild = child;
+        smallChildMoveLoc = search->rootNode->children[i].moveLoc;
+      }
+    }
+    testAssert(smallChild != NULL);
+    testAssert(countTreeNodes(smallChild) * search->searchParams.maxNodeArenaSizeFactor < search->getNodeArenaStats().numNodes);
+    search->makeMove(smallChildMoveLoc,nextPla);
+    graphNodes.clear();
+    collectGraphNodes(search->rootNode,graphNodes);
+    testAssert(search->getNodeArenaStats().numNodes == (int64_t)graphNodes.size());
+    testAssert(search->nodeTable->size() == graphNodes.size()-1);
+    cout << "Graph compacted on makeMove" << endl;
+
+    search->searchParams.numThreads = 4;
+    search->runWholeSearch(getOpp(nextPla),logger,NULL);
+    graphNodes.clear();
+    collectGraphNodes(search->rootNode,graphNodes);
+    testAssert(search->getNodeArenaStats().numNodes == (int64_t)graphNodes.size());
+    testAssert(search->getRootVisits() >= 3000);
+    cout << "Multithreaded graph search consistent" << endl;
+
+    delete search;
+    delete nnEval;
+    cout << endl;
+  }
+
+  {
+    cout << "===================================================================" << endl;
+    cout << "Graph search weighting shared nodes by edge visits" << endl;
+    cout << "===================================================================" << endl;
+
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    SearchParams params;
+    params.maxVisits = 3000;
+    params.useGraphSearch = true;
+    //Weight children by visits alone, so that a parent's values are exactly the edge-weighted average of its children's
+    params.valueWeightExponent = 0;
+    //Makes beginSearch recompute the whole graph, bringing parents up to date with playouts through shared children
+    //that came from their other parents
+    params.dynamicScoreUtilityFactor = 0.3;
+    Search* search = new Search(params, nnEval, "autoSearchRandSeed");
+    Rules rules = Rules::getTrompTaylorish();
+    Board board(5,5);
+    Player nextPla = P_BLACK;
+    BoardHistory hist(board,nextPla,rules,0);
+
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    search->beginSearch(logger);
+    std::set<const SearchNode*> graphNodes;
+    collectGraphNodes(search->rootNode,graphNodes);
+
+    std::map<const SearchNode*,int64_t> incomingVisits;
+    std::map<const SearchNode*,int> numParents;
+    for(const SearchNode* node: graphNodes) {
+      NodeStats stats = node->getStats();
+      int numChildren = node->numChildren;
+      if(numChildren <= 0)
+        continue;
+      //One visit for the node's own evaluation, the rest through its edges
+      int64_t edgeVisitsSum = 0;
+      double winValueSum = node->getNNOutput()->whiteWinProb;
+      for(int i = 0; i<numChildren; i++) {
+        const SearchChild& edge = node->children[i];
+        int64_t edgeVisits = edge.edgeVisits.load();
+        NodeStats childStats = edge.node->getStats();
+        testAssert(edgeVisits <= childStats.visits);
+        if(edgeVisits > 0)
+          winValueSum += edgeVisits * childStats.winValueSum / childStats.weightSum;
+        edgeVisitsSum += edgeVisits;
+        incomingVisits[edge.node] += edgeVisits;
+        numParents[edge.node] += 1;
+      }
+      testAssert(edgeVisitsSum + 1 <= stats.visits);
+      testAssert(std::fabs(stats.winValueSum / stats.weightSum - winValueSum / (edgeVisitsSum + 1)) < 1e-9);
+    }
+
+    //Every visit of a node other than the root came through exactly one of its edges
+    int numSharedNodes = 0;
+    for(const SearchNode* node: graphNodes) {
+      if(node == search->rootNode)
+        continue;
+      testAssert(incomingVisits[node] == node->getStats().visits);
+      if(numParents[node] > 1)
+        numSharedNodes++;
+    }
+    testAssert(numSharedNodes > 0);
+    cout << "Shared nodes count in each parent only by the visits through its edge" << endl;
+
+    delete search;
+    delete nnEval;
+    cout << endl;
+  }
+
   NeuralNet::globalCleanup();
 }
 
@@ -1151,3 +1632,441 @@ void Tests::runNNOnTinyBoard(const string& modelFile, bool inputsNHWC, bool cuda
   delete nnEval;
   NeuralNet::globalCleanup();
 }
+
+//Checks that the tree is exactly consistent once all search threads are done: every node's visits are one for
+//its own evaluation plus its children's, no virtual losses are left behind, and no move was added twice.
+static int64_t checkStressTreeConsistency(const SearchNode* node) {
+  testAssert(node->virtualLosses.load() == 0);
+  NodeStats stats = node->getStats();
+  int numChildren = node->numChildren;
+  int64_t count = 1;
+  int64_t childVisits = 0;
+  for(int i = 0; i<numChildren; i++) {
+    const SearchNode* child = node->children[i].node;
+    for(int j = 0; j<i; j++)
+      testAssert(node->children[j].moveLoc != node->children[i].moveLoc);
+    childVisits += child->getStats().visits;
+    count += checkStressTreeConsistency(child);
+  }
+  if(numChildren > 0) {
+    testAssert(node->getNNOutput() != NULL);
+    testAssert(stats.visits == childVisits + 1);
+  }
+  testAssert(stats.visits > 0);
+  testAssert(stats.weightSum > 0.0);
+  return count;
+}
+
+//Producers hand out numbered requests through the queue and wait on each one's WaitFlag, consumers answer them,
+//the same pattern NNEvaluator uses between search threads and server threads.
+static void runNNQueueHandoffStressTest() {
+  struct Request {
+    WaitFlag done;
+    int64_t value;
+    int64_t answer;
+  };
+  const int numProducers = 8;
+  const int numConsumers = 3;
+  const int64_t numRequestsPerProducer = 20000;
+  //Small enough to wrap around many times, but large enough for every producer to have one request in flight
+  LockFreeQueue<Request*> queue(numProducers);
+  std::atomic<int64_t> numAnswered(0);
+  std::atomic<bool> producersDone(false);
+
+  auto produce = [&](int producerIdx) {
+    Request request;
+    for(int64_t i = 0; i<numRequestsPerProducer; i++) {
+      request.done.reset();
+      request.value = producerIdx * numRequestsPerProducer + i;
+      request.answer = -1;
+      while(!queue.tryPush(&request))
+        std::this_thread::yield();
+      request.done.wait();
+      testAssert(request.answer == request.value * 3 + 1);
+    }
+  };
+  auto consume = [&]() {
+    Request* request;
+    while(true) {
+      if(queue.tryPop(request)) {
+        testAssert(!request->done.isSet());
+        request->answer = request->value * 3 + 1;
+        request->done.set();
+        numAnswered.fetch_add(1);
+      }
+      else if(producersDone.load())
+        break;
+      else
+        std::this_thread::yield();
+    }
+  };
+
+  vector<std::thread> consumers;
+  for(int i = 0; i<numConsumers; i++)
+    consumers.push_back(std::thread(consume));
+  vector<std::thread> producers;
+  for(int i = 0; i<numProducers; i++)
+    producers.push_back(std::thread(produce,i));
+  for(int i = 0; i<numProducers; i++)
+    producers[i].join();
+  producersDone.store(true);
+  for(int i = 0; i<numConsumers; i++)
+    consumers[i].join();
+
+  testAssert(numAnswered.load() == numProducers * numRequestsPerProducer);
+  Request* leftover;
+  testAssert(!queue.tryPop(leftover));
+  cout << "Queue handoff requests " << numAnswered.load() << endl;
+}
+
+void Tests::runSearchStressTests() {
+  cout << "Running search stress tests" << endl;
+  runNNQueueHandoffStressTest();
+  NeuralNet::globalInitialize();
+
+  //Placeholder, doesn't actually do anything since we have debugSkipNeuralNet = true
+  string modelFile = "/dev/null";
+
+  Logger logger;
+  logger.setLogToStdout(false);
+  logger.setLogTime(false);
+
+  Board board(19,19);
+  Player nextPla = P_BLACK;
+  Rules rules = Rules::getTrompTaylorish();
+  BoardHistory hist(board,nextPla,rules,0);
+
+  //Playouts/sec below are for this build only. To compare against reads that lock like writes do, rebuild with
+  //-DNODE_STATS_LOCKED_READS=1. Neither is the original design, where every access to a node's stats held the
+  //node's mutex from the MutexPool, so that is not measured here.
+#ifdef NODE_STATS_LOCKED_READS
+  cout << "Node stats reads: locked" << endl;
+#else
+  cout << "Node stats reads: optimistic" << endl;
+#endif
+  const int64_t maxVisits = 20000;
+  vector<int> threadCounts = {1,2,4,8,16,32,64};
+  for(int i = 0; i<(int)threadCounts.size()*2; i++) {
+    int numThreads = threadCounts[i % threadCounts.size()];
+    bool useGraphSearch = i >= (int)threadCounts.size();
+    NNEvaluator* nnEval = startNNEval(modelFile,logger,"",NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,0,true,false,false,true,1.0);
+    SearchParams params;
+    params.maxVisits = maxVisits;
+    params.numThreads = numThreads;
+    params.useGraphSearch = useGraphSearch;
+    Search* search = new Search(params, nnEval, "stressTestSeed");
+    search->setPosition(nextPla,board,hist);
+
+    ClockTimer timer;
+    search->runWholeSearch(nextPla,logger,NULL);
+    double seconds = timer.getSeconds();
+
+    //Threads may each finish one playout past the limit
+    int64_t rootVisits = search->getRootVisits();
+    testAssert(rootVisits >= maxVisits);
+    testAssert(rootVisits <= maxVisits + numThreads);
+    int64_t numNodes;
+    if(useGraphSearch) {
+      std::set<const SearchNode*> graphNodes;
+      collectGraphNodes(search->rootNode,graphNodes);
+      numNodes = (int64_t)graphNodes.size();
+    }
+    else
+      numNodes = checkStressTreeConsistency(search->rootNode);
+    //Every node allocated must have made it into the tree
+    testAssert(numNodes == search->getNodeArenaStats().numNodes);
+
+    cout << Global::strprintf(
+      "%s threads %2d visits %7lld nodes %7lld time %7.3fs playouts/sec %9.1f",
+      useGraphSearch ? "Graph" : "Tree ",
+      numThreads, (long long)rootVisits, (long long)numNodes, seconds, rootVisits / seconds
+    ) << endl;
+
+    delete search;
+    delete nnEval;
+  }
+
+  //A few threads each descending many playouts before evaluating all of their leaves together
+  for(int i = 0; i<6; i++) {
+    int numThreads = 1 << (i % 3);
+    bool useGraphSearch = i >= 3;
+    //More than the evaluator's max batch size of 64 on some, so that their leaves are replayed in several chunks
+    const int numLeavesPerThread = i % 2 == 0 ? 32 : 100;
+    vector<int> gpuIdxs = {-1};
+    NNEvaluator* nnEval = new NNEvaluator(
+      modelFile,modelFile,gpuIdxs,&logger,0,64,1024,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,
+      false,false,16,12,true,false,1.0,""
+    );
+    SyntheticNNParams syntheticParams;
+    syntheticParams.batchLatencyMs = 0.2;
+    syntheticParams.rowLatencyMs = 0.01;
+    nnEval->setSyntheticNN(syntheticParams);
+    nnEval->setBatchingParams(NNBatchingParams::getDefaults("throughput"));
+    nnEval->spawnServerThreads(1,false,"stressTestSeed",0,logger,gpuIdxs,false,false);
+
+    SearchParams params;
+    params.maxVisits = 5000;
+    params.numThreads = numThreads;
+    params.useGraphSearch = useGraphSearch;
+    params.numLeavesPerThread = numLeavesPerThread;
+    Search* search = new Search(params, nnEval, "stressTestSeed");
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+
+    int64_t rootVisits = search->getRootVisits();
+    testAssert(rootVisits >= params.maxVisits);
+    testAssert(rootVisits <= params.maxVisits + numThreads * numLeavesPerThread);
+    int64_t numNodes;
+    if(useGraphSearch) {
+      std::set<const SearchNode*> graphNodes;
+      collectGraphNodes(search->rootNode,graphNodes);
+      numNodes = (int64_t)graphNodes.size();
+    }
+    else
+      numNodes = checkStressTreeConsistency(search->rootNode);
+    testAssert(numNodes == search->getNodeArenaStats().numNodes);
+    testAssert(nnEval->averageProcessedBatchSize() > 4.0);
+
+    cout << Global::strprintf(
+      "%s leaf batches threads %d visits %5lld avgBatchSize %5.2f",
+      useGraphSearch ? "Graph" : "Tree ", numThreads, (long long)rootVisits, nnEval->averageProcessedBatchSize()
+    ) << endl;
+
+    delete search;
+    delete nnEval;
+  }
+
+  //Holding back partial batches, with more than one server thread competing for them
+  for(int i = 0; i<(int)threadCounts.size(); i++) {
+    int numThreads = threadCounts[i];
+    const int maxBatchSize = 8;
+    vector<int> gpuIdxs = {-1,-1};
+    NNEvaluator* nnEval = new NNEvaluator(
+      modelFile,modelFile,gpuIdxs,&logger,0,maxBatchSize,1024,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,
+      false,false,16,12,true,false,1.0,""
+    );
+    SyntheticNNParams syntheticParams;
+    syntheticParams.batchLatencyMs = 0.2;
+    syntheticParams.rowLatencyMs = 0.01;
+    nnEval->setSyntheticNN(syntheticParams);
+    nnEval->setBatchingParams(NNBatchingParams::getDefaults("throughput"));
+    nnEval->spawnServerThreads(2,false,"stressTestSeed",0,logger,gpuIdxs,false,false);
+
+    SearchParams params;
+    params.maxVisits = 3000;
+    params.numThreads = numThreads;
+    Search* search = new Search(params, nnEval, "stressTestSeed");
+    search->setPosition(nextPla,board,hist);
+    search->runWholeSearch(nextPla,logger,NULL);
+    testAssert(search->getRootVisits() >= params.maxVisits);
+
+    vector<uint64_t> histogram = nnEval->getBatchSizeHistogram();
+    testAssert(histogram.size() == maxBatchSize+1);
+    testAssert(histogram[0] == 0);
+    uint64_t numBatches = 0;
+    uint64_t numRows = 0;
+    for(int rows = 0; rows <= maxBatchSize; rows++) {
+      numBatches += histogram[rows];
+      numRows += histogram[rows] * rows;
+    }
+    testAssert(numBatches == nnEval->numBatchesProcessed());
+    testAssert(numRows == nnEval->numRowsProcessed());
+    testAssert(nnEval->submitLatencyPercentileSeconds(0.5) > 0.0);
+    testAssert(nnEval->submitLatencyPercentileSeconds(0.5) <= nnEval->submitLatencyPercentileSeconds(0.99));
+
+    cout << Global::strprintf("Batching threads %2d avgBatchSize %5.2f", numThreads, nnEval->averageProcessedBatchSize()) << endl;
+
+    delete search;
+    delete nnEval;
+  }
+
+  //Many threads asking for the same position while its evaluation is slow should all get the one result
+  {
+    const int numThreads = 16;
+    vector<int> gpuIdxs = {-1};
+    NNEvaluator* nnEval = new NNEvaluator(
+      modelFile,modelFile,gpuIdxs,&logger,0,numThreads,1024,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,
+      false,false,16,12,true,false,1.0,""
+    );
+    SyntheticNNParams syntheticParams;
+    syntheticParams.batchLatencyMs = 200.0;
+    syntheticParams.rowLatencyMs = 0.0;
+    nnEval->setSyntheticNN(syntheticParams);
+    nnEval->spawnServerThreads(1,false,"stressTestSeed",0,logger,gpuIdxs,false,false);
+
+    vector<shared_ptr<NNOutput>> results(numThreads);
+    auto evaluate = [&](int threadIdx) {
+      Board b = board;
+      NNResultBuf buf;
+      nnEval->evaluate(b,hist,nextPla,0.0,buf,NULL,false,false);
+      results[threadIdx] = std::move(buf.result);
+    };
+    vector<std::thread> threads;
+    for(int i = 0; i<numThreads; i++)
+      threads.push_back(std::thread(evaluate,i));
+    for(int i = 0; i<numThreads; i++)
+      threads[i].join();
+
+    for(int i = 0; i<numThreads; i++) {
+      testAssert(results[i] != nullptr);
+      testAssert(results[i]->nnHash == results[0]->nnHash);
+      testAssert(results[i]->whiteWinProb == results[0]->whiteWinProb);
+    }
+    testAssert(nnEval->numCoalescedRequests() > 0);
+    testAssert(nnEval->numRowsProcessed() + nnEval->numCoalescedRequests() <= numThreads);
+    cout << "Coalescing rows " << nnEval->numRowsProcessed() << " coalesced " << nnEval->numCoalescedRequests() << endl;
+    delete nnEval;
+  }
+
+  //Submitting many positions at once from one thread should give the same results as evaluating them one by one
+  {
+    const int maxBatchSize = 8;
+    vector<int> gpuIdxs = {-1,-1};
+    SyntheticNNParams syntheticParams;
+    syntheticParams.batchLatencyMs = 1.0;
+    syntheticParams.rowLatencyMs = 0.0;
+    NNEvaluator* batchEval = new NNEvaluator(
+      modelFile,modelFile,gpuIdxs,&logger,0,maxBatchSize,1024,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,
+      false,false,16,12,true,false,1.0,""
+    );
+    batchEval->setSyntheticNN(syntheticParams);
+    batchEval->spawnServerThreads(2,false,"stressTestSeed",0,logger,gpuIdxs,false,false);
+    //Also cached, so that both return outputs rounded the same way as stored in the cache
+    NNEvaluator* singleEval = new NNEvaluator(
+      modelFile,modelFile,gpuIdxs,&logger,0,maxBatchSize,1024,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,
+      false,false,16,12,true,false,1.0,""
+    );
+    singleEval->setSyntheticNN(syntheticParams);
+    singleEval->spawnServerThreads(2,false,"stressTestSeed",0,logger,gpuIdxs,false,false);
+
+    const int numPositions = 50;
+    Rand rand("evaluateBatch");
+    vector<Board> boards;
+    vector<BoardHistory> hists;
+    vector<Player> plas;
+    Board b = board;
+    BoardHistory h = hist;
+    Player pla = nextPla;
+    for(int i = 0; i<numPositions; i++) {
+      boards.push_back(b);
+      hists.push_back(h);
+      plas.push_back(pla);
+      Loc loc;
+      do {
+        loc = Location::getLoc((int)rand.nextUInt(b.x_size),(int)rand.nextUInt(b.y_size),b.x_size);
+      } while(!h.isLegal(b,loc,pla));
+      h.makeBoardMoveAssumeLegal(b,loc,pla,NULL);
+      pla = getOpp(pla);
+    }
+
+    //Every position twice in a row, so that the second either finds the first in flight or in the cache
+    vector<NNBatchQuery> queries;
+    for(int i = 0; i<numPositions; i++) {
+      for(int j = 0; j<2; j++)
+        queries.push_back(NNBatchQuery(boards[i],hists[i],plas[i],0.5,i % 3 == 0));
+    }
+    vector<shared_ptr<NNOutput>> results;
+    batchEval->evaluateBatch(queries,results,&logger,false);
+    testAssert(results.size() == queries.size());
+    testAssert(batchEval->numRowsProcessed() == numPositions);
+
+    for(size_t q = 0; q<queries.size(); q++) {
+      const NNBatchQuery& query = queries[q];
+      Board copy = *(query.board);
+      NNResultBuf buf;
+      singleEval->evaluate(copy,*(query.history),query.nextPlayer,0.5,buf,NULL,false,query.includeOwnerMap);
+      testAssert(results[q] != nullptr);
+      testAssert(results[q]->nnHash == buf.result->nnHash);
+      testAssert(results[q]->whiteWinProb == buf.result->whiteWinProb);
+      testAssert(results[q]->whiteScoreMean == buf.result->whiteScoreMean);
+      for(int i = 0; i<NNPos::MAX_NN_POLICY_SIZE; i++)
+        testAssert(results[q]->policyProbs[i] == buf.result->policyProbs[i]);
+      testAssert((results[q]->whiteOwnerMap != NULL) == query.includeOwnerMap);
+    }
+
+    //All in the cache now
+    batchEval->evaluateBatch(queries,results,&logger,false);
+    testAssert(batchEval->numRowsProcessed() == numPositions);
+    for(size_t q = 0; q<queries.size(); q++)
+      testAssert(results[q] != nullptr);
+    cout << "Batch rows " << batchEval->numRowsProcessed() << " batches " << batchEval->numBatchesProcessed()
+         << " coalesced " << batchEval->numCoalescedRequests() << endl;
+    delete batchEval;
+    delete singleEval;
+  }
+
+  //Swapping models while other threads evaluate, after which nothing cached from the earlier models is reused
+  {
+    const int numThreads = 8;
+    vector<int> gpuIdxs = {-1,-1};
+    NNEvaluator* nnEval = new NNEvaluator(
+      modelFile,modelFile,gpuIdxs,&logger,0,numThreads,1024,NNPos::MAX_BOARD_LEN,NNPos::MAX_BOARD_LEN,
+      false,false,16,12,true,false,1.0,""
+    );
+    SyntheticNNParams syntheticParams;
+    syntheticParams.batchLatencyMs = 1.0;
+    syntheticParams.rowLatencyMs = 0.0;
+    nnEval->setSyntheticNN(syntheticParams);
+    nnEval->spawnServerThreads(2,false,"stressTestSeed",0,logger,gpuIdxs,false,false);
+
+    auto evaluateOnce = [&]() {
+      Board b = board;
+      NNResultBuf buf;
+      nnEval->evaluate(b,hist,nextPla,0.0,buf,NULL,false,false);
+      testAssert(buf.result != nullptr);
+    };
+    evaluateOnce();
+    evaluateOnce();
+    testAssert(nnEval->numRowsProcessed() == 1);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int64_t> numEvaluated(0);
+    auto evaluateLoop = [&](int threadIdx) {
+      Rand rand("swapModel" + Global::intToString(threadIdx));
+      Board b = board;
+      BoardHistory h = hist;
+      Player pla = nextPla;
+      while(!stop.load()) {
+        if(h.moveHistory.size() >= 100) {
+          b = board;
+          h = hist;
+          pla = nextPla;
+        }
+        Loc loc = Location::getLoc((int)rand.nextUInt(b.x_size),(int)rand.nextUInt(b.y_size),b.x_size);
+        if(!h.isLegal(b,loc,pla))
+          continue;
+        h.makeBoardMoveAssumeLegal(b,loc,pla,NULL);
+        pla = getOpp(pla);
+        NNResultBuf buf;
+        nnEval->evaluate(b,h,pla,0.0,buf,NULL,false,rand.nextBool(0.5));
+        testAssert(buf.result != nullptr);
+        numEvaluated.fetch_add(1);
+      }
+    };
+    vector<std::thread> threads;
+    for(int i = 0; i<numThreads; i++)
+      threads.push_back(std::thread(evaluateLoop,i));
+    const int numSwaps = 20;
+    for(int i = 0; i<numSwaps; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      nnEval->swapModel("swapped" + Global::intToString(i),modelFile,0,&logger);
+    }
+    stop.store(true);
+    for(int i = 0; i<numThreads; i++)
+      threads[i].join();
+    testAssert(nnEval->getModelGeneration() == numSwaps);
+    testAssert(nnEval->getModelName() == "swapped" + Global::intToString(numSwaps-1));
+    testAssert(numEvaluated.load() > 0);
+
+    uint64_t numRowsBefore = nnEval->numRowsProcessed();
+    evaluateOnce();
+    testAssert(nnEval->numRowsProcessed() == numRowsBefore + 1);
+    evaluateOnce();
+    testAssert(nnEval->numRowsProcessed() == numRowsBefore + 1);
+    cout << "Swapped models " << numSwaps << " times" << endl;
+    delete nnEval;
+  }
+
+  NeuralNet::globalCleanup();
+  cout << "Search stress tests passed" << endl;
+}